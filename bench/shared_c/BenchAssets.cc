@@ -0,0 +1,47 @@
+#include "BenchAssets.h"
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string
+getBenchAssetPath(const char *fileName) {
+  std::string directory = access("/dev/shm", W_OK) == 0 ? "/dev/shm/" : "";
+  return directory + "altplayer_bench_" + fileName;
+}
+
+static bool
+isPrepared(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && info.st_size > 0;
+}
+
+std::string
+prepareRawFile(const char *fileName, size_t fileSize) {
+  std::string path = getBenchAssetPath(fileName);
+  if (!isPrepared(path)) {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    unsigned int seed = 1;
+    for (size_t i = 0; i < fileSize; ++i) {
+      file.put(static_cast<char>(rand_r(&seed)));
+    }
+  }
+  return path;
+}
+
+std::string
+prepareCorpusFile(
+  const char *fileName,
+  enum pcm_format format,
+  enum pcm_corpus_signal signal,
+  unsigned int seconds) {
+    std::string path = getBenchAssetPath(fileName);
+    if (!isPrepared(path)) {
+      EMPTY_STRUCT(pcm_spec, spec);
+      spec.channels_count = 2;
+      spec.samples_per_sec = 44100;
+      spec.bits_per_sample = 16;
+      spec.samples_count = seconds * spec.samples_per_sec;
+      pcm_corpus_write(path.c_str(), format, signal, 1, &spec);
+    }
+    return path;
+  }
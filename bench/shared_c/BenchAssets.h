@@ -0,0 +1,33 @@
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <string>
+
+extern "C" {
+  #include "corpus.h"
+}
+
+#define EMPTY_STRUCT(t, n) struct t n;\
+  memset(&n, 0, sizeof(n))
+
+/**
+ * Generated files are kept on tmpfs if available,
+ * so that benchmarks do not measure the disk.
+ */
+std::string
+getBenchAssetPath(const char *fileName);
+
+/**
+ * File of given size with pseudo-random content.
+ */
+std::string
+prepareRawFile(const char *fileName, size_t fileSize);
+
+/**
+ * Stereo 44.1kHz 16 bit file from the synthetic corpus.
+ */
+std::string
+prepareCorpusFile(
+  const char *fileName,
+  enum pcm_format format,
+  enum pcm_corpus_signal signal,
+  unsigned int seconds);
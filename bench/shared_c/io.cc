@@ -0,0 +1,113 @@
+#include "BenchAssets.h"
+#include <cstdint>
+#include <vector>
+#include <unistd.h>
+
+extern "C" {
+  #include "io.h"
+}
+
+/**
+ * Args: item size, ring buffer, items left unread after each round.
+ * Leaving items behind moves the read offset, so that linear buffer
+ * has to compact and ring buffer wraps around.
+ */
+static void
+io_buffer_BENCH_write_read(benchmark::State &state) {
+  const size_t item_size = state.range(0);
+  const bool is_ring = state.range(1) != 0;
+  const size_t items_left = state.range(2);
+  const size_t buffer_size = 64 * 1024;
+  std::vector<char> item(item_size, 1);
+
+  EMPTY_STRUCT(io_buffer, buffer);
+  error_t error_r = is_ring
+    ? io_buffer_alloc_ring(buffer_size, &buffer)
+    : io_buffer_alloc(buffer_size, &buffer);
+  if (error_r != 0) {
+    state.SkipWithError("Cannot allocate buffer");
+    return;
+  }
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    while (io_buffer_try_write(&buffer, item_size, item.data())) {
+      bytes += item_size;
+    }
+
+    void *data;
+    size_t unread = io_buffer_get_unread_size(&buffer) / item_size;
+    while (unread > items_left) {
+      size_t count = io_buffer_read_array(
+        &buffer, item_size, &data, unread - items_left);
+      benchmark::DoNotOptimize(data);
+      unread -= count;
+    }
+  }
+  state.SetBytesProcessed(bytes);
+  state.SetLabel(is_ring ? "ring" : "linear");
+  io_buffer_free(&buffer);
+}
+BENCHMARK(io_buffer_BENCH_write_read)
+  ->ArgNames({"item", "ring", "left"})
+  ->ArgsProduct({{2, 4, 64, 4096}, {0, 1}, {0, 1}});
+
+/**
+ * Args: buffer size in kB, single read size in kB,
+ * 0 for plain reads, 1 for memory mapping, 2 for io_uring.
+ */
+static void
+io_rf_stream_BENCH_read(benchmark::State &state) {
+  const size_t file_size = 64 * 1024 * 1024;
+  const size_t buffer_size = state.range(0) * 1024;
+  const size_t read_size = state.range(1) * 1024;
+  const int64_t mode = state.range(2);
+  const size_t page_size = getpagesize();
+  std::string path = prepareRawFile("io_rf_stream.bin", file_size);
+
+  for (auto _ : state) {
+    EMPTY_STRUCT(io_rf_stream, stream);
+    error_t error_r = mode == 1
+      ? io_rf_stream_open_file_mapped(
+        path.c_str(), buffer_size, read_size, &stream)
+      : io_rf_stream_open_file(path.c_str(), buffer_size, read_size, &stream);
+    if (error_r == 0 && mode == 2) {
+      error_r = io_rf_stream_enable_uring(&stream, 4);
+      if (error_r == ENOTSUP) {
+        io_rf_stream_free(&stream);
+        state.SkipWithError("io_uring is not available");
+        return;
+      }
+    }
+
+    while (error_r == 0 && !io_rf_stream_is_empty(&stream)) {
+      if (!io_rf_stream_is_eof(&stream)
+        && !io_rf_stream_is_buffer_full(&stream)) {
+          error_r = io_rf_stream_read_with_poll(&stream, -1);
+        }
+      // touch every page, memory mapping does not read anything otherwise
+      char *data;
+      size_t count = io_rf_stream_read_array(
+        &stream, 1, reinterpret_cast<void**>(&data), SIZE_MAX);
+      for (size_t i = 0; i < count; i += page_size) {
+        benchmark::DoNotOptimize(data[i]);
+      }
+    }
+    io_rf_stream_free(&stream);
+    if (error_r != 0) {
+      state.SkipWithError("Reading failed");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * file_size);
+}
+BENCHMARK(io_rf_stream_BENCH_read)
+  ->ArgNames({"buffer_kB", "read_kB", "mode"})
+  ->Args({64, 16, 0})
+  ->Args({1024, 64, 0})
+  ->Args({16 * 1024, 1024, 0})
+  ->Args({16 * 1024, 1024, 1})
+  ->Args({1024, 64, 2})
+  ->Args({16 * 1024, 1024, 2})
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
@@ -0,0 +1,123 @@
+#include "BenchAssets.h"
+#include <cstdint>
+
+extern "C" {
+  #include "pcm.h"
+  #include "flac.h"
+}
+
+/**
+ * Decode the whole file, reports PCM MB/s
+ * and realtime factor: seconds of audio decoded per second.
+ */
+static void
+decodeFile(
+  benchmark::State &state,
+  enum pcm_format format,
+  const std::string &path) {
+    size_t pcm_bytes = 0;
+    double audio_seconds = 0;
+
+    for (auto _ : state) {
+      EMPTY_STRUCT(io_rf_stream, stream);
+      struct pcm_decoder *decoder = NULL;
+      error_t error_r = io_rf_stream_open_file(
+        path.c_str(), 1024 * 1024, 64 * 1024, &stream);
+      if (error_r == 0) {
+        error_r = format == pcm_format_flac
+          ? pcm_decoder_flac_open(&stream, 64 * 1024, &decoder)
+          : pcm_decoder_wav_open(&stream, &decoder);
+      }
+
+      // passthrough decoder output is its source buffer
+      struct io_buffer *output = error_r == 0 ?
+        pcm_decoder_get_output_buffer(decoder) : NULL;
+      while (
+        error_r == 0
+        && !(pcm_decoder_is_source_buffer_empty(decoder)
+          && pcm_decoder_is_output_buffer_empty(decoder))) {
+            error_r = pcm_decoder_read_source(decoder, -1);
+            while (
+              error_r == 0
+              && pcm_decoder_is_source_buffer_ready_to_read(decoder)
+              && !pcm_decoder_is_output_buffer_full(decoder)) {
+                error_r = pcm_decoder_decode_once(decoder);
+              }
+
+            void *pcm;
+            size_t count = io_buffer_read_array(
+              output, pcm_decoder_frame_size(decoder), &pcm, SIZE_MAX);
+            if (count > 0) {
+              benchmark::DoNotOptimize(*static_cast<char*>(pcm));
+            }
+          }
+
+      if (decoder != NULL) {
+        pcm_bytes += decoder->spec.samples_count
+          * pcm_decoder_frame_size(decoder);
+        struct timespec total = pcm_decoder_get_total_time(decoder);
+        audio_seconds += total.tv_sec + total.tv_nsec / 1e9;
+        pcm_decoder_decode_release(&decoder);
+      }
+      io_rf_stream_free(&stream);
+      if (error_r != 0) {
+        state.SkipWithError("Decoding failed");
+        return;
+      }
+    }
+
+    state.SetBytesProcessed(pcm_bytes);
+    state.counters["realtime_factor"] = benchmark::Counter(
+      audio_seconds, benchmark::Counter::kIsRate);
+  }
+
+static void
+pcm_decoder_wav_BENCH_decode(benchmark::State &state) {
+  decodeFile(
+    state,
+    pcm_format_wav,
+    prepareCorpusFile(
+      "decode.wav", pcm_format_wav, pcm_corpus_signal_sine, 60));
+}
+BENCHMARK(pcm_decoder_wav_BENCH_decode)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+/**
+ * Arg: corpus signal, sine compresses well, noise does not compress at all.
+ */
+static void
+pcm_decoder_flac_BENCH_decode(benchmark::State &state) {
+  enum pcm_corpus_signal signal = (enum pcm_corpus_signal)state.range(0);
+  std::string fileName = std::string("decode_")
+    + pcm_corpus_signal_name(signal) + ".flac";
+  state.SetLabel(pcm_corpus_signal_name(signal));
+  decodeFile(
+    state,
+    pcm_format_flac,
+    prepareCorpusFile(fileName.c_str(), pcm_format_flac, signal, 60));
+}
+BENCHMARK(pcm_decoder_flac_BENCH_decode)
+  ->ArgName("signal")
+  ->Arg(pcm_corpus_signal_sine)
+  ->Arg(pcm_corpus_signal_noise)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+static void
+pcm_spec_get_samples_time_BENCH(benchmark::State &state) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.channels_count = 2;
+  spec.samples_per_sec = 44100;
+  spec.bits_per_sample = 16;
+  spec.is_signed = true;
+
+  size_t samples_count = 0;
+  for (auto _ : state) {
+    struct timespec result = pcm_spec_get_samples_time(&spec, samples_count);
+    benchmark::DoNotOptimize(result);
+    samples_count += 4096;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(pcm_spec_get_samples_time_BENCH);
@@ -0,0 +1,44 @@
+#include "BenchAssets.h"
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+  #include "pcm_convert.h"
+  #include "simd.h"
+}
+
+/**
+ * Arg: max SIMD level. Packed 24 bit big endian to 32 bit,
+ * the conversion ALSA devices need the most. Items are samples.
+ */
+static void
+pcm_convert_BENCH_s24_3be(benchmark::State &state) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 24;
+  spec.is_big_endian = true;
+  spec.is_signed = true;
+  struct pcm_converter converter;
+  if (pcm_converter_init(&spec, pcm_convert_format_s32_le, &converter) != 0) {
+    state.SkipWithError("Cannot convert S24_3BE to S32_LE");
+    return;
+  }
+
+  const size_t samples = 8192;
+  std::vector<uint8_t> src(samples * 3);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = (uint8_t)(((i + 1) * 2654435761u) >> 13);
+  }
+  std::vector<uint8_t> dest(samples * 4);
+  simd_set_max_level((enum simd_level)state.range(0));
+  state.SetLabel(simd_level_name(simd_get_level()));
+  for (auto _ : state) {
+    pcm_convert(&converter, src.data(), samples, dest.data());
+    benchmark::DoNotOptimize(dest.data());
+  }
+  simd_set_max_level(simd_level_avx2);
+  state.SetItemsProcessed(state.iterations() * samples);
+}
+BENCHMARK(pcm_convert_BENCH_s24_3be)
+  ->ArgName("level")
+  ->Arg(simd_level_scalar)
+  ->Arg(simd_level_avx2);
@@ -0,0 +1,60 @@
+#include "BenchAssets.h"
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+  #include "pcm_convolve.h"
+  #include "simd.h"
+}
+
+/**
+ * Arg: partition, from low latency to low CPU. 64k taps per channel
+ * of 96kHz stereo in blocks of 1024 frames, reports core_share:
+ * CPU seconds the stage takes per second of audio.
+ */
+static void
+pcm_convolve_BENCH(benchmark::State &state) {
+  const size_t taps = 65536, block_frames = 1024;
+  const size_t partition = state.range(0);
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 32;
+  spec.channels_count = 2;
+  spec.samples_per_sec = 96000;
+
+  std::vector<float> samples(2 * taps + 2 * block_frames);
+  uint32_t seed = 7;
+  for (float &sample : samples) {
+    seed = seed * 1664525 + 1013904223;
+    sample = (float)(int32_t)seed / 2147483648.0f;
+  }
+  const float *channels[] = { samples.data(), samples.data() + taps };
+  EMPTY_STRUCT(pcm_convolve_ir, ir);
+  ir.channels = channels;
+  ir.channels_count = 2;
+  ir.taps_count = taps;
+  ir.samples_per_sec = spec.samples_per_sec;
+  float *planes = samples.data() + 2 * taps;
+  void *planes_ptr[] = { planes, planes + block_frames };
+
+  struct pcm_dsp_stage *stage = NULL;
+  if (pcm_convolve_stage_open_ir(&ir, partition, &stage) != 0
+    || stage->prepare(stage, &spec, block_frames) != 0) {
+      pcm_dsp_stage_release(&stage);
+      state.SkipWithError("Cannot open convolution stage");
+      return;
+    }
+  state.SetLabel(simd_level_name(simd_get_level()));
+  for (auto _ : state) {
+    stage->process(stage, planes_ptr, planes_ptr, block_frames);
+  }
+  state.counters["core_share"] = benchmark::Counter(
+    (double)state.iterations() * block_frames / spec.samples_per_sec,
+    benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  pcm_dsp_stage_release(&stage);
+}
+BENCHMARK(pcm_convolve_BENCH)
+  ->ArgName("partition")
+  ->Arg(256)
+  ->Arg(1024)
+  ->Arg(4096)
+  ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,60 @@
+#include "BenchAssets.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "pcm_gain.h"
+  #include "simd.h"
+}
+
+/**
+ * Arg: dither. 192kHz 8 channels of 24 bit samples in blocks
+ * of 4096 frames, without conversion of the chain. Reports core_share:
+ * CPU seconds the stage takes per second of audio.
+ */
+static void
+pcm_gain_BENCH(benchmark::State &state) {
+  enum pcm_dither dither = (enum pcm_dither)state.range(0);
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 24;
+  spec.channels_count = 8;
+  spec.samples_per_sec = 192000;
+  spec.is_signed = true;
+  const size_t block_frames = 4096;
+  std::vector<int32_t> planes(spec.channels_count * block_frames);
+  for (size_t i = 0; i < planes.size(); ++i) {
+    planes[i] = (int32_t)(i * 2654435761u) & ~0xff;
+  }
+  void *channels[PCM_DSP_MAX_CHANNELS];
+  for (unsigned int c = 0; c < spec.channels_count; ++c) {
+    channels[c] = planes.data() + c * block_frames;
+  }
+
+  EMPTY_STRUCT(pcm_gain_parameters, params);
+  params.volume_db = -3;
+  params.dither = dither;
+  struct pcm_dsp_stage *stage = NULL;
+  if (pcm_gain_stage_open(&params, &stage) != 0
+    || stage->prepare(stage, &spec, block_frames) != 0) {
+      pcm_dsp_stage_release(&stage);
+      state.SkipWithError("Cannot open gain stage");
+      return;
+    }
+  state.SetLabel(
+    std::string(pcm_dither_name(dither))
+      + " " + simd_level_name(simd_get_level()));
+  for (auto _ : state) {
+    stage->process(stage, channels, channels, block_frames);
+  }
+  state.counters["core_share"] = benchmark::Counter(
+    (double)state.iterations() * block_frames / spec.samples_per_sec,
+    benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  pcm_dsp_stage_release(&stage);
+}
+BENCHMARK(pcm_gain_BENCH)
+  ->ArgName("dither")
+  ->Arg(pcm_dither_none)
+  ->Arg(pcm_dither_tpdf)
+  ->Arg(pcm_dither_shaped)
+  ->Unit(benchmark::kMicrosecond);
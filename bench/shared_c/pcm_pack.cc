@@ -0,0 +1,94 @@
+#include "BenchAssets.h"
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+  #include "io.h"
+  #include "pcm_pack.h"
+  #include "simd.h"
+}
+
+static std::vector<std::vector<int32_t>>
+preparePlanar(unsigned int channels, size_t frames, unsigned int bytes) {
+  std::vector<std::vector<int32_t>> result(channels);
+  for (unsigned int c = 0; c < channels; ++c) {
+    result[c].resize(frames);
+    for (size_t i = 0; i < frames; ++i) {
+      uint32_t value = (uint32_t)((i + 1) * 2654435761u + c * 40503u);
+      result[c][i] = (int32_t)value >> (32 - 8 * bytes);
+    }
+  }
+  return result;
+}
+
+/**
+ * Arg: bytes per sample. Per sample writes, as FLAC write_callback
+ * used to do, baseline for pcm_pack_interleave_BENCH.
+ */
+static void
+pcm_pack_BENCH_per_sample(benchmark::State &state) {
+  const unsigned int bytes = state.range(0);
+  const unsigned int channels = 2;
+  const size_t frames = 4096;
+  auto planar = preparePlanar(channels, frames, bytes);
+
+  EMPTY_STRUCT(io_buffer, buffer);
+  if (io_buffer_alloc(frames * channels * bytes, &buffer) != 0) {
+    state.SkipWithError("Cannot allocate buffer");
+    return;
+  }
+  for (auto _ : state) {
+    for (size_t i = 0; i < frames; ++i) {
+      for (unsigned int c = 0; c < channels; ++c) {
+        int32_t sample = planar[c][i];
+        io_buffer_try_write(&buffer, bytes, &sample);
+      }
+    }
+    io_buffer_array_seek(&buffer, 1, io_buffer_get_unread_size(&buffer));
+  }
+  state.SetItemsProcessed(state.iterations() * frames * channels);
+  io_buffer_free(&buffer);
+}
+BENCHMARK(pcm_pack_BENCH_per_sample)
+  ->ArgName("bytes")
+  ->Arg(2)
+  ->Arg(3);
+
+/**
+ * Args: bytes per sample, max SIMD level. Items are samples.
+ */
+static void
+pcm_pack_interleave_BENCH(benchmark::State &state) {
+  const unsigned int bytes = state.range(0);
+  const unsigned int channels = 2;
+  const size_t frames = 4096;
+  auto planar = preparePlanar(channels, frames, bytes);
+  std::vector<const int32_t*> pointers;
+  for (const auto &channel : planar) {
+    pointers.push_back(channel.data());
+  }
+
+  EMPTY_STRUCT(io_buffer, buffer);
+  if (io_buffer_alloc(frames * channels * bytes, &buffer) != 0) {
+    state.SkipWithError("Cannot allocate buffer");
+    return;
+  }
+  simd_set_max_level((enum simd_level)state.range(1));
+  state.SetLabel(simd_level_name(simd_get_level()));
+  for (auto _ : state) {
+    void *dest;
+    size_t size = frames * channels * bytes;
+    io_buffer_write_begin(&buffer, size, &dest);
+    pcm_pack_interleave(pointers.data(), channels, frames, bytes, dest);
+    io_buffer_write_commit(&buffer, size);
+    io_buffer_array_seek(&buffer, 1, io_buffer_get_unread_size(&buffer));
+  }
+  simd_set_max_level(simd_level_avx2);
+  state.SetItemsProcessed(state.iterations() * frames * channels);
+  io_buffer_free(&buffer);
+}
+BENCHMARK(pcm_pack_interleave_BENCH)
+  ->ArgNames({"bytes", "level"})
+  ->ArgsProduct({
+    {2, 3},
+    {simd_level_scalar, simd_level_sse2, simd_level_ssse3, simd_level_avx2}});
@@ -0,0 +1,63 @@
+#include "BenchAssets.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+  #include "pcm_resample.h"
+  #include "simd.h"
+}
+
+/**
+ * Args: input rate, quality. One second of stereo S32_LE sine
+ * to 48kHz per iteration, reports output samples per second
+ * and realtime factor: seconds of audio resampled per second.
+ */
+static void
+pcm_resample_BENCH(benchmark::State &state) {
+  const unsigned int channels = 2;
+  const unsigned int in_rate = state.range(0);
+  const unsigned int out_rate = 48000;
+  enum pcm_resample_quality quality =
+    (enum pcm_resample_quality)state.range(1);
+  std::vector<int32_t> input(in_rate * channels);
+  for (size_t i = 0; i < input.size(); ++i) {
+    double t = (double)(i / channels) / in_rate;
+    input[i] = (int32_t)lrint(
+      0.5 * 2147483647.0 * sin(2 * M_PI * 1000 * (i % channels + 1) * t));
+  }
+  std::vector<int32_t> output(out_rate * channels + 1024);
+
+  struct pcm_resampler *resampler = NULL;
+  if (pcm_resampler_open(
+    quality, channels, pcm_convert_format_s32_le,
+    in_rate, out_rate, &resampler) != 0) {
+      state.SkipWithError("Cannot open resampler");
+      return;
+    }
+  state.SetLabel(
+    std::string(pcm_resample_quality_name(quality))
+      + " " + simd_level_name(simd_get_level()));
+
+  size_t produced = 0;
+  for (auto _ : state) {
+    size_t used;
+    produced += pcm_resample(
+      resampler, input.data(), in_rate, &used,
+      output.data(), output.size() / channels);
+  }
+  state.SetItemsProcessed(produced * channels);
+  state.counters["realtime_factor"] = benchmark::Counter(
+    (double)produced / out_rate, benchmark::Counter::kIsRate);
+  pcm_resampler_release(&resampler);
+}
+BENCHMARK(pcm_resample_BENCH)
+  ->ArgNames({"in_rate", "quality"})
+  ->ArgsProduct({
+    {44100, 192000},
+    {
+      pcm_resample_quality_fast,
+      pcm_resample_quality_medium,
+      pcm_resample_quality_best
+    }})
+  ->Unit(benchmark::kMillisecond);
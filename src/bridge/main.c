@@ -1,35 +1,91 @@
 #include <argp.h>
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "flac.h"
+#include "library.h"
 #include "log.h"
 #include "player.h"
+#include "realtime.h"
+#include "server.h"
 #include "timer.h"
 
 #define ARGP_GROUP_PLAYER 1
 #define ARGP_KEY_PLAYER_FILE 'f'
 #define ARGP_KEY_PLAYER_BUFFER_SIZE 'b'
 #define ARGP_KEY_PLAYER_FILE_FORMAT 't'
+#define ARGP_KEY_PLAYER_MMAP 'm'
+#define ARGP_KEY_PLAYER_URING 'u'
+#define ARGP_KEY_PLAYER_THREADED 'T'
+#define ARGP_KEY_PLAYER_SINK 's'
+#define ARGP_KEY_PLAYER_START 3
+#define ARGP_KEY_PLAYER_REALTIME 'R'
+#define ARGP_KEY_PLAYER_RT_CPU 7
+#define ARGP_KEY_PLAYER_VOLUME 12
+#define ARGP_KEY_PLAYER_REPLAY_GAIN 13
+#define ARGP_KEY_PLAYER_DITHER 14
+#define ARGP_KEY_PLAYER_CONVOLVE 15
+#define ARGP_KEY_PLAYER_PARTITION 16
 
 #define ARGP_GROUP_ALSA 2
 #define ARGP_KEY_ALSA_HARDWARE 'h'
 #define ARGP_KEY_ALSA_PERIOD_SIZE 'p'
 #define ARGP_KEY_ALSA_PERIOD_COUNT 'c'
+#define ARGP_KEY_ALSA_RW_ACCESS 'r'
+#define ARGP_KEY_ALSA_AUTO 8
+#define ARGP_KEY_ALSA_RESAMPLE 11
+
+// playback time measured before sink size is picked
+#define BRIDGE_AUTO_TUNE_SECONDS 3
 
 #define ARGP_GROUP_LOG 3
 #define ARGP_KEY_LOG_VERBOSE 'v'
 #define ARGP_KEY_LOG_OUTPUT 1
+#define ARGP_KEY_LOG_ASYNC 2
+
+#define ARGP_GROUP_LIBRARY 4
+#define ARGP_KEY_LIBRARY_SCAN 4
+#define ARGP_KEY_LIBRARY_INDEX 5
+#define ARGP_KEY_LIBRARY_THREADS 6
+
+#define ARGP_GROUP_SERVER 5
+#define ARGP_KEY_SERVER_UNIX 9
+#define ARGP_KEY_SERVER_TCP 10
 
 struct bridge_config {
-  char *file_path;
+  char **file_paths;
+  size_t files_count;
   size_t io_buffer_size;
+  bool io_mmap;
+  unsigned int io_uring_depth;
+  bool is_threaded;
+  enum player_sink sink;
+  char *sink_file_path;
+  unsigned long start_seconds;
+  int realtime_priority;
+  unsigned long writer_cpu_mask;
+  double volume_db;
+  enum pcm_replay_gain_mode replay_gain;
+  enum pcm_dither dither;
+  char *convolution_path;
+  size_t convolution_partition;
   enum pcm_format pcm_format;
   char *alsa_hadrware;
   size_t alsa_period_size;
   unsigned int alsa_periods_per_buffer;
+  bool alsa_rw_access;
+  unsigned int alsa_auto_margin;
+  enum pcm_resample_quality alsa_resample_quality;
+  bool log_async;
+  char *library_dir;
+  char *library_index;
+  unsigned int library_threads;
+  char *server_unix_path;
+  char *server_tcp_host;
+  unsigned short server_tcp_port;
 };
 
 const char *argp_program_version =
@@ -38,6 +94,28 @@ const char *argp_program_version =
 const char *argp_program_bug_address =
   "<https://github.com/tomaszbiegacz/altPlayer/issues>";
 
+/**
+ * @brief File opened for playback, the next one is opened
+ * while the current one is playing.
+ */
+struct bridge_track {
+  const char *file_path;
+  struct io_rf_stream stream;
+  struct pcm_decoder *decoder;
+};
+
+/**
+ * @brief Sink size used by the next player, picked by auto-tuning
+ * once per player.
+ */
+struct bridge_sink_size {
+  size_t period_size;
+  unsigned int periods_per_buffer;
+  bool is_tuned;
+  bool is_decided;
+  bool is_reopen_needed;
+};
+
 static error_t
 argp_parser(int key, char *arg, struct argp_state *state);
 
@@ -67,100 +145,403 @@ bridge_config_defaults(struct bridge_config *config) {
 
 static void
 bridge_config_free(struct bridge_config *config) {
-  if (config->file_path != NULL) {
-    free(config->file_path);
-    config->file_path = NULL;
+  if (config->file_paths != NULL) {
+    for (size_t i = 0; i < config->files_count; ++i) {
+      free(config->file_paths[i]);
+    }
+    free(config->file_paths);
+    config->file_paths = NULL;
+    config->files_count = 0;
   }
   if (config->alsa_hadrware != NULL) {
     free(config->alsa_hadrware);
     config->alsa_hadrware = NULL;
   }
+  if (config->sink_file_path != NULL) {
+    free(config->sink_file_path);
+    config->sink_file_path = NULL;
+  }
+  if (config->convolution_path != NULL) {
+    free(config->convolution_path);
+    config->convolution_path = NULL;
+  }
+  if (config->library_dir != NULL) {
+    free(config->library_dir);
+    config->library_dir = NULL;
+  }
+  if (config->library_index != NULL) {
+    free(config->library_index);
+    config->library_index = NULL;
+  }
+  if (config->server_unix_path != NULL) {
+    free(config->server_unix_path);
+    config->server_unix_path = NULL;
+  }
+  if (config->server_tcp_host != NULL) {
+    free(config->server_tcp_host);
+    config->server_tcp_host = NULL;
+  }
 }
 
 static error_t
-play(struct player *player) {
-  struct player_playback_status status;
-  error_t error_r = 0;
+bridge_track_open(
+  const struct bridge_config *config,
+  const char *file_path,
+  struct bridge_track *track) {
+    log_verbose("Opening [%s]", file_path);
+    track->file_path = file_path;
 
-  while (error_r == 0 && !player_is_eof(player)) {
-    error_r = player_process_once(player);
+    enum pcm_format pcm_format = config->pcm_format;
+    error_t error_r = 0;
+    if (pcm_format == 0) {
+      error_r = pcm_guess_format(file_path, &pcm_format);
+    }
     if (error_r == 0) {
-        error_r = player_get_playback_status(player, &status);
+      size_t max_single_read_size = config->alsa_period_size;
+      if (config->io_mmap) {
+        error_r = io_rf_stream_open_file_mapped(
+          file_path,
+          config->io_buffer_size,
+          max_single_read_size,
+          &track->stream);
+      } else {
+        error_r = io_rf_stream_open_file(
+          file_path,
+          config->io_buffer_size,
+          max_single_read_size,
+          &track->stream);
+      }
+    }
+    if (error_r == 0
+      && config->io_uring_depth > 0
+      && !track->stream.is_mapped) {
+        error_t uring_error = io_rf_stream_enable_uring(
+          &track->stream,
+          config->io_uring_depth);
+        if (uring_error == ENOTSUP) {
+          log_info("io_uring is not available, reading file synchronously");
+        } else {
+          error_r = uring_error;
+        }
+      }
+    if (error_r == 0 && config->alsa_auto_margin > 0) {
+      // read latency is taken into account by auto-tuning
+      error_r = io_rf_stream_enable_stats(&track->stream);
     }
     if (error_r == 0) {
-      fprintf(
-        stdout,
-"Playing %02d:%02d from %02d:%02d (io buffer %ldkb, alsa buffer %dms)       \r",
-        timespec_get_minutes(status.actual),
-        timespec_get_remaining_seconds(status.actual),
-        timespec_get_minutes(status.total),
-        timespec_get_remaining_seconds(status.total),
-        status.stream_buffer / 1024,
-        timespec_miliseconds(status.playback_buffer));
-      fflush(stdout);
+      size_t pcm_buffer_size = 2 * config->alsa_period_size;
+      switch (pcm_format) {
+        case pcm_format_wav:
+          error_r = pcm_decoder_wav_open(&track->stream, &track->decoder);
+          break;
+        case pcm_format_flac:
+          error_r = pcm_decoder_flac_open(
+            &track->stream,
+            pcm_buffer_size,
+            &track->decoder);
+          break;
+        default:
+          log_error("Unknown format: %d", pcm_format);
+          error_r = EINVAL;
+      }
     }
+    return error_r;
   }
-  printf("\n");
-  return error_r;
+
+static void
+bridge_track_free(struct bridge_track *track) {
+  if (track->decoder != NULL) {
+    pcm_decoder_decode_release(&track->decoder);
+  }
+  io_rf_stream_free(&track->stream);
+  *track = (struct bridge_track) { 0 };
 }
 
+/**
+ * @brief Auto-tuning: pick sink size after the first seconds
+ * of the player.
+ *
+ * Sink is resized for the first track queued after the decision
+ * if it has not been tuned yet or the current one violates the margin,
+ * the track already queued is played gaplessly on the current sink.
+ */
+static void
+bridge_auto_tune(
+  const struct bridge_config *config,
+  struct player *player,
+  struct bridge_sink_size *size) {
+    if (config->alsa_auto_margin == 0 || size->is_decided) {
+      return;
+    }
+    struct player_sink_tuning tuning;
+    if (player_tune_sink(player, config->alsa_auto_margin, &tuning) != 0
+      || tuning.measured.tv_sec < BRIDGE_AUTO_TUNE_SECONDS) {
+        return;
+      }
+
+    size->is_decided = true;
+    log_verbose(
+      "Worst stall %luus, sink of %d periods of %lu bytes is %s",
+      timespec_microseconds(tuning.stall),
+      tuning.periods_per_buffer,
+      tuning.period_size,
+      tuning.is_margin_violated ? "needed" : "enough");
+    if (!size->is_tuned || tuning.is_margin_violated) {
+      size->is_reopen_needed =
+        size->period_size != tuning.period_size
+        || size->periods_per_buffer != tuning.periods_per_buffer;
+      size->period_size = tuning.period_size;
+      size->periods_per_buffer = tuning.periods_per_buffer;
+      size->is_tuned = true;
+    }
+  }
+
+/**
+ * @brief Open the next file and queue it, if its format differs
+ * or sink is going to be resized it stays open until the current
+ * player is over.
+ */
+static error_t
+play_queue_next(
+  const struct bridge_config *config,
+  struct player *player,
+  bool is_reopen_needed,
+  size_t *next_file,
+  struct bridge_track *next) {
+    error_t error_r = bridge_track_open(
+      config, config->file_paths[(*next_file)++], next);
+    if (error_r == 0 && is_reopen_needed) {
+      log_verbose(
+        "[%s] is going to be played on resized sink", next->file_path);
+    } else if (error_r == 0) {
+      error_r = player_enqueue(player, next->decoder);
+      if (error_r == ENOTSUP) {
+        log_verbose(
+          "[%s] is going to be played on reopened sink", next->file_path);
+        error_r = 0;
+      }
+    }
+    return error_r;
+  }
+
 static error_t
-play_file(struct bridge_config *config) {
-  log_info("Playing music from [%s]", config->file_path);
+play(
+  const struct bridge_config *config,
+  struct player *player,
+  struct bridge_sink_size *size,
+  size_t *next_file,
+  struct bridge_track **current,
+  struct bridge_track **next) {
+    struct player_playback_status status;
+    size_t track = 0;
+    error_t error_r = 0;
+
+    log_info("Playing music from [%s]", (*current)->file_path);
+    while (error_r == 0 && !player_is_eof(player)) {
+      bridge_auto_tune(config, player, size);
+      if ((*next)->decoder == NULL && *next_file < config->files_count) {
+        error_r = play_queue_next(
+          config, player, size->is_reopen_needed, next_file, *next);
+      }
+      if (error_r == 0) {
+        error_r = player_wait(player, -1);
+      }
+      if (error_r == 0) {
+        error_r = player_process_once(player);
+      }
+      if (error_r == 0 && player_take_finished(player) != NULL) {
+        // next track is being decoded, its stream must stay in place
+        struct bridge_track *finished = *current;
+        bridge_track_free(finished);
+        *current = *next;
+        *next = finished;
+      }
+      if (error_r == 0) {
+          error_r = player_get_playback_status(player, &status);
+      }
+      if (error_r == 0 && status.track != track) {
+        track = status.track;
+        printf("\n");
+        log_info("Playing music from [%s]", (*current)->file_path);
+      }
+      if (error_r == 0) {
+        fprintf(
+          stdout,
+"Playing %02d:%02d from %02d:%02d (io buffer %ldkb, alsa buffer %dms, "
+"xruns %lu)       \r",
+          timespec_get_minutes(status.actual),
+          timespec_get_remaining_seconds(status.actual),
+          timespec_get_minutes(status.total),
+          timespec_get_remaining_seconds(status.total),
+          status.stream_buffer / 1024,
+          timespec_miliseconds(status.playback_buffer),
+          status.xruns_count);
+        fflush(stdout);
+      }
+    }
+    printf("\n");
+    return error_r;
+  }
 
-  struct io_rf_stream file_stream = { 0 };
-  struct pcm_decoder *decoder = NULL;
+/**
+ * @brief Play files one after another, sink is reopened only
+ * when the next file format differs.
+ */
+static error_t
+play_files(struct bridge_config *config) {
+  struct bridge_track tracks[2] = { 0 };
+  struct bridge_track *current = &tracks[0];
+  struct bridge_track *next = &tracks[1];
   struct player *player = NULL;
+  size_t next_file = 0;
+  bool is_first = true;
+  struct bridge_sink_size size = (struct bridge_sink_size) {
+    .period_size = config->alsa_period_size,
+    .periods_per_buffer = config->alsa_periods_per_buffer,
+  };
+
   error_t error_r = 0;
-  if (config->pcm_format == 0) {
-    error_r = pcm_guess_format(config->file_path, &config->pcm_format);
-  }
-  if (error_r == 0) {
-    size_t max_single_read_size = config->alsa_period_size;
-    error_r = io_rf_stream_open_file(
-      config->file_path,
-      config->io_buffer_size,
-      max_single_read_size,
-      &file_stream);
+  if (config->realtime_priority > 0) {
+    realtime_log_limits();
+    // memory mapped files would be locked in RAM as a whole
+    error_r = realtime_lock_memory(!config->io_mmap);
   }
-  if (error_r == 0) {
-    size_t pcm_buffer_size = 2 * config->alsa_period_size;
-    switch (config->pcm_format) {
-      case pcm_format_wav:
-        error_r = pcm_decoder_wav_open(
-          &file_stream,
-          pcm_buffer_size,
-          &decoder);
-        break;
-      case pcm_format_flac:
-        error_r = pcm_decoder_flac_open(
-          &file_stream,
-          pcm_buffer_size,
-          &decoder);
-        break;
-      default:
-        log_error("Unknown format: %d", config->pcm_format);
-        error_r = EINVAL;
+  while (error_r == 0
+    && (next->decoder != NULL || next_file < config->files_count)) {
+      player_release(&player);
+      bridge_track_free(current);
+      struct bridge_track *opened = next;
+      next = current;
+      current = opened;
+      if (current->decoder == NULL) {
+        // previous player was over before next file has been queued
+        error_r = bridge_track_open(
+          config, config->file_paths[next_file++], current);
+      }
+
+      if (error_r == 0) {
+        struct player_parameters player_params = (struct player_parameters) {
+          .sink = config->sink,
+          .sink_file_path = config->sink_file_path,
+          .hardware_id = config->alsa_hadrware,
+          .disable_resampling = 0,
+          .disable_mmap_access = config->alsa_rw_access,
+          .resample_quality = config->alsa_resample_quality,
+          .period_size = size.period_size,
+          .periods_per_buffer = size.periods_per_buffer,
+          .reads_per_period = 3,
+          .is_threaded = config->is_threaded,
+          .handoff_buffer_size = 0,
+          .realtime_priority = config->realtime_priority,
+          .writer_cpu_mask = config->writer_cpu_mask,
+          .volume_db = config->volume_db,
+          .replay_gain = config->replay_gain,
+          .dither = config->dither,
+          .convolution_path = config->convolution_path,
+          .convolution_partition = config->convolution_partition,
+        };
+        error_r = player_open(&player_params, current->decoder, &player);
+        size.is_decided = false;
+        size.is_reopen_needed = false;
+      }
+      if (error_r == 0 && is_first && config->start_seconds > 0) {
+        error_r = player_seek(
+          player,
+          config->start_seconds * current->decoder->spec.samples_per_sec);
+      }
+      is_first = false;
+      if (error_r == 0) {
+        log_info(
+          "Sink access type: %s",
+          player_access_name(player_get_access(player)));
+        error_r = play(config, player, &size, &next_file, &current, &next);
+      }
     }
-  }
-  if (error_r == 0) {
-    struct player_parameters player_params = (struct player_parameters) {
+
+  player_release(&player);
+  bridge_track_free(&tracks[0]);
+  bridge_track_free(&tracks[1]);
+  return error_r;
+}
+
+static struct server *bridge_server;
+
+static void
+bridge_server_stop(int signal) {
+  UNUSED(signal);
+  server_stop(bridge_server);
+}
+
+/**
+ * @brief Play files sent by clients until SIGINT or SIGTERM.
+ */
+static error_t
+serve(const struct bridge_config *config) {
+  struct server_parameters params = (struct server_parameters) {
+    .unix_path = config->server_unix_path,
+    .tcp_host = config->server_tcp_host,
+    .tcp_port = config->server_tcp_port,
+    .io_buffer_size = config->io_buffer_size,
+    .player = (struct player_parameters) {
+      .sink = config->sink,
+      .sink_file_path = config->sink_file_path,
       .hardware_id = config->alsa_hadrware,
-      .disable_resampling = 0,
+      .disable_mmap_access = config->alsa_rw_access,
+      .resample_quality = config->alsa_resample_quality,
       .period_size = config->alsa_period_size,
       .periods_per_buffer = config->alsa_periods_per_buffer,
       .reads_per_period = 3,
-    };
-    error_r = player_open(&player_params, decoder, &player);
-  }
+      .realtime_priority = config->realtime_priority,
+      .writer_cpu_mask = config->writer_cpu_mask,
+      .volume_db = config->volume_db,
+      .replay_gain = config->replay_gain,
+      .dither = config->dither,
+      .convolution_path = config->convolution_path,
+      .convolution_partition = config->convolution_partition,
+    }
+  };
 
+  error_t error_r = 0;
+  if (config->realtime_priority > 0) {
+    realtime_log_limits();
+    error_r = realtime_lock_memory(true);
+  }
   if (error_r == 0) {
-    error_r = play(player);
+    error_r = server_open(&params, &bridge_server);
   }
+  if (error_r == 0) {
+    struct sigaction action = { .sa_handler = bridge_server_stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    error_r = server_run(bridge_server);
+  }
+  server_release(&bridge_server);
+  return error_r;
+}
 
-  player_release(&player);
-  pcm_decoder_decode_release(&decoder);
-  io_rf_stream_free(&file_stream);
+static error_t
+scan_library(const struct bridge_config *config) {
+  struct library_scan_parameters params = (struct library_scan_parameters) {
+    .dir_path = config->library_dir,
+    .index_path = IF_NULL(config->library_index, "altPlayer.index"),
+    .threads_count = config->library_threads
+  };
+  struct library_scan_statistics stats;
+  log_info("Scanning [%s] into [%s]", params.dir_path, params.index_path);
+  error_t error_r = library_scan(&params, &stats);
+  if (error_r == 0) {
+    log_info(
+      "Found %lu tracks in %lu directories within %dms",
+      stats.files_count,
+      stats.dirs_count,
+      timespec_miliseconds(stats.elapsed));
+    log_info(
+      "Headers read: %lu, unchanged: %lu, invalid: %lu",
+      stats.probed_count,
+      stats.unchanged_count,
+      stats.invalid_count);
+  }
   return error_r;
 }
 
@@ -205,7 +586,9 @@ main(int argc, char **argv) {
       .key = ARGP_KEY_PLAYER_FILE,
       .arg = "PATH",
       .flags = 0,
-      .doc = "Play file from the given path.",
+      .doc =
+        "Play file from the given path, "
+        "repeat it to play files one after another without gaps.",
       .group = ARGP_GROUP_PLAYER
     },
     (struct argp_option) {
@@ -216,6 +599,113 @@ main(int argc, char **argv) {
       .doc = "IO buffer size in MB, default 16.",
       .group = ARGP_GROUP_ALSA
     },
+    (struct argp_option) {
+      .name = "mmap",
+      .key = ARGP_KEY_PLAYER_MMAP,
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Read regular files via memory mapping instead of IO buffer.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "uring",
+      .key = ARGP_KEY_PLAYER_URING,
+      .arg = "DEPTH",
+      .flags = 0,
+      .doc = "Keep DEPTH reads in flight via io_uring, if available.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "threaded",
+      .key = ARGP_KEY_PLAYER_THREADED,
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Decode and write to ALSA on separate threads.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "sink",
+      .key = ARGP_KEY_PLAYER_SINK,
+      .arg = "SINK",
+      .flags = 0,
+      .doc =
+        "Where PCM goes: alsa (default), "
+        "null (as fast as possible), null-rt (at real-time rate) "
+        "or wav:PATH.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "start",
+      .key = ARGP_KEY_PLAYER_START,
+      .arg = "SECONDS",
+      .flags = 0,
+      .doc = "Start playing the first file SECONDS from its beginning.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "realtime",
+      .key = ARGP_KEY_PLAYER_REALTIME,
+      .arg = "PRIORITY",
+      .flags = 0,
+      .doc =
+        "Write to the sink with SCHED_FIFO PRIORITY, "
+        "lock process memory and prefault IO buffers.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "rt-cpu",
+      .key = ARGP_KEY_PLAYER_RT_CPU,
+      .arg = "CPU",
+      .flags = 0,
+      .doc = "Write to the sink only on CPU, repeat it to allow more CPUs.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "volume",
+      .key = ARGP_KEY_PLAYER_VOLUME,
+      .arg = "DB",
+      .flags = 0,
+      .doc = "Software volume in dB, i.e. -6.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "replay-gain",
+      .key = ARGP_KEY_PLAYER_REPLAY_GAIN,
+      .arg = "MODE",
+      .flags = 0,
+      .doc = "Apply ReplayGain tags: track or album.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "dither",
+      .key = ARGP_KEY_PLAYER_DITHER,
+      .arg = "DITHER",
+      .flags = 0,
+      .doc =
+        "Dither of samples requantized after gain: none, tpdf (default) "
+        "or shaped.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "convolve",
+      .key = ARGP_KEY_PLAYER_CONVOLVE,
+      .arg = "FILE",
+      .flags = 0,
+      .doc =
+        "Convolve with impulse responses of WAV FILE, i.e. room correction, "
+        "mono one applies to all channels.",
+      .group = ARGP_GROUP_PLAYER
+    },
+    (struct argp_option) {
+      .name = "partition",
+      .key = ARGP_KEY_PLAYER_PARTITION,
+      .arg = "FRAMES",
+      .flags = 0,
+      .doc =
+        "Convolution latency, power of 2 from 32 to 16384, larger ones "
+        "take less CPU (default 1024).",
+      .group = ARGP_GROUP_PLAYER
+    },
     (struct argp_option) {
       .name = "format",
       .key = ARGP_KEY_PLAYER_FILE_FORMAT,
@@ -248,6 +738,50 @@ main(int argc, char **argv) {
       .doc = "Alsa periods count in buffer, default 1024.",
       .group = ARGP_GROUP_PLAYER
     },
+    (struct argp_option) {
+      .name = "alsa-auto",
+      .key = ARGP_KEY_ALSA_AUTO,
+      .arg = "MARGIN",
+      .flags = 0,
+      .doc =
+        "Pick the smallest period and buffer, which hold MARGIN times "
+        "the worst stall measured, for tracks queued after tuning.",
+      .group = ARGP_GROUP_ALSA
+    },
+    (struct argp_option) {
+      .name = "alsa-rw",
+      .key = ARGP_KEY_ALSA_RW_ACCESS,
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Copy PCM to the device even if it supports mmap access.",
+      .group = ARGP_GROUP_ALSA
+    },
+    (struct argp_option) {
+      .name = "resample",
+      .key = ARGP_KEY_ALSA_RESAMPLE,
+      .arg = "QUALITY",
+      .flags = 0,
+      .doc =
+        "Resample in process when the device does not take the file rate: "
+        "fast, medium or best, instead of the ALSA rate plugin.",
+      .group = ARGP_GROUP_ALSA
+    },
+    (struct argp_option) {
+      .name = "serve",
+      .key = ARGP_KEY_SERVER_UNIX,
+      .arg = "PATH",
+      .flags = 0,
+      .doc = "Play files sent by clients connecting to Unix socket PATH.",
+      .group = ARGP_GROUP_SERVER
+    },
+    (struct argp_option) {
+      .name = "listen",
+      .key = ARGP_KEY_SERVER_TCP,
+      .arg = "HOST:PORT",
+      .flags = 0,
+      .doc = "Play files sent by clients connecting via TCP to HOST:PORT.",
+      .group = ARGP_GROUP_SERVER
+    },
     (struct argp_option) {
       .name = "log-output",
       .key = ARGP_KEY_LOG_OUTPUT,
@@ -267,6 +801,42 @@ main(int argc, char **argv) {
         "then store verbose diagnostics only in the file.",
       .group = ARGP_GROUP_LOG
     },
+    (struct argp_option) {
+      .name = "log-async",
+      .key = ARGP_KEY_LOG_ASYNC,
+      .arg = NULL,
+      .flags = 0,
+      .doc =
+        "Format and write diagnostics on background thread, "
+        "lines are dropped rather than delaying playback.",
+      .group = ARGP_GROUP_LOG
+    },
+    (struct argp_option) {
+      .name = "scan",
+      .key = ARGP_KEY_LIBRARY_SCAN,
+      .arg = "DIR",
+      .flags = 0,
+      .doc =
+        "Read headers of WAV and FLAC files under DIR into track index, "
+        "files of unchanged size and mtime are not read again.",
+      .group = ARGP_GROUP_LIBRARY
+    },
+    (struct argp_option) {
+      .name = "index",
+      .key = ARGP_KEY_LIBRARY_INDEX,
+      .arg = "PATH",
+      .flags = 0,
+      .doc = "Track index file, default altPlayer.index.",
+      .group = ARGP_GROUP_LIBRARY
+    },
+    (struct argp_option) {
+      .name = "scan-threads",
+      .key = ARGP_KEY_LIBRARY_THREADS,
+      .arg = "COUNT",
+      .flags = 0,
+      .doc = "Scanning threads count, default twice the CPUs count.",
+      .group = ARGP_GROUP_LIBRARY
+    },
     { 0 }
   };
 
@@ -276,8 +846,10 @@ main(int argc, char **argv) {
     .args_doc = NULL,
     .doc =
       "\n"
-      "List available sound cards or "
-      "select a file to play it via ALSA."
+      "List available sound cards, "
+      "scan music library, "
+      "select a file to play it via ALSA "
+      "or serve playback commands."
       "\n"
       "\nOptions:",
     .children = NULL,
@@ -289,12 +861,20 @@ main(int argc, char **argv) {
   if (error_r == 0) {
     error_r = bridge_config_defaults(&config);
   }
+  if (error_r == 0 && config.log_async) {
+    error_r = log_start_async();
+  }
   if (error_r == 0) {
     log_verbose("Starting %s", argp_program_version);
     log_full_system_information();
 
-    if (config.file_path != NULL) {
-      error_r = play_file(&config);
+    if (config.library_dir != NULL) {
+      error_r = scan_library(&config);
+    } else if (config.server_unix_path != NULL
+      || config.server_tcp_host != NULL) {
+        error_r = serve(&config);
+    } else if (config.files_count > 0) {
+      error_r = play_files(&config);
     } else {
       error_r = list_sound_cards();
     }
@@ -324,14 +904,115 @@ static error_t
 argp_parser(int key, char *arg, struct argp_state *state) {
   struct bridge_config* const config = state->input;
   switch (key) {
-    case ARGP_KEY_PLAYER_FILE:
-      SAVE_ARG_STRDUP(config->file_path);
+    case ARGP_KEY_PLAYER_FILE: {
+      char **file_paths = realloc(
+        config->file_paths, (config->files_count + 1) * sizeof(char*));
+      if (file_paths == NULL) {
+        return ENOMEM;
+      }
+      config->file_paths = file_paths;
+      SAVE_ARG_STRDUP(config->file_paths[config->files_count]);
+      config->files_count++;
       return 0;
+    }
 
     case ARGP_KEY_PLAYER_BUFFER_SIZE:
       SAVE_ARG_UL(config->io_buffer_size);
       return 0;
 
+    case ARGP_KEY_PLAYER_MMAP:
+      config->io_mmap = true;
+      return 0;
+
+    case ARGP_KEY_PLAYER_URING:
+      SAVE_ARG_UL(config->io_uring_depth);
+      return 0;
+
+    case ARGP_KEY_PLAYER_THREADED:
+      config->is_threaded = true;
+      return 0;
+
+    case ARGP_KEY_PLAYER_SINK:
+      if (strcasecmp(arg, "alsa") == 0) {
+        config->sink = player_sink_alsa;
+        return 0;
+      } else if (strcasecmp(arg, "null") == 0) {
+        config->sink = player_sink_null;
+        return 0;
+      } else if (strcasecmp(arg, "null-rt") == 0) {
+        config->sink = player_sink_null_realtime;
+        return 0;
+      } else if (strncasecmp(arg, "wav:", 4) == 0 && arg[4] != 0) {
+        config->sink = player_sink_wav;
+        arg += 4;
+        SAVE_ARG_STRDUP(config->sink_file_path);
+        return 0;
+      } else {
+        log_error("Unknown sink: %s", arg);
+        return EINVAL;
+      }
+
+    case ARGP_KEY_PLAYER_START:
+      SAVE_ARG_UL(config->start_seconds);
+      return 0;
+
+    case ARGP_KEY_PLAYER_REALTIME:
+      SAVE_ARG_UL(config->realtime_priority);
+      return 0;
+
+    case ARGP_KEY_PLAYER_RT_CPU: {
+      char *end;
+      unsigned long cpu = strtoul(arg, &end, 10);
+      if (*arg == 0 || *end != 0 || cpu >= 8 * sizeof(unsigned long)) {
+        log_error("Invalid CPU: %s", arg);
+        return EINVAL;
+      }
+      config->writer_cpu_mask |= 1ul << cpu;
+      return 0;
+    }
+
+    case ARGP_KEY_PLAYER_VOLUME: {
+      char *end;
+      config->volume_db = strtod(arg, &end);
+      if (*arg == 0 || *end != 0) {
+        log_error("Invalid volume: %s", arg);
+        return EINVAL;
+      }
+      return 0;
+    }
+
+    case ARGP_KEY_PLAYER_REPLAY_GAIN:
+      for (int mode = pcm_replay_gain_track;
+        mode <= pcm_replay_gain_album;
+        mode++) {
+          if (strcasecmp(arg, pcm_replay_gain_mode_name(mode)) == 0) {
+            config->replay_gain = mode;
+            return 0;
+          }
+        }
+      log_error("Unknown ReplayGain mode: %s", arg);
+      return EINVAL;
+
+    case ARGP_KEY_PLAYER_DITHER:
+      for (int dither = pcm_dither_none;
+        dither <= pcm_dither_shaped;
+        dither++) {
+          if (strcasecmp(arg, pcm_dither_name(dither)) == 0) {
+            config->dither = dither;
+            return 0;
+          }
+        }
+      log_error("Unknown dither: %s", arg);
+      return EINVAL;
+
+    case ARGP_KEY_PLAYER_CONVOLVE:
+      SAVE_ARG_STRDUP(config->convolution_path);
+      return 0;
+
+    case ARGP_KEY_PLAYER_PARTITION:
+      SAVE_ARG_UL(config->convolution_partition);
+      return 0;
+
     case ARGP_KEY_PLAYER_FILE_FORMAT:
       if (strcasecmp(arg, "wav") == 0) {
         config->pcm_format = pcm_format_wav;
@@ -344,6 +1025,10 @@ argp_parser(int key, char *arg, struct argp_state *state) {
         return EINVAL;
       }
 
+    case ARGP_KEY_ALSA_RW_ACCESS:
+      config->alsa_rw_access = true;
+      return 0;
+
     case ARGP_KEY_ALSA_HARDWARE:
       if (soundc_is_valid_hardware_id(arg)) {
         SAVE_ARG_STRDUP(config->alsa_hadrware);
@@ -361,6 +1046,23 @@ argp_parser(int key, char *arg, struct argp_state *state) {
       SAVE_ARG_UL(config->alsa_periods_per_buffer);
       return 0;
 
+    case ARGP_KEY_ALSA_AUTO:
+      SAVE_ARG_UL(config->alsa_auto_margin);
+      return 0;
+
+    case ARGP_KEY_ALSA_RESAMPLE:
+      for (int quality = pcm_resample_quality_fast;
+        quality <= pcm_resample_quality_best;
+        quality++) {
+          if (strcasecmp(
+            arg, pcm_resample_quality_name(quality)) == 0) {
+              config->alsa_resample_quality = quality;
+              return 0;
+            }
+        }
+      log_error("Unknown resample quality: %s", arg);
+      return EINVAL;
+
     case ARGP_KEY_LOG_VERBOSE:
       log_set_verbose(true);
       return 0;
@@ -368,6 +1070,38 @@ argp_parser(int key, char *arg, struct argp_state *state) {
     case ARGP_KEY_LOG_OUTPUT:
       return log_open_output_st(arg);
 
+    case ARGP_KEY_LOG_ASYNC:
+      config->log_async = true;
+      return 0;
+
+    case ARGP_KEY_LIBRARY_SCAN:
+      SAVE_ARG_STRDUP(config->library_dir);
+      return 0;
+
+    case ARGP_KEY_LIBRARY_INDEX:
+      SAVE_ARG_STRDUP(config->library_index);
+      return 0;
+
+    case ARGP_KEY_LIBRARY_THREADS:
+      SAVE_ARG_UL(config->library_threads);
+      return 0;
+
+    case ARGP_KEY_SERVER_UNIX:
+      SAVE_ARG_STRDUP(config->server_unix_path);
+      return 0;
+
+    case ARGP_KEY_SERVER_TCP: {
+      char *port = strrchr(arg, ':');
+      unsigned long value = port != NULL ? strtoul(port + 1, NULL, 10) : 0;
+      if (port == NULL || port == arg || value == 0 || value > 65535) {
+        log_error("Invalid HOST:PORT: %s", arg);
+        return EINVAL;
+      }
+      config->server_tcp_port = value;
+      config->server_tcp_host = strndup(arg, port - arg);
+      return config->server_tcp_host != NULL ? 0 : ENOMEM;
+    }
+
     case ARGP_KEY_ARG:
       return ARGP_ERR_UNKNOWN;
 
@@ -0,0 +1,613 @@
+#include <argp.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "corpus.h"
+#include "log.h"
+
+#define ARGP_GROUP_OUTPUT 1
+#define ARGP_KEY_OUTPUT_DIR 'o'
+#define ARGP_KEY_OUTPUT_FILE 'f'
+#define ARGP_KEY_OUTPUT_FORMAT 't'
+
+#define ARGP_GROUP_PCM 2
+#define ARGP_KEY_PCM_BITS 'b'
+#define ARGP_KEY_PCM_CHANNELS 'c'
+#define ARGP_KEY_PCM_RATE 'r'
+#define ARGP_KEY_PCM_SECONDS 's'
+#define ARGP_KEY_PCM_SIZE 'S'
+#define ARGP_KEY_PCM_SIGNAL 'g'
+#define ARGP_KEY_PCM_SEED 1
+#define ARGP_KEY_PCM_ALL 'a'
+
+#define ARGP_GROUP_LOG 3
+#define ARGP_KEY_LOG_VERBOSE 'v'
+
+#define CORPUS_MAX_VALUES 16
+
+/**
+ * @brief Comma separated list of values from CLI
+ */
+struct corpus_values {
+  unsigned int values[CORPUS_MAX_VALUES];
+  size_t count;
+};
+
+/**
+ * @brief Container format of corpus file, RIFX is big endian WAV
+ */
+enum corpus_format {
+  corpus_format_wav     = 1,
+  corpus_format_rifx    = 2,
+  corpus_format_flac    = 3,
+};
+
+struct corpus_config {
+  char *output_dir;
+  char *output_file;
+  struct corpus_values formats;
+  struct corpus_values bits;
+  struct corpus_values channels;
+  struct corpus_values rates;
+  struct corpus_values signals;
+  size_t seconds;
+  size_t size;
+  unsigned int seed;
+  bool is_all;
+};
+
+const char *argp_program_version =
+  "altCorpus 0.1";
+
+const char *argp_program_bug_address =
+  "<https://github.com/tomaszbiegacz/altPlayer/issues>";
+
+static const struct corpus_values corpus_all_formats = {
+  .values = { corpus_format_wav, corpus_format_rifx, corpus_format_flac },
+  .count = 3
+};
+
+static const struct corpus_values corpus_all_bits = {
+  .values = { 8, 16, 24, 32 },
+  .count = 4
+};
+
+static const struct corpus_values corpus_all_channels = {
+  .values = { 1, 2, 3, 4, 5, 6, 7, 8 },
+  .count = 8
+};
+
+static const struct corpus_values corpus_all_rates = {
+  .values = {
+    8000, 11025, 16000, 22050, 32000, 44100, 48000,
+    88200, 96000, 176400, 192000, 352800, 384000
+  },
+  .count = 13
+};
+
+static const struct corpus_values corpus_all_signals = {
+  .values = { pcm_corpus_signal_sine, pcm_corpus_signal_noise },
+  .count = 2
+};
+
+static error_t
+argp_parser(int key, char *arg, struct argp_state *state);
+
+static void
+corpus_values_default(
+  struct corpus_values *values,
+  const struct corpus_values *all,
+  bool is_all,
+  unsigned int value) {
+    if (values->count == 0) {
+      if (is_all) {
+        *values = *all;
+      } else {
+        values->values[0] = value;
+        values->count = 1;
+      }
+    }
+  }
+
+static error_t
+corpus_config_defaults(struct corpus_config *config) {
+  corpus_values_default(
+    &config->formats, &corpus_all_formats, config->is_all, corpus_format_wav);
+  corpus_values_default(
+    &config->bits, &corpus_all_bits, config->is_all, 16);
+  corpus_values_default(
+    &config->channels, &corpus_all_channels, config->is_all, 2);
+  corpus_values_default(
+    &config->rates, &corpus_all_rates, config->is_all, 44100);
+  corpus_values_default(
+    &config->signals,
+    &corpus_all_signals,
+    config->is_all,
+    pcm_corpus_signal_sine);
+
+  if (config->seconds == 0 && config->size == 0) {
+    config->seconds = 3;
+  }
+  if (config->seed == 0) {
+    config->seed = 1;
+  }
+
+  if (config->output_file != NULL) {
+    if (config->formats.count > 1
+      || config->bits.count > 1
+      || config->channels.count > 1
+      || config->rates.count > 1
+      || config->signals.count > 1) {
+        log_error("Only single value of each parameter is allowed for file");
+        return EINVAL;
+      }
+  } else if (config->output_dir == NULL) {
+    config->output_dir = strdup(".");
+    if (config->output_dir == NULL) {
+      return ENOMEM;
+    }
+  }
+  return 0;
+}
+
+static void
+corpus_config_free(struct corpus_config *config) {
+  if (config->output_dir != NULL) {
+    free(config->output_dir);
+    config->output_dir = NULL;
+  }
+  if (config->output_file != NULL) {
+    free(config->output_file);
+    config->output_file = NULL;
+  }
+}
+
+static const char*
+corpus_format_extension(enum corpus_format format) {
+  switch (format) {
+    case corpus_format_wav:
+      return "wav";
+    case corpus_format_rifx:
+      return "rifx.wav";
+    case corpus_format_flac:
+      return "flac";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Write single file, ENOTSUP means that format cannot store the spec
+ */
+static error_t
+corpus_write_file(
+  const struct corpus_config *config,
+  const char *file_path,
+  enum corpus_format format,
+  enum pcm_corpus_signal signal,
+  struct pcm_spec *spec) {
+    spec->is_big_endian = format == corpus_format_rifx;
+    spec->samples_count = config->size > 0
+      ? config->size / pcm_frame_size(spec)
+      : config->seconds * spec->samples_per_sec;
+
+    return pcm_corpus_write(
+      file_path,
+      format == corpus_format_flac ? pcm_format_flac : pcm_format_wav,
+      signal,
+      config->seed,
+      spec);
+  }
+
+static error_t
+corpus_write_all(const struct corpus_config *config) {
+  size_t written_count = 0;
+  size_t skipped_count = 0;
+  error_t error_r = 0;
+  char file_path[4096];
+
+  // all combinations, rates change the fastest
+  const struct corpus_values *dimensions[] = {
+    &config->rates,
+    &config->channels,
+    &config->bits,
+    &config->signals,
+    &config->formats
+  };
+  const size_t dimensions_count = sizeof(dimensions) / sizeof(dimensions[0]);
+  size_t combinations_count = 1;
+  for (size_t d = 0; d < dimensions_count; ++d) {
+    combinations_count *= dimensions[d]->count;
+  }
+
+  for (size_t i = 0; error_r == 0 && i < combinations_count; ++i) {
+    unsigned int values[sizeof(dimensions) / sizeof(dimensions[0])];
+    size_t index = i;
+    for (size_t d = 0; d < dimensions_count; ++d) {
+      values[d] = dimensions[d]->values[index % dimensions[d]->count];
+      index /= dimensions[d]->count;
+    }
+
+    struct pcm_spec spec = {
+      .samples_per_sec = values[0],
+      .channels_count = values[1],
+      .bits_per_sample = values[2]
+    };
+    enum pcm_corpus_signal signal = values[3];
+    enum corpus_format format = values[4];
+
+    snprintf(
+      file_path,
+      sizeof(file_path),
+      "%s/%s_%dbit_%dch_%dHz.%s",
+      config->output_dir,
+      pcm_corpus_signal_name(signal),
+      spec.bits_per_sample,
+      spec.channels_count,
+      spec.samples_per_sec,
+      corpus_format_extension(format));
+
+    error_r = corpus_write_file(config, file_path, format, signal, &spec);
+    if (error_r == 0) {
+      log_info("Written [%s]", file_path);
+      written_count++;
+    } else if (error_r == ENOTSUP) {
+      log_info("Skipped [%s], format does not support it", file_path);
+      remove(file_path);
+      skipped_count++;
+      error_r = 0;
+    }
+  }
+
+  log_info("Written %zu files, skipped %zu", written_count, skipped_count);
+  return error_r;
+}
+
+static error_t
+corpus_write_single(const struct corpus_config *config) {
+  struct pcm_spec spec = {
+    .channels_count = config->channels.values[0],
+    .samples_per_sec = config->rates.values[0],
+    .bits_per_sample = config->bits.values[0]
+  };
+  error_t error_r = corpus_write_file(
+    config,
+    config->output_file,
+    config->formats.values[0],
+    config->signals.values[0],
+    &spec);
+  if (error_r == 0) {
+    log_info("Written [%s]", config->output_file);
+  }
+  return error_r;
+}
+
+error_t
+main(int argc, char **argv) {
+  log_start();
+  struct corpus_config config = { 0 };
+
+  const struct argp_option argp_options[] = {
+    (struct argp_option) {
+      .name = "output",
+      .key = ARGP_KEY_OUTPUT_DIR,
+      .arg = "DIR",
+      .flags = 0,
+      .doc = "Write all combinations of parameters into DIR, default '.'.",
+      .group = ARGP_GROUP_OUTPUT
+    },
+    (struct argp_option) {
+      .name = "file",
+      .key = ARGP_KEY_OUTPUT_FILE,
+      .arg = "PATH",
+      .flags = 0,
+      .doc = "Write single file, format is guessed from the extension.",
+      .group = ARGP_GROUP_OUTPUT
+    },
+    (struct argp_option) {
+      .name = "format",
+      .key = ARGP_KEY_OUTPUT_FORMAT,
+      .arg = "LIST",
+      .flags = 0,
+      .doc = "File formats: wav, rifx (big endian WAV), flac.",
+      .group = ARGP_GROUP_OUTPUT
+    },
+    (struct argp_option) {
+      .name = "bits",
+      .key = ARGP_KEY_PCM_BITS,
+      .arg = "LIST",
+      .flags = 0,
+      .doc = "Bits per sample: 8, 16, 24 or 32, default 16.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "channels",
+      .key = ARGP_KEY_PCM_CHANNELS,
+      .arg = "LIST",
+      .flags = 0,
+      .doc = "Channels count, default 2.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "rate",
+      .key = ARGP_KEY_PCM_RATE,
+      .arg = "LIST",
+      .flags = 0,
+      .doc = "Samples per second, default 44100.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "seconds",
+      .key = ARGP_KEY_PCM_SECONDS,
+      .arg = "COUNT",
+      .flags = 0,
+      .doc = "Length of each file, default 3.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "size",
+      .key = ARGP_KEY_PCM_SIZE,
+      .arg = "SIZE",
+      .flags = 0,
+      .doc = "PCM size of each file, with optional K, M or G suffix.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "signal",
+      .key = ARGP_KEY_PCM_SIGNAL,
+      .arg = "LIST",
+      .flags = 0,
+      .doc = "Content: sine or noise, default sine.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "seed",
+      .key = ARGP_KEY_PCM_SEED,
+      .arg = "SEED",
+      .flags = 0,
+      .doc = "Seed of the noise, default 1.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "all",
+      .key = ARGP_KEY_PCM_ALL,
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Use all supported values of parameters which are not given.",
+      .group = ARGP_GROUP_PCM
+    },
+    (struct argp_option) {
+      .name = "verbose",
+      .key = ARGP_KEY_LOG_VERBOSE,
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Produce verbose output.",
+      .group = ARGP_GROUP_LOG
+    },
+    { 0 }
+  };
+
+  const struct argp argp_spec = (struct argp) {
+    .options = argp_options,
+    .parser = argp_parser,
+    .args_doc = NULL,
+    .doc =
+      "\n"
+      "Synthesize deterministic WAV and FLAC files "
+      "for tests and benchmarks."
+      "\n"
+      "\nOptions:",
+    .children = NULL,
+    .help_filter = NULL,
+    .argp_domain = NULL
+  };
+
+  error_t error_r = argp_parse(&argp_spec, argc, argv, 0, NULL, &config);
+  if (error_r == 0) {
+    error_r = corpus_config_defaults(&config);
+  }
+  if (error_r == 0) {
+    if (config.output_file != NULL) {
+      error_r = corpus_write_single(&config);
+    } else {
+      error_r = corpus_write_all(&config);
+    }
+  }
+
+  log_verbose(
+    "Finished with error %d (%s)",
+    error_r,
+    strerror(error_r));
+
+  corpus_config_free(&config);
+  log_free();
+  return error_r == 0 ? 0 : -1;
+}
+
+static error_t
+parse_values(
+  char *arg,
+  error_t (*parse_value)(const char *value, unsigned int *result),
+  struct corpus_values *result) {
+    result->count = 0;
+    char *save_ptr;
+    for (
+      char *value = strtok_r(arg, ",", &save_ptr);
+      value != NULL;
+      value = strtok_r(NULL, ",", &save_ptr)) {
+        if (result->count == CORPUS_MAX_VALUES) {
+          log_error("Too many values: %s", arg);
+          return EINVAL;
+        }
+        error_t error_r = parse_value(value, result->values + result->count);
+        if (error_r != 0) {
+          log_error("Invalid argument: %s", value);
+          return error_r;
+        }
+        result->count++;
+      }
+    return 0;
+  }
+
+static error_t
+parse_number(const char *value, unsigned int *result) {
+  char *end;
+  unsigned long number = strtoul(value, &end, 10);
+  if (*end != 0 || number == 0 || number > UINT32_MAX) {
+    return EINVAL;
+  }
+  *result = number;
+  return 0;
+}
+
+static error_t
+parse_format(const char *value, unsigned int *result) {
+  if (strcasecmp(value, "wav") == 0) {
+    *result = corpus_format_wav;
+  } else if (strcasecmp(value, "rifx") == 0) {
+    *result = corpus_format_rifx;
+  } else if (strcasecmp(value, "flac") == 0) {
+    *result = corpus_format_flac;
+  } else {
+    return EINVAL;
+  }
+  return 0;
+}
+
+static error_t
+parse_signal(const char *value, unsigned int *result) {
+  enum pcm_corpus_signal signal;
+  error_t error_r = pcm_corpus_guess_signal(value, &signal);
+  if (error_r == 0) {
+    *result = signal;
+  }
+  return error_r;
+}
+
+static error_t
+parse_size(const char *value, size_t *result) {
+  char *end;
+  size_t size = strtoull(value, &end, 10);
+  switch (*end) {
+    case 'G':
+    case 'g':
+      size *= 1024;
+      // fall through
+    case 'M':
+    case 'm':
+      size *= 1024;
+      // fall through
+    case 'K':
+    case 'k':
+      size *= 1024;
+      end++;
+      break;
+  }
+  if (*end != 0 || size == 0) {
+    return EINVAL;
+  }
+  *result = size;
+  return 0;
+}
+
+/**
+ * @brief Format of single file is taken from its extension
+ */
+static error_t
+guess_file_format(const char *file_path, struct corpus_values *result) {
+  if (result->count > 0) {
+    // rifx given explicitly
+    return 0;
+  }
+  enum pcm_format format;
+  error_t error_r = pcm_guess_format(file_path, &format);
+  if (error_r != 0) {
+    log_error("Unknown file format: %s", file_path);
+    return error_r;
+  }
+  result->values[0] = format == pcm_format_flac
+    ? corpus_format_flac : corpus_format_wav;
+  result->count = 1;
+  return 0;
+}
+
+#define SAVE_ARG_STRDUP(c) c = strdup(arg);\
+  if (c == NULL) return ENOMEM;
+
+#define SAVE_ARG_UL(c) c = strtoul(arg, NULL, 10);\
+  if (c == 0) {\
+    log_error("Invalid argument: %s", arg);\
+    return EINVAL;\
+  }
+
+static error_t
+argp_parser(int key, char *arg, struct argp_state *state) {
+  struct corpus_config *config = state->input;
+  switch (key) {
+    case ARGP_KEY_OUTPUT_DIR:
+      SAVE_ARG_STRDUP(config->output_dir);
+      return 0;
+
+    case ARGP_KEY_OUTPUT_FILE:
+      SAVE_ARG_STRDUP(config->output_file);
+      return 0;
+
+    case ARGP_KEY_OUTPUT_FORMAT:
+      return parse_values(arg, parse_format, &config->formats);
+
+    case ARGP_KEY_PCM_BITS:
+      return parse_values(arg, parse_number, &config->bits);
+
+    case ARGP_KEY_PCM_CHANNELS:
+      return parse_values(arg, parse_number, &config->channels);
+
+    case ARGP_KEY_PCM_RATE:
+      return parse_values(arg, parse_number, &config->rates);
+
+    case ARGP_KEY_PCM_SIGNAL:
+      return parse_values(arg, parse_signal, &config->signals);
+
+    case ARGP_KEY_PCM_SECONDS:
+      SAVE_ARG_UL(config->seconds);
+      return 0;
+
+    case ARGP_KEY_PCM_SIZE:
+      if (parse_size(arg, &config->size) != 0) {
+        log_error("Invalid argument: %s", arg);
+        return EINVAL;
+      }
+      return 0;
+
+    case ARGP_KEY_PCM_SEED:
+      SAVE_ARG_UL(config->seed);
+      return 0;
+
+    case ARGP_KEY_PCM_ALL:
+      config->is_all = true;
+      return 0;
+
+    case ARGP_KEY_LOG_VERBOSE:
+      log_set_verbose(true);
+      return 0;
+
+    case ARGP_KEY_END:
+      if (config->output_file != NULL) {
+        return guess_file_format(config->output_file, &config->formats);
+      }
+      return 0;
+
+    case ARGP_KEY_ARG:
+      return ARGP_ERR_UNKNOWN;
+
+    case ARGP_KEY_ARGS:
+      log_error("Unknown CLI argument: %s", arg);
+      argp_usage(state);
+      return EINVAL;
+
+    default:
+      return 0;
+  }
+}
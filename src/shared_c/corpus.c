@@ -0,0 +1,300 @@
+#include <errno.h>
+#include <FLAC/metadata.h>
+#include <FLAC/stream_encoder.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "corpus.h"
+#include "sink.h"
+
+#define CORPUS_CHUNK_FRAMES 16384
+#define CORPUS_SINE_FREQUENCY 110
+
+error_t
+pcm_corpus_guess_signal(
+  const char *name,
+  enum pcm_corpus_signal *signal) {
+    assert(name != NULL);
+    assert(signal != NULL);
+    if (strcasecmp(name, "sine") == 0) {
+      *signal = pcm_corpus_signal_sine;
+      return 0;
+    }
+    if (strcasecmp(name, "noise") == 0) {
+      *signal = pcm_corpus_signal_noise;
+      return 0;
+    }
+    return EINVAL;
+  }
+
+const char*
+pcm_corpus_signal_name(enum pcm_corpus_signal signal) {
+  switch (signal) {
+    case pcm_corpus_signal_sine:
+      return "sine";
+    case pcm_corpus_signal_noise:
+      return "noise";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Signal synthesis state, samples are generated chunk by chunk
+ * so that multi-GB files do not need much memory.
+ */
+struct pcm_corpus_generator {
+  enum pcm_corpus_signal signal;
+  const struct pcm_spec *spec;
+  uint32_t noise_state;
+  size_t position;
+  int32_t *samples;
+};
+
+static double
+pcm_corpus_next_value(
+  struct pcm_corpus_generator *generator,
+  unsigned short channel) {
+    if (generator->signal == pcm_corpus_signal_sine) {
+      const unsigned int rate = generator->spec->samples_per_sec;
+      double frequency = CORPUS_SINE_FREQUENCY * (channel + 1);
+      // all frequencies are periodic within a second, which keeps
+      // the argument small for precision of long files
+      double t = (double)(generator->position % rate) / rate;
+      return 0.5 * sin(2 * M_PI * frequency * t);
+    } else {
+      // xorshift32
+      uint32_t x = generator->noise_state;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      generator->noise_state = x;
+      return (double)x / UINT32_MAX - 0.5;
+    }
+  }
+
+/**
+ * @brief Generate next chunk of interleaved samples, returns frames count.
+ */
+static size_t
+pcm_corpus_generate(struct pcm_corpus_generator *generator) {
+  const struct pcm_spec *spec = generator->spec;
+  const int64_t max_value = ((int64_t)1 << (spec->bits_per_sample - 1)) - 1;
+  size_t count = min_size_t(
+    CORPUS_CHUNK_FRAMES, spec->samples_count - generator->position);
+
+  int32_t *sample = generator->samples;
+  for (size_t i = 0; i < count; ++i) {
+    for (unsigned short ch = 0; ch < spec->channels_count; ++ch) {
+      *sample++ = (int32_t)llround(
+        pcm_corpus_next_value(generator, ch) * max_value);
+    }
+    generator->position++;
+  }
+  return count;
+}
+
+static error_t
+pcm_corpus_generator_init(
+  enum pcm_corpus_signal signal,
+  unsigned int seed,
+  const struct pcm_spec *spec,
+  struct pcm_corpus_generator *result) {
+    *result = (struct pcm_corpus_generator) {
+      .signal = signal,
+      .spec = spec,
+      // xorshift state must not be 0
+      .noise_state = seed * 2654435761u | 1,
+      .position = 0,
+      .samples = calloc(
+        CORPUS_CHUNK_FRAMES * spec->channels_count, sizeof(int32_t))
+    };
+    if (result->samples == NULL) {
+      log_error("CORPUS: Insufficient memory for samples");
+      return ENOMEM;
+    }
+    return 0;
+  }
+
+static void
+pcm_corpus_pack_wav(
+  const struct pcm_spec *spec,
+  const int32_t *samples,
+  size_t count,
+  unsigned char *dest) {
+    const size_t sample_size = spec->bits_per_sample / 8;
+    for (size_t i = 0; i < count; ++i) {
+      // 8 bit WAV is unsigned
+      uint32_t value = sample_size == 1 ? samples[i] + 128 : samples[i];
+      for (size_t b = 0; b < sample_size; ++b) {
+        size_t shift = 8 * (spec->is_big_endian ? sample_size - 1 - b : b);
+        *dest++ = (value >> shift) & 0xff;
+      }
+    }
+  }
+
+static error_t
+pcm_corpus_write_wav(
+  const char *file_path,
+  struct pcm_corpus_generator *generator) {
+    const struct pcm_spec *spec = generator->spec;
+    const size_t frame_size = pcm_frame_size(spec);
+    if (spec->samples_count * frame_size > PCM_SINK_WAV_MAX_DATA_SIZE) {
+      log_error("CORPUS: WAV cannot be bigger than 4GB");
+      return ENOTSUP;
+    }
+
+    struct pcm_sink_parameters params = {
+      .period_size = CORPUS_CHUNK_FRAMES * frame_size,
+      .periods_per_buffer = 2,
+      .disable_resampling = true,
+      .disable_mmap_access = true
+    };
+    struct pcm_sink *sink = NULL;
+    error_t error_r = pcm_sink_wav_open(file_path, &params, spec, &sink);
+
+    unsigned char *pcm = NULL;
+    if (error_r == 0) {
+      pcm = malloc(CORPUS_CHUNK_FRAMES * frame_size);
+      if (pcm == NULL) {
+        log_error("CORPUS: Insufficient memory for PCM");
+        error_r = ENOMEM;
+      }
+    }
+    while (error_r == 0 && generator->position < spec->samples_count) {
+      size_t count = pcm_corpus_generate(generator);
+      pcm_corpus_pack_wav(
+        spec, generator->samples, count * spec->channels_count, pcm);
+      size_t written;
+      error_r = pcm_sink_write(sink, pcm, count, &written);
+    }
+
+    free(pcm);
+    pcm_sink_release(&sink);
+    return error_r;
+  }
+
+static error_t
+pcm_corpus_write_flac(
+  const char *file_path,
+  struct pcm_corpus_generator *generator) {
+    const struct pcm_spec *spec = generator->spec;
+    if (spec->is_big_endian) {
+      log_error("CORPUS: FLAC cannot be big endian");
+      return ENOTSUP;
+    }
+
+    FLAC__StreamEncoder *encoder = FLAC__stream_encoder_new();
+    if (encoder == NULL) {
+      log_error("CORPUS: FLAC encoder allocation failed");
+      return ENOMEM;
+    }
+
+    // seek points are filled in by the encoder, one per second
+    error_t error_r = 0;
+    FLAC__StreamMetadata *seek_table = FLAC__metadata_object_new(
+      FLAC__METADATA_TYPE_SEEKTABLE);
+    FLAC__bool is_seek_table = seek_table != NULL;
+    is_seek_table = is_seek_table &&
+      FLAC__metadata_object_seektable_template_append_spaced_points_by_samples(
+        seek_table, spec->samples_per_sec, spec->samples_count);
+    is_seek_table = is_seek_table
+      && FLAC__metadata_object_seektable_template_sort(seek_table, true);
+    if (!is_seek_table) {
+      log_error("CORPUS: FLAC seek table allocation failed");
+      error_r = ENOMEM;
+    }
+
+    FLAC__stream_encoder_set_channels(encoder, spec->channels_count);
+    FLAC__stream_encoder_set_bits_per_sample(encoder, spec->bits_per_sample);
+    FLAC__stream_encoder_set_sample_rate(encoder, spec->samples_per_sec);
+    FLAC__stream_encoder_set_compression_level(encoder, 5);
+    FLAC__stream_encoder_set_total_samples_estimate(
+      encoder, spec->samples_count);
+    // 32 bit samples are outside of streamable subset
+    FLAC__stream_encoder_set_streamable_subset(
+      encoder, spec->bits_per_sample <= 24);
+    if (error_r == 0) {
+      FLAC__stream_encoder_set_metadata(encoder, &seek_table, 1);
+    }
+
+    FLAC__StreamEncoderInitStatus status = error_r == 0 ?
+      FLAC__stream_encoder_init_file(encoder, file_path, NULL, NULL) :
+      FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR;
+    if (error_r == 0 && status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+      log_error(
+        "CORPUS: FLAC encoder init: %s",
+        FLAC__StreamEncoderInitStatusString[status]);
+      error_r = status == FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR
+        ? EIO : ENOTSUP;
+    }
+
+    while (error_r == 0 && generator->position < spec->samples_count) {
+      size_t count = pcm_corpus_generate(generator);
+      if (!FLAC__stream_encoder_process_interleaved(
+        encoder, generator->samples, count)) {
+          FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(
+            encoder);
+          log_error(
+            "CORPUS: FLAC encoding: %s",
+            FLAC__StreamEncoderStateString[state]);
+          error_r = EIO;
+        }
+    }
+
+    if (status == FLAC__STREAM_ENCODER_INIT_STATUS_OK
+      && !FLAC__stream_encoder_finish(encoder)
+      && error_r == 0) {
+        log_error("CORPUS: FLAC encoder cannot finish the file");
+        error_r = EIO;
+      }
+    FLAC__stream_encoder_delete(encoder);
+    if (seek_table != NULL) {
+      FLAC__metadata_object_delete(seek_table);
+    }
+    return error_r;
+  }
+
+error_t
+pcm_corpus_write(
+  const char *file_path,
+  enum pcm_format format,
+  enum pcm_corpus_signal signal,
+  unsigned int seed,
+  const struct pcm_spec *spec) {
+    assert(file_path != NULL);
+    assert(spec != NULL);
+    log_verbose("Writing corpus file [%s]", file_path);
+    pcm_spec_log("CORPUS", spec);
+
+    if (spec->bits_per_sample < 8
+      || spec->bits_per_sample > 32
+      || spec->bits_per_sample % 8 != 0
+      || spec->channels_count == 0
+      || spec->samples_per_sec == 0) {
+        log_error("CORPUS: Invalid PCM spec");
+        return EINVAL;
+      }
+
+    // FLAC samples are always signed, WAV ones above 8 bits
+    struct pcm_spec file_spec = *spec;
+    file_spec.is_signed = format == pcm_format_flac
+      || spec->bits_per_sample > 8;
+
+    struct pcm_corpus_generator generator;
+    error_t error_r = pcm_corpus_generator_init(
+      signal, seed, &file_spec, &generator);
+    if (error_r == 0) {
+      switch (format) {
+        case pcm_format_wav:
+          error_r = pcm_corpus_write_wav(file_path, &generator);
+          break;
+        case pcm_format_flac:
+          error_r = pcm_corpus_write_flac(file_path, &generator);
+          break;
+      }
+    }
+    free(generator.samples);
+    return error_r;
+  }
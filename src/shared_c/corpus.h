@@ -0,0 +1,41 @@
+#ifndef PLAYER_CORPUS_H_
+#define PLAYER_CORPUS_H_
+
+#include "pcm.h"
+
+/**
+ * @brief Content of synthesized files
+ *
+ * Sine is 110Hz times channel number, noise is uniform white noise.
+ * Both are at half of the full scale.
+ */
+enum pcm_corpus_signal {
+  pcm_corpus_signal_sine    = 1,
+  pcm_corpus_signal_noise   = 2,
+};
+
+error_t
+pcm_corpus_guess_signal(
+  const char *name,
+  enum pcm_corpus_signal *signal);
+
+const char*
+pcm_corpus_signal_name(enum pcm_corpus_signal signal);
+
+/**
+ * @brief Synthesize file of spec->samples_count frames.
+ *
+ * WAV is RIFX if spec->is_big_endian, 8 bit WAV is unsigned.
+ * Content depends only on the arguments, so that it can be generated again
+ * instead of being stored. ENOTSUP is returned for specs which cannot be
+ * stored in the given format, i.e. WAV over 4GB.
+ */
+error_t
+pcm_corpus_write(
+  const char *file_path,
+  enum pcm_format format,
+  enum pcm_corpus_signal signal,
+  unsigned int seed,
+  const struct pcm_spec *spec);
+
+#endif
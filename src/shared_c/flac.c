@@ -3,12 +3,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include "flac.h"
+#include "pcm_pack.h"
+
+// frame and subframe headers, CRC and padding of verbatim frame
+#define FLAC_MAX_FRAME_OVERHEAD 64
 
 struct pcm_decoder_flac {
   struct pcm_decoder base;
   FLAC__StreamDecoder *flac_decoder;
+  bool is_finished;
 };
 
+/**
+ * Verbatim frame is the largest, side channel has one more bit per sample.
+ */
+static size_t
+flac_max_frame_size(const FLAC__StreamMetadata_StreamInfo *info) {
+  if (info->max_framesize > 0) {
+    return info->max_framesize;
+  }
+  return (size_t)info->max_blocksize * info->channels
+    * (info->bits_per_sample + 1) / 8
+    + FLAC_MAX_FRAME_OVERHEAD;
+}
+
 static void
 metadata_callback(
   const FLAC__StreamDecoder *flac_decoder,
@@ -27,8 +45,19 @@ metadata_callback(
       spec->samples_per_sec = info->sample_rate;
       spec->samples_count = info->total_samples;
       spec->is_big_endian = false;
-      spec->is_signed = spec->bits_per_sample > 8;
+      // FLAC samples are always signed, 8 bit ones included
+      spec->is_signed = true;
       decoder->base.block_size = info->max_blocksize * pcm_frame_size(spec);
+      decoder->base.min_decode_size = flac_max_frame_size(info);
+    } else if (metadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+      const FLAC__StreamMetadata_VorbisComment *comments =
+        &metadata->data.vorbis_comment;
+      for (FLAC__uint32 i = 0; i < comments->num_comments; ++i) {
+        pcm_replay_gain_parse_comment(
+          &decoder->base.replay_gain,
+          (const char*)comments->comments[i].entry,
+          comments->comments[i].length);
+      }
     }
   }
 
@@ -50,7 +79,7 @@ read_callback(
         src, sizeof(FLAC__byte), &data, *bytes);
 
       if (read_count == 0 && *bytes > 0) {
-        // this is likely reading of metadata
+        // metadata and seeking, frames are decoded only once buffered
         error_t error_r = EAGAIN;
         while (error_r == EAGAIN) {
           error_r = io_rf_stream_read_with_poll(src, -1);
@@ -80,6 +109,69 @@ read_callback(
       }
     }
 
+static FLAC__StreamDecoderSeekStatus
+seek_callback(
+  const FLAC__StreamDecoder *flac_decoder,
+  FLAC__uint64 absolute_byte_offset,
+  void *client_data) {
+    UNUSED(flac_decoder);
+    assert(client_data != NULL);
+    struct pcm_decoder_flac *decoder = (struct pcm_decoder_flac*)client_data;
+
+    error_t error_r = io_rf_stream_seek(
+      decoder->base.src, absolute_byte_offset);
+    if (error_r == ESPIPE) {
+      return FLAC__STREAM_DECODER_SEEK_STATUS_UNSUPPORTED;
+    }
+    return error_r == 0 ?
+      FLAC__STREAM_DECODER_SEEK_STATUS_OK :
+      FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+  }
+
+static FLAC__StreamDecoderTellStatus
+tell_callback(
+  const FLAC__StreamDecoder *flac_decoder,
+  FLAC__uint64 *absolute_byte_offset,
+  void *client_data) {
+    UNUSED(flac_decoder);
+    assert(absolute_byte_offset != NULL);
+    assert(client_data != NULL);
+    struct pcm_decoder_flac *decoder = (struct pcm_decoder_flac*)client_data;
+    *absolute_byte_offset = io_rf_stream_get_position(decoder->base.src);
+    return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+  }
+
+static FLAC__StreamDecoderLengthStatus
+length_callback(
+  const FLAC__StreamDecoder *flac_decoder,
+  FLAC__uint64 *stream_length,
+  void *client_data) {
+    UNUSED(flac_decoder);
+    assert(stream_length != NULL);
+    assert(client_data != NULL);
+    struct pcm_decoder_flac *decoder = (struct pcm_decoder_flac*)client_data;
+
+    off_t size;
+    error_t error_r = io_rf_stream_get_size(decoder->base.src, &size);
+    if (error_r == ESPIPE) {
+      return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+    } else if (error_r != 0) {
+      return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
+    }
+    *stream_length = size;
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+  }
+
+static FLAC__bool
+eof_callback(
+  const FLAC__StreamDecoder *flac_decoder,
+  void *client_data) {
+    UNUSED(flac_decoder);
+    assert(client_data != NULL);
+    struct pcm_decoder_flac *decoder = (struct pcm_decoder_flac*)client_data;
+    return io_rf_stream_is_empty(decoder->base.src);
+  }
+
 static FLAC__StreamDecoderWriteStatus
 write_callback(
     const FLAC__StreamDecoder *flac_decoder,
@@ -118,17 +210,19 @@ write_callback(
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
       }
 
-      size_t sample_size = header_info->bits_per_sample / 8;
-      for (uint32_t i = 0; i < header_info->blocksize; i++) {
-        for (uint32_t c = 0; c < header_info->channels; c++) {
-          FLAC__int32 sample = buffer[0][i];
-          bool result = io_buffer_try_write(dest, sample_size, &sample);
-          if (!result) {
-            log_error("FLAC: cannot write samples");
-            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-          }
-        }
+      size_t block_size = header_info->blocksize * pcm_frame_size(spec);
+      void *pcm;
+      if (io_buffer_write_begin(dest, block_size, &pcm) < block_size) {
+        log_error("FLAC: cannot write samples");
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
       }
+      pcm_pack_interleave(
+        buffer,
+        header_info->channels,
+        header_info->blocksize,
+        header_info->bits_per_sample / 8,
+        pcm);
+      io_buffer_write_commit(dest, block_size);
       return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
     }
 
@@ -146,23 +240,27 @@ error_callback(
 
 #define LOG_SETUP_ERROR(f, m)  if (!f) log_error(m)
 
+/**
+ * Start decoding from the beginning of the stream, up to the first frame.
+ */
 static error_t
-pcm_validate_flac_content(struct pcm_decoder_flac *decoder) {
-  FLAC__StreamDecoder *flac_decoder = FLAC__stream_decoder_new();
-  if (flac_decoder == NULL) {
-    log_error("FLAC: decoder allocation failed");
-    return EINVAL;
-  }
-
-  decoder->flac_decoder = flac_decoder;
+pcm_init_flac_decoder(struct pcm_decoder_flac *decoder) {
+  FLAC__StreamDecoder *flac_decoder = decoder->flac_decoder;
+  // settings are reset by finish
   LOG_SETUP_ERROR(
     FLAC__stream_decoder_set_md5_checking(flac_decoder, true),
     "FLAC: Setting up md5 checking failed");
+  // ReplayGain tags
+  LOG_SETUP_ERROR(
+    FLAC__stream_decoder_set_metadata_respond(
+      flac_decoder, FLAC__METADATA_TYPE_VORBIS_COMMENT),
+    "FLAC: Setting up Vorbis comment reading failed");
 
+  // seeking uses SEEKTABLE if there is any, md5 is not checked after it
   FLAC__StreamDecoderInitStatus status = FLAC__stream_decoder_init_stream(
     flac_decoder,
     read_callback,
-    NULL, NULL, NULL, NULL,
+    seek_callback, tell_callback, length_callback, eof_callback,
     write_callback, metadata_callback, error_callback,
     (void*)decoder); // NOLINT
 
@@ -181,16 +279,33 @@ pcm_validate_flac_content(struct pcm_decoder_flac *decoder) {
       FLAC__StreamDecoderStateString[state]);
     return EINVAL;
   }
-
-  pcm_spec_log("FLAC", &decoder->base.spec);
+  decoder->is_finished = false;
   return 0;
 }
 
+static error_t
+pcm_validate_flac_content(struct pcm_decoder_flac *decoder) {
+  decoder->flac_decoder = FLAC__stream_decoder_new();
+  if (decoder->flac_decoder == NULL) {
+    log_error("FLAC: decoder allocation failed");
+    return EINVAL;
+  }
+
+  error_t error_r = pcm_init_flac_decoder(decoder);
+  if (error_r == 0) {
+    pcm_spec_log("FLAC", &decoder->base.spec);
+  }
+  return error_r;
+}
+
 static error_t
 pcm_decoder_flac_decode_once(struct pcm_decoder *handler) {
   assert(handler != NULL);
-  assert(io_rf_stream_get_unread_buffer_size(handler->src) > 0);
   assert(!io_buffer_is_full(&handler->dest));
+  if (!pcm_decoder_is_source_buffer_ready_to_read(handler)) {
+    // libFLAC would wait in read_callback for the rest of the frame
+    return EAGAIN;
+  }
 
   struct pcm_decoder_flac *decoder = (struct pcm_decoder_flac*)handler;
   if (!FLAC__stream_decoder_process_single(decoder->flac_decoder)) {
@@ -198,6 +313,7 @@ pcm_decoder_flac_decode_once(struct pcm_decoder *handler) {
       decoder->flac_decoder);
     if (state == FLAC__STREAM_DECODER_END_OF_STREAM) {
       assert(io_rf_stream_is_eof(handler->src));
+      decoder->is_finished = true;
       if (!FLAC__stream_decoder_finish(decoder->flac_decoder)) {
         log_error("FLAC: there is an issue with MD5 signature");
       }
@@ -211,6 +327,39 @@ pcm_decoder_flac_decode_once(struct pcm_decoder *handler) {
   return 0;
 }
 
+/**
+ * Target frame is decoded right away, samples before the target are dropped.
+ */
+static error_t
+pcm_decoder_flac_seek(struct pcm_decoder *handler, size_t frame) {
+  assert(handler != NULL);
+  struct pcm_decoder_flac *decoder = (struct pcm_decoder_flac*)handler;
+  error_t error_r = 0;
+  if (decoder->is_finished) {
+    // finished decoder is uninitialized, start it over
+    error_r = io_rf_stream_seek(handler->src, 0);
+    if (error_r == 0) {
+      error_r = pcm_init_flac_decoder(decoder);
+    }
+  }
+
+  if (error_r == 0
+    && !FLAC__stream_decoder_seek_absolute(decoder->flac_decoder, frame)) {
+      FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(
+        decoder->flac_decoder);
+      log_error(
+        "FLAC: seeking to frame %lu: %s",
+        frame,
+        FLAC__StreamDecoderStateString[state]);
+      if (state == FLAC__STREAM_DECODER_SEEK_ERROR) {
+        // decoder has to be flushed before it can be used again
+        FLAC__stream_decoder_flush(decoder->flac_decoder);
+      }
+      error_r = EIO;
+    }
+  return error_r;
+}
+
 static void
 pcm_decoder_flac_release(struct pcm_decoder **handler) {
   assert(handler != NULL);
@@ -252,6 +401,7 @@ pcm_decoder_flac_open(
     }
     if (error_r == 0) {
       result->base.decode_once = &pcm_decoder_flac_decode_once;
+      result->base.seek = &pcm_decoder_flac_seek;
       result->base.release = &pcm_decoder_flac_release;
       *decoder = (struct pcm_decoder*)result;
     } else {
@@ -259,3 +409,20 @@ pcm_decoder_flac_open(
     }
     return error_r;
   }
+
+error_t
+pcm_flac_read_spec(struct io_rf_stream *src, struct pcm_spec *spec) {
+  assert(src != NULL);
+  assert(spec != NULL);
+  struct pcm_decoder_flac decoder = { 0 };
+  decoder.base.src = src;
+  error_t error_r = pcm_validate_flac_content(&decoder);
+  if (error_r == 0) {
+    *spec = decoder.base.spec;
+  }
+  if (decoder.flac_decoder != NULL) {
+    // nothing has been decoded, MD5 signature cannot match
+    FLAC__stream_decoder_delete(decoder.flac_decoder);
+  }
+  return error_r;
+}
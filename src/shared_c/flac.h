@@ -13,4 +13,10 @@ pcm_decoder_flac_open(
   size_t buffer_size,
   struct pcm_decoder **decoder);
 
+/**
+ * @brief Read FLAC metadata only, no frame is decoded.
+ */
+error_t
+pcm_flac_read_spec(struct io_rf_stream *src, struct pcm_spec *spec);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "histogram.h"
+#include "log.h"
+
+// each power of two is split into 2^HISTOGRAM_SUB_BITS buckets
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS_COUNT \
+  ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+struct histogram {
+  atomic_ulong count;
+  atomic_ulong sum;
+  atomic_ulong min;
+  atomic_ulong max;
+  atomic_ulong buckets[HISTOGRAM_BUCKETS_COUNT];
+};
+
+static inline size_t
+histogram_get_index(unsigned long value) {
+  if (value < HISTOGRAM_SUB_COUNT) {
+    return value;
+  }
+  unsigned int msb = 8 * sizeof(unsigned long) - 1 - __builtin_clzl(value);
+  unsigned int shift = msb - HISTOGRAM_SUB_BITS;
+  return (shift + 1) * HISTOGRAM_SUB_COUNT
+    + ((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+static inline unsigned long
+histogram_get_lowest_value(size_t index) {
+  if (index < HISTOGRAM_SUB_COUNT) {
+    return index;
+  }
+  unsigned int shift = index / HISTOGRAM_SUB_COUNT - 1;
+  unsigned long sub = index % HISTOGRAM_SUB_COUNT;
+  return (HISTOGRAM_SUB_COUNT + sub) << shift;
+}
+
+error_t
+histogram_alloc(struct histogram **result) {
+  assert(result != NULL);
+  struct histogram *histogram = malloc(sizeof(struct histogram));
+  if (histogram == NULL) {
+    log_error("HISTOGRAM: Insufficient memory for 'histogram'");
+    return ENOMEM;
+  }
+  atomic_init(&histogram->count, 0);
+  atomic_init(&histogram->sum, 0);
+  atomic_init(&histogram->min, ULONG_MAX);
+  atomic_init(&histogram->max, 0);
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS_COUNT; ++i) {
+    atomic_init(&histogram->buckets[i], 0);
+  }
+  *result = histogram;
+  return 0;
+}
+
+void
+histogram_free(struct histogram **histogram) {
+  assert(histogram != NULL);
+  free(*histogram);
+  *histogram = NULL;
+}
+
+void
+histogram_record(struct histogram *histogram, unsigned long value) {
+  assert(histogram != NULL);
+  atomic_fetch_add_explicit(
+    &histogram->buckets[histogram_get_index(value)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+  unsigned long min = atomic_load_explicit(
+    &histogram->min, memory_order_relaxed);
+  while (value < min && !atomic_compare_exchange_weak_explicit(
+    &histogram->min, &min, value,
+    memory_order_relaxed, memory_order_relaxed)) {
+  }
+  unsigned long max = atomic_load_explicit(
+    &histogram->max, memory_order_relaxed);
+  while (value > max && !atomic_compare_exchange_weak_explicit(
+    &histogram->max, &max, value,
+    memory_order_relaxed, memory_order_relaxed)) {
+  }
+  // counted last, so that readers rarely see more values than buckets have
+  atomic_fetch_add_explicit(&histogram->count, 1, memory_order_release);
+}
+
+unsigned long
+histogram_get_percentile(
+  const struct histogram *histogram,
+  unsigned int per_mille) {
+    assert(histogram != NULL);
+    assert(per_mille <= 1000);
+    unsigned long count = atomic_load_explicit(
+      &histogram->count, memory_order_acquire);
+    if (count == 0) {
+      return 0;
+    }
+
+    // rounded up, so that the top value is reached for 1000
+    unsigned long expected = (count * per_mille + 999) / 1000;
+    unsigned long seen = 0;
+    unsigned long min = atomic_load_explicit(
+      &histogram->min, memory_order_relaxed);
+    unsigned long max = atomic_load_explicit(
+      &histogram->max, memory_order_relaxed);
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS_COUNT; ++i) {
+      seen += atomic_load_explicit(
+        &histogram->buckets[i], memory_order_relaxed);
+      if (seen >= expected && seen > 0) {
+        // bucket may start below min, i.e. if all values are the same
+        unsigned long value = histogram_get_lowest_value(i);
+        return value < min ? min : value > max ? max : value;
+      }
+    }
+    return max;
+  }
+
+void
+histogram_get_summary(
+  const struct histogram *histogram,
+  struct histogram_summary *result) {
+    assert(histogram != NULL);
+    assert(result != NULL);
+    *result = (struct histogram_summary) { 0 };
+    result->count = atomic_load_explicit(
+      &histogram->count, memory_order_acquire);
+    if (result->count > 0) {
+      result->min = atomic_load(&histogram->min);
+      result->max = atomic_load(&histogram->max);
+      result->avg = atomic_load(&histogram->sum) / result->count;
+      result->p50 = histogram_get_percentile(histogram, 500);
+      result->p90 = histogram_get_percentile(histogram, 900);
+      result->p99 = histogram_get_percentile(histogram, 990);
+      result->p999 = histogram_get_percentile(histogram, 999);
+    }
+  }
+
+void
+histogram_log(
+  const char *name,
+  const char *unit,
+  const struct histogram *histogram) {
+    struct histogram_summary summary;
+    histogram_get_summary(histogram, &summary);
+    if (summary.count > 0) {
+      log_verbose(
+        "%s [%s]: count %lu, min %lu, avg %lu, max %lu, "
+        "p50 %lu, p90 %lu, p99 %lu, p99.9 %lu",
+        name,
+        unit,
+        summary.count,
+        summary.min,
+        summary.avg,
+        summary.max,
+        summary.p50,
+        summary.p90,
+        summary.p99,
+        summary.p999);
+    }
+  }
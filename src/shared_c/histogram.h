@@ -0,0 +1,60 @@
+#ifndef PLAYER_HISTOGRAM_H_
+#define PLAYER_HISTOGRAM_H_
+
+#include "shrdef.h"
+
+/**
+ * @brief HDR-style histogram of unsigned values
+ *
+ * Buckets are exact below 8 and within 1/8 of the value above it,
+ * so that the whole 64 bit range fits into fixed memory.
+ * Values can be recorded from any thread without locking, counters are
+ * read one by one, so that snapshot taken during recording can be
+ * slightly inconsistent.
+ */
+struct histogram;
+
+struct histogram_summary {
+  unsigned long count;
+  unsigned long min;
+  unsigned long avg;
+  unsigned long max;
+  unsigned long p50;
+  unsigned long p90;
+  unsigned long p99;
+  unsigned long p999;
+};
+
+error_t
+histogram_alloc(struct histogram **result);
+
+void
+histogram_free(struct histogram **histogram);
+
+void
+histogram_record(struct histogram *histogram, unsigned long value);
+
+/**
+ * @brief Lowest value of the bucket, which has at least per_mille
+ * of recorded values at or below it, clamped to recorded min and max.
+ */
+unsigned long
+histogram_get_percentile(
+  const struct histogram *histogram,
+  unsigned int per_mille);
+
+void
+histogram_get_summary(
+  const struct histogram *histogram,
+  struct histogram_summary *result);
+
+/**
+ * @brief Verbose log line with summary of given histogram
+ */
+void
+histogram_log(
+  const char *name,
+  const char *unit,
+  const struct histogram *histogram);
+
+#endif
@@ -1,7 +1,9 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,9 +13,13 @@
 #include "io.h"
 #include "log.h"
 #include "timer.h"
+#include "uring.h"
 
 #define LAST_IO_ERROR errno != 0 ? errno : EIO
 
+#define IO_RF_STREAM_MAP_WINDOW_SIZE \
+  (sizeof(size_t) > 4 ? ((size_t)1 << 32) : ((size_t)1 << 28))
+
 const char*
 get_filename_ext(const char *file_name) {
   assert(file_name != NULL);
@@ -24,18 +30,42 @@ get_filename_ext(const char *file_name) {
     return dot + 1;
 }
 
-error_t
-io_buffer_alloc(
+// real-time mode: buffers are faulted in and locked when allocated
+static atomic_bool io_is_memory_locked = false;
+
+void
+io_buffer_set_memory_locked(bool value) {
+  atomic_store(&io_is_memory_locked, value);
+}
+
+static inline int
+io_buffer_get_populate_flag() {
+  return atomic_load(&io_is_memory_locked) ? MAP_POPULATE : 0;
+}
+
+/**
+ * Keep pages of populated mapping in RAM, buffer still works
+ * if it cannot be locked.
+ */
+static void
+io_buffer_lock_mapping(void *data, size_t size) {
+  if (atomic_load(&io_is_memory_locked) && mlock(data, size) != 0) {
+    log_error(
+      "Cannot lock memory mapping of size %dkB: %s",
+      size / 1024,
+      strerror(errno));
+  }
+}
+
+static error_t
+io_buffer_alloc_linear(
   size_t size,
   struct io_buffer *result) {
-    assert(result != NULL);
-    assert(result->data == NULL);
-
     void* mem_range = mmap(
       NULL,
       size,
       PROT_READ | PROT_WRITE,
-      MAP_PRIVATE | MAP_ANONYMOUS,
+      MAP_PRIVATE | MAP_ANONYMOUS | io_buffer_get_populate_flag(),
       0, 0);
 
     if (mem_range == MAP_FAILED) {
@@ -49,14 +79,115 @@ io_buffer_alloc(
         size / 1024,
         (unsigned long)mem_range);
     }
+    io_buffer_lock_mapping(mem_range, size);
 
     result->size_allocated = size;
     result->size_used = 0;
     result->start_offset = 0;
+    result->is_ring = false;
     result->data = mem_range;
     return 0;
   }
 
+/**
+ * Map the same memfd pages twice into one reserved address range,
+ * so that [data, data + 2 * size) is a contiguous view of the ring.
+ */
+static error_t
+io_buffer_alloc_mirrored(
+  size_t size,
+  struct io_buffer *result) {
+    error_t error_r = 0;
+    int fd = memfd_create("io_buffer", MFD_CLOEXEC);
+    if (fd == -1) {
+      return errno;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+      error_r = errno;
+    }
+
+    void *mem_range = MAP_FAILED;
+    if (error_r == 0) {
+      mem_range = mmap(
+        NULL,
+        2 * size,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+      if (mem_range == MAP_FAILED) {
+        error_r = errno;
+      }
+    }
+
+    for (int i = 0; error_r == 0 && i < 2; i++) {
+      void *mirror = mmap(
+        (char*)mem_range + i * size, // NOLINT
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED | io_buffer_get_populate_flag(),
+        fd, 0);
+      if (mirror == MAP_FAILED) {
+        error_r = errno;
+      }
+    }
+
+    if (error_r != 0 && mem_range != MAP_FAILED) {
+      munmap(mem_range, 2 * size);
+    }
+    // mappings keep the memory alive
+    close(fd);
+
+    if (error_r == 0) {
+      log_verbose(
+        "Allocated %dkB of ring memory mapping starting at %x",
+        size / 1024,
+        (unsigned long)mem_range);
+      io_buffer_lock_mapping(mem_range, 2 * size);
+
+      result->size_allocated = size;
+      result->size_used = 0;
+      result->start_offset = 0;
+      result->is_ring = true;
+      result->data = mem_range;
+    }
+    return error_r;
+  }
+
+error_t
+io_buffer_alloc_ring(
+  size_t size,
+  struct io_buffer *result) {
+    assert(result != NULL);
+    assert(result->data == NULL);
+    assert(size > 0);
+
+    size_t page_size = getpagesize();
+    size = (size + page_size - 1) / page_size * page_size;
+    error_t error_r = io_buffer_alloc_mirrored(size, result);
+    if (error_r != 0) {
+      log_verbose(
+        "Ring memory mapping is not available (%s), using linear one",
+        strerror(error_r));
+      error_r = io_buffer_alloc_linear(size, result);
+    }
+    return error_r;
+  }
+
+error_t
+io_buffer_alloc(
+  size_t size,
+  struct io_buffer *result) {
+    assert(result != NULL);
+    assert(result->data == NULL);
+
+    if (size > 0 && size % getpagesize() == 0) {
+      return io_buffer_alloc_ring(size, result);
+    } else {
+      return io_buffer_alloc_linear(size, result);
+    }
+  }
+
 inline static void*
 io_buffer_data_start_read(struct io_buffer *src) {
   return (char*)src->data + src->start_offset; // NOLINT
@@ -67,9 +198,27 @@ io_buffer_data_start_write(struct io_buffer *src) {
   return (char*)src->data + src->size_used; // NOLINT
 }
 
+inline static size_t
+io_buffer_get_write_space(const struct io_buffer *src) {
+  // ring wraps around its mirror, linear buffer ends with the allocation
+  return src->is_ring ?
+    io_buffer_get_available_size(src) :
+    src->size_allocated - src->size_used;
+}
+
+inline static void
+io_buffer_seek_read(struct io_buffer *src, size_t size) {
+  src->start_offset += size;
+  if (src->is_ring && src->start_offset >= src->size_allocated) {
+    // move back from the mirror, this is the same memory
+    src->start_offset -= src->size_allocated;
+    src->size_used -= src->size_allocated;
+  }
+}
+
 static void
 io_buffer_no_padding(struct io_buffer *src) {
-  if (src->start_offset > 0) {
+  if (!src->is_ring && src->start_offset > 0) {
     size_t unread_size = io_buffer_get_unread_size(src);
     memmove(
       src->data,
@@ -91,7 +240,7 @@ io_buffer_try_write(
     if (remaining < item_size) {
       return false;
     } else {
-      if (dest->size_allocated - dest->size_used < item_size) {
+      if (io_buffer_get_write_space(dest) < item_size) {
         io_buffer_no_padding(dest);
       }
       memcpy(
@@ -103,6 +252,29 @@ io_buffer_try_write(
     }
   }
 
+size_t
+io_buffer_write_begin(
+  struct io_buffer *dest,
+  size_t min_size,
+  void **result) {
+    assert(dest != NULL);
+    assert(result != NULL);
+    if (io_buffer_get_write_space(dest) < min_size) {
+      io_buffer_no_padding(dest);
+    }
+    *result = io_buffer_data_start_write(dest);
+    return io_buffer_get_write_space(dest);
+  }
+
+void
+io_buffer_write_commit(
+  struct io_buffer *dest,
+  size_t size) {
+    assert(dest != NULL);
+    assert(size <= io_buffer_get_write_space(dest));
+    dest->size_used += size;
+  }
+
 bool
 io_buffer_try_read(
   struct io_buffer *src,
@@ -112,7 +284,7 @@ io_buffer_try_read(
     size_t available = io_buffer_get_unread_size(src);
     if (available >= item_size) {
       *result = io_buffer_data_start_read(src),
-      src->start_offset += item_size;
+      io_buffer_seek_read(src, item_size);
       return true;
     } else {
       return false;
@@ -131,7 +303,7 @@ io_buffer_read_array(
     size_t items_count = min_size_t(max_count, available / item_size);
     if (items_count > 0) {
       *result = io_buffer_data_start_read(src),
-      src->start_offset += items_count * item_size;
+      io_buffer_seek_read(src, items_count * item_size);
     }
     return items_count;
   }
@@ -144,7 +316,7 @@ io_buffer_array_seek(
     assert(src != NULL);
     size_t seek_size = items_count * item_size;
     assert(seek_size <= io_buffer_get_unread_size(src));
-    src->start_offset += seek_size;
+    io_buffer_seek_read(src, seek_size);
   }
 
 void
@@ -164,7 +336,9 @@ void
 io_buffer_free(struct io_buffer* result) {
   assert(result != NULL);
   if (result->data != NULL) {
-    if (munmap(result->data, result->size_allocated) != 0) {
+    size_t mapping_size = result->is_ring ?
+      2 * result->size_allocated : result->size_allocated;
+    if (munmap(result->data, mapping_size) != 0) {
       log_error(
         "Cannot release memory mapping starting at %x due to",
         (unsigned long)result->data,
@@ -176,11 +350,176 @@ io_buffer_free(struct io_buffer* result) {
       result->size_allocated = 0;
       result->size_used = 0;
       result->start_offset = 0;
+      result->is_ring = false;
       result->data = NULL;
     }
   }
 }
 
+struct io_spsc_buffer {
+  struct io_buffer buffer;
+  // positions are only growing, both are taken modulo buffer size
+  _Atomic size_t write_position;
+  _Atomic size_t read_position;
+};
+
+static size_t
+gcd_size_t(size_t a, size_t b) {
+  while (b != 0) {
+    size_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+error_t
+io_spsc_buffer_alloc(
+  size_t size,
+  size_t item_size,
+  struct io_spsc_buffer **result) {
+    assert(result != NULL);
+    assert(item_size > 0);
+    struct io_spsc_buffer *spsc = calloc(1, sizeof(struct io_spsc_buffer));
+    if (spsc == NULL) {
+      log_error("Out of memory for allocating spsc buffer");
+      return ENOMEM;
+    }
+
+    // linear fallback splits regions at its end, it must not split items
+    size_t page_size = getpagesize();
+    size_t unit = item_size / gcd_size_t(item_size, page_size) * page_size;
+    size = (max_size_t(size, 1) + unit - 1) / unit * unit;
+    error_t error_r = io_buffer_alloc_ring(size, &spsc->buffer);
+    if (error_r == 0) {
+      atomic_init(&spsc->write_position, 0);
+      atomic_init(&spsc->read_position, 0);
+      *result = spsc;
+    } else {
+      free(spsc);
+    }
+    return error_r;
+  }
+
+size_t
+io_spsc_buffer_get_allocated_size(const struct io_spsc_buffer *src) {
+  assert(src != NULL);
+  return src->buffer.size_allocated;
+}
+
+size_t
+io_spsc_buffer_get_unread_size(const struct io_spsc_buffer *src) {
+  assert(src != NULL);
+  size_t read_position = atomic_load_explicit(
+    &src->read_position, memory_order_relaxed);
+  size_t write_position = atomic_load_explicit(
+    &src->write_position, memory_order_relaxed);
+  return write_position - read_position;
+}
+
+/**
+ * Contiguous part of the region, ring mapping is contiguous as a whole.
+ */
+inline static size_t
+io_spsc_buffer_contiguous(
+  const struct io_spsc_buffer *src,
+  size_t offset,
+  size_t size) {
+    return src->buffer.is_ring ?
+      size : min_size_t(size, src->buffer.size_allocated - offset);
+  }
+
+size_t
+io_spsc_buffer_write_begin(
+  struct io_spsc_buffer *dest,
+  void **result) {
+    assert(dest != NULL);
+    assert(result != NULL);
+    size_t write_position = atomic_load_explicit(
+      &dest->write_position, memory_order_relaxed);
+    size_t read_position = atomic_load_explicit(
+      &dest->read_position, memory_order_acquire);
+
+    size_t offset = write_position % dest->buffer.size_allocated;
+    *result = (char*)dest->buffer.data + offset; // NOLINT
+    return io_spsc_buffer_contiguous(
+      dest,
+      offset,
+      dest->buffer.size_allocated - (write_position - read_position));
+  }
+
+void
+io_spsc_buffer_write_commit(
+  struct io_spsc_buffer *dest,
+  size_t size) {
+    assert(dest != NULL);
+    atomic_fetch_add_explicit(&dest->write_position, size, memory_order_release);
+  }
+
+size_t
+io_spsc_buffer_read_begin(
+  struct io_spsc_buffer *src,
+  void **result) {
+    assert(src != NULL);
+    assert(result != NULL);
+    size_t read_position = atomic_load_explicit(
+      &src->read_position, memory_order_relaxed);
+    size_t write_position = atomic_load_explicit(
+      &src->write_position, memory_order_acquire);
+
+    size_t offset = read_position % src->buffer.size_allocated;
+    *result = (char*)src->buffer.data + offset; // NOLINT
+    return io_spsc_buffer_contiguous(
+      src,
+      offset,
+      write_position - read_position);
+  }
+
+void
+io_spsc_buffer_read_commit(
+  struct io_spsc_buffer *src,
+  size_t size) {
+    assert(src != NULL);
+    assert(size <= io_spsc_buffer_get_unread_size(src));
+    atomic_fetch_add_explicit(&src->read_position, size, memory_order_release);
+  }
+
+void
+io_spsc_buffer_free(struct io_spsc_buffer **src) {
+  assert(src != NULL);
+  if (*src != NULL) {
+    io_buffer_free(&(*src)->buffer);
+    free(*src);
+    *src = NULL;
+  }
+}
+
+void
+io_stream_statistics_add_read(
+  struct io_stream_statistics *stats,
+  const struct timespec latency) {
+    assert(stats != NULL);
+    stats->reads_count++;
+    stats->read_latency_total = timespec_add(
+      stats->read_latency_total, latency);
+    if (timespec_is_greater(latency, stats->read_latency_max)) {
+      stats->read_latency_max = latency;
+    }
+  }
+
+void
+io_stream_statistics_add_seek(
+  struct io_stream_statistics *stats,
+  const struct timespec latency) {
+    assert(stats != NULL);
+    stats->seeks_count++;
+    stats->seek_latency_total = timespec_add(
+      stats->seek_latency_total, latency);
+    if (timespec_is_greater(latency, stats->seek_latency_max)) {
+      stats->seek_latency_max = latency;
+    }
+  }
+
 error_t
 io_buffer_write_from_read(
   struct io_buffer *dest,
@@ -193,10 +532,10 @@ io_buffer_write_from_read(
     assert(fd != -1);
     assert(is_eof != NULL);
 
-    if (dest->size_allocated == dest->size_used) {
+    if (io_buffer_get_write_space(dest) == 0) {
       io_buffer_no_padding(dest);
     }
-    assert(dest->size_allocated > dest->size_used);
+    assert(io_buffer_get_write_space(dest) > 0);
 
     struct timespec wait_start;
     if (stats != NULL) {
@@ -204,13 +543,15 @@ io_buffer_write_from_read(
     }
     size_t read_size = min_size_t(
       max_read_size,
-      dest->size_allocated - dest->size_used);
+      io_buffer_get_write_space(dest));
     ssize_t read_count = read(
       fd,
       io_buffer_data_start_write(dest),
       read_size);
     if (stats != NULL) {
-      timer_add_elapsed(&stats->reading_time, wait_start);
+      struct timespec latency = timer_elapsed(wait_start);
+      stats->reading_time = timespec_add(stats->reading_time, latency);
+      io_stream_statistics_add_read(stats, latency);
     }
 
     if (read_count < 0) {
@@ -227,15 +568,17 @@ io_buffer_write_from_read(
     }
   }
 
-static void
+error_t
 io_rf_stream_enable_stats(struct io_rf_stream *src)  {
   assert(src != NULL);
   if (src->stats == NULL) {
     src->stats = calloc(1, sizeof(struct io_stream_statistics));
     if (src->stats == NULL) {
       log_error("Out of memory for allocating rf_stream stats");
+      return ENOMEM;
     }
   }
+  return 0;
 }
 
 error_t
@@ -283,8 +626,44 @@ io_rf_stream_open_file(
     return error_r;
   }
 
+error_t
+io_rf_stream_open_file_view(
+  const char *file_path,
+  void *buffer_data,
+  size_t buffer_size,
+  size_t buffer_max_single_read_size,
+  struct io_rf_stream *result) {
+    assert(result != NULL);
+    assert(result->name == NULL);
+
+    result->fd = open(file_path, O_RDONLY | O_NONBLOCK);
+    if (result->fd == -1) {
+      error_t error_r = errno;
+      log_error("Cannot open file [%s]", file_path);
+      return error_r;
+    }
+
+    result->name = strdup(file_path);
+    if (result->name == NULL) {
+      close(result->fd);
+      result->fd = -1;
+      return ENOMEM;
+    }
+
+    io_buffer_init_view(buffer_data, buffer_size, &result->buffer);
+    result->is_buffer_view = true;
+    result->buffer_max_single_read_size = buffer_max_single_read_size;
+    if (log_is_verbose()) {
+      io_rf_stream_enable_stats(result);
+    }
+    return 0;
+  }
+
 static void
 io_rf_stream_close_fd(struct io_rf_stream *result) {
+  if (result->uring != NULL) {
+    io_rf_uring_release(&result->uring);
+  }
   if (close(result->fd) == -1) {
     log_error(
       "Error when closing rf_stream [%s]",
@@ -294,15 +673,214 @@ io_rf_stream_close_fd(struct io_rf_stream *result) {
   result->fd = -1;
 }
 
+/**
+ * Replace current mapping with the one starting at page
+ * containing given file offset.
+ */
+static error_t
+io_rf_stream_map_window(
+  struct io_rf_stream *src,
+  off_t read_offset) {
+    assert(src->fd != -1);
+    assert(read_offset <= src->file_size);
+
+    const off_t page_size = getpagesize();
+    off_t map_offset = read_offset / page_size * page_size;
+    size_t map_size = min_size_t(
+      IO_RF_STREAM_MAP_WINDOW_SIZE,
+      src->file_size - map_offset);
+
+    struct timespec wait_start;
+    if (src->stats != NULL) {
+      timer_start(&wait_start);
+    }
+
+    void *mem_range = NULL;
+    if (map_size > 0) {
+      mem_range = mmap(
+        NULL,
+        map_size,
+        PROT_READ,
+        MAP_PRIVATE,
+        src->fd, map_offset);
+
+      if (mem_range == MAP_FAILED) {
+        log_error(
+          "Cannot map rf_stream [%s] at offset %ld: %s",
+          src->name,
+          (long)map_offset,
+          strerror(errno));
+        return LAST_IO_ERROR;
+      }
+      if (madvise(mem_range, map_size, MADV_SEQUENTIAL) != 0) {
+        // ignore failure, this is only a hint
+        log_verbose(
+          "Sequential access advice for rf_stream [%s] failed: %s",
+          src->name,
+          strerror(errno));
+      }
+    }
+
+    io_buffer_free(&src->buffer);
+    src->buffer.data = mem_range;
+    src->buffer.size_allocated = map_size;
+    src->buffer.size_used = map_size;
+    src->buffer.start_offset = read_offset - map_offset;
+    src->map_offset = map_offset;
+
+    if (src->stats != NULL) {
+      timer_add_elapsed(&src->stats->reading_time, wait_start);
+    }
+    log_verbose(
+      "Mapped %dkB of rf_stream [%s] at offset %ld",
+      map_size / 1024,
+      src->name,
+      (long)map_offset);
+
+    if (map_offset + (off_t)map_size == src->file_size) {
+      log_verbose(
+        "Whole rf_stream [%s] is mapped, closing",
+        src->name);
+      io_rf_stream_close_fd(src);
+    }
+    return 0;
+  }
+
+error_t
+io_rf_stream_open_file_mapped(
+  const char *file_path,
+  size_t buffer_size,
+  size_t buffer_max_single_read_size,
+  struct io_rf_stream *result) {
+    assert(result != NULL);
+    assert(result->name == NULL);
+
+    error_t error_r = 0;
+    result->fd = open(file_path, O_RDONLY);
+    if (result->fd == -1) {
+      log_error("Cannot open file [%s]", file_path);
+      return errno;
+    }
+
+    struct stat file_stat;
+    if (fstat(result->fd, &file_stat) != 0) {
+      error_r = errno;
+    } else if (!S_ISREG(file_stat.st_mode)) {
+      error_r = ENODEV;
+    }
+    if (error_r != 0) {
+      log_verbose(
+        "File [%s] cannot be mapped (%s), reading it instead",
+        file_path,
+        strerror(error_r));
+      io_rf_stream_close_fd(result);
+      return io_rf_stream_open_file(
+        file_path,
+        buffer_size,
+        buffer_max_single_read_size,
+        result);
+    }
+
+    result->name = strdup(file_path);
+    if (result->name == NULL) {
+      error_r = ENOMEM;
+    }
+
+    if (error_r == 0) {
+      result->is_mapped = true;
+      result->file_size = file_stat.st_size;
+      result->buffer_max_single_read_size = buffer_max_single_read_size;
+      if (log_is_verbose()) {
+        io_rf_stream_enable_stats(result);
+      }
+      error_r = io_rf_stream_map_window(result, 0);
+    }
+
+    if (error_r != 0) {
+      io_rf_stream_free(result);
+      if (result->fd != -1) {
+        io_rf_stream_close_fd(result);
+      }
+    }
+    return error_r;
+  }
+
+error_t
+io_rf_stream_enable_uring(
+  struct io_rf_stream *src,
+  unsigned int queue_depth) {
+    assert(src != NULL);
+    assert(src->uring == NULL);
+    assert(queue_depth > 0);
+    if (src->is_mapped || io_rf_stream_is_eof(src)) {
+      // there is nothing to read asynchronously
+      return ENOTSUP;
+    }
+
+    error_t error_r = io_rf_uring_open(src->fd, queue_depth, &src->uring);
+    if (error_r == 0) {
+      src->uring_queue_depth = queue_depth;
+      log_verbose(
+        "Reading rf_stream [%s] via io_uring with queue depth %d",
+        src->name,
+        queue_depth);
+    } else {
+      log_verbose(
+        "io_uring is not available for rf_stream [%s]: %s",
+        src->name,
+        strerror(error_r));
+    }
+    return error_r;
+  }
+
+static error_t
+io_rf_stream_read_uring(
+  struct io_rf_stream *src,
+  int wait_timeout) {
+    bool is_eof;
+    size_t unread_size = io_buffer_get_unread_size(&src->buffer);
+    error_t error_r = io_rf_uring_read(
+      src->uring,
+      &src->buffer,
+      src->buffer_max_single_read_size,
+      wait_timeout,
+      &is_eof,
+      src->stats);
+    src->file_offset += io_buffer_get_unread_size(&src->buffer) - unread_size;
+
+    if (error_r == 0 && is_eof) {
+      log_verbose(
+        "EOF of rf_stream [%s], closing",
+        src->name);
+      io_rf_stream_close_fd(src);
+    } else if (error_r != 0) {
+      log_error(
+        "Got error when reading from rf_stream [%s]: %d",
+        src->name, error_r);
+    }
+    return error_r;
+  }
+
 static error_t
 io_rf_stream_read_once(struct io_rf_stream *src) {
+  if (src->is_mapped) {
+    return io_rf_stream_map_window(
+      src,
+      src->map_offset + src->buffer.start_offset);
+  }
+  if (src->uring != NULL) {
+    return io_rf_stream_read_uring(src, -1);
+  }
+
   bool is_eof;
+  size_t unread_size = io_buffer_get_unread_size(&src->buffer);
   error_t error_r = io_buffer_write_from_read(
     &src->buffer,
     src->buffer_max_single_read_size,
     src->fd,
     &is_eof,
     src->stats);
+  src->file_offset += io_buffer_get_unread_size(&src->buffer) - unread_size;
 
   if (error_r == 0 && is_eof) {
     log_verbose(
@@ -346,11 +924,38 @@ io_rf_stream_read(
     return error_r;
   }
 
+int
+io_rf_stream_get_poll_fd(const struct io_rf_stream *src) {
+  assert(src != NULL);
+  if (io_rf_stream_is_eof(src) || src->is_mapped) {
+    return -1;
+  }
+  if (src->uring != NULL) {
+    return io_rf_uring_get_poll_fd(src->uring);
+  }
+  return src->fd;
+}
+
 error_t
 io_rf_stream_read_with_poll(
   struct io_rf_stream *src,
   int poll_timeout) {
     assert(!io_rf_stream_is_eof(src));
+    if (src->is_mapped) {
+      // page cache is always ready, move window only when half of it is read
+      if (io_buffer_get_unread_size(&src->buffer)
+        < io_buffer_get_allocated_size(&src->buffer) / 2) {
+          return io_rf_stream_read_once(src);
+        }
+      return 0;
+    }
+    if (src->uring != NULL) {
+      // poll is meaningless for regular files, wait only if starving
+      return io_rf_stream_read_uring(
+        src,
+        io_buffer_is_empty(&src->buffer) ? poll_timeout : 0);
+    }
+
     struct pollfd pfd = (struct pollfd) {
       .fd = src->fd,
       .events = POLLIN
@@ -394,16 +999,146 @@ io_rf_stream_read_with_poll(
     return error_r;
   }
 
+error_t
+io_rf_stream_get_size(const struct io_rf_stream *src, off_t *size) {
+  assert(src != NULL);
+  assert(size != NULL);
+  if (src->is_mapped) {
+    *size = src->file_size;
+    return 0;
+  }
+  if (io_rf_stream_is_eof(src)) {
+    // everything has been read
+    *size = src->file_offset;
+    return 0;
+  }
+
+  struct stat file_stat;
+  if (fstat(src->fd, &file_stat) != 0) {
+    return errno;
+  }
+  if (!S_ISREG(file_stat.st_mode)) {
+    return ESPIPE;
+  }
+  *size = file_stat.st_size;
+  return 0;
+}
+
+/**
+ * File is closed on EOF, open it again to read it from other offset.
+ */
+static error_t
+io_rf_stream_reopen_fd(struct io_rf_stream *src) {
+  src->fd = open(
+    src->name,
+    src->is_mapped ? O_RDONLY : O_RDONLY | O_NONBLOCK);
+  if (src->fd == -1) {
+    error_t error_r = errno;
+    log_error(
+      "Cannot reopen rf_stream [%s]: %s",
+      src->name,
+      strerror(error_r));
+    return error_r;
+  }
+  log_verbose("Reopened rf_stream [%s]", src->name);
+  return 0;
+}
+
+static error_t
+io_rf_stream_seek_mapped(struct io_rf_stream *src, off_t offset) {
+  if (offset > src->file_size) {
+    log_error(
+      "Cannot seek rf_stream [%s] beyond its size: %ld",
+      src->name,
+      (long)offset);
+    return EINVAL;
+  }
+  if (offset >= src->map_offset
+    && offset <= src->map_offset + (off_t)src->buffer.size_allocated) {
+      // the whole window stays mapped, reading can go back as well
+      src->buffer.start_offset = offset - src->map_offset;
+      return 0;
+    }
+
+  error_t error_r = 0;
+  if (src->fd == -1) {
+    error_r = io_rf_stream_reopen_fd(src);
+  }
+  if (error_r == 0) {
+    error_r = io_rf_stream_map_window(src, offset);
+  }
+  return error_r;
+}
+
+error_t
+io_rf_stream_seek(struct io_rf_stream *src, off_t offset) {
+  assert(src != NULL);
+  assert(src->name != NULL);
+  assert(offset >= 0);
+  if (src->is_mapped) {
+    return io_rf_stream_seek_mapped(src, offset);
+  }
+
+  off_t position = io_rf_stream_get_position(src);
+  if (offset >= position && offset <= src->file_offset) {
+    // already in the buffer
+    io_buffer_seek_read(&src->buffer, offset - position);
+    return 0;
+  }
+
+  error_t error_r = 0;
+  if (src->fd == -1) {
+    error_r = io_rf_stream_reopen_fd(src);
+  } else if (src->uring != NULL) {
+    // reads in flight are for the old offset
+    io_rf_uring_release(&src->uring);
+  }
+  if (error_r == 0 && lseek(src->fd, offset, SEEK_SET) == -1) {
+    error_r = errno;
+    log_error(
+      "Cannot seek rf_stream [%s] to %ld: %s",
+      src->name,
+      (long)offset,
+      strerror(error_r));
+  }
+  if (error_r == 0) {
+    io_buffer_clear(&src->buffer);
+    src->file_offset = offset;
+    if (src->uring_queue_depth > 0) {
+      error_r = io_rf_uring_open(
+        src->fd, src->uring_queue_depth, &src->uring);
+    }
+  }
+  return error_r;
+}
+
 void
 io_rf_stream_free(struct io_rf_stream *result) {
   assert(result != NULL);
 
   if (result->stats != NULL) {
+    const struct io_stream_statistics *stats = result->stats;
     log_verbose(
       "Stream %s stats: waiting %dms, reading %dms",
       result->name,
-      timespec_miliseconds(result->stats->waiting_time),
-      timespec_miliseconds(result->stats->reading_time));
+      timespec_miliseconds(stats->waiting_time),
+      timespec_miliseconds(stats->reading_time));
+    if (stats->reads_count > 0) {
+      log_verbose(
+        "Stream %s reads: %lu, latency avg %luus, max %luus",
+        result->name,
+        stats->reads_count,
+        timespec_microseconds(stats->read_latency_total) / stats->reads_count,
+        timespec_microseconds(stats->read_latency_max));
+    }
+    if (stats->seeks_count > 0) {
+      log_verbose(
+        "Stream %s seeks: %lu, latency avg %luus, max %luus",
+        result->name,
+        stats->seeks_count,
+        timespec_microseconds(stats->seek_latency_total) / stats->seeks_count,
+        timespec_microseconds(stats->seek_latency_max));
+    }
 
     free(result->stats);
     result->stats = NULL;
@@ -415,9 +1150,17 @@ io_rf_stream_free(struct io_rf_stream *result) {
       io_rf_stream_close_fd(result);
     }
 
-    io_buffer_free(&result->buffer);
+    if (result->is_buffer_view) {
+      result->buffer = (struct io_buffer) { 0 };
+    } else {
+      io_buffer_free(&result->buffer);
+    }
 
     free(result->name);
     result->name = NULL;
   }
+  result->is_buffer_view = false;
+  result->is_mapped = false;
+  result->file_offset = 0;
+  result->uring_queue_depth = 0;
 }
@@ -1,6 +1,7 @@
 #ifndef PLAYER_IO_H_
 #define PLAYER_IO_H_
 
+#include <sys/types.h>
 #include "shrdef.h"
 #include "log.h"
 
@@ -10,11 +11,15 @@ get_filename_ext(const char *file_name);
 /**
  * @brief memory buffer
  *
+ * Buffers of page aligned size are allocated as rings: the same physical
+ * pages are mapped twice, back to back, so that both unread and free
+ * regions are always contiguous and no compaction is needed.
  */
 struct io_buffer {
   size_t size_allocated;
   size_t size_used;
   size_t start_offset;
+  bool is_ring;
   void *data;
 };
 
@@ -23,6 +28,52 @@ io_buffer_alloc(
   size_t size,
   struct io_buffer *result);
 
+/**
+ * @brief Buffers allocated from now on are prefaulted and locked in RAM,
+ * so that reading and decoding never waits for page faults.
+ */
+void
+io_buffer_set_memory_locked(bool value);
+
+/**
+ * @brief Allocate mirrored ring buffer, size is rounded up to page size.
+ * Falls back to linear buffer if mirrored mapping is not available.
+ */
+error_t
+io_buffer_alloc_ring(
+  size_t size,
+  struct io_buffer *result);
+
+/**
+ * @brief Wrap memory owned by someone else as empty linear buffer.
+ * Such buffer must not be released with io_buffer_free.
+ */
+static inline void
+io_buffer_init_view(
+  void *data,
+  size_t size,
+  struct io_buffer *result) {
+    assert(data != NULL);
+    assert(result != NULL);
+    *result = (struct io_buffer) {
+      .size_allocated = size,
+      .size_used = 0,
+      .start_offset = 0,
+      .is_ring = false,
+      .data = data
+    };
+  }
+
+/**
+ * @brief Drop everything what has been written.
+ */
+static inline void
+io_buffer_clear(struct io_buffer *src) {
+  assert(src != NULL);
+  src->size_used = 0;
+  src->start_offset = 0;
+}
+
 static inline size_t
 io_buffer_get_allocated_size(const struct io_buffer *src) {
   assert(src != NULL);
@@ -56,6 +107,24 @@ io_buffer_try_write(
   size_t item_size,
   const void *src);
 
+/**
+ * @brief Get contiguous free region for writing without copying.
+ * Linear buffer is compacted if free region is smaller than min_size.
+ */
+size_t
+io_buffer_write_begin(
+  struct io_buffer *dest,
+  size_t min_size,
+  void **result);
+
+/**
+ * @brief Mark given size of region from io_buffer_write_begin as written.
+ */
+void
+io_buffer_write_commit(
+  struct io_buffer *dest,
+  size_t size);
+
 bool
 io_buffer_try_read(
   struct io_buffer *src,
@@ -85,6 +154,64 @@ io_buffer_array_seek(
 void
 io_buffer_free(struct io_buffer *src);
 
+/**
+ * @brief Lock-free single producer, single consumer buffer
+ * for handing data over between threads.
+ *
+ */
+struct io_spsc_buffer;
+
+/**
+ * @brief Size is rounded up to whole pages and items, so that regions
+ * contain whole items when both sides commit whole items.
+ */
+error_t
+io_spsc_buffer_alloc(
+  size_t size,
+  size_t item_size,
+  struct io_spsc_buffer **result);
+
+size_t
+io_spsc_buffer_get_allocated_size(const struct io_spsc_buffer *src);
+
+size_t
+io_spsc_buffer_get_unread_size(const struct io_spsc_buffer *src);
+
+/**
+ * @brief Producer: get contiguous free region.
+ */
+size_t
+io_spsc_buffer_write_begin(
+  struct io_spsc_buffer *dest,
+  void **result);
+
+/**
+ * @brief Producer: publish given size of region from write_begin.
+ */
+void
+io_spsc_buffer_write_commit(
+  struct io_spsc_buffer *dest,
+  size_t size);
+
+/**
+ * @brief Consumer: get contiguous unread region.
+ */
+size_t
+io_spsc_buffer_read_begin(
+  struct io_spsc_buffer *src,
+  void **result);
+
+/**
+ * @brief Consumer: release given size of region from read_begin.
+ */
+void
+io_spsc_buffer_read_commit(
+  struct io_spsc_buffer *src,
+  size_t size);
+
+void
+io_spsc_buffer_free(struct io_spsc_buffer **src);
+
 /**
  * @brief IO stream statistics
  *
@@ -92,8 +219,24 @@ io_buffer_free(struct io_buffer *src);
 struct io_stream_statistics {
   struct timespec waiting_time;
   struct timespec reading_time;
+  size_t reads_count;
+  struct timespec read_latency_total;
+  struct timespec read_latency_max;
+  size_t seeks_count;
+  struct timespec seek_latency_total;
+  struct timespec seek_latency_max;
 };
 
+void
+io_stream_statistics_add_read(
+  struct io_stream_statistics *stats,
+  const struct timespec latency);
+
+void
+io_stream_statistics_add_seek(
+  struct io_stream_statistics *stats,
+  const struct timespec latency);
+
 error_t
 io_buffer_write_from_read(
   struct io_buffer *dest,
@@ -102,6 +245,8 @@ io_buffer_write_from_read(
   bool *is_eof,
   struct io_stream_statistics *stats);
 
+struct io_rf_uring;
+
 /**
  * @brief IO read-forward stream
  *
@@ -112,6 +257,21 @@ struct io_rf_stream {
   struct io_buffer buffer;
   size_t buffer_max_single_read_size;
   struct io_stream_statistics *stats;
+
+  // file offset of the end of buffered data, not used in mapped mode
+  off_t file_offset;
+
+  // buffer memory is owned by the caller
+  bool is_buffer_view;
+
+  // mapped mode: buffer is a window of the file mapping
+  bool is_mapped;
+  off_t map_offset;
+  off_t file_size;
+
+  // asynchronous reads, when enabled
+  struct io_rf_uring *uring;
+  unsigned int uring_queue_depth;
 };
 
 /**
@@ -125,6 +285,48 @@ io_rf_stream_open_file(
   size_t buffer_max_single_read_size,
   struct io_rf_stream *result);
 
+/**
+ * @brief Open file for reading into memory owned by the caller, so that
+ * the same memory can be reused for reading headers of many files.
+ * The memory is not released by io_rf_stream_free.
+ */
+error_t
+io_rf_stream_open_file_view(
+  const char *file_path,
+  void *buffer_data,
+  size_t buffer_size,
+  size_t buffer_max_single_read_size,
+  struct io_rf_stream *result);
+
+/**
+ * @brief Open regular file for reading via memory mapping of the file.
+ * Buffer points straight into page cache, files bigger than mapping window
+ * (4GB on 64 bit systems) are remapped when reading progresses.
+ * Falls back to io_rf_stream_open_file if file cannot be mapped.
+ */
+error_t
+io_rf_stream_open_file_mapped(
+  const char *file_path,
+  size_t buffer_size,
+  size_t buffer_max_single_read_size,
+  struct io_rf_stream *result);
+
+/**
+ * @brief Collect read statistics, they are collected
+ * by default in verbose mode.
+ */
+error_t
+io_rf_stream_enable_stats(struct io_rf_stream *src);
+
+/**
+ * @brief Keep up to queue_depth reads in flight via io_uring.
+ * Returns ENOTSUP if io_uring is not available, stream is still usable then.
+ */
+error_t
+io_rf_stream_enable_uring(
+  struct io_rf_stream *src,
+  unsigned int queue_depth);
+
 static inline bool
 io_rf_stream_is_eof(const struct io_rf_stream *src) {
   assert(src != NULL);
@@ -161,6 +363,13 @@ io_rf_stream_is_buffer_full(const struct io_rf_stream *src) {
   return io_buffer_is_full(&src->buffer);
 }
 
+/**
+ * @brief Descriptor which becomes readable when the next read can progress,
+ * -1 if reading never blocks (end of stream, memory mapping).
+ */
+int
+io_rf_stream_get_poll_fd(const struct io_rf_stream *src);
+
 /**
  * @brief Check if there is anything to read before reading
  *
@@ -190,6 +399,32 @@ io_rf_stream_read_array(
     return io_buffer_read_array(&src->buffer, item_size, dest, max_count);
   }
 
+/**
+ * @brief File offset of the next byte to be read from the buffer.
+ */
+static inline off_t
+io_rf_stream_get_position(const struct io_rf_stream *src) {
+  assert(src != NULL);
+  if (src->is_mapped) {
+    return src->map_offset + src->buffer.start_offset;
+  }
+  return src->file_offset - io_buffer_get_unread_size(&src->buffer);
+}
+
+/**
+ * @brief Size of the file, ESPIPE if it is not known.
+ */
+error_t
+io_rf_stream_get_size(const struct io_rf_stream *src, off_t *size);
+
+/**
+ * @brief Continue reading from given file offset. Buffered data is reused
+ * if possible, otherwise buffer is dropped and file is reopened
+ * if it has been closed on EOF. ESPIPE if stream is not seekable.
+ */
+error_t
+io_rf_stream_seek(struct io_rf_stream *src, off_t offset);
+
 void
 io_rf_stream_free(struct io_rf_stream *src);
 
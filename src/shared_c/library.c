@@ -0,0 +1,719 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "flac.h"
+#include "library.h"
+#include "timer.h"
+
+// WAV headers fit into a single read, FLAC metadata with pictures
+// is read in more steps
+#define LIBRARY_PROBE_BUFFER_SIZE (64 * 1024)
+#define LIBRARY_PROBE_SINGLE_READ_SIZE (16 * 1024)
+#define LIBRARY_WRITE_BUFFER_SIZE (1024 * 1024)
+
+#define LAST_IO_ERROR ((errno != 0) ? errno : EIO)
+
+_Static_assert(
+  sizeof(struct library_index_header) == 32,
+  "Index header layout has changed, bump LIBRARY_INDEX_VERSION");
+_Static_assert(
+  sizeof(struct library_record) == 48,
+  "Index record layout has changed, bump LIBRARY_INDEX_VERSION");
+
+static error_t
+library_index_validate(
+  const char *file_path,
+  struct library_index *index) {
+    const struct library_index_header *header = index->data;
+    if (memcmp(header->magic, LIBRARY_INDEX_MAGIC, 4) != 0
+      || header->version != LIBRARY_INDEX_VERSION
+      || header->record_size != sizeof(struct library_record)) {
+        log_error("LIBRARY: Index [%s] is of unknown version", file_path);
+        return EINVAL;
+      }
+
+    size_t content_size = index->size - sizeof(struct library_index_header);
+    if (header->records_count > content_size / sizeof(struct library_record)
+      || header->strings_size != content_size
+        - header->records_count * sizeof(struct library_record)) {
+        log_error("LIBRARY: Index [%s] is corrupted (1)", file_path);
+        return EINVAL;
+      }
+
+    const struct library_record *records =
+      (const struct library_record*)(header + 1);
+    const char *strings = (const char*)(records + header->records_count);
+    if (header->strings_size > 0 && strings[header->strings_size - 1] != 0) {
+      log_error("LIBRARY: Index [%s] is corrupted (2)", file_path);
+      return EINVAL;
+    }
+    for (size_t i = 0; i < header->records_count; ++i) {
+      if (records[i].path_offset >= header->strings_size) {
+        log_error("LIBRARY: Index [%s] is corrupted (3)", file_path);
+        return EINVAL;
+      }
+    }
+
+    index->header = header;
+    index->records = records;
+    index->strings = strings;
+    return 0;
+  }
+
+error_t
+library_index_open(const char *file_path, struct library_index *result) {
+  assert(file_path != NULL);
+  assert(result != NULL);
+  assert(result->data == NULL);
+
+  int fd = open(file_path, O_RDONLY);
+  if (fd == -1) {
+    // missing index is not an error for incremental scan
+    return errno;
+  }
+
+  error_t error_r = 0;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    error_r = errno;
+  }
+  if (error_r == 0
+    && (size_t)file_stat.st_size < sizeof(struct library_index_header)) {
+      log_error("LIBRARY: Index [%s] is too small", file_path);
+      error_r = EINVAL;
+    }
+
+  void *data = MAP_FAILED;
+  if (error_r == 0) {
+    data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      error_r = errno;
+      log_error(
+        "LIBRARY: Cannot map index [%s]: %s",
+        file_path,
+        strerror(error_r));
+    }
+  }
+  close(fd);
+
+  if (error_r == 0) {
+    result->data = data;
+    result->size = file_stat.st_size;
+    error_r = library_index_validate(file_path, result);
+    if (error_r != 0) {
+      library_index_free(result);
+    }
+  }
+  return error_r;
+}
+
+const struct library_record*
+library_index_find(const struct library_index *index, const char *file_path) {
+  assert(index != NULL);
+  assert(file_path != NULL);
+  size_t begin = 0;
+  size_t end = library_index_get_count(index);
+  while (begin < end) {
+    size_t middle = begin + (end - begin) / 2;
+    const struct library_record *record = index->records + middle;
+    int compared = strcmp(library_index_get_path(index, record), file_path);
+    if (compared == 0) {
+      return record;
+    } else if (compared < 0) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return NULL;
+}
+
+void
+library_record_get_spec(
+  const struct library_record *record,
+  struct pcm_spec *spec) {
+    assert(record != NULL);
+    assert(spec != NULL);
+    *spec = (struct pcm_spec) {
+      .channels_count = record->channels_count,
+      .samples_per_sec = record->samples_per_sec,
+      .bits_per_sample = record->bits_per_sample,
+      .is_big_endian = (record->flags & library_record_flag_big_endian) != 0,
+      .is_signed = (record->flags & library_record_flag_signed) != 0,
+      .samples_count = record->samples_count
+    };
+  }
+
+void
+library_index_free(struct library_index *index) {
+  assert(index != NULL);
+  if (index->data != NULL) {
+    if (munmap(index->data, index->size) != 0) {
+      log_error(
+        "LIBRARY: Cannot release index mapping: %s",
+        strerror(errno));
+    }
+  }
+  *index = (struct library_index) { 0 };
+}
+
+/**
+ * Track found by the worker, path is owned by the entry.
+ */
+struct library_entry {
+  char *path;
+  struct library_record record;
+};
+
+struct library_entries {
+  struct library_entry *items;
+  size_t count;
+  size_t allocated;
+};
+
+/**
+ * State shared by workers: stack of directories to be listed,
+ * scan is over when it is empty and no worker is listing any directory.
+ */
+struct library_scanner {
+  const struct library_index *previous;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  char **dirs;
+  size_t dirs_count;
+  size_t dirs_allocated;
+  size_t busy_count;
+  error_t error;
+};
+
+struct library_worker {
+  pthread_t thread;
+  bool is_started;
+  struct library_scanner *scanner;
+  void *buffer;
+  struct library_entries entries;
+  struct library_scan_statistics stats;
+};
+
+static char*
+library_join_path(const char *dir_path, const char *name) {
+  size_t dir_length = strlen(dir_path);
+  bool has_separator = dir_length > 0 && dir_path[dir_length - 1] == '/';
+  size_t size = dir_length + strlen(name) + 2;
+  char *result = malloc(size);
+  if (result != NULL) {
+    snprintf(result, size, has_separator ? "%s%s" : "%s/%s", dir_path, name);
+  } else {
+    log_error("LIBRARY: Insufficient memory for path");
+  }
+  return result;
+}
+
+static error_t
+library_entries_add(
+  struct library_entries *entries,
+  char *path,
+  const struct library_record *record) {
+    if (entries->count == entries->allocated) {
+      size_t allocated = max_size_t(2 * entries->allocated, 256);
+      struct library_entry *items = realloc(
+        entries->items, allocated * sizeof(struct library_entry));
+      if (items == NULL) {
+        log_error("LIBRARY: Insufficient memory for entries");
+        return ENOMEM;
+      }
+      entries->items = items;
+      entries->allocated = allocated;
+    }
+    entries->items[entries->count++] = (struct library_entry) {
+      .path = path,
+      .record = *record
+    };
+    return 0;
+  }
+
+static void
+library_entries_free(struct library_entries *entries) {
+  for (size_t i = 0; i < entries->count; ++i) {
+    free(entries->items[i].path);
+  }
+  free(entries->items);
+  *entries = (struct library_entries) { 0 };
+}
+
+/**
+ * Directory path is owned by the scanner from now on.
+ */
+static error_t
+library_scanner_push_dir(struct library_scanner *scanner, char *dir_path) {
+  error_t error_r = 0;
+  pthread_mutex_lock(&scanner->lock);
+  if (scanner->dirs_count == scanner->dirs_allocated) {
+    size_t allocated = max_size_t(2 * scanner->dirs_allocated, 64);
+    char **dirs = realloc(scanner->dirs, allocated * sizeof(char*));
+    if (dirs != NULL) {
+      scanner->dirs = dirs;
+      scanner->dirs_allocated = allocated;
+    } else {
+      log_error("LIBRARY: Insufficient memory for directories");
+      error_r = ENOMEM;
+    }
+  }
+  if (error_r == 0) {
+    scanner->dirs[scanner->dirs_count++] = dir_path;
+    pthread_cond_signal(&scanner->changed);
+  } else {
+    free(dir_path);
+  }
+  pthread_mutex_unlock(&scanner->lock);
+  return error_r;
+}
+
+static bool
+library_scanner_take_dir(struct library_scanner *scanner, char **dir_path) {
+  pthread_mutex_lock(&scanner->lock);
+  while (scanner->error == 0
+    && scanner->dirs_count == 0
+    && scanner->busy_count > 0) {
+      pthread_cond_wait(&scanner->changed, &scanner->lock);
+    }
+  bool result = scanner->error == 0 && scanner->dirs_count > 0;
+  if (result) {
+    *dir_path = scanner->dirs[--scanner->dirs_count];
+    scanner->busy_count++;
+  }
+  pthread_mutex_unlock(&scanner->lock);
+  return result;
+}
+
+static void
+library_scanner_done_dir(struct library_scanner *scanner, error_t error_r) {
+  pthread_mutex_lock(&scanner->lock);
+  scanner->busy_count--;
+  if (error_r != 0 && scanner->error == 0) {
+    scanner->error = error_r;
+  }
+  if (scanner->busy_count == 0 || scanner->error != 0) {
+    // waiting workers either finish or have something to do
+    pthread_cond_broadcast(&scanner->changed);
+  }
+  pthread_mutex_unlock(&scanner->lock);
+}
+
+static void
+library_worker_probe(
+  struct library_worker *worker,
+  const char *file_path,
+  struct library_record *record) {
+    struct io_rf_stream stream = { 0 };
+    struct pcm_spec spec;
+    error_t error_r = io_rf_stream_open_file_view(
+      file_path,
+      worker->buffer,
+      LIBRARY_PROBE_BUFFER_SIZE,
+      LIBRARY_PROBE_SINGLE_READ_SIZE,
+      &stream);
+    if (error_r == 0) {
+      if (record->format == pcm_format_flac) {
+        error_r = pcm_flac_read_spec(&stream, &spec);
+      } else {
+        error_r = pcm_wav_read_spec(&stream, &spec);
+      }
+    }
+    io_rf_stream_free(&stream);
+
+    if (error_r == 0) {
+      record->samples_count = spec.samples_count;
+      record->samples_per_sec = spec.samples_per_sec;
+      record->channels_count = spec.channels_count;
+      record->bits_per_sample = spec.bits_per_sample;
+      record->flags =
+        (spec.is_big_endian ? library_record_flag_big_endian : 0)
+        | (spec.is_signed ? library_record_flag_signed : 0);
+    } else {
+      log_verbose("LIBRARY: Cannot read headers of [%s]", file_path);
+      record->flags = library_record_flag_invalid;
+    }
+  }
+
+/**
+ * File path is owned by the worker from now on.
+ */
+static error_t
+library_worker_add_file(
+  struct library_worker *worker,
+  char *file_path,
+  enum pcm_format format,
+  const struct stat *file_stat) {
+    worker->stats.files_count++;
+    struct library_record record = (struct library_record) {
+      .mtime_sec = file_stat->st_mtim.tv_sec,
+      .mtime_nsec = file_stat->st_mtim.tv_nsec,
+      .file_size = file_stat->st_size,
+      .format = format
+    };
+
+    const struct library_record *previous = library_index_find(
+      worker->scanner->previous, file_path);
+    if (previous != NULL
+      && previous->mtime_sec == record.mtime_sec
+      && previous->mtime_nsec == record.mtime_nsec
+      && previous->file_size == record.file_size
+      && previous->format == record.format) {
+        record = *previous;
+        worker->stats.unchanged_count++;
+      } else {
+        library_worker_probe(worker, file_path, &record);
+        worker->stats.probed_count++;
+      }
+    if (!library_record_is_valid(&record)) {
+      worker->stats.invalid_count++;
+    }
+
+    error_t error_r = library_entries_add(
+      &worker->entries, file_path, &record);
+    if (error_r != 0) {
+      free(file_path);
+    }
+    return error_r;
+  }
+
+/**
+ * Subdirectories are pushed to the scanner, symbolic links
+ * to directories are not followed so that there are no cycles.
+ */
+static error_t
+library_worker_list_dir(struct library_worker *worker, const char *dir_path) {
+  DIR *dir = opendir(dir_path);
+  if (dir == NULL) {
+    // unreadable directory does not stop the scan
+    log_error(
+      "LIBRARY: Cannot open directory [%s]: %s",
+      dir_path,
+      strerror(errno));
+    return 0;
+  }
+  worker->stats.dirs_count++;
+
+  error_t error_r = 0;
+  struct dirent *entry;
+  while (error_r == 0 && (entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    enum pcm_format format = 0;
+    bool is_track = entry->d_type != DT_DIR
+      && pcm_guess_format(entry->d_name, &format) == 0;
+    if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN && !is_track) {
+      continue;
+    }
+
+    char *path = library_join_path(dir_path, entry->d_name);
+    if (path == NULL) {
+      error_r = ENOMEM;
+    } else if (entry->d_type == DT_DIR) {
+      error_r = library_scanner_push_dir(worker->scanner, path);
+    } else {
+      // file system does not report type, do not follow links then
+      int flags = entry->d_type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0;
+      struct stat file_stat;
+      if (fstatat(dirfd(dir), entry->d_name, &file_stat, flags) != 0) {
+        log_error(
+          "LIBRARY: Cannot get status of [%s]: %s",
+          path,
+          strerror(errno));
+        free(path);
+      } else if (S_ISDIR(file_stat.st_mode)) {
+        error_r = library_scanner_push_dir(worker->scanner, path);
+      } else if (is_track && S_ISREG(file_stat.st_mode)) {
+        error_r = library_worker_add_file(worker, path, format, &file_stat);
+      } else {
+        free(path);
+      }
+    }
+  }
+  closedir(dir);
+  return error_r;
+}
+
+static void*
+library_worker_thread(void *arg) {
+  struct library_worker *worker = arg;
+  char *dir_path;
+  while (library_scanner_take_dir(worker->scanner, &dir_path)) {
+    error_t error_r = library_worker_list_dir(worker, dir_path);
+    free(dir_path);
+    library_scanner_done_dir(worker->scanner, error_r);
+  }
+  return NULL;
+}
+
+static int
+library_entry_compare(const void *a, const void *b) {
+  return strcmp(
+    ((const struct library_entry*)a)->path,
+    ((const struct library_entry*)b)->path);
+}
+
+static error_t
+library_index_write_file(
+  FILE *file,
+  struct library_entry *entries,
+  size_t count) {
+    struct library_index_header header = (struct library_index_header) {
+      .version = LIBRARY_INDEX_VERSION,
+      .record_size = sizeof(struct library_record),
+      .records_count = count
+    };
+    memcpy(header.magic, LIBRARY_INDEX_MAGIC, 4);
+    for (size_t i = 0; i < count; ++i) {
+      entries[i].record.path_offset = header.strings_size;
+      header.strings_size += strlen(entries[i].path) + 1;
+    }
+
+    bool is_written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; is_written && i < count; ++i) {
+      is_written = fwrite(
+        &entries[i].record, sizeof(struct library_record), 1, file) == 1;
+    }
+    for (size_t i = 0; is_written && i < count; ++i) {
+      is_written = fputs(entries[i].path, file) >= 0
+        && fputc(0, file) != EOF;
+    }
+    return is_written ? 0 : LAST_IO_ERROR;
+  }
+
+/**
+ * Write entries sorted by path to temporary file, replace index with it.
+ */
+static error_t
+library_index_write(
+  const char *index_path,
+  struct library_entry *entries,
+  size_t count) {
+    qsort(entries, count, sizeof(struct library_entry), library_entry_compare);
+
+    char temp_path[PATH_MAX];
+    if (snprintf(temp_path, PATH_MAX, "%s.tmp", index_path) >= PATH_MAX) {
+      log_error("LIBRARY: Index path is too long [%s]", index_path);
+      return ENAMETOOLONG;
+    }
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+      error_t error_r = errno;
+      log_error(
+        "LIBRARY: Cannot create index [%s]: %s",
+        temp_path,
+        strerror(error_r));
+      return error_r;
+    }
+    setvbuf(file, NULL, _IOFBF, LIBRARY_WRITE_BUFFER_SIZE);
+
+    error_t error_r = library_index_write_file(file, entries, count);
+    if (fclose(file) != 0 && error_r == 0) {
+      error_r = LAST_IO_ERROR;
+    }
+    if (error_r == 0 && rename(temp_path, index_path) != 0) {
+      error_r = errno;
+    }
+    if (error_r != 0) {
+      log_error(
+        "LIBRARY: Cannot write index [%s]: %s",
+        index_path,
+        strerror(error_r));
+      unlink(temp_path);
+    }
+    return error_r;
+  }
+
+static void
+library_scan_statistics_add(
+  struct library_scan_statistics *result,
+  const struct library_scan_statistics *worker) {
+    result->dirs_count += worker->dirs_count;
+    result->files_count += worker->files_count;
+    result->probed_count += worker->probed_count;
+    result->unchanged_count += worker->unchanged_count;
+    result->invalid_count += worker->invalid_count;
+  }
+
+/**
+ * Entries of all workers are moved into one array.
+ */
+static error_t
+library_merge_entries(
+  struct library_worker *workers,
+  unsigned int workers_count,
+  struct library_entries *result) {
+    size_t count = 0;
+    for (unsigned int i = 0; i < workers_count; ++i) {
+      count += workers[i].entries.count;
+    }
+    result->items = malloc(max_size_t(count, 1) * sizeof(struct library_entry));
+    if (result->items == NULL) {
+      log_error("LIBRARY: Insufficient memory for entries");
+      return ENOMEM;
+    }
+    result->allocated = count;
+    for (unsigned int i = 0; i < workers_count; ++i) {
+      struct library_entries *entries = &workers[i].entries;
+      if (entries->count > 0) {
+        memcpy(
+          result->items + result->count,
+          entries->items,
+          entries->count * sizeof(struct library_entry));
+        result->count += entries->count;
+      }
+      free(entries->items);
+      *entries = (struct library_entries) { 0 };
+    }
+    return 0;
+  }
+
+static error_t
+library_scan_with_workers(
+  struct library_scanner *scanner,
+  struct library_worker *workers,
+  unsigned int workers_count) {
+    error_t error_r = 0;
+    for (unsigned int i = 0; error_r == 0 && i < workers_count; ++i) {
+      workers[i].scanner = scanner;
+      workers[i].buffer = malloc(LIBRARY_PROBE_BUFFER_SIZE);
+      if (workers[i].buffer == NULL) {
+        log_error("LIBRARY: Insufficient memory for worker buffer");
+        error_r = ENOMEM;
+      }
+      if (error_r == 0) {
+        error_r = pthread_create(
+          &workers[i].thread, NULL, library_worker_thread, &workers[i]);
+        if (error_r != 0) {
+          log_error(
+            "LIBRARY: Cannot start worker thread: %s",
+            strerror(error_r));
+        } else {
+          workers[i].is_started = true;
+        }
+      }
+    }
+    if (error_r != 0) {
+      pthread_mutex_lock(&scanner->lock);
+      scanner->error = error_r;
+      pthread_cond_broadcast(&scanner->changed);
+      pthread_mutex_unlock(&scanner->lock);
+    }
+
+    for (unsigned int i = 0; i < workers_count; ++i) {
+      if (workers[i].is_started) {
+        pthread_join(workers[i].thread, NULL);
+        workers[i].is_started = false;
+      }
+    }
+    return scanner->error;
+  }
+
+error_t
+library_scan(
+  const struct library_scan_parameters *params,
+  struct library_scan_statistics *stats) {
+    assert(params != NULL);
+    assert(params->dir_path != NULL);
+    assert(params->index_path != NULL);
+    assert(stats != NULL);
+    struct timespec started;
+    timer_start(&started);
+    *stats = (struct library_scan_statistics) { 0 };
+
+    unsigned int workers_count = params->threads_count;
+    if (workers_count == 0) {
+      // scan waits mostly for the disk, keep more requests in flight
+      workers_count = 2 * max_int(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    }
+    log_verbose(
+      "LIBRARY: Scanning [%s] with %d threads",
+      params->dir_path,
+      workers_count);
+
+    struct library_index previous = { 0 };
+    error_t error_r = library_index_open(params->index_path, &previous);
+    if (error_r == 0) {
+      log_verbose(
+        "LIBRARY: Previous index has %lu tracks",
+        library_index_get_count(&previous));
+    } else if (error_r != ENOENT) {
+      log_info("LIBRARY: Index [%s] is going to be rebuilt", params->index_path);
+    }
+
+    struct library_scanner scanner = (struct library_scanner) {
+      .previous = &previous
+    };
+    pthread_mutex_init(&scanner.lock, NULL);
+    pthread_cond_init(&scanner.changed, NULL);
+
+    // paths in the index do not depend on working directory
+    char *root_path = realpath(params->dir_path, NULL);
+    if (root_path == NULL) {
+      error_r = errno;
+      log_error(
+        "LIBRARY: Cannot resolve directory [%s]: %s",
+        params->dir_path,
+        strerror(error_r));
+    } else {
+      error_r = library_scanner_push_dir(&scanner, root_path);
+    }
+
+    struct library_worker *workers = NULL;
+    if (error_r == 0) {
+      workers = calloc(workers_count, sizeof(struct library_worker));
+      if (workers == NULL) {
+        log_error("LIBRARY: Insufficient memory for workers");
+        error_r = ENOMEM;
+      }
+    }
+    if (error_r == 0) {
+      error_r = library_scan_with_workers(&scanner, workers, workers_count);
+    }
+
+    struct library_entries entries = { 0 };
+    if (workers != NULL) {
+      for (unsigned int i = 0; i < workers_count; ++i) {
+        library_scan_statistics_add(stats, &workers[i].stats);
+      }
+      if (error_r == 0) {
+        error_r = library_merge_entries(workers, workers_count, &entries);
+      }
+    }
+    if (error_r == 0) {
+      error_r = library_index_write(
+        params->index_path,
+        entries.items,
+        entries.count);
+    }
+
+    library_entries_free(&entries);
+    if (workers != NULL) {
+      for (unsigned int i = 0; i < workers_count; ++i) {
+        library_entries_free(&workers[i].entries);
+        free(workers[i].buffer);
+      }
+      free(workers);
+    }
+    for (size_t i = 0; i < scanner.dirs_count; ++i) {
+      free(scanner.dirs[i]);
+    }
+    free(scanner.dirs);
+    pthread_cond_destroy(&scanner.changed);
+    pthread_mutex_destroy(&scanner.lock);
+    library_index_free(&previous);
+
+    stats->elapsed = timer_elapsed(started);
+    return error_r;
+  }
@@ -0,0 +1,129 @@
+#ifndef PLAYER_LIBRARY_H_
+#define PLAYER_LIBRARY_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "pcm.h"
+
+#define LIBRARY_INDEX_MAGIC "ALTL"
+#define LIBRARY_INDEX_VERSION 1
+
+/**
+ * @brief Track index file layout
+ *
+ * Header is followed by records sorted by path and by string table
+ * of NUL terminated paths. Index is a local cache, so that numbers
+ * are stored in native byte order; index of other version is rebuilt.
+ */
+struct library_index_header {
+  char magic[4];                // LIBRARY_INDEX_MAGIC
+  uint32_t version;             // LIBRARY_INDEX_VERSION
+  uint32_t record_size;         // sizeof(struct library_record)
+  uint32_t reserved;
+  uint64_t records_count;
+  uint64_t strings_size;
+};
+
+enum library_record_flag {
+  library_record_flag_big_endian  = 1,
+  library_record_flag_signed      = 2,
+  // headers cannot be read, file is skipped until it changes
+  library_record_flag_invalid     = 4,
+};
+
+struct library_record {
+  uint64_t path_offset;         // offset in string table
+  int64_t mtime_sec;
+  uint64_t file_size;
+  uint64_t samples_count;
+  uint32_t mtime_nsec;
+  uint32_t samples_per_sec;
+  uint16_t channels_count;
+  uint16_t bits_per_sample;
+  uint8_t format;               // enum pcm_format
+  uint8_t flags;                // enum library_record_flag
+  uint16_t reserved;
+};
+
+/**
+ * @brief Read-only memory mapping of track index file
+ */
+struct library_index {
+  void *data;
+  size_t size;
+  const struct library_index_header *header;
+  const struct library_record *records;
+  const char *strings;
+};
+
+/**
+ * @brief Map index file, EINVAL if it is of other version or corrupted.
+ */
+error_t
+library_index_open(const char *file_path, struct library_index *result);
+
+static inline size_t
+library_index_get_count(const struct library_index *index) {
+  assert(index != NULL);
+  return index->header != NULL ? index->header->records_count : 0;
+}
+
+static inline const char*
+library_index_get_path(
+  const struct library_index *index,
+  const struct library_record *record) {
+    assert(index != NULL);
+    assert(record != NULL);
+    return index->strings + record->path_offset;
+  }
+
+static inline bool
+library_record_is_valid(const struct library_record *record) {
+  assert(record != NULL);
+  return (record->flags & library_record_flag_invalid) == 0;
+}
+
+/**
+ * @brief Binary search for the record of given path, NULL if there is none.
+ */
+const struct library_record*
+library_index_find(const struct library_index *index, const char *file_path);
+
+void
+library_record_get_spec(
+  const struct library_record *record,
+  struct pcm_spec *spec);
+
+void
+library_index_free(struct library_index *index);
+
+struct library_scan_parameters {
+  const char *dir_path;
+  const char *index_path;
+  unsigned int threads_count;   // 0 for twice the online CPUs count
+};
+
+struct library_scan_statistics {
+  size_t dirs_count;
+  size_t files_count;
+  size_t probed_count;          // headers have been read
+  size_t unchanged_count;       // record taken from previous index
+  size_t invalid_count;
+  struct timespec elapsed;
+};
+
+/**
+ * @brief Walk directory tree with thread pool and write index of WAV
+ * and FLAC files found in it.
+ *
+ * Only headers of the files are read. If index file exists already,
+ * files of the same mtime and size are taken from it without opening them.
+ * Index is written to temporary file and renamed, so that readers
+ * always see complete index.
+ */
+error_t
+library_scan(
+  const struct library_scan_parameters *params,
+  struct library_scan_statistics *stats);
+
+#endif
@@ -1,11 +1,16 @@
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/sysinfo.h>
 #include <sys/utsname.h>
 #include "log.h"
@@ -17,6 +22,42 @@ static char _log_session_id[16];
 bool _log_is_verbose = false;
 static FILE *_log_output_st = NULL;
 
+enum log_level {
+  log_level_info      = 1,
+  log_level_verbose   = 2,
+  log_level_error     = 3,
+};
+
+/**
+ * @brief Async mode record, sequence tells whose turn it is
+ * (bounded MPSC queue by D. Vyukov).
+ */
+struct log_record {
+  atomic_size_t sequence;
+  enum log_level level;
+  time_t time;
+  char line[LOG_ASYNC_LINE_SIZE];
+};
+
+struct log_async {
+  struct log_record *records;
+  atomic_size_t enqueue_position;
+  size_t dequeue_position;
+  atomic_size_t dropped_count;
+
+  pthread_t thread;
+  bool is_thread_started;
+  atomic_bool is_stopping;
+  atomic_bool is_sleeping;
+  int wakeup_fd;
+
+  // formatted once per second
+  time_t cached_time;
+  char cached_time_str[32];
+};
+
+static struct log_async *_log_async = NULL;
+
 error_t
 log_start() {
   unsigned int rand_seed;
@@ -25,8 +66,288 @@ log_start() {
   return 0;
 }
 
+static void
+log_async_push(enum log_level level, const char *format, va_list args) {
+  struct log_async *async = _log_async;
+  const size_t mask = LOG_ASYNC_RECORDS_COUNT - 1;
+
+  struct log_record *record;
+  size_t position = atomic_load_explicit(
+    &async->enqueue_position, memory_order_relaxed);
+  while (true) {
+    record = async->records + (position & mask);
+    size_t sequence = atomic_load_explicit(
+      &record->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+        &async->enqueue_position,
+        &position,
+        position + 1,
+        memory_order_relaxed,
+        memory_order_relaxed)) {
+          break;
+        }
+    } else if (diff < 0) {
+      // ring is full, never wait for background thread
+      atomic_fetch_add_explicit(
+        &async->dropped_count, 1, memory_order_relaxed);
+      return;
+    } else {
+      position = atomic_load_explicit(
+        &async->enqueue_position, memory_order_relaxed);
+    }
+  }
+
+  struct timespec now;
+  // this cannot fail, coarse clock is read without syscall
+  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+  record->level = level;
+  record->time = now.tv_sec;
+  vsnprintf(record->line, sizeof(record->line), format, args);
+  atomic_store_explicit(
+    &record->sequence, position + 1, memory_order_release);
+
+  if (atomic_exchange(&async->is_sleeping, false)) {
+    uint64_t value = 1;
+    // ignore failure, thread wakes up on timeout anyway
+    ssize_t written = write(async->wakeup_fd, &value, sizeof(value));
+    (void)written;
+  }
+}
+
+static const char*
+log_async_time_str(struct log_async *async, time_t time) {
+  if (time != async->cached_time) {
+    struct tm local_time;
+    async->cached_time = time;
+    async->cached_time_str[0] = 0;
+    if (localtime_r(&time, &local_time) != NULL) {
+      size_t len = strftime(
+        async->cached_time_str,
+        sizeof(async->cached_time_str),
+        "%F %H:%M:%S",
+        &local_time);
+      if (len == 0) {
+        async->cached_time_str[0] = 0;
+      }
+    }
+  }
+  return async->cached_time_str;
+}
+
+static void
+log_async_print_st(FILE *st, const char *time_str, const char *line) {
+  // ignore failure
+  fputs("[", st);
+  fputs(_log_session_id, st);
+  if (time_str[0] != 0) {
+    fputs(", ", st);
+    fputs(time_str, st);
+  }
+  fputs("] ", st);
+  fputs(line, st);
+  putc('\n', st);
+}
+
+static void
+log_async_print(struct log_async *async, const struct log_record *record) {
+  const char *time_str = log_async_time_str(async, record->time);
+  switch (record->level) {
+    case log_level_info:
+      // ignore failure to stdout
+      fputs(record->line, stdout);
+      putc('\n', stdout);
+      if (_log_output_st != NULL) {
+        log_async_print_st(_log_output_st, time_str, record->line);
+      }
+      break;
+
+    case log_level_verbose:
+      if (_log_output_st != NULL) {
+        log_async_print_st(_log_output_st, time_str, record->line);
+      } else {
+        // ignore failure to stdout
+        fputs(record->line, stdout);
+        putc('\n', stdout);
+      }
+      break;
+
+    case log_level_error:
+      // ignore failure to stderr
+      fputs(record->line, stderr);
+      putc('\n', stderr);
+      if (_log_output_st != NULL) {
+        log_async_print_st(_log_output_st, time_str, record->line);
+      }
+      break;
+  }
+}
+
+static bool
+log_async_is_empty(struct log_async *async) {
+  const size_t mask = LOG_ASYNC_RECORDS_COUNT - 1;
+  const size_t position = async->dequeue_position;
+  const struct log_record *record = async->records + (position & mask);
+  return atomic_load(&record->sequence) != position + 1;
+}
+
+static size_t
+log_async_print_pending(struct log_async *async) {
+  const size_t mask = LOG_ASYNC_RECORDS_COUNT - 1;
+  size_t count = 0;
+  while (!log_async_is_empty(async)) {
+    const size_t position = async->dequeue_position;
+    struct log_record *record = async->records + (position & mask);
+    log_async_print(async, record);
+    atomic_store_explicit(
+      &record->sequence,
+      position + LOG_ASYNC_RECORDS_COUNT,
+      memory_order_release);
+    async->dequeue_position = position + 1;
+    count++;
+  }
+  if (count > 0) {
+    // ignore failure
+    fflush(stdout);
+    if (_log_output_st != NULL) {
+      fflush(_log_output_st);
+    }
+  }
+  return count;
+}
+
+static void*
+log_async_thread(void *arg) {
+  struct log_async *async = arg;
+  struct pollfd wakeup = {
+    .fd = async->wakeup_fd,
+    .events = POLLIN,
+    .revents = 0
+  };
+
+  while (true) {
+    bool is_stopping = atomic_load(&async->is_stopping);
+    if (log_async_print_pending(async) == 0) {
+      if (is_stopping) {
+        break;
+      }
+
+      atomic_store(&async->is_sleeping, true);
+      // producer could have pushed before noticing that we sleep
+      if (log_async_is_empty(async)) {
+        // ignore failure, in the worst case we wake up on timeout
+        if (poll(&wakeup, 1, 1000) > 0) {
+          uint64_t value;
+          ssize_t result = read(async->wakeup_fd, &value, sizeof(value));
+          (void)result;
+        }
+      }
+      atomic_store(&async->is_sleeping, false);
+    }
+  }
+  return NULL;
+}
+
+static void
+log_async_free(struct log_async **async) {
+  assert(async != NULL);
+  struct log_async *current = *async;
+  if (current != NULL) {
+    if (current->is_thread_started) {
+      atomic_store(&current->is_stopping, true);
+      uint64_t value = 1;
+      // ignore failure, thread wakes up on timeout anyway
+      ssize_t written = write(current->wakeup_fd, &value, sizeof(value));
+      (void)written;
+      pthread_join(current->thread, NULL);
+    }
+
+    size_t dropped_count = atomic_load(&current->dropped_count);
+    if (dropped_count > 0) {
+      fprintf(stderr, "LOG: %zu log lines were dropped\n", dropped_count);
+    }
+
+    if (current->wakeup_fd != -1) {
+      close(current->wakeup_fd);
+    }
+    free(current->records);
+    free(current);
+    *async = NULL;
+  }
+}
+
+error_t
+log_start_async() {
+  assert(_log_async == NULL);
+  // positions are masked
+  static_assert(
+    (LOG_ASYNC_RECORDS_COUNT & (LOG_ASYNC_RECORDS_COUNT - 1)) == 0,
+    "LOG_ASYNC_RECORDS_COUNT has to be power of 2");
+
+  struct log_async *async = calloc(1, sizeof(struct log_async));
+  if (async == NULL) {
+    fputs("Cannot allocate memory for async logs\n", stderr);
+    return ENOMEM;
+  }
+  async->wakeup_fd = -1;
+  async->cached_time = (time_t)-1;
+
+  error_t error_r = 0;
+  async->records = calloc(
+    LOG_ASYNC_RECORDS_COUNT, sizeof(struct log_record));
+  if (async->records == NULL) {
+    fputs("Cannot allocate memory for async logs ring\n", stderr);
+    error_r = ENOMEM;
+  }
+  if (error_r == 0) {
+    for (size_t i = 0; i < LOG_ASYNC_RECORDS_COUNT; i++) {
+      atomic_init(&async->records[i].sequence, i);
+    }
+    atomic_init(&async->enqueue_position, 0);
+    atomic_init(&async->dropped_count, 0);
+    atomic_init(&async->is_stopping, false);
+    atomic_init(&async->is_sleeping, false);
+
+    async->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (async->wakeup_fd == -1) {
+      error_r = errno;
+      fprintf(
+        stderr,
+        "Cannot create async logs eventfd: %s\n",
+        strerror(error_r));
+    }
+  }
+  if (error_r == 0) {
+    error_r = pthread_create(&async->thread, NULL, log_async_thread, async);
+    if (error_r != 0) {
+      fprintf(
+        stderr,
+        "Cannot start async logs thread: %s\n",
+        strerror(error_r));
+    } else {
+      async->is_thread_started = true;
+    }
+  }
+
+  if (error_r == 0) {
+    // ignore failure
+    fflush(stdout);
+    _log_async = async;
+  } else {
+    log_async_free(&async);
+  }
+  return error_r;
+}
+
+size_t
+log_get_dropped_count() {
+  return _log_async != NULL ? atomic_load(&_log_async->dropped_count) : 0;
+}
+
 void
 log_free() {
+  log_async_free(&_log_async);
   if (_log_output_st != NULL) {
     error_t result = fclose(_log_output_st);
     if (result != 0) {
@@ -110,7 +431,9 @@ log_verbose(const char *format, ...) {
     va_list args;
     va_start(args, format);
 
-    if (_log_output_st != NULL) {
+    if (_log_async != NULL) {
+      log_async_push(log_level_verbose, format, args);
+    } else if (_log_output_st != NULL) {
       print_st(_log_output_st, format, args);
     } else {
       // ignore failure to stdout
@@ -126,6 +449,13 @@ void
 log_info(const char *format, ...) {
   va_list args;
 
+  if (_log_async != NULL) {
+    va_start(args, format);
+    log_async_push(log_level_info, format, args);
+    va_end(args);
+    return;
+  }
+
   // ignore failure to stdout
   va_start(args, format);
   vprintf(format, args);
@@ -143,6 +473,13 @@ void
 log_error(const char *format, ...) {
   va_list args;
 
+  if (_log_async != NULL) {
+    va_start(args, format);
+    log_async_push(log_level_error, format, args);
+    va_end(args);
+    return;
+  }
+
   // ignore failure to stderr
   va_start(args, format);
   vfprintf(stderr, format, args);
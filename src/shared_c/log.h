@@ -4,6 +4,9 @@
 #include <assert.h>
 #include "shrdef.h"
 
+#define LOG_ASYNC_LINE_SIZE 240
+#define LOG_ASYNC_RECORDS_COUNT 1024
+
 extern bool _log_is_verbose;
 
 /**
@@ -12,6 +15,22 @@ extern bool _log_is_verbose;
 error_t
 log_start();
 
+/**
+ * From now on format, timestamp and write logs on background thread.
+ * Logging calls only format the line into fixed-size record
+ * of lock-free ring, they never block: lines are truncated to
+ * LOG_ASYNC_LINE_SIZE and dropped when the ring is full.
+ * Background thread is stopped by log_free.
+ */
+error_t
+log_start_async();
+
+/**
+ * Count of log lines dropped in async mode because of the full ring.
+ */
+size_t
+log_get_dropped_count();
+
 /**
  * Free resources allocated by diagnostics module.
  * Should be called when program ends.
@@ -1,10 +1,12 @@
 #include <assert.h>
+#include <endian.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include "pcm.h"
+#include "timer.h"
 
 /**
  * RIFF WAV file header, see
@@ -34,6 +36,17 @@ struct wav_data_chunk_header {
   uint32_t data_size;                 // size of the data section
 };
 
+// RIFF fields are little endian, RIFX ones big endian
+static inline uint32_t
+wav_uint32(uint32_t value, bool is_big_endian) {
+  return is_big_endian ? be32toh(value) : le32toh(value);
+}
+
+static inline uint16_t
+wav_uint16(uint16_t value, bool is_big_endian) {
+  return is_big_endian ? be16toh(value) : le16toh(value);
+}
+
 struct timespec
 pcm_spec_get_samples_time(const struct pcm_spec *params, size_t samples_count) {
   assert(params != NULL);
@@ -71,6 +84,80 @@ pcm_guess_format(
     return EINVAL;
   }
 
+/**
+ * Value of NAME=value comment, i.e. "-6.54 dB" or "0.988", units are ignored.
+ */
+static bool
+replay_gain_parse_value(
+  const char *comment,
+  size_t size,
+  const char *name,
+  float *value) {
+    size_t name_size = strlen(name);
+    if (size <= name_size
+      || comment[name_size] != '='
+      || strncasecmp(comment, name, name_size) != 0) {
+        return false;
+      }
+    char text[32];
+    size_t text_size = min_size_t(size - name_size - 1, sizeof(text) - 1);
+    memcpy(text, comment + name_size + 1, text_size);
+    text[text_size] = 0;
+
+    char *end;
+    float result = strtof(text, &end);
+    if (end == text) {
+      log_verbose("PCM: Ignoring malformed %s tag", name);
+      return false;
+    }
+    *value = result;
+    return true;
+  }
+
+void
+pcm_replay_gain_parse_comment(
+  struct pcm_replay_gain *tags,
+  const char *comment,
+  size_t size) {
+    assert(tags != NULL);
+    assert(comment != NULL);
+    if (replay_gain_parse_value(
+      comment, size, "REPLAYGAIN_TRACK_GAIN", &tags->track_gain)) {
+        tags->has_track = true;
+      }
+    if (replay_gain_parse_value(
+      comment, size, "REPLAYGAIN_ALBUM_GAIN", &tags->album_gain)) {
+        tags->has_album = true;
+      }
+    replay_gain_parse_value(
+      comment, size, "REPLAYGAIN_TRACK_PEAK", &tags->track_peak);
+    replay_gain_parse_value(
+      comment, size, "REPLAYGAIN_ALBUM_PEAK", &tags->album_peak);
+  }
+
+error_t
+pcm_decoder_seek(struct pcm_decoder *dec, size_t frame) {
+  assert(dec != NULL);
+  if (dec->seek == NULL) {
+    log_error("PCM: Decoder cannot seek");
+    return ENOTSUP;
+  }
+  // samples count is not known for some streams
+  if (dec->spec.samples_count > 0 && frame >= dec->spec.samples_count) {
+    log_error("PCM: Cannot seek beyond the end to frame %lu", frame);
+    return EINVAL;
+  }
+
+  struct timespec started;
+  timer_start(&started);
+  io_buffer_clear(&dec->dest);
+  error_t error_r = dec->seek(dec, frame);
+  if (error_r == 0 && dec->src->stats != NULL) {
+    io_stream_statistics_add_seek(dec->src->stats, timer_elapsed(started));
+  }
+  return error_r;
+}
+
 static error_t
 validate_wav_header(
   struct io_rf_stream *stream,
@@ -100,7 +187,7 @@ validate_wav_header(
       error_r = EINVAL;
     }
     if (error_r == 0) {
-      *fmt_length = header->fmt_length;
+      *fmt_length = wav_uint32(header->fmt_length, spec->is_big_endian);
     }
     return error_r;
   }
@@ -117,6 +204,10 @@ validate_wav_fmt_chunk_header(
         fmt_length);
       error_r = EINVAL;
     }
+    if (fmt_length > io_rf_stream_get_allocated_buffer_size(stream)) {
+      log_error("WAV: fmt chunk does not fit into buffer: %d", fmt_length);
+      error_r = EINVAL;
+    }
 
     struct wav_fmt_chunk_header *header;
     if (error_r == 0) {
@@ -124,23 +215,27 @@ validate_wav_fmt_chunk_header(
         stream,
         fmt_length, (void**)&header); //NOLINT
     }
-    if (error_r == 0 && header->fmt_format_type != 1) {
+    const bool be = result->is_big_endian;
+    if (error_r == 0 && wav_uint16(header->fmt_format_type, be) != 1) {
       log_error("WAV: invalid header (3).");
       error_r = EINVAL;
     }
     if (error_r == 0) {
-      const unsigned int samples_per_sec = header->samples_per_sec;
-      const unsigned int bits_per_sample = header->bits_per_sample;
-      const unsigned int channels_count = header->n_channels;
+      const unsigned int samples_per_sec = wav_uint32(
+        header->samples_per_sec, be);
+      const unsigned int bits_per_sample = wav_uint16(
+        header->bits_per_sample, be);
+      const unsigned int channels_count = wav_uint16(header->n_channels, be);
 
       const unsigned int exp_avg_bytes_per_sec =
         samples_per_sec * channels_count * bits_per_sample / 8;
-      if (header->avg_bytes_per_sec != exp_avg_bytes_per_sec) {
+      if (wav_uint32(header->avg_bytes_per_sec, be) != exp_avg_bytes_per_sec) {
         log_error("WAV: invalid header (4).");
         error_r = EINVAL;
       }
       if (error_r == 0
-          && header->block_align != channels_count * bits_per_sample / 8) {
+          && wav_uint16(header->block_align, be)
+            != channels_count * bits_per_sample / 8) {
         log_error("WAV: invalid header (5).");
         error_r = EINVAL;
       }
@@ -167,11 +262,12 @@ validate_wav_data_chunk_header(
     }
     if (error_r == 0) {
       size_t frame_size = pcm_frame_size(result);
-      if (header->data_size % frame_size != 0) {
+      size_t data_size = wav_uint32(header->data_size, result->is_big_endian);
+      if (data_size % frame_size != 0) {
         log_error("WAV: invalid header (6)");
         error_r = EINVAL;
       } else {
-        result->samples_count = header->data_size / frame_size;
+        result->samples_count = data_size / frame_size;
       }
     }
     return error_r;
@@ -196,21 +292,26 @@ pcm_validate_wav_content(
     return error_r;
   }
 
+error_t
+pcm_wav_read_spec(struct io_rf_stream *src, struct pcm_spec *spec) {
+  assert(src != NULL);
+  assert(spec != NULL);
+  *spec = (struct pcm_spec) { 0 };
+  return pcm_validate_wav_content(src, spec);
+}
+
 struct pcm_decoder_wav {
   struct pcm_decoder base;
+  off_t data_offset;
 };
 
 static error_t
-pcm_decoder_wav_decode_once(struct pcm_decoder *handler) {
+pcm_decoder_wav_seek(struct pcm_decoder *handler, size_t frame) {
   assert(handler != NULL);
-  assert(io_rf_stream_get_unread_buffer_size(handler->src) > 0);
-  assert(!io_buffer_is_full(&handler->dest));
-
-  void* data;
-  size_t count = io_rf_stream_read_array(
-    handler->src, 1, &data, io_buffer_get_available_size(&handler->dest));
-  assert(io_buffer_try_write(&handler->dest, count, data));
-  return 0;
+  struct pcm_decoder_wav *decoder = (struct pcm_decoder_wav*)handler;
+  return io_rf_stream_seek(
+    handler->src,
+    decoder->data_offset + frame * pcm_decoder_frame_size(handler));
 }
 
 static void
@@ -218,7 +319,6 @@ pcm_decoder_wav_release(struct pcm_decoder **handler) {
   assert(handler != NULL);
   struct pcm_decoder_wav *to_release = (struct pcm_decoder_wav*) *handler;
   if (to_release != NULL) {
-    io_buffer_free(&to_release->base.dest);
     free(to_release);
     *handler = NULL;
   }
@@ -227,7 +327,6 @@ pcm_decoder_wav_release(struct pcm_decoder **handler) {
 error_t
 pcm_decoder_wav_open(
   struct io_rf_stream *src,
-  size_t buffer_size,
   struct pcm_decoder **decoder) {
     log_verbose("Setting up PCM decoder for WAV");
     assert(!io_rf_stream_is_empty(src));
@@ -237,16 +336,17 @@ pcm_decoder_wav_open(
       log_error("WAV: Insufficient memory for 'pcm_decoder_wav'");
       error_r = ENOMEM;
     }
-    if (error_r == 0) {
-      error_r = io_buffer_alloc(buffer_size, &result->base.dest);
-    }
     if (error_r == 0) {
       error_r = pcm_validate_wav_content(src, &result->base.spec);
     }
     if (error_r == 0) {
       result->base.src = src;
       result->base.block_size = pcm_frame_size(&result->base.spec);
-      result->base.decode_once = &pcm_decoder_wav_decode_once;
+      result->base.is_passthrough = true;
+      result->data_offset = io_rf_stream_get_position(src);
+      // nothing to decode, frames are taken from the source buffer
+      result->base.decode_once = NULL;
+      result->base.seek = &pcm_decoder_wav_seek;
       result->base.release = &pcm_decoder_wav_release;
       *decoder = (struct pcm_decoder*)result;
     } else {
@@ -27,6 +27,20 @@ pcm_buffer_time_us(const struct pcm_spec *params, size_t size) {
     / params->samples_per_sec;
 }
 
+/**
+ * @brief PCM from both can go to the same device, samples count aside
+ */
+inline static bool
+pcm_spec_is_same_format(const struct pcm_spec *a, const struct pcm_spec *b) {
+  assert(a != NULL);
+  assert(b != NULL);
+  return a->channels_count == b->channels_count
+    && a->samples_per_sec == b->samples_per_sec
+    && a->bits_per_sample == b->bits_per_sample
+    && a->is_big_endian == b->is_big_endian
+    && a->is_signed == b->is_signed;
+}
+
 struct timespec
 pcm_spec_get_samples_time(const struct pcm_spec *params, size_t samples_count);
 
@@ -58,6 +72,29 @@ pcm_guess_format(
   const char *file_name,
   enum pcm_format *format);
 
+/**
+ * @brief ReplayGain tags of a track, gains in dB, peaks relative
+ * to full scale
+ */
+struct pcm_replay_gain {
+  bool has_track;
+  bool has_album;
+  float track_gain;
+  float track_peak;           // 0 if tag is missing
+  float album_gain;
+  float album_peak;
+};
+
+/**
+ * @brief Take REPLAYGAIN_* tag from NAME=value comment of given size,
+ * other comments are ignored.
+ */
+void
+pcm_replay_gain_parse_comment(
+  struct pcm_replay_gain *tags,
+  const char *comment,
+  size_t size);
+
 /**
  * @brief PCM stream decoder
  *
@@ -66,15 +103,32 @@ struct pcm_decoder;
 
 typedef error_t (*pcm_decoder_decode_once_f) (struct pcm_decoder *handler);
 
+typedef error_t (*pcm_decoder_seek_f) (
+  struct pcm_decoder *handler,
+  size_t frame);
+
 typedef void (*pcm_decoder_release_f) (struct pcm_decoder **handler);
 
+/**
+ * Passthrough decoder: source holds PCM as it is going to be played,
+ * so that frames are taken straight from the source buffer and dest
+ * is not allocated.
+ *
+ * Compressed block is decoded only once min_decode_size bytes of it
+ * are buffered, unless source is at EOF or its buffer is full, so that
+ * decoding never waits for I/O.
+ */
 struct pcm_decoder {
   struct io_rf_stream *src;
   struct pcm_spec spec;
   struct io_buffer dest;
   size_t block_size;
+  size_t min_decode_size;     // source bytes decoding never waits for more
+  bool is_passthrough;
+  struct pcm_replay_gain replay_gain;
 
-  pcm_decoder_decode_once_f decode_once;
+  pcm_decoder_decode_once_f decode_once;  // NULL if passthrough
+  pcm_decoder_seek_f seek;    // NULL if decoder cannot seek
   pcm_decoder_release_f release;
 };
 
@@ -93,13 +147,18 @@ pcm_decoder_frame_size(struct pcm_decoder *dec) {
 static inline bool
 pcm_decoder_is_source_empty(struct pcm_decoder *dec) {
   assert(dec != NULL);
+  if (dec->is_passthrough) {
+    // incomplete trailing frame is never played
+    return io_rf_stream_is_eof(dec->src)
+      && io_rf_stream_get_unread_buffer_size(dec->src)
+        < pcm_frame_size(&dec->spec);
+  }
   return io_rf_stream_is_empty(dec->src);
 }
 
 static inline bool
 pcm_decoder_is_source_buffer_empty(struct pcm_decoder *dec) {
-  assert(dec != NULL);
-  return io_rf_stream_is_empty(dec->src);
+  return pcm_decoder_is_source_empty(dec);
 }
 
 static inline bool
@@ -114,10 +173,19 @@ pcm_decoder_get_source_buffer_unread_size(struct pcm_decoder *dec) {
   return io_rf_stream_get_unread_buffer_size(dec->src);
 }
 
+/**
+ * @brief Source buffer holds enough to decode once without blocking,
+ * never true for passthrough decoder.
+ */
 static inline bool
 pcm_decoder_is_source_buffer_ready_to_read(struct pcm_decoder *dec) {
   assert(dec != NULL);
-  return io_rf_stream_get_unread_buffer_size(dec->src) > 0;
+  size_t unread = io_rf_stream_get_unread_buffer_size(dec->src);
+  return !dec->is_passthrough
+    && unread > 0
+    && (unread >= dec->min_decode_size
+      || io_rf_stream_is_eof(dec->src)
+      || io_rf_stream_is_buffer_full(dec->src));
 }
 
 static inline error_t
@@ -129,44 +197,81 @@ pcm_decoder_read_source(struct pcm_decoder *dec, int poll_timeout) {
   return 0;
 }
 
+static inline int
+pcm_decoder_get_source_poll_fd(struct pcm_decoder *dec) {
+  assert(dec != NULL);
+  return io_rf_stream_get_poll_fd(dec->src);
+}
+
+/**
+ * @brief Decoded frames, source buffer of passthrough decoder.
+ */
+static inline struct io_buffer*
+pcm_decoder_get_output_buffer(struct pcm_decoder *dec) {
+  assert(dec != NULL);
+  return dec->is_passthrough ? &dec->src->buffer : &dec->dest;
+}
+
 static inline bool
 pcm_decoder_is_output_buffer_empty(struct pcm_decoder *dec) {
   assert(dec != NULL);
-  return io_buffer_get_unread_size(&dec->dest) < pcm_frame_size(&dec->spec);
+  return io_buffer_get_unread_size(pcm_decoder_get_output_buffer(dec))
+    < pcm_frame_size(&dec->spec);
 }
 
 static inline bool
 pcm_decoder_is_output_buffer_full(struct pcm_decoder *dec) {
   assert(dec != NULL);
-  return io_buffer_get_available_size(&dec->dest) < dec->block_size;
+  return io_buffer_get_available_size(pcm_decoder_get_output_buffer(dec))
+    < dec->block_size;
 }
 
 static inline size_t
 pcm_decoder_get_output_buffer_frames_count(struct pcm_decoder *dec) {
   assert(dec != NULL);
-  return io_buffer_get_unread_size(&dec->dest) / pcm_frame_size(&dec->spec);
+  return io_buffer_get_unread_size(pcm_decoder_get_output_buffer(dec))
+    / pcm_frame_size(&dec->spec);
 }
 
+/**
+ * @brief Decode single block, EAGAIN if source buffer is not ready to read.
+ * Never called for passthrough decoder.
+ */
 static inline error_t
 pcm_decoder_decode_once(struct pcm_decoder *dec) {
   assert(dec != NULL);
+  assert(!dec->is_passthrough && dec->decode_once != NULL);
   return dec->decode_once(dec);
 }
 
+/**
+ * @brief Drop decoded PCM and continue decoding from given frame.
+ * Latency is added to source stream statistics.
+ */
+error_t
+pcm_decoder_seek(struct pcm_decoder *dec, size_t frame);
+
 static inline void
 pcm_decoder_decode_release(struct pcm_decoder **dec) {
   assert(dec != NULL);
   (*dec)->release(dec);
 }
 
+/**
+ * @brief Read WAV headers only, stream is left at the first frame.
+ */
+error_t
+pcm_wav_read_spec(struct io_rf_stream *src, struct pcm_spec *spec);
+
 /**
  * @brief WAV format decoder implementation
  *
+ * Frames are stored as they are played, so that the decoder
+ * is passthrough and needs no buffer of its own.
  */
 error_t
 pcm_decoder_wav_open(
   struct io_rf_stream *src,
-  size_t buffer_size,
   struct pcm_decoder **decoder);
 
 #endif
@@ -0,0 +1,313 @@
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include "pcm_convert.h"
+#include "simd.h"
+
+#ifdef PLAYER_SIMD_X86
+#include <immintrin.h>
+#endif
+
+size_t
+pcm_convert_list_formats(
+  const struct pcm_spec *spec,
+  enum pcm_convert_format formats[PCM_CONVERT_MAX_FORMATS]) {
+    assert(spec != NULL);
+    assert(formats != NULL);
+    size_t count = 0;
+    switch (spec->bits_per_sample) {
+      case 8:
+        formats[count++] = pcm_convert_format_s8;
+        formats[count++] = pcm_convert_format_s16_le;
+        formats[count++] = pcm_convert_format_s32_le;
+        break;
+      case 16:
+        formats[count++] = pcm_convert_format_s16_le;
+        formats[count++] = pcm_convert_format_s32_le;
+        break;
+      case 24:
+        formats[count++] = pcm_convert_format_s24_3le;
+        formats[count++] = pcm_convert_format_s24_le;
+        formats[count++] = pcm_convert_format_s32_le;
+        break;
+      case 32:
+        formats[count++] = pcm_convert_format_s32_le;
+        break;
+    }
+    return count;
+  }
+
+unsigned int
+pcm_convert_format_bytes(enum pcm_convert_format format) {
+  switch (format) {
+    case pcm_convert_format_s8:
+      return 1;
+    case pcm_convert_format_s16_le:
+      return 2;
+    case pcm_convert_format_s24_3le:
+      return 3;
+    case pcm_convert_format_s24_le:
+    case pcm_convert_format_s32_le:
+      return 4;
+  }
+  return 0;
+}
+
+static unsigned int
+pcm_convert_format_significant_bytes(enum pcm_convert_format format) {
+  return format == pcm_convert_format_s24_le ?
+    3 : pcm_convert_format_bytes(format);
+}
+
+error_t
+pcm_converter_init(
+  const struct pcm_spec *spec,
+  enum pcm_convert_format format,
+  struct pcm_converter *converter) {
+    assert(spec != NULL);
+    assert(converter != NULL);
+    unsigned int src_bytes = spec->bits_per_sample / 8;
+    if (src_bytes < 1 || src_bytes > 4
+      || src_bytes > pcm_convert_format_significant_bytes(format)) {
+        log_error(
+          "PCM: Cannot convert %d bit samples to format %d",
+          spec->bits_per_sample,
+          format);
+        return EINVAL;
+      }
+
+    converter->src_bytes = src_bytes;
+    // 8 bit WAV is unsigned, but it has no byte order
+    converter->is_big_endian = spec->is_big_endian && src_bytes > 1;
+    converter->is_unsigned = !spec->is_signed;
+    converter->format = format;
+    converter->dest_bytes = pcm_convert_format_bytes(format);
+    return 0;
+  }
+
+/**
+ * Sample aligned to the top of 32 bits, signed.
+ */
+inline static uint32_t
+pcm_convert_load(const struct pcm_converter *converter, const uint8_t *src) {
+  unsigned int src_bytes = converter->src_bytes;
+  uint32_t value = 0;
+  for (unsigned int b = 0; b < src_bytes; b++) {
+    uint8_t byte = converter->is_big_endian ? src[src_bytes - 1 - b] : src[b];
+    value |= (uint32_t)byte << (8 * (b + 4 - src_bytes));
+  }
+  return converter->is_unsigned ? value ^ 0x80000000u : value;
+}
+
+inline static void
+pcm_convert_store(
+  const struct pcm_converter *converter,
+  uint32_t value,
+  uint8_t *dest) {
+    unsigned int dest_bytes = converter->dest_bytes;
+    unsigned int dropped = 4 - dest_bytes;
+    if (converter->format == pcm_convert_format_s24_le) {
+      value = (uint32_t)((int32_t)value >> 8);
+    }
+    for (unsigned int b = 0; b < dest_bytes; b++) {
+      dest[b] = (uint8_t)(value >> (8 * (b + dropped)));
+    }
+  }
+
+static void
+pcm_convert_scalar(
+  const struct pcm_converter *converter,
+  const uint8_t *src,
+  size_t samples_count,
+  uint8_t *dest) {
+    for (size_t i = 0; i < samples_count; i++) {
+      pcm_convert_store(converter, pcm_convert_load(converter, src), dest);
+      src += converter->src_bytes;
+      dest += converter->dest_bytes;
+    }
+  }
+
+#ifdef PLAYER_SIMD_X86
+
+/**
+ * Byte shuffle and sign flip of count samples. Samples of 24 bits
+ * in 4 bytes are aligned to the top as well, shift puts them down.
+ */
+static void
+pcm_convert_prepare_masks(
+  const struct pcm_converter *converter,
+  unsigned int count,
+  uint8_t shuffle[16],
+  uint8_t sign[16]) {
+    unsigned int src_bytes = converter->src_bytes;
+    unsigned int dest_bytes = converter->dest_bytes;
+    // highest bit set in shuffle zeroes the byte
+    memset(shuffle, 0x80, 16);
+    memset(sign, 0, 16);
+    for (unsigned int i = 0; i < count; i++) {
+      uint8_t *sample = shuffle + i * dest_bytes + dest_bytes - src_bytes;
+      for (unsigned int b = 0; b < src_bytes; b++) {
+        sample[b] = i * src_bytes
+          + (converter->is_big_endian ? src_bytes - 1 - b : b);
+      }
+      if (converter->is_unsigned) {
+        sign[i * dest_bytes + dest_bytes - 1] = 0x80;
+      }
+    }
+  }
+
+SIMD_TARGET("sse2") static size_t
+pcm_convert_s16_sse2(
+  const struct pcm_converter *converter,
+  const uint8_t *src,
+  size_t samples_count,
+  uint8_t *dest) {
+    const __m128i sign = _mm_set1_epi16(
+      converter->is_unsigned ? (int16_t)0x8000 : 0);
+    const __m128i zero = _mm_setzero_si128();
+    bool is_widened = converter->dest_bytes == 4;
+    size_t i = 0;
+    for (; i + 8 <= samples_count; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+      if (converter->is_big_endian) {
+        x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+      }
+      x = _mm_xor_si128(x, sign);
+      if (is_widened) {
+        _mm_storeu_si128(
+          (__m128i*)(dest + 4 * i), _mm_unpacklo_epi16(zero, x));
+        _mm_storeu_si128(
+          (__m128i*)(dest + 4 * i + 16), _mm_unpackhi_epi16(zero, x));
+      } else {
+        _mm_storeu_si128((__m128i*)(dest + 2 * i), x);
+      }
+    }
+    return i;
+  }
+
+SIMD_TARGET("ssse3") static size_t
+pcm_convert_shuffle_ssse3(
+  const struct pcm_converter *converter,
+  const uint8_t *src,
+  size_t samples_count,
+  uint8_t *dest) {
+    unsigned int src_bytes = converter->src_bytes;
+    unsigned int dest_bytes = converter->dest_bytes;
+    unsigned int count = 16 / max_uint(src_bytes, dest_bytes);
+    uint8_t shuffle_bytes[16];
+    uint8_t sign_bytes[16];
+    pcm_convert_prepare_masks(converter, count, shuffle_bytes, sign_bytes);
+    const __m128i shuffle = _mm_loadu_si128((const __m128i*)shuffle_bytes);
+    const __m128i sign = _mm_loadu_si128((const __m128i*)sign_bytes);
+    bool is_shifted = converter->format == pcm_convert_format_s24_le;
+
+    size_t i = 0;
+    // loads and stores take 16 bytes, those after the last block are the tail
+    for (;
+      i * src_bytes + 16 <= samples_count * src_bytes
+      && i * dest_bytes + 16 <= samples_count * dest_bytes;
+      i += count) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i * src_bytes));
+        x = _mm_xor_si128(_mm_shuffle_epi8(x, shuffle), sign);
+        if (is_shifted) {
+          x = _mm_srai_epi32(x, 8);
+        }
+        _mm_storeu_si128((__m128i*)(dest + i * dest_bytes), x);
+      }
+    return i;
+  }
+
+SIMD_TARGET("avx2") static size_t
+pcm_convert_shuffle_avx2(
+  const struct pcm_converter *converter,
+  const uint8_t *src,
+  size_t samples_count,
+  uint8_t *dest) {
+    unsigned int src_bytes = converter->src_bytes;
+    unsigned int dest_bytes = converter->dest_bytes;
+    unsigned int count = 16 / max_uint(src_bytes, dest_bytes);
+    uint8_t shuffle_bytes[16];
+    uint8_t sign_bytes[16];
+    pcm_convert_prepare_masks(converter, count, shuffle_bytes, sign_bytes);
+    const __m256i shuffle = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*)shuffle_bytes));
+    const __m256i sign = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*)sign_bytes));
+    bool is_shifted = converter->format == pcm_convert_format_s24_le;
+
+    size_t i = 0;
+    // shuffle works within lanes, each of them takes count samples
+    for (;
+      (i + count) * src_bytes + 16 <= samples_count * src_bytes
+      && (i + count) * dest_bytes + 16 <= samples_count * dest_bytes;
+      i += 2 * count) {
+        __m256i x = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i*)(src + i * src_bytes))),
+          _mm_loadu_si128((const __m128i*)(src + (i + count) * src_bytes)),
+          1);
+        x = _mm256_xor_si256(_mm256_shuffle_epi8(x, shuffle), sign);
+        if (is_shifted) {
+          x = _mm256_srai_epi32(x, 8);
+        }
+        // bytes after the low lane block are overwritten by the high one
+        _mm_storeu_si128(
+          (__m128i*)(dest + i * dest_bytes), _mm256_castsi256_si128(x));
+        _mm_storeu_si128(
+          (__m128i*)(dest + (i + count) * dest_bytes),
+          _mm256_extracti128_si256(x, 1));
+      }
+    return i;
+  }
+
+/**
+ * Convert as many samples as vectorized kernels can, return their count.
+ */
+static size_t
+pcm_convert_simd(
+  const struct pcm_converter *converter,
+  const uint8_t *src,
+  size_t samples_count,
+  uint8_t *dest) {
+    enum simd_level level = simd_get_level();
+    if (level >= simd_level_avx2) {
+      return pcm_convert_shuffle_avx2(converter, src, samples_count, dest);
+    }
+    if (level >= simd_level_ssse3) {
+      return pcm_convert_shuffle_ssse3(converter, src, samples_count, dest);
+    }
+    if (level >= simd_level_sse2
+      && converter->src_bytes == 2
+      && (converter->format == pcm_convert_format_s16_le
+        || converter->format == pcm_convert_format_s32_le)) {
+      return pcm_convert_s16_sse2(converter, src, samples_count, dest);
+    }
+    return 0;
+  }
+
+#endif
+
+void
+pcm_convert(
+  const struct pcm_converter *converter,
+  const void *src,
+  size_t samples_count,
+  void *dest) {
+    assert(converter != NULL);
+    assert(src != NULL);
+    assert(dest != NULL);
+
+    const uint8_t *from = (const uint8_t*)src;
+    uint8_t *to = (uint8_t*)dest;
+    size_t done = 0;
+#ifdef PLAYER_SIMD_X86
+    done = pcm_convert_simd(converter, from, samples_count, to);
+#endif
+    if (done < samples_count) {
+      pcm_convert_scalar(
+        converter,
+        from + done * converter->src_bytes,
+        samples_count - done,
+        to + done * converter->dest_bytes);
+    }
+  }
@@ -0,0 +1,70 @@
+#ifndef PLAYER_PCM_CONVERT_H_
+#define PLAYER_PCM_CONVERT_H_
+
+#include <stdint.h>
+#include "pcm.h"
+
+#define PCM_CONVERT_MAX_FORMATS 3
+
+/**
+ * @brief Device sample formats PCM can be converted to,
+ * all of them signed little endian.
+ */
+enum pcm_convert_format {
+  pcm_convert_format_s8       = 1,
+  pcm_convert_format_s16_le   = 2,
+  pcm_convert_format_s24_3le  = 3,
+  pcm_convert_format_s24_le   = 4,    // low 3 bytes of 4
+  pcm_convert_format_s32_le   = 5,
+};
+
+/**
+ * @brief Sample format conversion, samples keep all their bits
+ * and wider formats get zeros below them, so that it is bit-perfect.
+ */
+struct pcm_converter {
+  unsigned int src_bytes;
+  bool is_big_endian;
+  bool is_unsigned;
+  enum pcm_convert_format format;
+  unsigned int dest_bytes;
+};
+
+/**
+ * @brief Formats PCM of given spec can be converted to, cheapest first,
+ * returns their count.
+ *
+ * Same width goes first, so that only endianness and sign are changed,
+ * then the narrowest wider format.
+ */
+size_t
+pcm_convert_list_formats(
+  const struct pcm_spec *spec,
+  enum pcm_convert_format formats[PCM_CONVERT_MAX_FORMATS]);
+
+unsigned int
+pcm_convert_format_bytes(enum pcm_convert_format format);
+
+/**
+ * @brief Set up conversion from spec, EINVAL if format is narrower.
+ */
+error_t
+pcm_converter_init(
+  const struct pcm_spec *spec,
+  enum pcm_convert_format format,
+  struct pcm_converter *converter);
+
+/**
+ * @brief Convert interleaved samples, src and dest cannot overlap.
+ *
+ * Endian swap, sign flip, 16 to 32 bit and 24 bit 3 byte to 4 byte
+ * widening use SSE2/SSSE3/AVX2 kernels when available.
+ */
+void
+pcm_convert(
+  const struct pcm_converter *converter,
+  const void *src,
+  size_t samples_count,
+  void *dest);
+
+#endif
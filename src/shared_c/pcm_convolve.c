@@ -0,0 +1,683 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "pcm_convolve.h"
+#include "simd.h"
+
+#ifdef PLAYER_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// buffers start at multiples of it, for aligned SIMD loads
+#define PCM_CONVOLVE_ALIGN 32
+// spectra are padded to whole AVX2 vectors
+#define PCM_CONVOLVE_LANES 8
+#define PCM_CONVOLVE_READ_SIZE 65536
+
+/**
+ * Real and imaginary parts of a spectrum are stride floats apart.
+ */
+typedef void (*pcm_convolve_mac_f) (
+  const float *x,
+  const float *h,
+  float *y,
+  size_t stride);
+
+/**
+ * Radix-2 FFT of size complex points, real transforms of twice that
+ * many samples are done by it.
+ */
+struct pcm_convolve_fft {
+  size_t size;
+  uint32_t *reversed;           // bit reversed indexes
+  float *twiddles;              // complex, half of butterflies per pass
+  float *real_twiddles;         // complex, e^(-i pi k / size), k <= size
+  float *work;                  // complex, size points
+};
+
+struct pcm_convolve_stage {
+  struct pcm_dsp_stage base;
+  size_t partition;
+  // impulse responses, planar
+  float *taps;
+  unsigned int ir_channels;
+  size_t taps_count;
+  unsigned int samples_per_sec;
+
+  unsigned int channels_count;
+  size_t partitions_count;
+  size_t stride;
+  struct pcm_convolve_fft fft;
+  pcm_convolve_mac_f mac;
+  float *memory;
+  // spectra of partitions, per IR channel
+  float *filters[PCM_DSP_MAX_CHANNELS];
+  // spectra of the last partitions_count input blocks, ring from head
+  float *history[PCM_DSP_MAX_CHANNELS];
+  // previous and current input block
+  float *input[PCM_DSP_MAX_CHANNELS];
+  float *output[PCM_DSP_MAX_CHANNELS];
+  float *sum;
+  float *time;
+  size_t head;
+  size_t position;
+};
+
+static void
+pcm_convolve_fft_free(struct pcm_convolve_fft *fft) {
+  free(fft->reversed);
+  free(fft->twiddles);
+  free(fft->real_twiddles);
+  free(fft->work);
+  memset(fft, 0, sizeof(struct pcm_convolve_fft));
+}
+
+static error_t
+pcm_convolve_fft_init(struct pcm_convolve_fft *fft, size_t size) {
+  fft->size = size;
+  fft->reversed = malloc(size * sizeof(uint32_t));
+  fft->twiddles = malloc(2 * size * sizeof(float));
+  fft->real_twiddles = malloc(2 * (size + 1) * sizeof(float));
+  fft->work = aligned_alloc(PCM_CONVOLVE_ALIGN, 2 * size * sizeof(float));
+  if (fft->reversed == NULL
+    || fft->twiddles == NULL
+    || fft->real_twiddles == NULL
+    || fft->work == NULL) {
+      log_error("CONVOLVE: Insufficient memory for FFT of %lu points", size);
+      pcm_convolve_fft_free(fft);
+      return ENOMEM;
+    }
+
+  unsigned int bits = 0;
+  while (((size_t)1 << bits) < size) {
+    bits++;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t reversed = 0;
+    for (unsigned int b = 0; b < bits; ++b) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    fft->reversed[i] = reversed;
+  }
+  for (size_t half = 1; half < size; half <<= 1) {
+    for (size_t j = 0; j < half; ++j) {
+      double angle = -M_PI * (double)j / (double)half;
+      fft->twiddles[2 * (half - 1 + j)] = (float)cos(angle);
+      fft->twiddles[2 * (half - 1 + j) + 1] = (float)sin(angle);
+    }
+  }
+  for (size_t k = 0; k <= size; ++k) {
+    double angle = -M_PI * (double)k / (double)size;
+    fft->real_twiddles[2 * k] = (float)cos(angle);
+    fft->real_twiddles[2 * k + 1] = (float)sin(angle);
+  }
+  return 0;
+}
+
+/**
+ * In place, data is in bit reversed order.
+ */
+static void
+pcm_convolve_fft_run(const struct pcm_convolve_fft *fft, float *data) {
+  size_t size = fft->size;
+  for (size_t half = 1; half < size; half <<= 1) {
+    const float *w = fft->twiddles + 2 * (half - 1);
+    for (size_t i = 0; i < size; i += 2 * half) {
+      float *a = data + 2 * i;
+      float *b = a + 2 * half;
+      for (size_t j = 0; j < half; ++j) {
+        float re = b[2 * j] * w[2 * j] - b[2 * j + 1] * w[2 * j + 1];
+        float im = b[2 * j] * w[2 * j + 1] + b[2 * j + 1] * w[2 * j];
+        b[2 * j] = a[2 * j] - re;
+        b[2 * j + 1] = a[2 * j + 1] - im;
+        a[2 * j] += re;
+        a[2 * j + 1] += im;
+      }
+    }
+  }
+}
+
+/**
+ * Spectrum of 2 * size real samples, bins 0 to size. Even and odd samples
+ * are transformed as complex ones and separated afterwards, result is
+ * twice the spectrum.
+ */
+static void
+pcm_convolve_forward(
+  const struct pcm_convolve_fft *fft,
+  const float *samples,
+  float *spectrum,
+  size_t stride) {
+    size_t size = fft->size;
+    float *z = fft->work;
+    for (size_t n = 0; n < size; ++n) {
+      uint32_t from = fft->reversed[n];
+      z[2 * n] = samples[2 * from];
+      z[2 * n + 1] = samples[2 * from + 1];
+    }
+    pcm_convolve_fft_run(fft, z);
+
+    float *re = spectrum;
+    float *im = spectrum + stride;
+    for (size_t k = 0; k <= size; ++k) {
+      size_t a = k == size ? 0 : k;
+      size_t b = k == 0 ? 0 : size - k;
+      // even ones are Z[k] + Z*[size - k], odd ones -i(Z[k] - Z*[size - k])
+      float even_re = z[2 * a] + z[2 * b];
+      float even_im = z[2 * a + 1] - z[2 * b + 1];
+      float odd_re = z[2 * a + 1] + z[2 * b + 1];
+      float odd_im = z[2 * b] - z[2 * a];
+      float w_re = fft->real_twiddles[2 * k];
+      float w_im = fft->real_twiddles[2 * k + 1];
+      re[k] = even_re + w_re * odd_re - w_im * odd_im;
+      im[k] = even_im + w_re * odd_im + w_im * odd_re;
+    }
+  }
+
+/**
+ * Inverse of pcm_convolve_forward, result is 2 * size times the samples.
+ */
+static void
+pcm_convolve_inverse(
+  const struct pcm_convolve_fft *fft,
+  const float *spectrum,
+  size_t stride,
+  float *samples) {
+    size_t size = fft->size;
+    float *z = fft->work;
+    const float *re = spectrum;
+    const float *im = spectrum + stride;
+    for (size_t k = 0; k < size; ++k) {
+      size_t b = size - k;
+      float even_re = re[k] + re[b];
+      float even_im = im[k] - im[b];
+      float diff_re = re[k] - re[b];
+      float diff_im = im[k] + im[b];
+      // odd ones are multiplied by conjugated twiddle
+      float w_re = fft->real_twiddles[2 * k];
+      float w_im = fft->real_twiddles[2 * k + 1];
+      float odd_re = diff_re * w_re + diff_im * w_im;
+      float odd_im = diff_im * w_re - diff_re * w_im;
+      // conjugated, so that forward transform inverts it
+      uint32_t to = fft->reversed[k];
+      z[2 * to] = even_re - odd_im;
+      z[2 * to + 1] = -(even_im + odd_re);
+    }
+    pcm_convolve_fft_run(fft, z);
+    for (size_t n = 0; n < size; ++n) {
+      samples[2 * n] = z[2 * n];
+      samples[2 * n + 1] = -z[2 * n + 1];
+    }
+  }
+
+static void
+pcm_convolve_mac_scalar(
+  const float *x,
+  const float *h,
+  float *y,
+  size_t stride) {
+    const float *x_im = x + stride;
+    const float *h_im = h + stride;
+    float *y_im = y + stride;
+    for (size_t k = 0; k < stride; ++k) {
+      y[k] += x[k] * h[k] - x_im[k] * h_im[k];
+      y_im[k] += x[k] * h_im[k] + x_im[k] * h[k];
+    }
+  }
+
+#ifdef PLAYER_SIMD_X86
+
+SIMD_TARGET("sse2") static void
+pcm_convolve_mac_sse2(
+  const float *x,
+  const float *h,
+  float *y,
+  size_t stride) {
+    const float *x_im = x + stride;
+    const float *h_im = h + stride;
+    float *y_im = y + stride;
+    for (size_t k = 0; k < stride; k += 4) {
+      __m128 xr = _mm_load_ps(x + k);
+      __m128 xi = _mm_load_ps(x_im + k);
+      __m128 hr = _mm_load_ps(h + k);
+      __m128 hi = _mm_load_ps(h_im + k);
+      _mm_store_ps(y + k, _mm_add_ps(_mm_load_ps(y + k),
+        _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi))));
+      _mm_store_ps(y_im + k, _mm_add_ps(_mm_load_ps(y_im + k),
+        _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr))));
+    }
+  }
+
+SIMD_TARGET("avx2") static void
+pcm_convolve_mac_avx2(
+  const float *x,
+  const float *h,
+  float *y,
+  size_t stride) {
+    const float *x_im = x + stride;
+    const float *h_im = h + stride;
+    float *y_im = y + stride;
+    for (size_t k = 0; k < stride; k += PCM_CONVOLVE_LANES) {
+      __m256 xr = _mm256_load_ps(x + k);
+      __m256 xi = _mm256_load_ps(x_im + k);
+      __m256 hr = _mm256_load_ps(h + k);
+      __m256 hi = _mm256_load_ps(h_im + k);
+      _mm256_store_ps(y + k, _mm256_add_ps(_mm256_load_ps(y + k),
+        _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi))));
+      _mm256_store_ps(y_im + k, _mm256_add_ps(_mm256_load_ps(y_im + k),
+        _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr))));
+    }
+  }
+
+#endif
+
+static pcm_convolve_mac_f
+pcm_convolve_get_mac() {
+#ifdef PLAYER_SIMD_X86
+  enum simd_level level = simd_get_level();
+  if (level >= simd_level_avx2) {
+    return &pcm_convolve_mac_avx2;
+  }
+  if (level >= simd_level_sse2) {
+    return &pcm_convolve_mac_sse2;
+  }
+#endif
+  return &pcm_convolve_mac_scalar;
+}
+
+/**
+ * Spectrum of the input block goes to history, it is multiplied with
+ * filter partitions, the newest one with the first partition, and sum
+ * of products is transformed back. Its second half is the output,
+ * the first one wraps around.
+ */
+static void
+pcm_convolve_block(struct pcm_convolve_stage *stage) {
+  size_t partition = stage->partition;
+  size_t stride = stage->stride;
+  size_t spectrum_size = 2 * stride;
+  for (unsigned int c = 0; c < stage->channels_count; ++c) {
+    float *history = stage->history[c];
+    const float *filter = stage->filters[
+      stage->ir_channels == 1 ? 0 : c];
+    pcm_convolve_forward(
+      &stage->fft,
+      stage->input[c],
+      history + stage->head * spectrum_size,
+      stride);
+    memcpy(
+      stage->input[c],
+      stage->input[c] + partition,
+      partition * sizeof(float));
+
+    memset(stage->sum, 0, spectrum_size * sizeof(float));
+    size_t slot = stage->head;
+    for (size_t p = 0; p < stage->partitions_count; ++p) {
+      stage->mac(
+        history + slot * spectrum_size,
+        filter + p * spectrum_size,
+        stage->sum,
+        stride);
+      slot = slot == 0 ? stage->partitions_count - 1 : slot - 1;
+    }
+    pcm_convolve_inverse(&stage->fft, stage->sum, stride, stage->time);
+    memcpy(
+      stage->output[c],
+      stage->time + partition,
+      partition * sizeof(float));
+  }
+  stage->head = (stage->head + 1) % stage->partitions_count;
+}
+
+/**
+ * Blocks of any size are buffered up to the partition, which is
+ * processed once it is complete, so frames leave partition later.
+ */
+static void
+pcm_convolve_process(
+  struct pcm_dsp_stage *handler,
+  const void *const *in,
+  void *const *out,
+  size_t frames) {
+    struct pcm_convolve_stage *stage = (struct pcm_convolve_stage*)handler;
+    size_t partition = stage->partition;
+    size_t done = 0;
+    while (done < frames) {
+      size_t count = min_size_t(frames - done, partition - stage->position);
+      for (unsigned int c = 0; c < stage->channels_count; ++c) {
+        // in place, input is taken before it is overwritten
+        memcpy(
+          stage->input[c] + partition + stage->position,
+          (const float*)in[c] + done,
+          count * sizeof(float));
+        memcpy(
+          (float*)out[c] + done,
+          stage->output[c] + stage->position,
+          count * sizeof(float));
+      }
+      stage->position += count;
+      done += count;
+      if (stage->position == partition) {
+        pcm_convolve_block(stage);
+        stage->position = 0;
+      }
+    }
+  }
+
+static void
+pcm_convolve_reset(struct pcm_dsp_stage *handler) {
+  struct pcm_convolve_stage *stage = (struct pcm_convolve_stage*)handler;
+  size_t partition = stage->partition;
+  size_t history_size = stage->partitions_count * 2 * stage->stride;
+  for (unsigned int c = 0; c < stage->channels_count; ++c) {
+    memset(stage->history[c], 0, history_size * sizeof(float));
+    memset(stage->input[c], 0, 2 * partition * sizeof(float));
+    memset(stage->output[c], 0, partition * sizeof(float));
+  }
+  stage->head = 0;
+  stage->position = 0;
+}
+
+/**
+ * Scale of both transforms is applied to filter spectra, so that
+ * blocks are not scaled at all.
+ */
+static void
+pcm_convolve_prepare_filters(struct pcm_convolve_stage *stage) {
+  size_t partition = stage->partition;
+  size_t spectrum_size = 2 * stage->stride;
+  float scale = 1.0f / (8 * partition);
+  for (unsigned int c = 0; c < stage->ir_channels; ++c) {
+    const float *taps = stage->taps + c * stage->taps_count;
+    for (size_t p = 0; p < stage->partitions_count; ++p) {
+      size_t first = p * partition;
+      size_t count = min_size_t(partition, stage->taps_count - first);
+      memset(stage->time, 0, 2 * partition * sizeof(float));
+      for (size_t i = 0; i < count; ++i) {
+        stage->time[i] = taps[first + i] * scale;
+      }
+      pcm_convolve_forward(
+        &stage->fft,
+        stage->time,
+        stage->filters[c] + p * spectrum_size,
+        stage->stride);
+    }
+  }
+}
+
+static error_t
+pcm_convolve_prepare(
+  struct pcm_dsp_stage *handler,
+  const struct pcm_spec *spec,
+  size_t max_frames) {
+    UNUSED(max_frames);
+    struct pcm_convolve_stage *stage = (struct pcm_convolve_stage*)handler;
+    if (stage->ir_channels != 1
+      && stage->ir_channels != spec->channels_count) {
+        log_error(
+          "CONVOLVE: %d IR channels for %d channels of stream",
+          stage->ir_channels,
+          spec->channels_count);
+        return EINVAL;
+      }
+    if (stage->samples_per_sec != 0
+      && stage->samples_per_sec != spec->samples_per_sec) {
+        log_error(
+          "CONVOLVE: IR of %dHz for stream of %dHz",
+          stage->samples_per_sec,
+          spec->samples_per_sec);
+        return EINVAL;
+      }
+
+    size_t partition = stage->partition;
+    stage->channels_count = spec->channels_count;
+    stage->partitions_count = (stage->taps_count + partition - 1) / partition;
+    // bins from 0 to partition
+    stage->stride = partition + PCM_CONVOLVE_LANES;
+    size_t spectrum_size = 2 * stage->stride;
+    size_t filter_size = stage->partitions_count * spectrum_size;
+    size_t channel_size = filter_size + 3 * partition;
+    size_t memory_size = stage->ir_channels * filter_size
+      + stage->channels_count * channel_size
+      + spectrum_size
+      + 2 * partition;
+    stage->memory = aligned_alloc(
+      PCM_CONVOLVE_ALIGN, memory_size * sizeof(float));
+    if (stage->memory == NULL) {
+      log_error(
+        "CONVOLVE: Insufficient memory for %lu partitions",
+        stage->partitions_count);
+      return ENOMEM;
+    }
+    error_t error_r = pcm_convolve_fft_init(&stage->fft, partition);
+    if (error_r != 0) {
+      return error_r;
+    }
+    // padding of spectra stays 0
+    memset(stage->memory, 0, memory_size * sizeof(float));
+
+    float *next = stage->memory;
+    for (unsigned int c = 0; c < stage->ir_channels; ++c) {
+      stage->filters[c] = next;
+      next += filter_size;
+    }
+    for (unsigned int c = 0; c < stage->channels_count; ++c) {
+      stage->history[c] = next;
+      stage->input[c] = next + filter_size;
+      stage->output[c] = next + filter_size + 2 * partition;
+      next += channel_size;
+    }
+    stage->sum = next;
+    stage->time = next + spectrum_size;
+    stage->mac = pcm_convolve_get_mac();
+    pcm_convolve_prepare_filters(stage);
+
+    log_verbose(
+      "CONVOLVE: %lu taps of %d channels, %lu partitions of %lu frames",
+      stage->taps_count,
+      stage->ir_channels,
+      stage->partitions_count,
+      partition);
+    return 0;
+  }
+
+/**
+ * Delayed frames and response to the last one.
+ */
+static size_t
+pcm_convolve_get_tail(const struct pcm_dsp_stage *handler) {
+  const struct pcm_convolve_stage *stage =
+    (const struct pcm_convolve_stage*)handler;
+  return stage->partition + stage->taps_count - 1;
+}
+
+static void
+pcm_convolve_release(struct pcm_dsp_stage **handler) {
+  struct pcm_convolve_stage *stage = (struct pcm_convolve_stage*)*handler;
+  pcm_convolve_fft_free(&stage->fft);
+  free(stage->memory);
+  free(stage->taps);
+  free(stage);
+  *handler = NULL;
+}
+
+error_t
+pcm_convolve_stage_open_ir(
+  const struct pcm_convolve_ir *ir,
+  size_t partition_frames,
+  struct pcm_dsp_stage **result) {
+    assert(ir != NULL);
+    assert(result != NULL);
+    size_t partition = partition_frames != 0 ?
+      partition_frames : PCM_CONVOLVE_DEFAULT_PARTITION;
+    if (partition < PCM_CONVOLVE_MIN_PARTITION
+      || partition > PCM_CONVOLVE_MAX_PARTITION
+      || (partition & (partition - 1)) != 0) {
+        log_error(
+          "CONVOLVE: Partition of %lu frames is not a power of 2 "
+          "from %d to %d",
+          partition,
+          PCM_CONVOLVE_MIN_PARTITION,
+          PCM_CONVOLVE_MAX_PARTITION);
+        return EINVAL;
+      }
+    if (ir->channels_count == 0
+      || ir->channels_count > PCM_DSP_MAX_CHANNELS
+      || ir->taps_count == 0
+      || ir->taps_count > PCM_CONVOLVE_MAX_TAPS) {
+        log_error(
+          "CONVOLVE: Unsupported IR of %lu taps of %d channels",
+          ir->taps_count,
+          ir->channels_count);
+        return EINVAL;
+      }
+
+    struct pcm_convolve_stage *stage = calloc(
+      1, sizeof(struct pcm_convolve_stage));
+    float *taps = malloc(ir->channels_count * ir->taps_count * sizeof(float));
+    if (stage == NULL || taps == NULL) {
+      log_error("CONVOLVE: Insufficient memory for 'pcm_convolve_stage'");
+      free(stage);
+      free(taps);
+      return ENOMEM;
+    }
+    for (unsigned int c = 0; c < ir->channels_count; ++c) {
+      memcpy(
+        taps + c * ir->taps_count,
+        ir->channels[c],
+        ir->taps_count * sizeof(float));
+    }
+    stage->base.name = "convolve";
+    stage->base.format = pcm_dsp_format_float;
+    stage->base.is_in_place = true;
+    stage->base.prepare = &pcm_convolve_prepare;
+    stage->base.process = &pcm_convolve_process;
+    stage->base.reset = &pcm_convolve_reset;
+    stage->base.get_latency = &pcm_convolve_stage_get_latency;
+    stage->base.get_tail = &pcm_convolve_get_tail;
+    stage->base.release = &pcm_convolve_release;
+    stage->partition = partition;
+    stage->taps = taps;
+    stage->ir_channels = ir->channels_count;
+    stage->taps_count = ir->taps_count;
+    stage->samples_per_sec = ir->samples_per_sec;
+    *result = &stage->base;
+    return 0;
+  }
+
+/**
+ * All frames of WAV file to planar floats.
+ */
+static error_t
+pcm_convolve_read_ir(
+  struct pcm_decoder *decoder,
+  float *const *channels) {
+    const struct pcm_spec *spec = &decoder->spec;
+    size_t frame_size = pcm_frame_size(spec);
+    size_t loaded = 0;
+    error_t error_r = 0;
+    while (error_r == 0 && loaded < spec->samples_count) {
+      void *data;
+      size_t count = io_rf_stream_read_array(
+        decoder->src, frame_size, &data, spec->samples_count - loaded);
+      if (count > 0) {
+        float *planes[PCM_DSP_MAX_CHANNELS];
+        for (unsigned int c = 0; c < spec->channels_count; ++c) {
+          planes[c] = channels[c] + loaded;
+        }
+        pcm_dsp_load_planes(
+          spec, data, count, pcm_dsp_format_float, (void *const *)planes);
+        loaded += count;
+      } else if (io_rf_stream_is_eof(decoder->src)) {
+        log_error("CONVOLVE: IR file is truncated");
+        error_r = EINVAL;
+      } else {
+        error_r = io_rf_stream_read_with_poll(decoder->src, -1);
+        error_r = error_r == EAGAIN ? 0 : error_r;
+      }
+    }
+    return error_r;
+  }
+
+error_t
+pcm_convolve_stage_open(
+  const struct pcm_convolve_parameters *params,
+  struct pcm_dsp_stage **result) {
+    assert(params != NULL);
+    assert(params->ir_path != NULL);
+    assert(result != NULL);
+    struct io_rf_stream stream = { 0 };
+    struct pcm_decoder *decoder = NULL;
+    float *taps = NULL;
+    error_t error_r = io_rf_stream_open_file(
+      params->ir_path,
+      PCM_CONVOLVE_READ_SIZE,
+      PCM_CONVOLVE_READ_SIZE,
+      &stream);
+    if (error_r == 0) {
+      error_r = pcm_decoder_wav_open(&stream, &decoder);
+    }
+
+    const struct pcm_spec *spec = decoder != NULL ? &decoder->spec : NULL;
+    if (error_r == 0 && (spec->channels_count == 0
+      || spec->channels_count > PCM_DSP_MAX_CHANNELS
+      || spec->bits_per_sample == 0
+      || spec->bits_per_sample > 32
+      || spec->bits_per_sample % 8 != 0
+      || spec->samples_count == 0
+      || spec->samples_count > PCM_CONVOLVE_MAX_TAPS)) {
+        log_error(
+          "CONVOLVE: Unsupported IR of %lu frames of %d channels of %d bits",
+          spec->samples_count,
+          spec->channels_count,
+          spec->bits_per_sample);
+        error_r = EINVAL;
+      }
+    if (error_r == 0) {
+      taps = malloc(
+        spec->channels_count * spec->samples_count * sizeof(float));
+      if (taps == NULL) {
+        log_error("CONVOLVE: Insufficient memory for IR");
+        error_r = ENOMEM;
+      }
+    }
+    float *channels[PCM_DSP_MAX_CHANNELS];
+    if (error_r == 0) {
+      for (unsigned int c = 0; c < spec->channels_count; ++c) {
+        channels[c] = taps + c * spec->samples_count;
+      }
+      error_r = pcm_convolve_read_ir(decoder, channels);
+    }
+    if (error_r == 0) {
+      const struct pcm_convolve_ir ir = {
+        .channels = (const float *const *)channels,
+        .channels_count = spec->channels_count,
+        .taps_count = spec->samples_count,
+        .samples_per_sec = spec->samples_per_sec,
+      };
+      error_r = pcm_convolve_stage_open_ir(
+        &ir, params->partition_frames, result);
+    }
+    if (error_r != 0) {
+      log_error("CONVOLVE: Cannot load IR [%s]", params->ir_path);
+    }
+
+    free(taps);
+    if (decoder != NULL) {
+      pcm_decoder_decode_release(&decoder);
+    }
+    io_rf_stream_free(&stream);
+    return error_r;
+  }
+
+size_t
+pcm_convolve_stage_get_latency(const struct pcm_dsp_stage *handler) {
+  assert(handler != NULL);
+  const struct pcm_convolve_stage *stage =
+    (const struct pcm_convolve_stage*)handler;
+  return stage->partition;
+}
@@ -0,0 +1,62 @@
+#ifndef PLAYER_PCM_CONVOLVE_H_
+#define PLAYER_PCM_CONVOLVE_H_
+
+#include "pcm_dsp.h"
+
+// partition is a power of 2 in this range, it is the latency of the stage
+#define PCM_CONVOLVE_MIN_PARTITION 32
+#define PCM_CONVOLVE_MAX_PARTITION 16384
+#define PCM_CONVOLVE_DEFAULT_PARTITION 1024
+// about 11s at 96kHz
+#define PCM_CONVOLVE_MAX_TAPS (1 << 20)
+
+struct pcm_convolve_parameters {
+  const char *ir_path;
+  size_t partition_frames;    // PCM_CONVOLVE_DEFAULT_PARTITION if 0
+};
+
+/**
+ * @brief Impulse responses, planar floats, one per channel.
+ */
+struct pcm_convolve_ir {
+  const float *const *channels;
+  unsigned int channels_count;
+  size_t taps_count;
+  unsigned int samples_per_sec;
+};
+
+/**
+ * @brief Room correction stage, convolution with impulse responses
+ *
+ * Filter is split into partitions of partition_frames taps, whose spectra
+ * are computed once, each block of that many input frames is transformed
+ * and multiplied with all of them against spectra of previous blocks
+ * (uniformly partitioned overlap-save). Complex multiply-accumulate
+ * dominates for long filters, it runs in SSE2 or AVX2 kernel.
+ *
+ * Output is delayed by partition_frames, that many frames and the
+ * response of the filter are its tail after the last frame. Larger
+ * partitions need fewer multiplications per frame, so they trade
+ * latency for CPU.
+ *
+ * IR of a single channel applies to all of them, otherwise it needs
+ * as many channels as the stream and the same sample rate.
+ */
+error_t
+pcm_convolve_stage_open(
+  const struct pcm_convolve_parameters *params,
+  struct pcm_dsp_stage **result);
+
+/**
+ * @brief Open stage with impulse responses from memory, they are copied.
+ */
+error_t
+pcm_convolve_stage_open_ir(
+  const struct pcm_convolve_ir *ir,
+  size_t partition_frames,
+  struct pcm_dsp_stage **result);
+
+size_t
+pcm_convolve_stage_get_latency(const struct pcm_dsp_stage *stage);
+
+#endif
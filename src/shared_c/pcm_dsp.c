@@ -0,0 +1,407 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "pcm_dsp.h"
+
+// planes start at multiples of it, for aligned SIMD loads
+#define PCM_DSP_ALIGN 32
+
+struct pcm_dsp_chain {
+  struct pcm_spec spec;
+  size_t max_frames;
+  struct pcm_dsp_stage *stages[PCM_DSP_MAX_STAGES];
+  size_t stages_count;
+
+  // two planar blocks, stages which are not in place switch between them
+  void *buffer;
+  void *planes[2][PCM_DSP_MAX_CHANNELS];
+
+  atomic_ulong stage_frames[PCM_DSP_MAX_STAGES];
+  atomic_ulong stage_ns[PCM_DSP_MAX_STAGES];
+  atomic_ulong format_frames;
+  atomic_ulong format_ns;
+};
+
+/**
+ * CPU time of the calling thread, so that preemption does not count.
+ */
+static unsigned long
+pcm_dsp_cpu_ns() {
+  struct timespec now;
+  int result = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  assert(result == 0);
+  UNUSED(result);
+  return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+error_t
+pcm_dsp_chain_open(
+  const struct pcm_spec *spec,
+  size_t max_frames,
+  struct pcm_dsp_stage *const *stages,
+  size_t stages_count,
+  struct pcm_dsp_chain **result) {
+    assert(spec != NULL);
+    assert(stages != NULL || stages_count == 0);
+    assert(result != NULL);
+    error_t error_r = 0;
+
+    struct pcm_dsp_chain *chain = calloc(1, sizeof(struct pcm_dsp_chain));
+    if (chain == NULL) {
+      log_error("DSP: Insufficient memory for 'pcm_dsp_chain'");
+      error_r = ENOMEM;
+    }
+    // chain owns stages from now on
+    for (size_t i = 0; i < stages_count; i++) {
+      struct pcm_dsp_stage *stage = stages[i];
+      if (chain != NULL && i < PCM_DSP_MAX_STAGES) {
+        chain->stages[chain->stages_count++] = stage;
+      } else {
+        pcm_dsp_stage_release(&stage);
+      }
+    }
+    if (error_r != 0) {
+      return error_r;
+    }
+
+    if (stages_count > PCM_DSP_MAX_STAGES
+      || spec->channels_count == 0
+      || spec->channels_count > PCM_DSP_MAX_CHANNELS
+      || spec->bits_per_sample == 0
+      || spec->bits_per_sample > 32
+      || spec->bits_per_sample % 8 != 0
+      || max_frames == 0) {
+        log_error(
+          "DSP: Unsupported %d stages for %d channels of %d bits",
+          stages_count,
+          spec->channels_count,
+          spec->bits_per_sample);
+        error_r = EINVAL;
+      }
+
+    size_t plane_size = 0;
+    if (error_r == 0) {
+      chain->spec = *spec;
+      chain->max_frames = max_frames;
+      plane_size = (max_frames * sizeof(int32_t) + PCM_DSP_ALIGN - 1)
+        / PCM_DSP_ALIGN * PCM_DSP_ALIGN;
+      chain->buffer = aligned_alloc(
+        PCM_DSP_ALIGN, 2 * spec->channels_count * plane_size);
+      if (chain->buffer == NULL) {
+        log_error("DSP: Insufficient memory for working buffers");
+        error_r = ENOMEM;
+      }
+    }
+    if (error_r == 0) {
+      for (unsigned int b = 0; b < 2; b++) {
+        for (unsigned int c = 0; c < spec->channels_count; c++) {
+          chain->planes[b][c] = (char*)chain->buffer  // NOLINT
+            + (b * spec->channels_count + c) * plane_size;
+        }
+      }
+    }
+    for (size_t i = 0; error_r == 0 && i < chain->stages_count; i++) {
+      struct pcm_dsp_stage *stage = chain->stages[i];
+      if (stage->prepare != NULL) {
+        error_r = stage->prepare(stage, spec, max_frames);
+      }
+    }
+
+    if (error_r == 0) {
+      for (size_t i = 0; i < chain->stages_count; i++) {
+        atomic_init(&chain->stage_frames[i], 0);
+        atomic_init(&chain->stage_ns[i], 0);
+        log_verbose("DSP: stage %d: %s", i, chain->stages[i]->name);
+      }
+      atomic_init(&chain->format_frames, 0);
+      atomic_init(&chain->format_ns, 0);
+      *result = chain;
+    } else {
+      pcm_dsp_chain_release(&chain);
+    }
+    return error_r;
+  }
+
+/**
+ * Interleaved spec samples to planar ones, aligned to the top of 32 bits.
+ */
+static void
+pcm_dsp_load(
+  const struct pcm_spec *spec,
+  const uint8_t *src,
+  size_t frames,
+  void *const *planes) {
+    unsigned int channels = spec->channels_count;
+    unsigned int bytes = spec->bits_per_sample / 8;
+    // 8 bit WAV is unsigned, but it has no byte order
+    bool is_big_endian = spec->is_big_endian && bytes > 1;
+    uint32_t sign = spec->is_signed ? 0 : 0x80000000u;
+
+    if (bytes == 2 && !is_big_endian && spec->is_signed) {
+      // the most common one, simple enough to be vectorized
+      for (unsigned int c = 0; c < channels; c++) {
+        int32_t *dest = (int32_t*)planes[c];
+        const uint8_t *sample = src + 2 * c;
+        for (size_t i = 0; i < frames; i++) {
+          int16_t value;
+          memcpy(&value, sample + i * 2 * channels, sizeof(value));
+          dest[i] = (int32_t)((uint32_t)(uint16_t)value << 16);
+        }
+      }
+      return;
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+      for (unsigned int c = 0; c < channels; c++) {
+        uint32_t value = 0;
+        for (unsigned int b = 0; b < bytes; b++) {
+          uint8_t byte = is_big_endian ? src[bytes - 1 - b] : src[b];
+          value |= (uint32_t)byte << (8 * (b + 4 - bytes));
+        }
+        ((int32_t*)planes[c])[i] = (int32_t)(value ^ sign);
+        src += bytes;
+      }
+    }
+  }
+
+/**
+ * Planar samples back to interleaved spec ones, rounded to the nearest.
+ */
+static void
+pcm_dsp_store(
+  const struct pcm_spec *spec,
+  void *const *planes,
+  size_t frames,
+  uint8_t *dest) {
+    unsigned int channels = spec->channels_count;
+    unsigned int bits = spec->bits_per_sample;
+    unsigned int bytes = bits / 8;
+    unsigned int shift = 32 - bits;
+    bool is_big_endian = spec->is_big_endian && bytes > 1;
+    uint32_t sign = spec->is_signed ? 0 : 1u << (bits - 1);
+    int64_t max = ((int64_t)1 << (bits - 1)) - 1;
+    int64_t half = shift > 0 ? (int64_t)1 << (shift - 1) : 0;
+
+    for (size_t i = 0; i < frames; i++) {
+      for (unsigned int c = 0; c < channels; c++) {
+        int64_t value = (((int64_t)((const int32_t*)planes[c])[i]) + half)
+          >> shift;
+        uint32_t sample = (uint32_t)(value > max ? max : value) ^ sign;
+        for (unsigned int b = 0; b < bytes; b++) {
+          unsigned int to = is_big_endian ? bytes - 1 - b : b;
+          dest[to] = (uint8_t)(sample >> (8 * b));
+        }
+        dest += bytes;
+      }
+    }
+  }
+
+static void
+pcm_dsp_change_format(
+  void *const *planes,
+  unsigned int channels,
+  size_t frames,
+  enum pcm_dsp_format format) {
+    for (unsigned int c = 0; c < channels; c++) {
+      // both take 32 bits, conversion is in place
+      float *floats = (float*)planes[c];
+      int32_t *ints = (int32_t*)planes[c];
+      if (format == pcm_dsp_format_float) {
+        for (size_t i = 0; i < frames; i++) {
+          floats[i] = (float)ints[i] * (1.0f / 2147483648.0f);
+        }
+      } else {
+        for (size_t i = 0; i < frames; i++) {
+          float value = floats[i] * 2147483648.0f;
+          if (value >= 2147483648.0f) {
+            ints[i] = INT32_MAX;
+          } else if (value <= -2147483648.0f) {
+            ints[i] = INT32_MIN;
+          } else {
+            ints[i] = (int32_t)lrintf(value);
+          }
+        }
+      }
+    }
+  }
+
+void
+pcm_dsp_load_planes(
+  const struct pcm_spec *spec,
+  const void *src,
+  size_t frames,
+  enum pcm_dsp_format format,
+  void *const *planes) {
+    assert(spec != NULL);
+    assert(src != NULL || frames == 0);
+    assert(planes != NULL);
+    pcm_dsp_load(spec, (const uint8_t*)src, frames, planes);
+    if (format != pcm_dsp_format_int32) {
+      pcm_dsp_change_format(planes, spec->channels_count, frames, format);
+    }
+  }
+
+static void
+pcm_dsp_chain_process_block(
+  struct pcm_dsp_chain *chain,
+  const uint8_t *in,
+  size_t frames,
+  uint8_t *out) {
+    unsigned int channels = chain->spec.channels_count;
+    unsigned long started = pcm_dsp_cpu_ns();
+    if (in != NULL) {
+      pcm_dsp_load(&chain->spec, in, frames, chain->planes[0]);
+    } else {
+      for (unsigned int c = 0; c < channels; c++) {
+        memset(chain->planes[0][c], 0, frames * sizeof(int32_t));
+      }
+    }
+    enum pcm_dsp_format format = pcm_dsp_format_int32;
+    unsigned int current = 0;
+    unsigned long now = pcm_dsp_cpu_ns();
+    unsigned long format_ns = now - started;
+
+    for (size_t i = 0; i < chain->stages_count; i++) {
+      struct pcm_dsp_stage *stage = chain->stages[i];
+      if (stage->format != format) {
+        pcm_dsp_change_format(
+          chain->planes[current], channels, frames, stage->format);
+        format = stage->format;
+        started = now;
+        now = pcm_dsp_cpu_ns();
+        format_ns += now - started;
+      }
+
+      unsigned int next = stage->is_in_place ? current : 1 - current;
+      stage->process(
+        stage,
+        (const void *const *)chain->planes[current],
+        chain->planes[next],
+        frames);
+      current = next;
+      started = now;
+      now = pcm_dsp_cpu_ns();
+      atomic_fetch_add(&chain->stage_ns[i], now - started);
+      atomic_fetch_add(&chain->stage_frames[i], frames);
+    }
+
+    if (format != pcm_dsp_format_int32) {
+      pcm_dsp_change_format(
+        chain->planes[current], channels, frames, pcm_dsp_format_int32);
+    }
+    pcm_dsp_store(&chain->spec, chain->planes[current], frames, out);
+    format_ns += pcm_dsp_cpu_ns() - now;
+    atomic_fetch_add(&chain->format_ns, format_ns);
+    atomic_fetch_add(&chain->format_frames, frames);
+  }
+
+void
+pcm_dsp_chain_process(
+  struct pcm_dsp_chain *chain,
+  const void *in,
+  size_t frames,
+  void *out) {
+    assert(chain != NULL);
+    assert(out != NULL);
+    size_t frame_size = pcm_frame_size(&chain->spec);
+    for (size_t done = 0; done < frames; done += chain->max_frames) {
+      // whole block is loaded before it is stored, so in may be out
+      pcm_dsp_chain_process_block(
+        chain,
+        in != NULL ? (const uint8_t*)in + done * frame_size : NULL,
+        min_size_t(frames - done, chain->max_frames),
+        (uint8_t*)out + done * frame_size);
+    }
+  }
+
+size_t
+pcm_dsp_chain_get_max_frames(const struct pcm_dsp_chain *chain) {
+  assert(chain != NULL);
+  return chain->max_frames;
+}
+
+void
+pcm_dsp_chain_reset(struct pcm_dsp_chain *chain) {
+  assert(chain != NULL);
+  for (size_t i = 0; i < chain->stages_count; i++) {
+    struct pcm_dsp_stage *stage = chain->stages[i];
+    if (stage->reset != NULL) {
+      stage->reset(stage);
+    }
+  }
+}
+
+size_t
+pcm_dsp_chain_get_latency(const struct pcm_dsp_chain *chain) {
+  assert(chain != NULL);
+  size_t result = 0;
+  for (size_t i = 0; i < chain->stages_count; i++) {
+    const struct pcm_dsp_stage *stage = chain->stages[i];
+    if (stage->get_latency != NULL) {
+      result += stage->get_latency(stage);
+    }
+  }
+  return result;
+}
+
+size_t
+pcm_dsp_chain_get_tail(const struct pcm_dsp_chain *chain) {
+  assert(chain != NULL);
+  // tail of a stage passes through all of the following ones
+  size_t result = 0;
+  for (size_t i = 0; i < chain->stages_count; i++) {
+    const struct pcm_dsp_stage *stage = chain->stages[i];
+    if (stage->get_tail != NULL) {
+      result += stage->get_tail(stage);
+    }
+  }
+  return result;
+}
+
+static struct timespec
+pcm_dsp_get_timespec(unsigned long ns) {
+  return (struct timespec) {
+    .tv_sec = ns / 1000000000ul,
+    .tv_nsec = ns % 1000000000ul
+  };
+}
+
+void
+pcm_dsp_chain_get_statistics(
+  struct pcm_dsp_chain *chain,
+  struct pcm_dsp_statistics *result) {
+    assert(chain != NULL);
+    assert(result != NULL);
+    result->stages_count = chain->stages_count;
+    for (size_t i = 0; i < chain->stages_count; i++) {
+      result->stages[i] = (struct pcm_dsp_stage_statistics) {
+        .name = chain->stages[i]->name,
+        .frames = atomic_load(&chain->stage_frames[i]),
+        .cpu_time = pcm_dsp_get_timespec(atomic_load(&chain->stage_ns[i]))
+      };
+    }
+    result->format = (struct pcm_dsp_stage_statistics) {
+      .name = "format",
+      .frames = atomic_load(&chain->format_frames),
+      .cpu_time = pcm_dsp_get_timespec(atomic_load(&chain->format_ns))
+    };
+  }
+
+void
+pcm_dsp_chain_release(struct pcm_dsp_chain **chain) {
+  assert(chain != NULL);
+  struct pcm_dsp_chain *to_release = *chain;
+  if (to_release != NULL) {
+    for (size_t i = 0; i < to_release->stages_count; i++) {
+      pcm_dsp_stage_release(&to_release->stages[i]);
+    }
+    free(to_release->buffer);
+    free(to_release);
+    *chain = NULL;
+  }
+}
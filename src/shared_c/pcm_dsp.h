@@ -0,0 +1,167 @@
+#ifndef PLAYER_PCM_DSP_H_
+#define PLAYER_PCM_DSP_H_
+
+#include <time.h>
+#include "pcm.h"
+
+#define PCM_DSP_MAX_STAGES 8
+#define PCM_DSP_MAX_CHANNELS 8
+
+/**
+ * @brief Working format of a stage, planar 32 bit samples.
+ *
+ * Int32 samples take the whole range, i.e. 16 bit PCM is shifted
+ * to the top bits, floats are in [-1, 1).
+ */
+enum pcm_dsp_format {
+  pcm_dsp_format_float  = 1,
+  pcm_dsp_format_int32  = 2,
+};
+
+struct pcm_dsp_stage;
+
+/**
+ * @brief Allocate everything processing needs, called once
+ * by pcm_dsp_chain_open, frames are never processed in larger blocks.
+ */
+typedef error_t (*pcm_dsp_prepare_f) (
+  struct pcm_dsp_stage *stage,
+  const struct pcm_spec *spec,
+  size_t max_frames);
+
+/**
+ * @brief Process frames of in planes into out planes, which are the same
+ * for in place stages. Planes are 32 byte aligned.
+ */
+typedef void (*pcm_dsp_process_f) (
+  struct pcm_dsp_stage *stage,
+  const void *const *in,
+  void *const *out,
+  size_t frames);
+
+/**
+ * @brief Forget frames processed so far, i.e. after seeking.
+ */
+typedef void (*pcm_dsp_reset_f) (struct pcm_dsp_stage *stage);
+
+/**
+ * @brief Frames of latency, or of tail which is still in the stage
+ * after the last frame, i.e. delayed frames and filter response.
+ */
+typedef size_t (*pcm_dsp_get_frames_f) (const struct pcm_dsp_stage *stage);
+
+typedef void (*pcm_dsp_release_f) (struct pcm_dsp_stage **stage);
+
+/**
+ * @brief Processing stage between decoder and sink
+ *
+ * Stages embed it as their first member, like sinks do.
+ */
+struct pcm_dsp_stage {
+  const char *name;
+  enum pcm_dsp_format format;
+  bool is_in_place;
+  pcm_dsp_prepare_f prepare;    // NULL if there is nothing to allocate
+  pcm_dsp_process_f process;
+  pcm_dsp_reset_f reset;        // NULL without state
+  pcm_dsp_get_frames_f get_latency;  // NULL if output is not delayed
+  pcm_dsp_get_frames_f get_tail;     // NULL if output ends with input
+  pcm_dsp_release_f release;
+};
+
+static inline void
+pcm_dsp_stage_release(struct pcm_dsp_stage **stage) {
+  assert(stage != NULL);
+  if (*stage != NULL) {
+    (*stage)->release(stage);
+  }
+}
+
+/**
+ * @brief Convert interleaved frames of spec format to planes
+ * of given format, i.e. to load coefficients of a stage.
+ */
+void
+pcm_dsp_load_planes(
+  const struct pcm_spec *spec,
+  const void *src,
+  size_t frames,
+  enum pcm_dsp_format format,
+  void *const *planes);
+
+/**
+ * @brief Stages run in given order on blocks of up to max_frames,
+ * PCM is converted to planar format when block enters the chain
+ * and back to spec format when it leaves it.
+ *
+ * Working buffers are allocated here, so that processing never allocates.
+ * Chain releases stages, even if it fails to open.
+ */
+struct pcm_dsp_chain;
+
+error_t
+pcm_dsp_chain_open(
+  const struct pcm_spec *spec,
+  size_t max_frames,
+  struct pcm_dsp_stage *const *stages,
+  size_t stages_count,
+  struct pcm_dsp_chain **result);
+
+/**
+ * @brief Process interleaved frames of spec format, in may be out.
+ * Silence is processed if in is NULL, i.e. to play out the tail.
+ */
+void
+pcm_dsp_chain_process(
+  struct pcm_dsp_chain *chain,
+  const void *in,
+  size_t frames,
+  void *out);
+
+size_t
+pcm_dsp_chain_get_max_frames(const struct pcm_dsp_chain *chain);
+
+void
+pcm_dsp_chain_reset(struct pcm_dsp_chain *chain);
+
+/**
+ * @brief Frames output of the chain is delayed by.
+ */
+size_t
+pcm_dsp_chain_get_latency(const struct pcm_dsp_chain *chain);
+
+/**
+ * @brief Frames of silence which play out what is left in stages
+ * after the last frame.
+ */
+size_t
+pcm_dsp_chain_get_tail(const struct pcm_dsp_chain *chain);
+
+/**
+ * @brief Frames processed by a stage and CPU time spent on them,
+ * format is the conversion between stream and stage formats.
+ */
+struct pcm_dsp_stage_statistics {
+  const char *name;
+  size_t frames;
+  struct timespec cpu_time;
+};
+
+struct pcm_dsp_statistics {
+  size_t stages_count;
+  struct pcm_dsp_stage_statistics stages[PCM_DSP_MAX_STAGES];
+  struct pcm_dsp_stage_statistics format;
+};
+
+/**
+ * @brief Get statistics, can be called from any thread.
+ */
+void
+pcm_dsp_chain_get_statistics(
+  struct pcm_dsp_chain *chain,
+  struct pcm_dsp_statistics *result);
+
+void
+pcm_dsp_chain_release(struct pcm_dsp_chain **chain);
+
+#endif
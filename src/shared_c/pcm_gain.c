@@ -0,0 +1,490 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "pcm_gain.h"
+#include "simd.h"
+
+#ifdef PLAYER_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define PCM_GAIN_UNITY ((int32_t)1 << PCM_GAIN_SHIFT)
+#define PCM_GAIN_ROUND ((int64_t)1 << (PCM_GAIN_SHIFT - 1))
+// below it gain is 0, volume is kept in 1/100 dB
+#define PCM_GAIN_MIN_DB -150.0
+// dither generators per channel, one per AVX2 lane
+#define PCM_GAIN_LANES 8
+
+/**
+ * Requantization to the stream bit depth, undithered one keeps all 32 bits.
+ */
+struct pcm_gain_quantizer {
+  bool is_dithered;
+  int64_t lsb;
+  int64_t max;                  // largest multiple of lsb
+  // TPDF of 16 bit halves scaled to lsb
+  unsigned int dither_right;
+  unsigned int dither_left;
+};
+
+typedef void (*pcm_gain_apply_f) (
+  const struct pcm_gain_quantizer *quantizer,
+  const int32_t *in,
+  int32_t *out,
+  size_t count,
+  int32_t gain,
+  uint32_t *lanes);
+
+struct pcm_gain_stage {
+  struct pcm_dsp_stage base;
+  enum pcm_dither dither;
+  // targets in 1/100 dB, set by any thread
+  atomic_int volume;
+  atomic_int replay_gain;
+
+  unsigned int channels_count;
+  struct pcm_gain_quantizer quantizer;
+  pcm_gain_apply_f apply;
+  bool is_started;
+  int target;
+  // multiplier moves from ramp_from to gain over ramp_frames
+  int32_t gain;
+  int32_t ramp_from;
+  size_t ramp_frames;
+  size_t ramp_position;
+  uint32_t lanes[PCM_DSP_MAX_CHANNELS][PCM_GAIN_LANES];
+  int64_t errors[PCM_DSP_MAX_CHANNELS][2];
+};
+
+const char*
+pcm_replay_gain_mode_name(enum pcm_replay_gain_mode mode) {
+  switch (mode) {
+    case pcm_replay_gain_track:
+      return "track";
+    case pcm_replay_gain_album:
+      return "album";
+  }
+  return "unknown";
+}
+
+double
+pcm_replay_gain_get_db(
+  const struct pcm_replay_gain *tags,
+  enum pcm_replay_gain_mode mode) {
+    assert(tags != NULL);
+    bool is_album = mode == pcm_replay_gain_album && tags->has_album;
+    if (!is_album && !tags->has_track) {
+      return 0;
+    }
+    double gain = is_album ? tags->album_gain : tags->track_gain;
+    double peak = is_album ? tags->album_peak : tags->track_peak;
+    if (peak > 0) {
+      gain = fmin(gain, -20 * log10(peak));
+    }
+    return gain;
+  }
+
+const char*
+pcm_dither_name(enum pcm_dither dither) {
+  switch (dither) {
+    case pcm_dither_none:
+      return "none";
+    case pcm_dither_tpdf:
+      return "tpdf";
+    case pcm_dither_shaped:
+      return "shaped";
+  }
+  return "unknown";
+}
+
+static int
+pcm_gain_db_to_target(double gain_db) {
+  return (int)lround(
+    100 * fmax(PCM_GAIN_MIN_DB, fmin(PCM_GAIN_MAX_DB, gain_db)));
+}
+
+static int32_t
+pcm_gain_target_to_multiplier(int target) {
+  if (target <= PCM_GAIN_MIN_DB * 100) {
+    return 0;
+  }
+  double gain = pow(10, target / 2000.0) * PCM_GAIN_UNITY;
+  return gain >= INT32_MAX ? INT32_MAX : (int32_t)lrint(gain);
+}
+
+/**
+ * Xorshift, cheap and good enough for dither.
+ */
+static inline uint32_t
+pcm_gain_next_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+ * Difference of two uniform values is triangular, [-1, 1) LSB.
+ */
+static inline int64_t
+pcm_gain_tpdf(const struct pcm_gain_quantizer *quantizer, uint32_t *state) {
+  uint32_t random = pcm_gain_next_random(state);
+  int32_t value = (int32_t)(random & 0xffff) - (int32_t)(random >> 16);
+  return (int64_t)(value >> quantizer->dither_right)
+    * ((int64_t)1 << quantizer->dither_left);
+}
+
+static inline int64_t
+pcm_gain_multiply(int32_t sample, int32_t gain) {
+  return ((int64_t)sample * gain + PCM_GAIN_ROUND) >> PCM_GAIN_SHIFT;
+}
+
+static inline int32_t
+pcm_gain_clamp(const struct pcm_gain_quantizer *quantizer, int64_t value) {
+  return value < INT32_MIN ?
+    INT32_MIN : value > quantizer->max ? quantizer->max : value;
+}
+
+static inline int32_t
+pcm_gain_sample(
+  const struct pcm_gain_quantizer *quantizer,
+  int32_t sample,
+  int32_t gain,
+  uint32_t *lane) {
+    int64_t value = pcm_gain_multiply(sample, gain);
+    if (quantizer->is_dithered) {
+      value += pcm_gain_tpdf(quantizer, lane) + quantizer->lsb / 2;
+      value &= -quantizer->lsb;
+    }
+    return pcm_gain_clamp(quantizer, value);
+  }
+
+/**
+ * Quantization error is fed back, so that the output one is shaped
+ * by (1 - z^-1)^2. Error is taken before clipping, so that it stays
+ * within 2 LSB.
+ */
+static inline int32_t
+pcm_gain_sample_shaped(
+  const struct pcm_gain_quantizer *quantizer,
+  int32_t sample,
+  int32_t gain,
+  uint32_t *lane,
+  int64_t *errors) {
+    int64_t wanted = pcm_gain_multiply(sample, gain)
+      - 2 * errors[0] + errors[1];
+    int64_t value = (wanted + pcm_gain_tpdf(quantizer, lane)
+      + quantizer->lsb / 2) & -quantizer->lsb;
+    errors[1] = errors[0];
+    errors[0] = value - wanted;
+    return pcm_gain_clamp(quantizer, value);
+  }
+
+/**
+ * Sample i is dithered by generator of lane i % PCM_GAIN_LANES,
+ * like in vectorized kernel. Generators are copied, so that they stay
+ * in registers, output might alias them otherwise.
+ */
+static void
+pcm_gain_apply_scalar(
+  const struct pcm_gain_quantizer *quantizer,
+  const int32_t *in,
+  int32_t *out,
+  size_t count,
+  int32_t gain,
+  uint32_t *lanes) {
+    const struct pcm_gain_quantizer local = *quantizer;
+    uint32_t states[PCM_GAIN_LANES];
+    memcpy(states, lanes, sizeof(states));
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = pcm_gain_sample(
+        &local, in[i], gain, &states[i % PCM_GAIN_LANES]);
+    }
+    memcpy(lanes, states, sizeof(states));
+  }
+
+#ifdef PLAYER_SIMD_X86
+
+SIMD_TARGET("avx2") static inline __m256i
+pcm_gain_clamp_avx2(__m256i value, __m256i min, __m256i max) {
+  value = _mm256_blendv_epi8(value, max, _mm256_cmpgt_epi64(value, max));
+  return _mm256_blendv_epi8(value, min, _mm256_cmpgt_epi64(min, value));
+}
+
+/**
+ * Products of even and odd samples are 64 bit, AVX2 has no arithmetic
+ * shift of them, so it is logical one of the product offset by 2^63.
+ */
+SIMD_TARGET("avx2") static void
+pcm_gain_apply_avx2(
+  const struct pcm_gain_quantizer *quantizer,
+  const int32_t *in,
+  int32_t *out,
+  size_t count,
+  int32_t gain,
+  uint32_t *lanes) {
+    const __m256i multiplier = _mm256_set1_epi32(gain);
+    const __m256i round = _mm256_set1_epi64x(PCM_GAIN_ROUND);
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i offset = _mm256_set1_epi64x(
+      (quantizer->is_dithered ? quantizer->lsb / 2 : 0)
+      - ((int64_t)1 << (63 - PCM_GAIN_SHIFT)));
+    const __m256i mask = _mm256_set1_epi64x(-quantizer->lsb);
+    const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+    const __m256i max = _mm256_set1_epi64x(quantizer->max);
+    const __m256i low = _mm256_set1_epi32(0xffff);
+    // even samples to the lower half, odd ones to the upper one
+    const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m128i right = _mm_cvtsi32_si128(quantizer->dither_right);
+    const __m128i left = _mm_cvtsi32_si128(quantizer->dither_left);
+    __m256i state = _mm256_loadu_si256((const __m256i*)lanes);
+
+    size_t i = 0;
+    for (; i + PCM_GAIN_LANES <= count; i += PCM_GAIN_LANES) {
+      __m256i samples = _mm256_loadu_si256((const __m256i*)(in + i));
+      __m256i even = _mm256_mul_epi32(samples, multiplier);
+      __m256i odd = _mm256_mul_epi32(
+        _mm256_srli_epi64(samples, 32), multiplier);
+      even = _mm256_add_epi64(_mm256_srli_epi64(
+        _mm256_xor_si256(_mm256_add_epi64(even, round), sign),
+        PCM_GAIN_SHIFT), offset);
+      odd = _mm256_add_epi64(_mm256_srli_epi64(
+        _mm256_xor_si256(_mm256_add_epi64(odd, round), sign),
+        PCM_GAIN_SHIFT), offset);
+
+      if (quantizer->is_dithered) {
+        state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+        state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+        state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+        __m256i dither = _mm256_sub_epi32(
+          _mm256_and_si256(state, low), _mm256_srli_epi32(state, 16));
+        dither = _mm256_sll_epi32(_mm256_sra_epi32(dither, right), left);
+        dither = _mm256_permutevar8x32_epi32(dither, order);
+        even = _mm256_add_epi64(
+          even, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(dither)));
+        odd = _mm256_add_epi64(
+          odd, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(dither, 1)));
+      }
+
+      even = pcm_gain_clamp_avx2(_mm256_and_si256(even, mask), min, max);
+      odd = pcm_gain_clamp_avx2(_mm256_and_si256(odd, mask), min, max);
+      _mm256_storeu_si256(
+        (__m256i*)(out + i),
+        _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa));
+    }
+    _mm256_storeu_si256((__m256i*)lanes, state);
+    pcm_gain_apply_scalar(quantizer, in + i, out + i, count - i, gain, lanes);
+  }
+
+#endif
+
+static pcm_gain_apply_f
+pcm_gain_get_apply() {
+#ifdef PLAYER_SIMD_X86
+  if (simd_get_level() >= simd_level_avx2) {
+    return &pcm_gain_apply_avx2;
+  }
+#endif
+  return &pcm_gain_apply_scalar;
+}
+
+static inline int32_t
+pcm_gain_get_ramped(const struct pcm_gain_stage *stage, size_t position) {
+  return stage->ramp_from
+    + (int64_t)(stage->gain - stage->ramp_from) * (int64_t)position
+    / (int64_t)stage->ramp_frames;
+}
+
+/**
+ * New target is ramped to from the gain reached so far, except for
+ * the first block, which starts with it.
+ */
+static void
+pcm_gain_update_target(struct pcm_gain_stage *stage) {
+  int target = atomic_load(&stage->volume) + atomic_load(&stage->replay_gain);
+  if (target == stage->target && stage->is_started) {
+    return;
+  }
+  int32_t gain = pcm_gain_target_to_multiplier(target);
+  stage->ramp_from = stage->is_started ?
+    pcm_gain_get_ramped(stage, stage->ramp_position) : gain;
+  stage->gain = gain;
+  stage->ramp_position = stage->ramp_from != gain ? 0 : stage->ramp_frames;
+  stage->target = target;
+  stage->is_started = true;
+}
+
+/**
+ * Error feedback runs sample by sample, ramped or not.
+ */
+static void
+pcm_gain_process_shaped(
+  struct pcm_gain_stage *stage,
+  unsigned int channel,
+  const int32_t *in,
+  int32_t *out,
+  size_t frames,
+  size_t ramped) {
+    const struct pcm_gain_quantizer quantizer = stage->quantizer;
+    uint32_t states[PCM_GAIN_LANES];
+    int64_t errors[2];
+    memcpy(states, stage->lanes[channel], sizeof(states));
+    memcpy(errors, stage->errors[channel], sizeof(errors));
+    for (size_t i = 0; i < frames; ++i) {
+      int32_t gain = i < ramped ?
+        pcm_gain_get_ramped(stage, stage->ramp_position + i + 1) :
+        stage->gain;
+      out[i] = pcm_gain_sample_shaped(
+        &quantizer, in[i], gain, &states[i % PCM_GAIN_LANES], errors);
+    }
+    memcpy(stage->lanes[channel], states, sizeof(states));
+    memcpy(stage->errors[channel], errors, sizeof(errors));
+  }
+
+static void
+pcm_gain_process_channel(
+  struct pcm_gain_stage *stage,
+  unsigned int channel,
+  const int32_t *in,
+  int32_t *out,
+  size_t frames,
+  size_t ramped) {
+    const struct pcm_gain_quantizer *quantizer = &stage->quantizer;
+    if (stage->dither == pcm_dither_shaped && quantizer->is_dithered) {
+      pcm_gain_process_shaped(stage, channel, in, out, frames, ramped);
+      return;
+    }
+    uint32_t *lanes = stage->lanes[channel];
+    for (size_t i = 0; i < ramped; ++i) {
+      out[i] = pcm_gain_sample(
+        quantizer,
+        in[i],
+        pcm_gain_get_ramped(stage, stage->ramp_position + i + 1),
+        &lanes[i % PCM_GAIN_LANES]);
+    }
+    stage->apply(
+      quantizer, in + ramped, out + ramped, frames - ramped, stage->gain,
+      lanes);
+  }
+
+static void
+pcm_gain_process(
+  struct pcm_dsp_stage *handler,
+  const void *const *in,
+  void *const *out,
+  size_t frames) {
+    struct pcm_gain_stage *stage = (struct pcm_gain_stage*)handler;
+    pcm_gain_update_target(stage);
+    size_t ramped = min_size_t(
+      frames, stage->ramp_frames - stage->ramp_position);
+    if (ramped == 0 && stage->gain == PCM_GAIN_UNITY) {
+      // samples are on the grid of the stream bit depth already
+      return;
+    }
+    for (unsigned int c = 0; c < stage->channels_count; ++c) {
+      pcm_gain_process_channel(
+        stage, c, (const int32_t*)in[c], (int32_t*)out[c], frames, ramped);
+    }
+    stage->ramp_position += ramped;
+  }
+
+static error_t
+pcm_gain_prepare(
+  struct pcm_dsp_stage *handler,
+  const struct pcm_spec *spec,
+  size_t max_frames) {
+    UNUSED(max_frames);
+    struct pcm_gain_stage *stage = (struct pcm_gain_stage*)handler;
+    unsigned int bits = spec->bits_per_sample;
+    stage->channels_count = spec->channels_count;
+    stage->ramp_frames = max_size_t(
+      1, (size_t)spec->samples_per_sec * PCM_GAIN_RAMP_MS / 1000);
+    stage->ramp_position = stage->ramp_frames;
+
+    struct pcm_gain_quantizer *quantizer = &stage->quantizer;
+    quantizer->is_dithered = stage->dither != pcm_dither_none && bits < 32;
+    quantizer->lsb = quantizer->is_dithered ? (int64_t)1 << (32 - bits) : 1;
+    quantizer->max = INT32_MAX & -quantizer->lsb;
+    quantizer->dither_right = bits > 16 ? bits - 16 : 0;
+    quantizer->dither_left = bits < 16 ? 16 - bits : 0;
+    stage->apply = pcm_gain_get_apply();
+
+    for (unsigned int c = 0; c < PCM_DSP_MAX_CHANNELS; ++c) {
+      for (unsigned int l = 0; l < PCM_GAIN_LANES; ++l) {
+        stage->lanes[c][l] = (c * PCM_GAIN_LANES + l + 1) * 0x9e3779b9u;
+      }
+    }
+    log_verbose(
+      "GAIN: %s dither to %d bits, ramp %lu frames",
+      pcm_dither_name(stage->dither), bits, stage->ramp_frames);
+    return 0;
+  }
+
+static void
+pcm_gain_reset(struct pcm_dsp_stage *handler) {
+  struct pcm_gain_stage *stage = (struct pcm_gain_stage*)handler;
+  // playback starts over, gain does not need to be ramped
+  stage->is_started = false;
+  memset(stage->errors, 0, sizeof(stage->errors));
+}
+
+static void
+pcm_gain_release(struct pcm_dsp_stage **handler) {
+  free(*handler);
+  *handler = NULL;
+}
+
+error_t
+pcm_gain_stage_open(
+  const struct pcm_gain_parameters *params,
+  struct pcm_dsp_stage **result) {
+    assert(params != NULL);
+    assert(result != NULL);
+    struct pcm_gain_stage *stage = calloc(1, sizeof(struct pcm_gain_stage));
+    if (stage == NULL) {
+      log_error("GAIN: Insufficient memory for 'pcm_gain_stage'");
+      return ENOMEM;
+    }
+    stage->base.name = "gain";
+    stage->base.format = pcm_dsp_format_int32;
+    stage->base.is_in_place = true;
+    stage->base.prepare = &pcm_gain_prepare;
+    stage->base.process = &pcm_gain_process;
+    stage->base.reset = &pcm_gain_reset;
+    stage->base.release = &pcm_gain_release;
+    stage->dither = params->dither != 0 ? params->dither : pcm_dither_tpdf;
+    atomic_init(&stage->volume, pcm_gain_db_to_target(params->volume_db));
+    atomic_init(&stage->replay_gain, 0);
+    *result = &stage->base;
+    return 0;
+  }
+
+void
+pcm_gain_stage_set_volume(struct pcm_dsp_stage *handler, double volume_db) {
+  assert(handler != NULL);
+  struct pcm_gain_stage *stage = (struct pcm_gain_stage*)handler;
+  atomic_store(&stage->volume, pcm_gain_db_to_target(volume_db));
+}
+
+double
+pcm_gain_stage_get_volume(struct pcm_dsp_stage *handler) {
+  assert(handler != NULL);
+  struct pcm_gain_stage *stage = (struct pcm_gain_stage*)handler;
+  return atomic_load(&stage->volume) / 100.0;
+}
+
+void
+pcm_gain_stage_set_replay_gain(
+  struct pcm_dsp_stage *handler,
+  double gain_db) {
+    assert(handler != NULL);
+    struct pcm_gain_stage *stage = (struct pcm_gain_stage*)handler;
+    atomic_store(&stage->replay_gain, pcm_gain_db_to_target(gain_db));
+  }
@@ -0,0 +1,79 @@
+#ifndef PLAYER_PCM_GAIN_H_
+#define PLAYER_PCM_GAIN_H_
+
+#include "pcm_dsp.h"
+
+// gain is fixed point with this many fractional bits, +18dB at most
+#define PCM_GAIN_SHIFT 28
+#define PCM_GAIN_MAX_DB 18.0
+// gain changes are ramped over this time
+#define PCM_GAIN_RAMP_MS 20
+
+enum pcm_replay_gain_mode {
+  pcm_replay_gain_track   = 1,
+  pcm_replay_gain_album   = 2,   // track gain if album one is missing
+};
+
+const char*
+pcm_replay_gain_mode_name(enum pcm_replay_gain_mode mode);
+
+/**
+ * @brief Gain of tags in given mode, lowered so that the peak
+ * does not clip, 0dB without tags.
+ */
+double
+pcm_replay_gain_get_db(
+  const struct pcm_replay_gain *tags,
+  enum pcm_replay_gain_mode mode);
+
+/**
+ * @brief Requantization to the stream bit depth
+ *
+ * TPDF dither is 2 LSB peak to peak triangular noise, shaped one moves
+ * its spectrum up by a second order error feedback, (1 - z^-1)^2.
+ */
+enum pcm_dither {
+  pcm_dither_none     = 1,    // samples are rounded
+  pcm_dither_tpdf     = 2,
+  pcm_dither_shaped   = 3,
+};
+
+const char*
+pcm_dither_name(enum pcm_dither dither);
+
+struct pcm_gain_parameters {
+  double volume_db;
+  enum pcm_dither dither;     // TPDF by default
+};
+
+/**
+ * @brief Software volume stage
+ *
+ * Gain is the sum of volume and ReplayGain, applied to int32 samples
+ * as a fixed point multiplier (AVX2 kernel), changes are ramped linearly
+ * over PCM_GAIN_RAMP_MS, so that they do not click. Samples are dithered
+ * and requantized to the stream bit depth, 32 bit streams are only rounded.
+ * At 0dB stage leaves samples untouched.
+ */
+error_t
+pcm_gain_stage_open(
+  const struct pcm_gain_parameters *params,
+  struct pcm_dsp_stage **result);
+
+/**
+ * @brief Set volume, can be called from any thread, it applies
+ * to the next block processed.
+ */
+void
+pcm_gain_stage_set_volume(struct pcm_dsp_stage *stage, double volume_db);
+
+double
+pcm_gain_stage_get_volume(struct pcm_dsp_stage *stage);
+
+/**
+ * @brief Set ReplayGain of the track being processed, any thread.
+ */
+void
+pcm_gain_stage_set_replay_gain(struct pcm_dsp_stage *stage, double gain_db);
+
+#endif
@@ -0,0 +1,252 @@
+#include <assert.h>
+#include <string.h>
+#include "pcm_pack.h"
+#include "simd.h"
+
+// FLAC limit
+#define PCM_PACK_MAX_CHANNELS 8
+
+#ifdef PLAYER_SIMD_X86
+#include <immintrin.h>
+#endif
+
+inline static void
+pcm_pack_sample(int32_t sample, unsigned int bytes_per_sample, uint8_t *dest) {
+  for (unsigned int b = 0; b < bytes_per_sample; b++) {
+    dest[b] = (uint8_t)((uint32_t)sample >> (8 * b));
+  }
+}
+
+static void
+pcm_pack_interleave_scalar(
+  const int32_t *const planar[],
+  unsigned int channels_count,
+  size_t frames_count,
+  unsigned int bytes_per_sample,
+  uint8_t *dest) {
+    for (size_t i = 0; i < frames_count; i++) {
+      for (unsigned int c = 0; c < channels_count; c++) {
+        pcm_pack_sample(planar[c][i], bytes_per_sample, dest);
+        dest += bytes_per_sample;
+      }
+    }
+  }
+
+#ifdef PLAYER_SIMD_X86
+
+SIMD_TARGET("sse2") static size_t
+pcm_pack_s16_mono_sse2(
+  const int32_t *src,
+  size_t frames_count,
+  uint8_t *dest) {
+    size_t i = 0;
+    for (; i + 8 <= frames_count; i += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+      _mm_storeu_si128((__m128i*)(dest + 2 * i), _mm_packs_epi32(a, b));
+    }
+    return i;
+  }
+
+SIMD_TARGET("sse2") static size_t
+pcm_pack_s16_stereo_sse2(
+  const int32_t *left,
+  const int32_t *right,
+  size_t frames_count,
+  uint8_t *dest) {
+    size_t i = 0;
+    for (; i + 4 <= frames_count; i += 4) {
+      __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+      __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+      __m128i lo = _mm_unpacklo_epi32(l, r);
+      __m128i hi = _mm_unpackhi_epi32(l, r);
+      _mm_storeu_si128((__m128i*)(dest + 4 * i), _mm_packs_epi32(lo, hi));
+    }
+    return i;
+  }
+
+SIMD_TARGET("sse2") static size_t
+pcm_pack_s32_stereo_sse2(
+  const int32_t *left,
+  const int32_t *right,
+  size_t frames_count,
+  uint8_t *dest) {
+    size_t i = 0;
+    for (; i + 4 <= frames_count; i += 4) {
+      __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+      __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+      _mm_storeu_si128((__m128i*)(dest + 8 * i), _mm_unpacklo_epi32(l, r));
+      _mm_storeu_si128((__m128i*)(dest + 8 * i + 16), _mm_unpackhi_epi32(l, r));
+    }
+    return i;
+  }
+
+/**
+ * 4 interleaved samples of 32 bits into 12 bytes of 24 bit samples,
+ * last 4 bytes of each 16 byte lane are garbage.
+ */
+#define PCM_PACK_S24_SHUFFLE \
+  -1, -1, -1, -1, 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0
+
+SIMD_TARGET("ssse3") static size_t
+pcm_pack_s24_stereo_ssse3(
+  const int32_t *left,
+  const int32_t *right,
+  size_t frames_count,
+  uint8_t *dest) {
+    const __m128i shuffle = _mm_set_epi8(PCM_PACK_S24_SHUFFLE);
+    size_t i = 0;
+    // each store writes 4 bytes after the block, leave them for the tail
+    for (; i + 5 <= frames_count; i += 4) {
+      __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+      __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+      __m128i lo = _mm_shuffle_epi8(_mm_unpacklo_epi32(l, r), shuffle);
+      __m128i hi = _mm_shuffle_epi8(_mm_unpackhi_epi32(l, r), shuffle);
+      _mm_storeu_si128((__m128i*)(dest + 6 * i), lo);
+      _mm_storeu_si128((__m128i*)(dest + 6 * i + 12), hi);
+    }
+    return i;
+  }
+
+SIMD_TARGET("avx2") static size_t
+pcm_pack_s16_stereo_avx2(
+  const int32_t *left,
+  const int32_t *right,
+  size_t frames_count,
+  uint8_t *dest) {
+    size_t i = 0;
+    for (; i + 8 <= frames_count; i += 8) {
+      __m256i l = _mm256_loadu_si256((const __m256i*)(left + i));
+      __m256i r = _mm256_loadu_si256((const __m256i*)(right + i));
+      // unpack and pack both work within lanes, so the order is kept
+      __m256i lo = _mm256_unpacklo_epi32(l, r);
+      __m256i hi = _mm256_unpackhi_epi32(l, r);
+      _mm256_storeu_si256(
+        (__m256i*)(dest + 4 * i), _mm256_packs_epi32(lo, hi));
+    }
+    return i;
+  }
+
+SIMD_TARGET("avx2") static size_t
+pcm_pack_s24_stereo_avx2(
+  const int32_t *left,
+  const int32_t *right,
+  size_t frames_count,
+  uint8_t *dest) {
+    const __m256i shuffle = _mm256_set_epi8(
+      PCM_PACK_S24_SHUFFLE, PCM_PACK_S24_SHUFFLE);
+    size_t i = 0;
+    for (; i + 9 <= frames_count; i += 8) {
+      __m256i l = _mm256_loadu_si256((const __m256i*)(left + i));
+      __m256i r = _mm256_loadu_si256((const __m256i*)(right + i));
+      __m256i lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi32(l, r), shuffle);
+      __m256i hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi32(l, r), shuffle);
+      // frames 0-1, 2-3 are in low lanes, 4-5, 6-7 in high lanes
+      uint8_t *block = dest + 6 * i;
+      _mm_storeu_si128((__m128i*)block, _mm256_castsi256_si128(lo));
+      _mm_storeu_si128((__m128i*)(block + 12), _mm256_castsi256_si128(hi));
+      _mm_storeu_si128(
+        (__m128i*)(block + 24), _mm256_extracti128_si256(lo, 1));
+      _mm_storeu_si128(
+        (__m128i*)(block + 36), _mm256_extracti128_si256(hi, 1));
+    }
+    return i;
+  }
+
+SIMD_TARGET("avx2") static size_t
+pcm_pack_s32_stereo_avx2(
+  const int32_t *left,
+  const int32_t *right,
+  size_t frames_count,
+  uint8_t *dest) {
+    size_t i = 0;
+    for (; i + 8 <= frames_count; i += 8) {
+      __m256i l = _mm256_loadu_si256((const __m256i*)(left + i));
+      __m256i r = _mm256_loadu_si256((const __m256i*)(right + i));
+      __m256i lo = _mm256_unpacklo_epi32(l, r);
+      __m256i hi = _mm256_unpackhi_epi32(l, r);
+      _mm256_storeu_si256(
+        (__m256i*)(dest + 8 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256(
+        (__m256i*)(dest + 8 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return i;
+  }
+
+/**
+ * Pack as many frames as vectorized kernels can, return their count.
+ */
+static size_t
+pcm_pack_interleave_simd(
+  const int32_t *const planar[],
+  unsigned int channels_count,
+  size_t frames_count,
+  unsigned int bytes_per_sample,
+  uint8_t *dest) {
+    enum simd_level level = simd_get_level();
+    if (channels_count == 1 && bytes_per_sample == 2
+      && level >= simd_level_sse2) {
+        return pcm_pack_s16_mono_sse2(planar[0], frames_count, dest);
+      }
+    if (channels_count != 2) {
+      return 0;
+    }
+
+    const int32_t *left = planar[0];
+    const int32_t *right = planar[1];
+    switch (bytes_per_sample) {
+      case 2:
+        if (level >= simd_level_avx2)
+          return pcm_pack_s16_stereo_avx2(left, right, frames_count, dest);
+        if (level >= simd_level_sse2)
+          return pcm_pack_s16_stereo_sse2(left, right, frames_count, dest);
+        break;
+      case 3:
+        if (level >= simd_level_avx2)
+          return pcm_pack_s24_stereo_avx2(left, right, frames_count, dest);
+        if (level >= simd_level_ssse3)
+          return pcm_pack_s24_stereo_ssse3(left, right, frames_count, dest);
+        break;
+      case 4:
+        if (level >= simd_level_avx2)
+          return pcm_pack_s32_stereo_avx2(left, right, frames_count, dest);
+        if (level >= simd_level_sse2)
+          return pcm_pack_s32_stereo_sse2(left, right, frames_count, dest);
+        break;
+    }
+    return 0;
+  }
+
+#endif
+
+void
+pcm_pack_interleave(
+  const int32_t *const planar[],
+  unsigned int channels_count,
+  size_t frames_count,
+  unsigned int bytes_per_sample,
+  void *dest) {
+    assert(planar != NULL);
+    assert(dest != NULL);
+    assert(bytes_per_sample >= 1 && bytes_per_sample <= 4);
+    assert(channels_count <= PCM_PACK_MAX_CHANNELS);
+
+    uint8_t *result = (uint8_t*)dest;
+    size_t done = 0;
+#ifdef PLAYER_SIMD_X86
+    done = pcm_pack_interleave_simd(
+      planar, channels_count, frames_count, bytes_per_sample, result);
+#endif
+    if (done < frames_count) {
+      const int32_t *tail[PCM_PACK_MAX_CHANNELS];
+      for (unsigned int c = 0; c < channels_count; c++) {
+        tail[c] = planar[c] + done;
+      }
+      pcm_pack_interleave_scalar(
+        tail,
+        channels_count,
+        frames_count - done,
+        bytes_per_sample,
+        result + done * channels_count * bytes_per_sample);
+    }
+  }
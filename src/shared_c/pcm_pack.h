@@ -0,0 +1,21 @@
+#ifndef PLAYER_PCM_PACK_H_
+#define PLAYER_PCM_PACK_H_
+
+#include <stdint.h>
+#include "shrdef.h"
+
+/**
+ * @brief Interleave planar 32 bit samples into packed little-endian frames
+ * with given bytes per sample (1 to 4), samples are truncated.
+ *
+ * Stereo and mono frames use SSE2/SSSE3/AVX2 kernels when available.
+ */
+void
+pcm_pack_interleave(
+  const int32_t *const planar[],
+  unsigned int channels_count,
+  size_t frames_count,
+  unsigned int bytes_per_sample,
+  void *dest);
+
+#endif
@@ -0,0 +1,442 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcm_resample.h"
+#include "simd.h"
+
+#ifdef PLAYER_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// input frames converted at once, history keeps taps - 1 more of them
+#define PCM_RESAMPLE_BLOCK_FRAMES 1024
+// kernels take 8 floats at once
+#define PCM_RESAMPLE_TAPS_ALIGN 8
+
+typedef float (*pcm_resample_dot_f) (
+  const float *samples,
+  const float *coefficients,
+  unsigned int count);
+
+struct pcm_resampler {
+  unsigned int channels_count;
+  enum pcm_convert_format format;
+  unsigned int bits_per_sample;
+  unsigned int up;
+  unsigned int down;
+  unsigned int taps;
+  float *coefficients;          // up phases of taps, reversed
+
+  // planar input as floats, newest frame of the next output at position
+  float *history[PCM_RESAMPLE_MAX_CHANNELS];
+  size_t history_capacity;
+  size_t history_size;
+  size_t position;
+  unsigned int phase;
+
+  pcm_resample_dot_f dot;
+};
+
+struct pcm_resample_tier {
+  unsigned int taps;
+  double rolloff;               // cutoff relative to Nyquist frequency
+  double kaiser_beta;
+};
+
+static const struct pcm_resample_tier pcm_resample_tiers[] = {
+  [pcm_resample_quality_fast]   = { 16, 0.80, 5.0 },
+  [pcm_resample_quality_medium] = { 32, 0.86, 7.0 },
+  [pcm_resample_quality_best]   = { 64, 0.91, 9.0 },
+};
+
+const char*
+pcm_resample_quality_name(enum pcm_resample_quality quality) {
+  switch (quality) {
+    case pcm_resample_quality_fast:
+      return "fast";
+    case pcm_resample_quality_medium:
+      return "medium";
+    case pcm_resample_quality_best:
+      return "best";
+  }
+  return "unknown";
+}
+
+static float
+pcm_resample_dot_scalar(
+  const float *samples,
+  const float *coefficients,
+  unsigned int count) {
+    float sum = 0;
+    for (unsigned int i = 0; i < count; i++) {
+      sum += samples[i] * coefficients[i];
+    }
+    return sum;
+  }
+
+#ifdef PLAYER_SIMD_X86
+
+SIMD_TARGET("sse2") static float
+pcm_resample_dot_sse2(
+  const float *samples,
+  const float *coefficients,
+  unsigned int count) {
+    __m128 a = _mm_setzero_ps();
+    __m128 b = _mm_setzero_ps();
+    for (unsigned int i = 0; i < count; i += 8) {
+      a = _mm_add_ps(a, _mm_mul_ps(
+        _mm_loadu_ps(samples + i), _mm_loadu_ps(coefficients + i)));
+      b = _mm_add_ps(b, _mm_mul_ps(
+        _mm_loadu_ps(samples + i + 4), _mm_loadu_ps(coefficients + i + 4)));
+    }
+    a = _mm_add_ps(a, b);
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+    return _mm_cvtss_f32(a);
+  }
+
+SIMD_TARGET("avx2") static float
+pcm_resample_dot_avx2(
+  const float *samples,
+  const float *coefficients,
+  unsigned int count) {
+    __m256 a = _mm256_setzero_ps();
+    __m256 b = _mm256_setzero_ps();
+    unsigned int i = 0;
+    for (; i + 16 <= count; i += 16) {
+      a = _mm256_add_ps(a, _mm256_mul_ps(
+        _mm256_loadu_ps(samples + i), _mm256_loadu_ps(coefficients + i)));
+      b = _mm256_add_ps(b, _mm256_mul_ps(
+        _mm256_loadu_ps(samples + i + 8),
+        _mm256_loadu_ps(coefficients + i + 8)));
+    }
+    if (i < count) {
+      a = _mm256_add_ps(a, _mm256_mul_ps(
+        _mm256_loadu_ps(samples + i), _mm256_loadu_ps(coefficients + i)));
+    }
+    a = _mm256_add_ps(a, b);
+    __m128 sum = _mm_add_ps(
+      _mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+  }
+
+#endif
+
+static pcm_resample_dot_f
+pcm_resample_get_dot() {
+#ifdef PLAYER_SIMD_X86
+  enum simd_level level = simd_get_level();
+  if (level >= simd_level_avx2) {
+    return &pcm_resample_dot_avx2;
+  }
+  if (level >= simd_level_sse2) {
+    return &pcm_resample_dot_sse2;
+  }
+#endif
+  return &pcm_resample_dot_scalar;
+}
+
+static unsigned int
+gcd_uint(unsigned int a, unsigned int b) {
+  while (b != 0) {
+    unsigned int r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+/**
+ * Modified Bessel function of the first kind, order 0.
+ */
+static double
+bessel_i0(double x) {
+  double sum = 1;
+  double term = 1;
+  for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+/**
+ * Prototype low-pass at up times input rate is split into phases,
+ * each of them normalized to unity gain at DC. It is centered on tap
+ * taps / 2 of phase 0, so output is delayed by whole input frames.
+ */
+static void
+pcm_resampler_design(
+  struct pcm_resampler *resampler,
+  const struct pcm_resample_tier *tier) {
+    unsigned int up = resampler->up;
+    unsigned int taps = resampler->taps;
+    double center = (double)taps * up / 2;
+    // in cycles per input frame
+    double cutoff = 0.5 * tier->rolloff
+      * fmin(1.0, (double)up / resampler->down);
+    double i0_beta = bessel_i0(tier->kaiser_beta);
+
+    for (unsigned int p = 0; p < up; p++) {
+      float *phase = resampler->coefficients + (size_t)p * taps;
+      double sum = 0;
+      for (unsigned int k = 0; k < taps; k++) {
+        size_t n = p + (size_t)k * up;
+        double t = (n - center) / up;
+        double x = 2 * cutoff * t;
+        double sinc = fabs(x) < 1e-12 ? 1 : sin(M_PI * x) / (M_PI * x);
+        double w = (n - center) / center;
+        double window = bessel_i0(
+          tier->kaiser_beta * sqrt(fmax(0, 1 - w * w))) / i0_beta;
+        double h = 2 * cutoff * sinc * window;
+        // newest frame is the last one in dot product
+        phase[taps - 1 - k] = (float)h;
+        sum += h;
+      }
+      for (unsigned int k = 0; k < taps; k++) {
+        phase[k] = (float)(phase[k] / sum);
+      }
+    }
+  }
+
+error_t
+pcm_resampler_open(
+  enum pcm_resample_quality quality,
+  unsigned int channels_count,
+  enum pcm_convert_format format,
+  unsigned int in_rate,
+  unsigned int out_rate,
+  struct pcm_resampler **result) {
+    assert(result != NULL);
+    if (quality < pcm_resample_quality_fast
+      || quality > pcm_resample_quality_best) {
+        log_error("RESAMPLE: Unknown quality %d", quality);
+        return EINVAL;
+      }
+    if (channels_count == 0 || channels_count > PCM_RESAMPLE_MAX_CHANNELS
+      || in_rate == 0 || out_rate == 0) {
+        log_error(
+          "RESAMPLE: Unsupported %d channels, %dHz to %dHz",
+          channels_count, in_rate, out_rate);
+        return EINVAL;
+      }
+    unsigned int divisor = gcd_uint(in_rate, out_rate);
+    unsigned int up = out_rate / divisor;
+    unsigned int down = in_rate / divisor;
+    if (up > PCM_RESAMPLE_MAX_PHASES) {
+      log_error(
+        "RESAMPLE: %dHz to %dHz needs %d phases, %d at most",
+        in_rate, out_rate, up, PCM_RESAMPLE_MAX_PHASES);
+      return EINVAL;
+    }
+
+    struct pcm_resampler *resampler = calloc(1, sizeof(struct pcm_resampler));
+    if (resampler == NULL) {
+      log_error("RESAMPLE: Insufficient memory for 'pcm_resampler'");
+      return ENOMEM;
+    }
+    const struct pcm_resample_tier *tier = &pcm_resample_tiers[quality];
+    unsigned int scale = (down + up - 1) / up;
+    resampler->channels_count = channels_count;
+    resampler->format = format;
+    resampler->bits_per_sample = format == pcm_convert_format_s24_le ?
+      24 : 8 * pcm_convert_format_bytes(format);
+    resampler->up = up;
+    resampler->down = down;
+    resampler->taps = (tier->taps * scale + PCM_RESAMPLE_TAPS_ALIGN - 1)
+      / PCM_RESAMPLE_TAPS_ALIGN * PCM_RESAMPLE_TAPS_ALIGN;
+    resampler->history_capacity = resampler->taps + PCM_RESAMPLE_BLOCK_FRAMES;
+    resampler->dot = pcm_resample_get_dot();
+
+    error_t error_r = 0;
+    resampler->coefficients = malloc(
+      (size_t)up * resampler->taps * sizeof(float));
+    resampler->history[0] = malloc(
+      channels_count * resampler->history_capacity * sizeof(float));
+    if (resampler->coefficients == NULL || resampler->history[0] == NULL) {
+      log_error("RESAMPLE: Insufficient memory for filter");
+      error_r = ENOMEM;
+    }
+    if (error_r == 0) {
+      for (unsigned int c = 1; c < channels_count; c++) {
+        resampler->history[c] =
+          resampler->history[0] + c * resampler->history_capacity;
+      }
+      pcm_resampler_design(resampler, tier);
+      pcm_resampler_reset(resampler);
+      log_verbose(
+        "RESAMPLE: %dHz to %dHz, %s quality, %d phases of %d taps",
+        in_rate, out_rate, pcm_resample_quality_name(quality),
+        up, resampler->taps);
+      *result = resampler;
+    } else {
+      pcm_resampler_release(&resampler);
+    }
+    return error_r;
+  }
+
+void
+pcm_resampler_reset(struct pcm_resampler *resampler) {
+  assert(resampler != NULL);
+  // silence before the first frame
+  size_t silence = resampler->taps - 1;
+  for (unsigned int c = 0; c < resampler->channels_count; c++) {
+    memset(resampler->history[c], 0, silence * sizeof(float));
+  }
+  resampler->history_size = silence;
+  resampler->position = silence;
+  resampler->phase = 0;
+}
+
+size_t
+pcm_resampler_get_input_frames(
+  const struct pcm_resampler *resampler,
+  size_t out_count) {
+    assert(resampler != NULL);
+    return out_count * resampler->down / resampler->up;
+  }
+
+size_t
+pcm_resampler_get_latency(const struct pcm_resampler *resampler) {
+  assert(resampler != NULL);
+  // frames after position wait for the next output, filter is centered
+  return resampler->history_size - resampler->position + resampler->taps / 2;
+}
+
+/**
+ * Sample of 32 bits with value in the top bits, as float in [-1, 1).
+ */
+static float
+pcm_resample_load(const struct pcm_resampler *resampler, const uint8_t *src) {
+  unsigned int bytes = pcm_convert_format_bytes(resampler->format);
+  uint32_t value = 0;
+  for (unsigned int b = 0; b < bytes; b++) {
+    value |= (uint32_t)src[b] << (8 * (b + 4 - bytes));
+  }
+  if (resampler->format == pcm_convert_format_s24_le) {
+    // low 3 bytes hold the sample, top one only sign
+    value <<= 8;
+  }
+  return (float)(int32_t)value * (1.0f / 2147483648.0f);
+}
+
+static void
+pcm_resample_store(
+  const struct pcm_resampler *resampler,
+  float sample,
+  uint8_t *dest) {
+    unsigned int bits = resampler->bits_per_sample;
+    int64_t max = ((int64_t)1 << (bits - 1)) - 1;
+    int64_t value = llrintf(sample * (float)(max + 1));
+    if (value > max) {
+      value = max;
+    } else if (value < -max - 1) {
+      value = -max - 1;
+    }
+    unsigned int bytes = pcm_convert_format_bytes(resampler->format);
+    for (unsigned int b = 0; b < bytes; b++) {
+      dest[b] = (uint8_t)((uint64_t)value >> (8 * b));
+    }
+  }
+
+/**
+ * Keep taps - 1 frames before position, append up to count input frames.
+ */
+static size_t
+pcm_resample_append(
+  struct pcm_resampler *resampler,
+  const uint8_t *in,
+  size_t count) {
+    size_t kept_from = resampler->position - (resampler->taps - 1);
+    assert(kept_from <= resampler->history_size);
+    if (kept_from > 0) {
+      size_t kept = resampler->history_size - kept_from;
+      for (unsigned int c = 0; c < resampler->channels_count; c++) {
+        memmove(
+          resampler->history[c],
+          resampler->history[c] + kept_from,
+          kept * sizeof(float));
+      }
+      resampler->history_size = kept;
+      resampler->position -= kept_from;
+    }
+
+    size_t appended = min_size_t(
+      count, resampler->history_capacity - resampler->history_size);
+    unsigned int sample_size = pcm_convert_format_bytes(resampler->format);
+    for (size_t i = 0; i < appended; i++) {
+      for (unsigned int c = 0; c < resampler->channels_count; c++) {
+        resampler->history[c][resampler->history_size + i] = in == NULL ?
+          0 : pcm_resample_load(resampler, in);
+        if (in != NULL) {
+          in += sample_size;
+        }
+      }
+    }
+    resampler->history_size += appended;
+    return appended;
+  }
+
+size_t
+pcm_resample(
+  struct pcm_resampler *resampler,
+  const void *in,
+  size_t in_count,
+  size_t *in_used,
+  void *out,
+  size_t out_capacity) {
+    assert(resampler != NULL);
+    assert(in_used != NULL);
+    assert(out != NULL);
+    unsigned int taps = resampler->taps;
+    unsigned int sample_size = pcm_convert_format_bytes(resampler->format);
+    size_t frame_size = resampler->channels_count * sample_size;
+    uint8_t *dest = (uint8_t*)out;
+    size_t produced = 0;
+    *in_used = 0;
+
+    while (produced < out_capacity) {
+      if (resampler->position >= resampler->history_size) {
+        if (*in_used == in_count) {
+          break;
+        }
+        const uint8_t *next = in == NULL ?
+          NULL : (const uint8_t*)in + *in_used * frame_size;
+        *in_used += pcm_resample_append(
+          resampler, next, in_count - *in_used);
+        continue;
+      }
+
+      const float *coefficients =
+        resampler->coefficients + (size_t)resampler->phase * taps;
+      size_t first = resampler->position - (taps - 1);
+      for (unsigned int c = 0; c < resampler->channels_count; c++) {
+        float sample = resampler->dot(
+          resampler->history[c] + first, coefficients, taps);
+        pcm_resample_store(resampler, sample, dest);
+        dest += sample_size;
+      }
+      produced++;
+
+      resampler->phase += resampler->down;
+      resampler->position += resampler->phase / resampler->up;
+      resampler->phase %= resampler->up;
+    }
+    return produced;
+  }
+
+void
+pcm_resampler_release(struct pcm_resampler **resampler) {
+  assert(resampler != NULL);
+  struct pcm_resampler *to_release = *resampler;
+  if (to_release != NULL) {
+    free(to_release->coefficients);
+    free(to_release->history[0]);
+    free(to_release);
+    *resampler = NULL;
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef PLAYER_PCM_RESAMPLE_H_
+#define PLAYER_PCM_RESAMPLE_H_
+
+#include "pcm_convert.h"
+
+// rate pairs which need more phases are not supported
+#define PCM_RESAMPLE_MAX_PHASES 4096
+#define PCM_RESAMPLE_MAX_CHANNELS 8
+
+/**
+ * @brief Resampler quality, longer filter passes more of the band
+ * and rejects images better.
+ */
+enum pcm_resample_quality {
+  pcm_resample_quality_fast     = 1,    // 16 taps, 54dB
+  pcm_resample_quality_medium   = 2,    // 32 taps, 72dB
+  pcm_resample_quality_best     = 3,    // 64 taps, 90dB
+};
+
+const char*
+pcm_resample_quality_name(enum pcm_resample_quality quality);
+
+/**
+ * @brief Polyphase windowed-sinc resampler
+ *
+ * Rate ratio is reduced to up / down, coefficients of up phases are
+ * computed once per rate pair when resampler is opened. Taps are scaled
+ * by down / up when downsampling, so that the cutoff follows output rate.
+ * Frames are interleaved samples of given format, filtered as floats
+ * with AVX2/SSE2 kernels when available.
+ */
+struct pcm_resampler;
+
+error_t
+pcm_resampler_open(
+  enum pcm_resample_quality quality,
+  unsigned int channels_count,
+  enum pcm_convert_format format,
+  unsigned int in_rate,
+  unsigned int out_rate,
+  struct pcm_resampler **result);
+
+/**
+ * @brief Resample up to in_count frames, never more than out_capacity
+ * frames are produced, frames consumed are set to in_used.
+ *
+ * NULL in is silence, i.e. to push out the end of the stream.
+ */
+size_t
+pcm_resample(
+  struct pcm_resampler *resampler,
+  const void *in,
+  size_t in_count,
+  size_t *in_used,
+  void *out,
+  size_t out_capacity);
+
+/**
+ * @brief Input frames taking the same time as out_count output ones,
+ * rounded down.
+ */
+size_t
+pcm_resampler_get_input_frames(
+  const struct pcm_resampler *resampler,
+  size_t out_count);
+
+/**
+ * @brief Input frames held in filter history, before output plays them.
+ */
+size_t
+pcm_resampler_get_latency(const struct pcm_resampler *resampler);
+
+/**
+ * @brief Drop filter history, next frame starts from silence.
+ */
+void
+pcm_resampler_reset(struct pcm_resampler *resampler);
+
+void
+pcm_resampler_release(struct pcm_resampler **resampler);
+
+#endif
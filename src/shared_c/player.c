@@ -1,9 +1,17 @@
 #include <alsa/asoundlib.h>
 #include <assert.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
 #include "log.h"
 #include "player.h"
+#include "realtime.h"
+#include "sink.h"
+#include "timer.h"
 
 #define RETURN_ON_SNDERROR(f, e)  error_r = f;\
   if (error_r < 0) {\
@@ -11,6 +19,9 @@
     return error_r;\
   }
 
+// shorter periods would only add wakeups
+#define PLAYER_TUNING_MIN_STALL_US 5000
+
 struct sound_card_info {
   int card_index;
   char *hardware_id;
@@ -208,311 +219,272 @@ soundc_release(struct sound_card_info **info) {
   }
 }
 
+struct player_threads {
+  struct io_spsc_buffer *handoff;
+  pthread_t producer;
+  pthread_t writer;
+  bool is_producer_started;
+  bool is_writer_started;
+  // frames written to the sink before threads have been started
+  size_t start_frame;
+
+  atomic_bool is_stopping;
+  atomic_bool is_producer_finishing;
+  atomic_bool is_producer_done;
+  atomic_bool is_writer_done;
+  atomic_int producer_error;
+  atomic_int writer_error;
+
+  atomic_size_t source_buffer;
+  atomic_size_t producer_frames;
+  atomic_size_t producer_source_empty_count;
+  atomic_size_t producer_handoff_full_count;
+  atomic_size_t writer_frames;
+  atomic_size_t writer_handoff_empty_count;
+  atomic_size_t writer_device_full_count;
+};
+
+/**
+ * Track boundary in frames written to the sink, previous track is still
+ * audible until sink delay gets past the start of the current one.
+ * After seek track continues at first_frame.
+ */
+struct player_track {
+  size_t index;
+  size_t start_frame;
+  size_t first_frame;
+  size_t samples_count;
+};
+
 struct player {
   struct pcm_decoder *decoder;
-  snd_pcm_uframes_t frames_per_period;
+  struct pcm_spec spec;
+  struct pcm_sink *sink;
+  size_t frames_per_period;
   int blocking_read_timeout;
-  snd_pcm_t *handle;
-  snd_pcm_uframes_t written_frames;
+  atomic_ulong written_frames;
+  size_t handoff_buffer_size;
+  int realtime_priority;
+  unsigned long writer_cpu_mask;
+  struct player_threads *threads;
+
+  // processed frames sink has not taken yet are pending in dsp_output
+  struct pcm_dsp_chain *dsp;
+  void *dsp_output;
+  size_t dsp_offset;
+  size_t dsp_pending;
+  // silence to process after the last track, so that stages play out
+  size_t dsp_tail;
+  // owned by the chain, NULL without volume control
+  struct pcm_dsp_stage *gain;
+  enum pcm_replay_gain_mode replay_gain;
+
+  // gapless queue, next decoder takes over when current one is over
+  _Atomic(struct pcm_decoder*) next_decoder;
+  _Atomic(struct pcm_decoder*) finished_decoder;
+  pthread_mutex_t tracks_lock;
+  struct player_track tracks[2];
+  bool is_draining;
+  bool is_threaded;
+  // requested by player_pause, applied by the thread writing to the sink
+  atomic_bool is_paused;
+  bool is_sink_paused;
+  // sink cannot pause, playback resumes by seeking to paused_frame
+  bool is_pause_dropped;
+  size_t paused_frame;
+
+  // event loop: control eventfd, source and sink descriptors
+  int control_fd;
+  struct pollfd *poll_fds;
+  size_t wakeups_count;
+  struct timespec started;
+
+  // latency telemetry, see struct player_latency_statistics
+  struct histogram *sink_avail;
+  struct histogram *decode_time;
+  struct histogram *write_interval;
+  struct timespec last_write;
+  // sink avail is not sampled before it is filled
+  size_t sink_filled_frame;
 };
 
 static error_t
-get_pcm_format(const struct pcm_spec *spec, snd_pcm_format_t *format) {
-  switch (spec->bits_per_sample) {
-  case 8:
-    *format = spec->is_signed ? SND_PCM_FORMAT_S8 : SND_PCM_FORMAT_U8;
-    return 0;
-  case 16:
-    if (spec->is_big_endian)
-      *format = spec->is_signed ? SND_PCM_FORMAT_S16_BE : SND_PCM_FORMAT_U16_BE;
-    else
-      *format = spec->is_signed ? SND_PCM_FORMAT_S16_LE : SND_PCM_FORMAT_U16_LE;
-    return 0;
-  case 24:
-    if (spec->is_big_endian)
-      *format = spec->is_signed ?
-        SND_PCM_FORMAT_S24_3BE : SND_PCM_FORMAT_U24_3BE;
-    else
-      *format = spec->is_signed ?
-        SND_PCM_FORMAT_S24_3LE : SND_PCM_FORMAT_U24_3LE;
-    return 0;
-  case 32:
-    if (spec->is_big_endian)
-      *format = spec->is_signed ? SND_PCM_FORMAT_S32_BE : SND_PCM_FORMAT_U32_BE;
-    else
-      *format = spec->is_signed ? SND_PCM_FORMAT_S32_LE : SND_PCM_FORMAT_U32_LE;
-    return 0;
-  }
+player_start_threads(struct player *player);
 
-  log_error("PLAYER: Unsupported player bitrate: %d", spec->bits_per_sample);
-  return EINVAL;
-}
+static void
+player_stop_threads(struct player *player);
 
 static error_t
-player_set_params_stream(
-  snd_pcm_t *player_handle,
-  snd_pcm_hw_params_t *hw_params,
-  const struct player_parameters *params,
-  const struct pcm_spec *stream_spec) {
-    snd_pcm_format_t pcm_format;
-    error_t error_r = get_pcm_format(stream_spec, &pcm_format);
-    if (error_r != 0) {
-      return error_r;
-    }
-
-    log_verbose(
-      "PLAYER: Resamplng is %s",
-      params->disable_resampling ? "OFF" : "ON");
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_rate_resample(
-        player_handle, hw_params, params->disable_resampling ? 0 : 1),
-      "PLAYER: Resampling setup failed for playback: %s");
-
-    log_verbose(
-      "PLAYER: Stream parameters are %uHz, %s, %u channels",
-      stream_spec->samples_per_sec,
-      snd_pcm_format_name(pcm_format),
-      stream_spec->channels_count);
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_access(
-        player_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED),
-      "PLAYER: Access type not available for playback: %s");
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_format(player_handle, hw_params, pcm_format),
-      "PLAYER: Sample format not available for playback: %s");
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_channels(
-        player_handle, hw_params, stream_spec->channels_count),
-      "PLAYER: Channels count not available for playbacks: %s");
-
-    int dir = 0;
-    unsigned int samples_per_sec = stream_spec->samples_per_sec;
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_rate_near(
-        player_handle, hw_params, &samples_per_sec, &dir),
-      "PLAYER: Rate not available for playback: %s");
-    if (samples_per_sec != stream_spec->samples_per_sec) {
-      log_error(
-        "PLAYER: Rate doesn't match (requested %uHz, get %uHz)",
-        stream_spec->samples_per_sec, samples_per_sec);
-      return EINVAL;
-    }
-
+player_open_poll(struct player *player) {
+  player->control_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (player->control_fd == -1) {
+    error_t error_r = errno;
+    log_error("PLAYER: Cannot create control eventfd: %s", strerror(error_r));
     return error_r;
   }
 
-static error_t
-player_set_params_period(
-  snd_pcm_t *player_handle,
-  snd_pcm_hw_params_t *hw_params,
-  const struct player_parameters *params,
-  const struct pcm_spec *stream_spec,
-  size_t *period_buffer_size,
-  snd_pcm_uframes_t *frames_per_period,
-  int *read_timeout) {
-    int dir;
-    error_t error_r;
-
-    if (log_is_verbose()) {
-      snd_pcm_uframes_t period_size_max, period_size_min;
-      dir = 0;
-      RETURN_ON_SNDERROR(
-        snd_pcm_hw_params_get_period_size_max(
-          hw_params, &period_size_max, &dir),
-        "PLAYER: Unable to get max period size for playback: %s");
-      dir = 0;
-      RETURN_ON_SNDERROR(
-        snd_pcm_hw_params_get_period_size_min(
-          hw_params, &period_size_min, &dir),
-        "PLAYER: Unable to get min period size for playback: %s");
-
-      size_t requested = *period_buffer_size / pcm_frame_size(stream_spec);
-      log_verbose(
-        "PLAYER: Frames per period (min, max, requested): %d, %d, %d (%d%)",
-        period_size_min, period_size_max,
-        requested, requested * 100 / period_size_max);
-    }
-
-    unsigned int period_time = pcm_buffer_time_us(
-      stream_spec, *period_buffer_size);
-    dir = 0;
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_period_time_near(
-        player_handle, hw_params, &period_time, &dir),
-      "PLAYER: Unable to set period time for playback: %s");
-    if (period_time < 100000) {
-      log_error(
-        "PLAYER: Period time is smaller than 100ms: %dus",
-        period_time);
-    }
-
-    dir = 0;
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_get_period_size(hw_params, frames_per_period, &dir),
-      "PLAYER: Unable to get period size for playback: %s");
-    size_t period_size = *frames_per_period * pcm_frame_size(stream_spec);
-    if (period_size > *period_buffer_size) {
-      log_error(
-        "PLAYER: Period size %d is greater than period buffer size %d",
-        period_size, *period_buffer_size);
-    }
-    *period_buffer_size = period_size;
-
-    log_verbose(
-      "PLAYER: Period time %dms (%d frames, %dkb)",
-      period_time / 1000,
-      *frames_per_period,
-      period_size / 1024);
+  // control, source and sink descriptors
+  player->poll_fds = calloc(
+    2 + player->sink->poll_fds_count, sizeof(struct pollfd));
+  if (player->poll_fds == NULL) {
+    log_error("PLAYER: Cannot allocate memory for poll descriptors");
+    return ENOMEM;
+  }
+  timer_start(&player->started);
+  return 0;
+}
 
-    unsigned int reads_per_period = max_uint(3, params->reads_per_period);
-    *read_timeout = max_int(1, period_time / 1000 / reads_per_period);
-    log_verbose("PLAYER: Read timeout: %d", *read_timeout);
+static error_t
+player_decode_once(struct player *player, struct pcm_decoder *decoder) {
+  struct timespec start;
+  timer_start(&start);
+  error_t error_r = pcm_decoder_decode_once(decoder);
+  struct timespec elapsed = timer_elapsed(start);
+  histogram_record(
+    player->decode_time,
+    elapsed.tv_sec * 1000000000ul + elapsed.tv_nsec);
+  return error_r;
+}
 
-    return 0;
+/**
+ * Frames have reached the sink, called only by the thread writing to it.
+ */
+static void
+player_add_written(struct player *player, size_t count) {
+  atomic_fetch_add(&player->written_frames, count);
+  if (player->last_write.tv_sec != 0 || player->last_write.tv_nsec != 0) {
+    histogram_record(
+      player->write_interval,
+      timespec_microseconds(timer_elapsed(player->last_write)));
   }
+  timer_start(&player->last_write);
+}
 
 static error_t
-player_set_params_buffer(
-  snd_pcm_t *player_handle,
-  snd_pcm_hw_params_t *hw_params,
-  const struct player_parameters *params,
-  const struct pcm_spec *stream_spec,
-  size_t frames_per_period) {
-    int dir;
-    error_t error_r;
-    size_t period_size = frames_per_period * pcm_frame_size(stream_spec);
-
-    if (log_is_verbose()) {
-      snd_pcm_uframes_t buffer_size_max, buffer_size_min;
-      RETURN_ON_SNDERROR(
-        snd_pcm_hw_params_get_buffer_size_max(
-          hw_params, &buffer_size_max),
-        "PLAYER: Unable to get max buffer size for playback: %s");
-      RETURN_ON_SNDERROR(
-        snd_pcm_hw_params_get_buffer_size_min(
-          hw_params, &buffer_size_min),
-        "PLAYER: Unable to get min buffer size for playback: %s");
-
-      size_t requested = frames_per_period * params->periods_per_buffer;
-      log_verbose(
-        "PLAYER: Frames per buffer (min, max, requested): %d, %d, %d (%d%)",
-        buffer_size_min, buffer_size_max,
-        requested, requested * 100 / buffer_size_max);
-    }
-
-    snd_pcm_uframes_t frames_per_buffer;
-    unsigned int buffer_time = pcm_buffer_time_us(
-      stream_spec, period_size * max_int(params->periods_per_buffer, 16));
-    dir = 0;
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_set_buffer_time_near(
-        player_handle, hw_params, &buffer_time, &dir),
-      "PLAYER: Unable to set buffer time for playback: %s");
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_get_buffer_size(hw_params, &frames_per_buffer),
-      "PLAYER: Unable to get buffer size for playback: %s");
-    log_verbose(
-      "PLAYER: Buffer time %dms (%d periods, %d frames, %dkB)",
-      buffer_time / 1000,
-      frames_per_buffer / frames_per_period,
-      frames_per_buffer,
-      frames_per_buffer * pcm_frame_size(stream_spec) / 1024);
+player_sample_sink_avail(struct player *player) {
+  if (atomic_load(&player->written_frames) < player->sink_filled_frame) {
     return 0;
   }
+  size_t avail;
+  error_t error_r = pcm_sink_avail(player->sink, &avail);
+  if (error_r == 0) {
+    histogram_record(player->sink_avail, avail);
+  }
+  return error_r;
+}
 
 static error_t
-player_set_params_sw(
-  snd_pcm_t *player_handle,
-  snd_pcm_uframes_t frames_per_period) {
-    error_t error_r = 0;
-    snd_pcm_sw_params_t *sw_params = NULL;
+preload_first_period(struct player *player, struct pcm_decoder *decoder) {
+  const size_t expected = player->frames_per_period;
 
-    snd_pcm_sw_params_alloca(&sw_params);
-    if (sw_params == NULL) {
-      log_error("PLAYER: cannot allocate sw_params");
-      return ENOMEM;
+  // part of first read has been used on metadata, do full read
+  error_t error_r = pcm_decoder_read_source(decoder, -1);
+  while (
+    error_r == 0
+    && pcm_decoder_get_output_buffer_frames_count(decoder) < expected) {
+      if (pcm_decoder_is_source_buffer_ready_to_read(decoder)) {
+        error_r = player_decode_once(player, decoder);
+      } else if (!io_rf_stream_is_eof(decoder->src)
+        && !pcm_decoder_is_source_buffer_full(decoder)) {
+          // nothing is playing yet, wait for the whole block
+          error_r = pcm_decoder_read_source(decoder, -1);
+        } else {
+          break;
+        }
     }
 
-    RETURN_ON_SNDERROR(
-      snd_pcm_sw_params_current(
-        player_handle, sw_params),
-      "PLAYER: Unable to get software parameters: %s");
-
-    RETURN_ON_SNDERROR(
-      snd_pcm_sw_params_set_start_threshold(
-        player_handle, sw_params, frames_per_period),
-      "PLAYER: Unable to set start threshold: %s");
-
-    RETURN_ON_SNDERROR(
-      snd_pcm_sw_params(player_handle, sw_params),
-      "PLAYER: Unable to set sw params for playback: %s");
-
-    return error_r;
-  }
+  return error_r;
+}
 
-static error_t
-player_set_params(
-  snd_pcm_t *player_handle,
-  const struct player_parameters *params,
-  const struct pcm_spec *stream_spec,
-  size_t period_buffer_size,
-  snd_pcm_uframes_t *frames_per_period,
-  int *read_timeout) {
-    error_t error_r = 0;
-    snd_pcm_hw_params_t *hw_params = NULL;
+static bool
+player_is_decoder_done(struct pcm_decoder *decoder) {
+  return pcm_decoder_is_source_empty(decoder)
+    && pcm_decoder_is_output_buffer_empty(decoder);
+}
 
-    snd_pcm_hw_params_alloca(&hw_params);
-    if (hw_params == NULL) {
-      log_error("PLAYER: cannot allocate hw_params");
-      return ENOMEM;
-    }
-    RETURN_ON_SNDERROR(
-      snd_pcm_hw_params_any(player_handle, hw_params),
-      "PLAYER: no configurations available: %s");
+/**
+ * Last track is over, but its tail is still in DSP stages.
+ */
+static bool
+player_has_dsp_tail(struct player *player) {
+  return player->dsp_tail > 0
+    && player_is_decoder_done(player->decoder)
+    && atomic_load(&player->next_decoder) == NULL;
+}
 
-    error_r = player_set_params_stream(
-      player_handle, hw_params, params, stream_spec);
-    if (error_r == 0) {
-      error_r = player_set_params_period(
-        player_handle, hw_params, params, stream_spec,
-        &period_buffer_size, frames_per_period, read_timeout);
-    }
-    if (error_r == 0) {
-      error_r = player_set_params_buffer(
-        player_handle, hw_params, params, stream_spec,
-        *frames_per_period);
-    }
-    if (error_r == 0) {
-      RETURN_ON_SNDERROR(
-        snd_pcm_hw_params(player_handle, hw_params),
-        "PLAYER: Unable to set hw params for playback: %s");
+/**
+ * Silence pushes the tail out of DSP stages, returns frames processed.
+ */
+static size_t
+player_process_dsp_tail(struct player *player, size_t count, void *pcm) {
+  size_t processed = min_size_t(count, player->dsp_tail);
+  pcm_dsp_chain_process(player->dsp, NULL, processed, pcm);
+  player->dsp_tail -= processed;
+  return processed;
+}
 
-      error_r = player_set_params_sw(
-        player_handle,
-        *frames_per_period);
-    }
+/**
+ * Nothing decoded is waiting for the sink, without threads.
+ */
+static bool
+player_is_output_empty(struct player *player) {
+  return pcm_decoder_is_output_buffer_empty(player->decoder)
+    && player->dsp_pending == 0
+    && !player_has_dsp_tail(player);
+}
 
-    return error_r;
+/**
+ * Gain of track tags applies from its first frame processed.
+ */
+static void
+player_apply_replay_gain(struct player *player, struct pcm_decoder *decoder) {
+  if (player->gain != NULL && player->replay_gain != 0) {
+    double gain_db = pcm_replay_gain_get_db(
+      &decoder->replay_gain, player->replay_gain);
+    log_verbose("PLAYER: ReplayGain %.2fdB", gain_db);
+    pcm_gain_stage_set_replay_gain(player->gain, gain_db);
   }
+}
 
-static error_t
-preload_first_period(struct player *player) {
-  const size_t expected = player->frames_per_period;
+static void
+player_reset_dsp(struct player *player) {
+  if (player->dsp != NULL) {
+    pcm_dsp_chain_reset(player->dsp);
+    player->dsp_pending = 0;
+    player->dsp_tail = pcm_dsp_chain_get_tail(player->dsp);
+  }
+}
 
-  // part of first read has been used on metadata, do full read
-  error_t error_r = pcm_decoder_read_source(player->decoder, -1);
-  while (
-    error_r == 0
-    && pcm_decoder_is_source_buffer_ready_to_read(player->decoder)
-    && pcm_decoder_get_output_buffer_frames_count(player->decoder) < expected) {
-      error_r = pcm_decoder_decode_once(player->decoder);
-      if (error_r == 0
-        && !pcm_decoder_is_source_buffer_empty(player->decoder)) {
-          error_r = pcm_decoder_read_source(player->decoder, -1);
-        }
-    }
+/**
+ * Current track is over, continue with the queued one if there is any.
+ * Its first frame goes to the sink right after start_frame.
+ */
+static bool
+player_switch_track(struct player *player, size_t start_frame) {
+  struct pcm_decoder *next = atomic_exchange(&player->next_decoder, NULL);
+  if (next == NULL) {
+    return false;
+  }
+  atomic_store(&player->finished_decoder, player->decoder);
+  player->decoder = next;
+  player_apply_replay_gain(player, next);
+  if (player->dsp != NULL) {
+    // tail played out already is just a gap before the track
+    player->dsp_tail = pcm_dsp_chain_get_tail(player->dsp);
+  }
 
-  return error_r;
+  pthread_mutex_lock(&player->tracks_lock);
+  player->tracks[0] = player->tracks[1];
+  player->tracks[1] = (struct player_track) {
+    .index = player->tracks[0].index + 1,
+    .start_frame = start_frame,
+    .first_frame = 0,
+    .samples_count = next->spec.samples_count
+  };
+  pthread_mutex_unlock(&player->tracks_lock);
+
+  log_verbose("PLAYER: next track starts at frame %lu", start_frame);
+  return true;
 }
 
 bool
@@ -527,223 +499,1398 @@ soundc_is_valid_hardware_id(const char *hardware_id) {
   }
 }
 
+static error_t
+player_open_sink(
+  const struct player_parameters *params,
+  const struct pcm_spec *spec,
+  size_t period_size,
+  struct pcm_sink **sink) {
+    const struct pcm_sink_parameters sink_params = {
+      .period_size = period_size,
+      .periods_per_buffer = params->periods_per_buffer,
+      .disable_resampling = params->disable_resampling,
+      .disable_mmap_access = params->disable_mmap_access,
+      .resample_quality = params->resample_quality,
+    };
+
+    // ALSA is the default one
+    enum player_sink sink_type = params->sink != 0 ?
+      params->sink : player_sink_alsa;
+    switch (sink_type) {
+      case player_sink_alsa:
+        return pcm_sink_alsa_open(params->hardware_id, &sink_params, spec, sink);
+      case player_sink_null:
+        return pcm_sink_null_open(false, &sink_params, spec, sink);
+      case player_sink_null_realtime:
+        return pcm_sink_null_open(true, &sink_params, spec, sink);
+      case player_sink_wav:
+        if (params->sink_file_path == NULL) {
+          log_error("PLAYER: File path is required for WAV sink");
+          return EINVAL;
+        }
+        return pcm_sink_wav_open(
+          params->sink_file_path, &sink_params, spec, sink);
+    }
+
+    log_error("PLAYER: Unknown sink: %d", params->sink);
+    return EINVAL;
+  }
+
+static bool
+player_has_gain(const struct player_parameters *params) {
+  return params->has_volume_control
+    || params->replay_gain != 0
+    || params->volume_db != 0;
+}
+
+static void
+player_release_stages(struct pcm_dsp_stage *const *stages, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    struct pcm_dsp_stage *stage = stages[i];
+    pcm_dsp_stage_release(&stage);
+  }
+}
+
+/**
+ * Frames are processed in blocks of a period, so that processing
+ * of a block never takes longer than its playback. Convolution follows
+ * stages of the caller. Gain stage is the last one, as it requantizes
+ * samples to the stream bit depth.
+ */
+static error_t
+player_open_dsp(
+  const struct player_parameters *params,
+  const struct pcm_spec *spec,
+  size_t period_size,
+  struct player *player) {
+    size_t frame_size = pcm_frame_size(spec);
+    size_t max_frames = max_size_t(1, period_size / frame_size);
+    bool has_convolution = params->convolution_path != NULL;
+    bool has_gain = player_has_gain(params);
+    size_t total_count = params->dsp_stages_count + has_convolution + has_gain;
+    if (total_count > PCM_DSP_MAX_STAGES) {
+      log_error(
+        "PLAYER: %lu DSP stages, %d at most",
+        total_count,
+        PCM_DSP_MAX_STAGES);
+      player_release_stages(params->dsp_stages, params->dsp_stages_count);
+      return EINVAL;
+    }
+
+    struct pcm_dsp_stage *stages[PCM_DSP_MAX_STAGES];
+    size_t stages_count = params->dsp_stages_count;
+    if (stages_count > 0) {
+      memcpy(stages, params->dsp_stages, stages_count * sizeof(stages[0]));
+    }
+    error_t error_r = 0;
+    if (has_convolution) {
+      const struct pcm_convolve_parameters convolve_params = {
+        .ir_path = params->convolution_path,
+        .partition_frames = params->convolution_partition,
+      };
+      error_r = pcm_convolve_stage_open(
+        &convolve_params, &stages[stages_count]);
+      if (error_r == 0) {
+        stages_count++;
+      } else {
+        player_release_stages(stages, stages_count);
+        return error_r;
+      }
+    }
+    if (has_gain) {
+      const struct pcm_gain_parameters gain_params = {
+        .volume_db = params->volume_db,
+        .dither = params->dither,
+      };
+      error_r = pcm_gain_stage_open(&gain_params, &player->gain);
+      if (error_r == 0) {
+        stages[stages_count++] = player->gain;
+        player->replay_gain = params->replay_gain;
+      } else {
+        player_release_stages(stages, stages_count);
+        return error_r;
+      }
+    }
+
+    error_r = pcm_dsp_chain_open(
+      spec,
+      max_frames,
+      stages,
+      stages_count,
+      &player->dsp);
+    if (error_r != 0) {
+      player->gain = NULL;
+    }
+    if (error_r == 0) {
+      player->dsp_output = malloc(max_frames * frame_size);
+      if (player->dsp_output == NULL) {
+        log_error("PLAYER: Cannot allocate memory for processed frames");
+        error_r = ENOMEM;
+      }
+    }
+    if (error_r == 0) {
+      player->dsp_tail = pcm_dsp_chain_get_tail(player->dsp);
+    }
+    return error_r;
+  }
+
 error_t
 player_open(
   const struct player_parameters *params,
   struct pcm_decoder *pcm_stream,
   struct player **player) {
-    log_verbose("Setting up ALSA player");
+    log_verbose("Setting up player");
+    assert(params != NULL);
     assert(pcm_stream != NULL);
     assert(player != NULL);
-    error_t error_r;
-    snd_output_t *output = NULL;
-    snd_pcm_t *player_handle = NULL;
-
-    const char *device_name = params->hardware_id != NULL ?
-      params->hardware_id : "default";
-
-    log_verbose("PLAYER: ALSA library version:  %s", SND_LIB_VERSION_STR);
-    log_verbose("PLAYER: Playback device: [%s]", device_name);
-    RETURN_ON_SNDERROR(
-      snd_output_stdio_attach(&output, stdout, 0),
-      "PLAYER: Attaching output failed: %s");
-    RETURN_ON_SNDERROR(
-      snd_pcm_open(
-        &player_handle,
-        device_name,
-        SND_PCM_STREAM_PLAYBACK,
-        SND_PCM_NONBLOCK),
-      "PLAYER: Playback open error: %s");
+    error_t error_r = 0;
 
     struct player *result = (struct player*)calloc(1, sizeof(struct player));
     if (result == NULL) {
       log_error("PLAYER: Cannot allocate memory for player");
-      snd_pcm_close(player_handle);
-      error_r = ENOMEM;
-    } else {
-      result->handle = player_handle;
+      player_release_stages(params->dsp_stages, params->dsp_stages_count);
+      return ENOMEM;
+    }
+    result->control_fd = -1;
+    pthread_mutex_init(&result->tracks_lock, NULL);
+    error_r = histogram_alloc(&result->sink_avail);
+    if (error_r == 0) {
+      error_r = histogram_alloc(&result->decode_time);
     }
-
     if (error_r == 0) {
-      size_t period_size = params->period_size;
-      if (period_size == 0) {
-        period_size = max_size_t(
-          64 * pcm_frame_size(&pcm_stream->spec),  // ALSA min
-          io_buffer_get_allocated_size(&pcm_stream->dest));
+      error_r = histogram_alloc(&result->write_interval);
+    }
+
+    size_t period_size = params->period_size;
+    if (period_size == 0) {
+      // what is decoded at once, passthrough decoder reads it
+      size_t decoded_size = pcm_stream->is_passthrough ?
+        pcm_stream->src->buffer_max_single_read_size :
+        io_buffer_get_allocated_size(&pcm_stream->dest);
+      period_size = max_size_t(
+        64 * pcm_frame_size(&pcm_stream->spec),  // ALSA min
+        decoded_size);
+    }
+    if (params->dsp_stages_count > 0
+      || params->convolution_path != NULL
+      || player_has_gain(params)) {
+        // chain releases stages, so it is opened even after failure
+        error_t dsp_error_r = player_open_dsp(
+          params, &pcm_stream->spec, period_size, result);
+        error_r = error_r != 0 ? error_r : dsp_error_r;
       }
-      error_r = player_set_params(
-        result->handle, params,
-        &pcm_stream->spec, period_size,
-        &result->frames_per_period, &result->blocking_read_timeout);
+    if (error_r == 0) {
+      error_r = player_open_sink(
+        params, &pcm_stream->spec, period_size, &result->sink);
     }
+    if (error_r == 0) {
+      result->frames_per_period = result->sink->frames_per_period;
+      unsigned int period_time = pcm_buffer_time_us(
+        &pcm_stream->spec,
+        result->frames_per_period * pcm_frame_size(&pcm_stream->spec));
+      unsigned int reads_per_period = max_uint(3, params->reads_per_period);
+      result->blocking_read_timeout = max_int(
+        1, period_time / 1000 / reads_per_period);
+      log_verbose(
+        "PLAYER: %s sink, read timeout: %d",
+        result->sink->name,
+        result->blocking_read_timeout);
 
+      error_r = player_open_poll(result);
+    }
     if (error_r == 0) {
-      result->written_frames = 0;
+      atomic_init(&result->written_frames, 0);
+      atomic_init(&result->next_decoder, NULL);
+      atomic_init(&result->finished_decoder, NULL);
+      atomic_init(&result->is_paused, false);
       result->decoder = pcm_stream;
-      *player = result;
-      if (log_is_verbose()) {
-        snd_pcm_dump(result->handle, output);
-      }
-      error_r = preload_first_period(result);
+      result->spec = pcm_stream->spec;
+      player_apply_replay_gain(result, pcm_stream);
+      result->tracks[0] = result->tracks[1] = (struct player_track) {
+        .index = 0,
+        .start_frame = 0,
+        .first_frame = 0,
+        .samples_count = pcm_stream->spec.samples_count
+      };
+      result->sink_filled_frame = result->sink->frames_per_buffer;
+      error_r = preload_first_period(result, pcm_stream);
     }
-    if (error_r != 0) {
+    if (error_r == 0) {
+      result->realtime_priority = params->realtime_priority;
+      result->writer_cpu_mask = params->writer_cpu_mask;
+    }
+    if (error_r == 0 && params->is_threaded) {
+      result->is_threaded = true;
+      result->handoff_buffer_size = params->handoff_buffer_size;
+      error_r = player_start_threads(result);
+    } else if (error_r == 0
+      && (params->realtime_priority > 0 || params->writer_cpu_mask != 0)) {
+        error_r = realtime_set_current_thread(
+          params->realtime_priority,
+          params->writer_cpu_mask);
+      }
+    if (error_r == 0) {
+      *player = result;
+    } else {
       player_release(&result);
     }
     return error_r;
   }
 
+static void
+player_log_latency_statistics(struct player *player) {
+  struct player_latency_statistics stats;
+  player_get_latency_statistics(player, &stats);
+  if (stats.xruns_count > 0 || stats.suspends_count > 0) {
+    log_info(
+      "PLAYER: %lu xruns, %lu suspends",
+      stats.xruns_count,
+      stats.suspends_count);
+  }
+  for (size_t i = 0; i < stats.xrun_times_count; ++i) {
+    log_verbose(
+      "PLAYER: xrun at %ld.%06lds",
+      stats.xrun_times[i].tv_sec,
+      stats.xrun_times[i].tv_nsec / 1000);
+  }
+  histogram_log("PLAYER: sink avail", "frames", player->sink_avail);
+  histogram_log("PLAYER: decode time", "ns", player->decode_time);
+  histogram_log("PLAYER: write interval", "us", player->write_interval);
+
+  struct pcm_dsp_statistics dsp;
+  player_get_dsp_statistics(player, &dsp);
+  for (size_t i = 0; i <= dsp.stages_count && dsp.format.frames > 0; ++i) {
+    const struct pcm_dsp_stage_statistics *stage = i < dsp.stages_count ?
+      &dsp.stages[i] : &dsp.format;
+    unsigned long cpu_ns = stage->cpu_time.tv_sec * 1000000000ul
+      + stage->cpu_time.tv_nsec;
+    log_verbose(
+      "PLAYER: DSP %s: %lu frames, CPU %luus, %luns per frame",
+      stage->name,
+      stage->frames,
+      cpu_ns / 1000,
+      stage->frames > 0 ? cpu_ns / stage->frames : 0);
+  }
+}
+
 void
 player_release(struct player **player) {
   assert(player != NULL);
   struct player *to_release = *player;
   if (to_release != NULL) {
-    snd_pcm_drain(to_release->handle);
-    snd_pcm_close(to_release->handle);
-  }
-  *player = NULL;
-}
-
-static error_t
-xrun_recovery(snd_pcm_t *player_handle, error_t error_r) {
-    if (error_r == -EPIPE) {
-      log_verbose("PLAYER: recovery due to broken pipe");
-      RETURN_ON_SNDERROR(
-        snd_pcm_prepare(player_handle),
-        "PLAYER: Can't recovery from underrun, prepare failed: %s");
-      return 0;
-    } else if (error_r == -ESTRPIPE) {
-      log_verbose("PLAYER: recovery due to stream pipe error");
-      error_t resume_error_r = snd_pcm_resume(player_handle);
-      while (resume_error_r == -EAGAIN) {
-        log_verbose("PLAYER: recovery sleep");
-        sleep(1);
-        resume_error_r = snd_pcm_resume(player_handle);
-      }
-      if (resume_error_r < 0) {
-        RETURN_ON_SNDERROR(
-          snd_pcm_prepare(player_handle),
-          "PLAYER: Can't recovery from suspend, prepare failed: %s");
+    player_stop_threads(to_release);
+    if (to_release->sink != NULL) {
+      player_log_latency_statistics(to_release);
+      if (to_release->is_sink_paused) {
+        // releasing sink would play the rest otherwise
+        pcm_sink_drop(to_release->sink);
       }
-      return 0;
-    } else {
-      log_verbose("PLAYER: can't recovery player from %d", error_r);
-      return error_r;
     }
+    pcm_sink_release(&to_release->sink);
+    pcm_dsp_chain_release(&to_release->dsp);
+    free(to_release->dsp_output);
+
+    if (to_release->wakeups_count > 0) {
+      time_t seconds = timer_elapsed(to_release->started).tv_sec;
+      log_verbose(
+        "PLAYER: %lu wakeups, %lu per second",
+        to_release->wakeups_count,
+        to_release->wakeups_count / (seconds > 0 ? seconds : 1));
+    }
+    if (to_release->control_fd != -1) {
+      close(to_release->control_fd);
+    }
+    free(to_release->poll_fds);
+    pthread_mutex_destroy(&to_release->tracks_lock);
+    histogram_free(&to_release->sink_avail);
+    histogram_free(&to_release->decode_time);
+    histogram_free(&to_release->write_interval);
+    free(to_release);
+  }
+  *player = NULL;
 }
 
 bool
 player_is_eof(struct player *player) {
   assert(player != NULL);
-  bool is_source_empty = pcm_decoder_is_source_buffer_empty(player->decoder);
-  bool is_output_empty = pcm_decoder_is_output_buffer_empty(player->decoder);
-  snd_pcm_state_t playback_state = snd_pcm_state(player->handle);
-  return is_source_empty
+  bool is_source_empty;
+  bool is_output_empty;
+  if (player->threads != NULL) {
+    is_source_empty = atomic_load(&player->threads->is_producer_done);
+    is_output_empty = atomic_load(&player->threads->is_writer_done);
+  } else {
+    is_source_empty = pcm_decoder_is_source_buffer_empty(player->decoder)
+      && atomic_load(&player->next_decoder) == NULL;
+    is_output_empty = player_is_output_empty(player);
+  }
+  return !atomic_load(&player->is_paused)
+    && is_source_empty
     && is_output_empty
-    && playback_state == SND_PCM_STATE_XRUN;
+    && pcm_sink_is_drained(player->sink);
 }
 
 static error_t
-player_preload(struct player *player, bool *has_been_waiting) {
+player_read_source(struct player *player, int poll_timeout) {
   error_t error_r = 0;
-  if (pcm_decoder_is_source_empty(player->decoder)) {
-    // nothing to read from the source, we are done here
-    *has_been_waiting = false;
-  } else {
-    if (pcm_decoder_is_source_buffer_full(player->decoder)) {
-      // source buffer is full, but we can still decode it
-      *has_been_waiting = false;
-    } else {
-      // fill up the buffer if possible with give read timeout
-      // if source is empty hope for the best
-      int poll_timeout = pcm_decoder_is_source_buffer_empty(player->decoder) ?
-        -1 : player->blocking_read_timeout;
+  if (!pcm_decoder_is_source_empty(player->decoder)
+    && !pcm_decoder_is_source_buffer_full(player->decoder)) {
+      // fill up the buffer if possible with given read timeout
       error_r = pcm_decoder_read_source(player->decoder, poll_timeout);
+      if (error_r == EAGAIN) {
+        // nothing has arrived yet, decode whatever is in the buffer
+        error_r = 0;
+      }
     }
+  return error_r;
+}
+
+static error_t
+player_preload(struct player *player, int poll_timeout) {
+  error_t error_r = 0;
+  if (!pcm_decoder_is_source_empty(player->decoder)) {
+    error_r = player_read_source(player, poll_timeout);
 
     while (
       error_r == 0
       && pcm_decoder_is_source_buffer_ready_to_read(player->decoder)
       && !pcm_decoder_is_output_buffer_full(player->decoder)) {
-        error_r = pcm_decoder_decode_once(player->decoder);
+        error_r = player_decode_once(player, player->decoder);
       }
   }
 
   return error_r;
 }
 
+/**
+ * Write as much as device accepts right now, never blocks.
+ */
 static error_t
-player_write_alsa(struct player *player) {
-  snd_pcm_sframes_t avail = snd_pcm_avail(player->handle);
-  if (avail == 0) {
-    // there is nothing to do here
-    return 0;
+player_write_frames(
+  struct player *player,
+  const void *pcm,
+  size_t count,
+  size_t *written) {
+    assert(count > 0);
+    size_t frame_size = pcm_decoder_frame_size(player->decoder);
+    error_t error_r = 0;
+    *written = 0;
+
+    while (error_r == 0 && *written < count) {
+      size_t avail;
+      error_r = pcm_sink_avail(player->sink, &avail);
+      if (error_r != 0 || avail == 0) {
+        // device is full, poll will tell when it needs more
+        break;
+      }
+
+      size_t frames_written;
+      error_r = pcm_sink_write(
+        player->sink,
+        (const char*)pcm + *written * frame_size,  // NOLINT
+        min_size_t(avail, count - *written),
+        &frames_written);
+      if (error_r == 0 && frames_written == 0) {
+        break;
+      }
+      *written += frames_written;
+      player_add_written(player, frames_written);
+    }
+
+    return error_r;
   }
 
-  error_t error_r = 0;
+/**
+ * Only as many frames as sink takes are processed, the rest of them
+ * is pending only if writing has failed, it goes first next time.
+ * Tail follows the last track.
+ */
+static error_t
+player_write_sink_dsp(struct player *player) {
   size_t frame_size = pcm_decoder_frame_size(player->decoder);
-  struct io_buffer *buffer = &player->decoder->dest;
-  void* pcm;
-  size_t count;
-  io_buffer_array_items(buffer, frame_size, &pcm, &count);
-  assert(count > 0);
+  error_t error_r = 0;
+  size_t written;
+  if (player->dsp_pending > 0) {
+    error_r = player_write_frames(
+      player,
+      (const char*)player->dsp_output  // NOLINT
+        + player->dsp_offset * frame_size,
+      player->dsp_pending,
+      &written);
+    player->dsp_offset += written;
+    player->dsp_pending -= written;
+  }
 
-  size_t avail_count = min_size_t(avail, count);
-  int write_result = snd_pcm_writei(player->handle, pcm, avail_count);
-  if (write_result == -EAGAIN) {
-    // let's try again
-    error_r = player_write_alsa(player);
-  } else {
-    if (write_result < 0) {
-      error_t err_recovery = xrun_recovery(player->handle, write_result);
-      if (err_recovery < 0) {
-        error_r = write_result;
-        log_error("PLAYER: Write error: %s", snd_strerror(error_r));
-      }
+  struct io_buffer *buffer = pcm_decoder_get_output_buffer(player->decoder);
+  while (error_r == 0 && player->dsp_pending == 0) {
+    void *pcm;
+    size_t count;
+    size_t avail = 0;
+    io_buffer_array_items(buffer, frame_size, &pcm, &count);
+    bool is_tail = count == 0 && player_has_dsp_tail(player);
+    if (count > 0 || is_tail) {
+      error_r = pcm_sink_avail(player->sink, &avail);
+    }
+    if (error_r != 0 || avail == 0) {
+      break;
+    }
+
+    size_t processed = min_size_t(
+      avail, pcm_dsp_chain_get_max_frames(player->dsp));
+    if (is_tail) {
+      processed = player_process_dsp_tail(
+        player, processed, player->dsp_output);
     } else {
-      io_buffer_array_seek(buffer, frame_size, write_result);
-      player->written_frames += write_result;
+      processed = min_size_t(processed, count);
+      pcm_dsp_chain_process(player->dsp, pcm, processed, player->dsp_output);
+      io_buffer_array_seek(buffer, frame_size, processed);
     }
+    error_r = player_write_frames(
+      player, player->dsp_output, processed, &written);
+    player->dsp_offset = written;
+    player->dsp_pending = processed - written;
   }
-
   return error_r;
 }
 
-error_t
-player_process_once(struct player *player) {
-  assert(player != NULL);
-  bool has_been_waiting;
-  error_t error_r = player_preload(player, &has_been_waiting);
-  if (error_r == 0 && !pcm_decoder_is_output_buffer_empty(player->decoder)) {
-    error_r = player_write_alsa(player);
-  }
-  if (error_r == 0 && !has_been_waiting) {
-    usleep(1000 * player->blocking_read_timeout);
+static error_t
+player_write_sink(struct player *player) {
+  if (player->dsp != NULL) {
+    return player_write_sink_dsp(player);
   }
+  size_t frame_size = pcm_decoder_frame_size(player->decoder);
+  // passthrough decoder is written straight from the source buffer
+  struct io_buffer *buffer = pcm_decoder_get_output_buffer(player->decoder);
+  void* pcm;
+  size_t count;
+  io_buffer_array_items(buffer, frame_size, &pcm, &count);
 
+  size_t written;
+  error_t error_r = player_write_frames(player, pcm, count, &written);
+  if (error_r == 0) {
+    io_buffer_array_seek(buffer, frame_size, written);
+  }
   return error_r;
 }
 
-error_t
-player_get_playback_status(
+/**
+ * Decode into given area of device ring, incomplete frame from previous
+ * decoding goes first and incomplete trailing frame goes back to output buffer.
+ */
+static size_t
+player_decode_into_area(
   struct player *player,
-  struct player_playback_status *result) {
-    assert(player != NULL);
-    assert(result != NULL);
+  void *area,
+  size_t frames_count,
+  error_t *error_r) {
+    struct pcm_decoder *decoder = player->decoder;
+    size_t frame_size = pcm_decoder_frame_size(decoder);
+    struct io_buffer output = decoder->dest;
+    io_buffer_init_view(area, frames_count * frame_size, &decoder->dest);
+
+    void *partial;
+    size_t partial_size = io_buffer_read_array(
+      &output, 1, &partial, frame_size);
+    if (partial_size > 0) {
+      memcpy(area, partial, partial_size);
+      io_buffer_write_commit(&decoder->dest, partial_size);
+    }
 
-    result->total = pcm_decoder_get_total_time(player->decoder);
-    result->stream_buffer = pcm_decoder_get_source_buffer_unread_size(
-      player->decoder);
+    while (
+      *error_r == 0
+      && pcm_decoder_is_source_buffer_ready_to_read(decoder)
+      && !pcm_decoder_is_output_buffer_full(decoder)) {
+        *error_r = player_decode_once(player, decoder);
+      }
 
-    snd_pcm_sframes_t delay;
-    error_t error_r = 0;
-    RETURN_ON_SNDERROR(
-      snd_pcm_delay(player->handle, &delay),
-      "PLAYER: getting delay: %s");
+    size_t decoded = io_buffer_get_unread_size(&decoder->dest);
+    size_t decoded_count = decoded / frame_size;
+    decoder->dest = output;
+    partial_size = decoded % frame_size;
+    if (partial_size > 0) {
+      bool has_partial = io_buffer_try_write(
+        &decoder->dest,
+        partial_size,
+        (char*)area + decoded_count * frame_size);  // NOLINT
+      assert(has_partial);
+      UNUSED(has_partial);
+    }
+    return decoded_count;
+  }
 
-    snd_pcm_uframes_t current = player->written_frames - delay;
-    result->actual = pcm_spec_get_samples_time(
-      &player->decoder->spec, current);
-    result->playback_buffer = pcm_spec_get_samples_time(
-      &player->decoder->spec, delay);
+/**
+ * Mmap access: decode straight into device ring, without output buffer.
+ */
+static error_t
+player_decode_mmap(struct player *player, size_t *written) {
+  struct pcm_decoder *decoder = player->decoder;
+  size_t frame_size = pcm_decoder_frame_size(decoder);
+  error_t error_r = 0;
+  *written = 0;
+
+  size_t frames_count;
+  error_r = pcm_sink_avail(player->sink, &frames_count);
+  if (error_r != 0 || frames_count * frame_size < decoder->block_size) {
+    // not enough space for the whole block
+    return error_r;
+  }
+
+  void *area;
+  error_r = pcm_sink_mmap_begin(player->sink, &area, &frames_count);
+  if (error_r != 0) {
+    return error_r;
+  }
+
+  // contiguous area ends with the end of the ring
+  if (frames_count * frame_size >= decoder->block_size) {
+    *written = player_decode_into_area(player, area, frames_count, &error_r);
+  }
+  if (player->dsp != NULL && *written > 0) {
+    // frames are committed right away, they are processed just once
+    pcm_dsp_chain_process(player->dsp, area, *written, area);
+  }
+
+  error_t commit_error_r = pcm_sink_mmap_commit(player->sink, *written);
+  if (commit_error_r == 0 && *written > 0) {
+    player_add_written(player, *written);
+  } else if (commit_error_r != 0) {
+    *written = 0;
+    error_r = commit_error_r;
+  }
+  return error_r;
+}
+
+static error_t
+player_process_mmap(struct player *player) {
+  struct pcm_decoder *decoder = player->decoder;
+  error_t error_r = player_read_source(player, 0);
+
+  // leftovers are copied
+  if (error_r == 0 && !player_is_output_empty(player)) {
+    error_r = player_write_sink(player);
+  }
+
+  size_t written = 1;
+  while (error_r == 0
+    && written > 0
+    && player_is_output_empty(player)
+    && pcm_decoder_is_source_buffer_ready_to_read(decoder)) {
+      error_r = player_decode_mmap(player, &written);
+    }
+
+  // end of the ring is too short for the whole block, copy single block there
+  size_t avail = 0;
+  if (error_r == 0
+    && player_is_output_empty(player)
+    && pcm_decoder_is_source_buffer_ready_to_read(decoder)) {
+      error_r = pcm_sink_avail(player->sink, &avail);
+    }
+  if (error_r == 0 && avail > 0) {
+      error_r = player_decode_once(player, decoder);
+      if (error_r == 0 && !pcm_decoder_is_output_buffer_empty(decoder)) {
+        error_r = player_write_sink(player);
+      }
+    }
+  return error_r;
+}
+
+/**
+ * Producer thread: read source and decode it into handoff buffer.
+ */
+static void*
+player_producer_thread(void *arg) {
+  struct player *player = (struct player*)arg;
+  struct player_threads *threads = player->threads;
+  struct pcm_decoder *decoder = player->decoder;
+  size_t frame_size = pcm_decoder_frame_size(decoder);
+  error_t error_r = 0;
+
+  while (error_r == 0 && !atomic_load(&threads->is_stopping)) {
+    int poll_timeout = player->blocking_read_timeout;
+    if (pcm_decoder_is_output_buffer_empty(decoder)
+      && !pcm_decoder_is_source_buffer_ready_to_read(decoder)
+      && !pcm_decoder_is_source_empty(decoder)) {
+        atomic_fetch_add(&threads->producer_source_empty_count, 1);
+        poll_timeout = -1;
+      }
+    error_r = player_preload(player, poll_timeout);
+    atomic_store(
+      &threads->source_buffer,
+      pcm_decoder_get_source_buffer_unread_size(decoder));
+
+    size_t moved = 0;
+    bool is_handoff_full = false;
+    if (error_r == 0 && !pcm_decoder_is_output_buffer_empty(decoder)) {
+      void *pcm;
+      size_t count;
+      struct io_buffer *output = pcm_decoder_get_output_buffer(decoder);
+      io_buffer_array_items(output, frame_size, &pcm, &count);
+
+      void *handoff;
+      size_t handoff_count = io_spsc_buffer_write_begin(
+        threads->handoff, &handoff) / frame_size;
+      moved = min_size_t(count, handoff_count);
+      is_handoff_full = count > 0 && handoff_count == 0;
+      if (moved > 0) {
+        if (player->dsp != NULL) {
+          // writer thread gets processed frames
+          pcm_dsp_chain_process(player->dsp, pcm, moved, handoff);
+        } else {
+          memcpy(handoff, pcm, moved * frame_size);
+        }
+        io_spsc_buffer_write_commit(threads->handoff, moved * frame_size);
+        io_buffer_array_seek(output, frame_size, moved);
+        atomic_fetch_add(&threads->producer_frames, moved);
+      }
+    } else if (error_r == 0 && player_has_dsp_tail(player)) {
+      void *handoff;
+      size_t handoff_count = io_spsc_buffer_write_begin(
+        threads->handoff, &handoff) / frame_size;
+      moved = player_process_dsp_tail(player, handoff_count, handoff);
+      is_handoff_full = handoff_count == 0;
+      io_spsc_buffer_write_commit(threads->handoff, moved * frame_size);
+      atomic_fetch_add(&threads->producer_frames, moved);
+    }
+
+    if (error_r == 0
+      && player_is_decoder_done(decoder)
+      && !player_has_dsp_tail(player)) {
+      // player_enqueue checks it after the next decoder is published
+      atomic_store(&threads->is_producer_finishing, true);
+      size_t produced = atomic_load(&threads->producer_frames);
+      if (!player_switch_track(player, threads->start_frame + produced)) {
+          log_verbose("PLAYER: producer finished");
+          break;
+        }
+      atomic_store(&threads->is_producer_finishing, false);
+      decoder = player->decoder;
+      continue;
+    }
+    if (is_handoff_full) {
+      atomic_fetch_add(&threads->producer_handoff_full_count, 1);
+    }
+    if (error_r == 0 && moved == 0) {
+      usleep(1000 * player->blocking_read_timeout);
+    }
+  }
+
+  atomic_store(&threads->producer_error, error_r);
+  atomic_store(&threads->is_producer_done, true);
+  return NULL;
+}
+
+static error_t
+player_pause_sink(struct player *player, bool is_paused) {
+  log_verbose("PLAYER: %s sink", is_paused ? "pausing" : "resuming");
+  player->is_sink_paused = is_paused;
+  return pcm_sink_pause(player->sink, is_paused);
+}
+
+/**
+ * Writer thread: feed ALSA from handoff buffer.
+ */
+static void*
+player_writer_thread(void *arg) {
+  struct player *player = (struct player*)arg;
+  struct player_threads *threads = player->threads;
+  size_t frame_size = pcm_frame_size(&player->spec);
+  error_t error_r = 0;
+
+  while (error_r == 0 && !atomic_load(&threads->is_stopping)) {
+    bool is_paused = atomic_load(&player->is_paused);
+    if (is_paused != player->is_sink_paused) {
+      error_r = player_pause_sink(player, is_paused);
+      continue;
+    } else if (is_paused) {
+      usleep(1000 * player->blocking_read_timeout);
+      continue;
+    }
+
+    // everything committed before producer is done is visible after it
+    bool is_producer_done = atomic_load(&threads->is_producer_done);
+    void *pcm;
+    size_t count = io_spsc_buffer_read_begin(
+      threads->handoff, &pcm) / frame_size;
+
+    if (count == 0) {
+      if (is_producer_done) {
+        // less than start threshold may be left after seeking near the end
+        error_r = pcm_sink_drain(player->sink);
+        if (error_r == 0 && !pcm_sink_is_drained(player->sink)) {
+          usleep(1000 * player->blocking_read_timeout);
+          continue;
+        }
+        log_verbose("PLAYER: writer finished");
+        break;
+      }
+      atomic_fetch_add(&threads->writer_handoff_empty_count, 1);
+      usleep(1000 * player->blocking_read_timeout);
+    } else {
+      size_t written = 0;
+      error_r = player_sample_sink_avail(player);
+      if (error_r == 0) {
+        error_r = player_write_frames(player, pcm, count, &written);
+      }
+      if (error_r == 0 && written > 0) {
+        io_spsc_buffer_read_commit(threads->handoff, written * frame_size);
+        atomic_fetch_add(&threads->writer_frames, written);
+      } else if (error_r == 0) {
+        atomic_fetch_add(&threads->writer_device_full_count, 1);
+        error_r = pcm_sink_wait(player->sink, player->blocking_read_timeout);
+      }
+    }
+  }
+
+  atomic_store(&threads->writer_error, error_r);
+  atomic_store(&threads->is_writer_done, true);
+  return NULL;
+}
+
+static error_t
+player_start_threads(struct player *player) {
+  log_verbose("PLAYER: starting producer and writer threads");
+  struct player_threads *threads = calloc(1, sizeof(struct player_threads));
+  if (threads == NULL) {
+    log_error("PLAYER: Cannot allocate memory for player threads");
+    return ENOMEM;
+  }
+  player->threads = threads;
+  threads->start_frame = atomic_load(&player->written_frames);
+  atomic_init(&threads->is_stopping, false);
+  atomic_init(&threads->is_producer_finishing, false);
+  atomic_init(&threads->is_producer_done, false);
+  atomic_init(&threads->is_writer_done, false);
+  atomic_init(&threads->producer_error, 0);
+  atomic_init(&threads->writer_error, 0);
+
+  size_t frame_size = pcm_decoder_frame_size(player->decoder);
+  size_t handoff_size = player->handoff_buffer_size;
+  if (handoff_size == 0) {
+    handoff_size = 4 * player->frames_per_period * frame_size;
+  }
+  error_t error_r = io_spsc_buffer_alloc(
+    handoff_size, frame_size, &threads->handoff);
+
+  if (error_r == 0) {
+    error_r = pthread_create(
+      &threads->producer, NULL, player_producer_thread, player);
+    if (error_r != 0) {
+      log_error("PLAYER: Cannot start producer thread: %s", strerror(error_r));
+    } else {
+      threads->is_producer_started = true;
+    }
+  }
+  // only the writer is real-time, decoding ahead absorbs producer delays
+  pthread_attr_t writer_attr;
+  bool is_writer_attr = false;
+  if (error_r == 0) {
+    error_r = realtime_thread_attr_init(
+      &writer_attr,
+      player->realtime_priority,
+      player->writer_cpu_mask);
+    is_writer_attr = error_r == 0;
+  }
+  if (error_r == 0) {
+    error_r = pthread_create(
+      &threads->writer, &writer_attr, player_writer_thread, player);
+    if (error_r == EPERM) {
+      log_error(
+        "PLAYER: Writer thread cannot run with priority %d, "
+        "see RLIMIT_RTPRIO",
+        player->realtime_priority);
+    } else if (error_r != 0) {
+      log_error("PLAYER: Cannot start writer thread: %s", strerror(error_r));
+    } else {
+      threads->is_writer_started = true;
+    }
+  }
+  if (is_writer_attr) {
+    pthread_attr_destroy(&writer_attr);
+  }
+  return error_r;
+}
+
+static void
+player_stop_threads(struct player *player) {
+  struct player_threads *threads = player->threads;
+  if (threads != NULL) {
+    atomic_store(&threads->is_stopping, true);
+    if (threads->is_producer_started) {
+      pthread_join(threads->producer, NULL);
+    }
+    if (threads->is_writer_started) {
+      pthread_join(threads->writer, NULL);
+    }
+
+    struct player_threads_statistics stats;
+    if (threads->handoff != NULL
+      && player_get_threads_statistics(player, &stats) == 0) {
+        log_verbose(
+          "PLAYER: producer frames %lu, source empty %lu, handoff full %lu",
+          stats.producer_frames,
+          stats.producer_source_empty_count,
+          stats.producer_handoff_full_count);
+        log_verbose(
+          "PLAYER: writer frames %lu, handoff empty %lu, device full %lu",
+          stats.writer_frames,
+          stats.writer_handoff_empty_count,
+          stats.writer_device_full_count);
+      }
+
+    io_spsc_buffer_free(&threads->handoff);
+    free(threads);
+    player->threads = NULL;
+  }
+}
+
+static error_t
+player_threads_process_once(struct player *player) {
+  struct player_threads *threads = player->threads;
+  error_t error_r = atomic_load(&threads->producer_error);
+  if (error_r == 0) {
+    error_r = atomic_load(&threads->writer_error);
+  }
+  return error_r;
+}
+
+error_t
+player_process_once(struct player *player) {
+  assert(player != NULL);
+  if (player->threads != NULL) {
+    return player_threads_process_once(player);
+  }
+  if (atomic_load(&player->is_paused)) {
+    return 0;
+  }
+
+  error_t error_r = 0;
+  if (!player_is_decoder_done(player->decoder)) {
+    error_r = player_sample_sink_avail(player);
+  }
+  if (error_r == 0 && pcm_sink_has_mmap(player->sink)) {
+    error_r = player_process_mmap(player);
+  } else if (error_r == 0) {
+    // waiting is left to player_wait
+    error_r = player_preload(player, 0);
+    if (error_r == 0 && !player_is_output_empty(player)) {
+      error_r = player_write_sink(player);
+    }
+  }
+
+  // everything has been written, queued track goes right after it
+  if (error_r == 0
+    && player_is_decoder_done(player->decoder)
+    && player->dsp_pending == 0) {
+      player_switch_track(player, atomic_load(&player->written_frames));
+    }
+  return error_r;
+}
+
+static int
+min_poll_timeout(int a, int b) {
+  if (a < 0) {
+    return b;
+  } else if (b < 0) {
+    return a;
+  } else {
+    return min_int(a, b);
+  }
+}
+
+/**
+ * Everything has been written, wake up when device is expected to be drained.
+ */
+static error_t
+player_get_drain_timeout(struct player *player, int *timeout) {
+  size_t delay = 0;
+  player->is_draining = true;
+  error_t error_r = pcm_sink_drain(player->sink);
+  if (error_r == 0) {
+    error_r = pcm_sink_delay(player->sink, &delay);
+  }
+  *timeout = 1 + timespec_miliseconds(
+    pcm_spec_get_samples_time(&player->decoder->spec, delay));
+  return error_r;
+}
+
+error_t
+player_wait(struct player *player, int timeout) {
+  assert(player != NULL);
+  struct pollfd *fds = player->poll_fds;
+  nfds_t fds_count = 0;
+  nfds_t sink_fds_start = 0;
+  int sink_fds_count = 0;
+  error_t error_r = 0;
+
+  fds[fds_count++] = (struct pollfd) {
+    .fd = player->control_fd,
+    .events = POLLIN
+  };
+
+  if (player->threads != NULL) {
+    // threads are doing the job, wake up only to refresh the status
+    timeout = min_poll_timeout(timeout, player->blocking_read_timeout);
+  } else {
+    // producer thread switches decoders, it is safe to use it only here
+    struct pcm_decoder *decoder = player->decoder;
+    int source_fd = pcm_decoder_get_source_poll_fd(decoder);
+    if (source_fd != -1 && !pcm_decoder_is_source_buffer_full(decoder)) {
+      fds[fds_count++] = (struct pollfd) {
+        .fd = source_fd,
+        .events = POLLIN
+      };
+    }
+
+    // decoded or not, there is something for the sink
+    bool has_frames = !player_is_output_empty(player)
+      || pcm_decoder_is_source_buffer_ready_to_read(decoder);
+    if (has_frames) {
+      sink_fds_start = fds_count;
+      sink_fds_count = pcm_sink_poll_descriptors(
+        player->sink, fds + fds_count, player->sink->poll_fds_count);
+      if (sink_fds_count < 0) {
+        return sink_fds_count;
+      }
+      if (sink_fds_count == 0) {
+        // sink never blocks
+        timeout = 0;
+      }
+      fds_count += sink_fds_count;
+    } else if (pcm_decoder_is_source_empty(decoder)
+      && atomic_load(&player->next_decoder) == NULL) {
+        int drain_timeout;
+        error_r = player_get_drain_timeout(player, &drain_timeout);
+        if (error_r != 0) {
+          return error_r;
+        }
+        timeout = min_poll_timeout(timeout, drain_timeout);
+      }
+  }
+
+  int ready = poll(fds, fds_count, timeout);
+  player->wakeups_count++;
+  if (ready == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    error_r = errno;
+    log_error("PLAYER: Poll failed: %s", strerror(error_r));
+    return error_r;
+  }
+
+  if (fds[0].revents & POLLIN) {
+    uint64_t wakeups;
+    if (read(player->control_fd, &wakeups, sizeof(wakeups)) == -1
+      && errno != EAGAIN) {
+        error_r = errno;
+        log_error("PLAYER: Reading control eventfd failed: %s", strerror(error_r));
+        return error_r;
+      }
+  }
+
+  if (ready > 0 && sink_fds_count > 0) {
+    unsigned short revents = 0;
+    error_r = pcm_sink_poll_revents(
+      player->sink, fds + sink_fds_start, sink_fds_count, &revents);
+    if (error_r != 0) {
+      return error_r;
+    }
+    if (revents & POLLERR) {
+      // next write is going to recover from it
+      log_verbose("PLAYER: device reported error while polling");
+    }
+  }
+  return 0;
+}
+
+void
+player_wakeup(struct player *player) {
+  assert(player != NULL);
+  uint64_t wakeup = 1;
+  if (write(player->control_fd, &wakeup, sizeof(wakeup)) == -1) {
+    log_error("PLAYER: Waking up failed: %s", strerror(errno));
+  }
+}
+
+error_t
+player_enqueue(struct player *player, struct pcm_decoder *next) {
+  assert(player != NULL);
+  assert(next != NULL);
+  if (atomic_load(&player->next_decoder) != NULL
+    || atomic_load(&player->finished_decoder) != NULL) {
+      log_error("PLAYER: Previous track has not been taken over yet");
+      return EBUSY;
+    }
+  if (!pcm_spec_is_same_format(&player->spec, &next->spec)) {
+    log_verbose("PLAYER: next track format differs, sink has to be reopened");
+    return ENOTSUP;
+  }
+  if (player->is_draining) {
+    log_verbose("PLAYER: sink is draining, next track is too late");
+    return ENOTSUP;
+  }
+
+  error_t error_r = preload_first_period(player, next);
+  if (error_r == 0) {
+    atomic_store(&player->next_decoder, next);
+
+    // producer may have checked the queue before it has been published
+    struct player_threads *threads = player->threads;
+    struct pcm_decoder *expected = next;
+    if (threads != NULL
+      && atomic_load(&threads->is_producer_finishing)
+      && atomic_compare_exchange_strong(
+        &player->next_decoder, &expected, NULL)) {
+          log_verbose("PLAYER: producer finished, next track is too late");
+          error_r = ENOTSUP;
+        }
+  }
+  return error_r;
+}
+
+struct pcm_decoder*
+player_take_finished(struct player *player) {
+  assert(player != NULL);
+  return atomic_exchange(&player->finished_decoder, NULL);
+}
+
+/**
+ * Status reports paused frame, as nothing is queued in the sink.
+ */
+static void
+player_set_paused_frame(struct player *player, size_t frame) {
+  player->paused_frame = frame;
+  pthread_mutex_lock(&player->tracks_lock);
+  player->tracks[1].start_frame = atomic_load(&player->written_frames);
+  player->tracks[1].first_frame = frame;
+  player->tracks[0] = player->tracks[1];
+  pthread_mutex_unlock(&player->tracks_lock);
+}
+
+/**
+ * Drop the paused sink, playback resumes by seeking to paused_frame.
+ */
+static error_t
+player_drop_paused(struct player *player) {
+  player_stop_threads(player);
+  error_t error_r = 0;
+  if (!player->is_pause_dropped) {
+    // drop ends pause of the sink as well
+    player->is_sink_paused = false;
+    error_r = pcm_sink_drop(player->sink);
+    player_reset_dsp(player);
+  }
+  player->is_pause_dropped = error_r == 0;
+  return error_r;
+}
+
+error_t
+player_seek(struct player *player, size_t frame) {
+  assert(player != NULL);
+  log_verbose("PLAYER: seeking to frame %lu", frame);
+  if (atomic_load(&player->is_paused)) {
+    size_t samples_count = player->decoder->spec.samples_count;
+    if (samples_count > 0 && frame >= samples_count) {
+      return EINVAL;
+    }
+    error_t error_r = player_drop_paused(player);
+    if (error_r == 0) {
+      player_set_paused_frame(player, frame);
+    }
+    return error_r;
+  }
+
+  // decoder and sink are owned by threads until they are stopped
+  bool is_threaded = player->threads != NULL;
+  player_stop_threads(player);
+
+  error_t error_r = pcm_sink_drop(player->sink);
+  player_reset_dsp(player);
+  if (error_r == 0) {
+    error_r = pcm_decoder_seek(player->decoder, frame);
+  }
+  if (error_r == 0) {
+    player->is_draining = false;
+    pthread_mutex_lock(&player->tracks_lock);
+    player->tracks[1].start_frame = atomic_load(&player->written_frames);
+    player->tracks[1].first_frame = frame;
+    player->tracks[0] = player->tracks[1];
+    pthread_mutex_unlock(&player->tracks_lock);
+    player->sink_filled_frame = atomic_load(&player->written_frames)
+      + player->sink->frames_per_buffer;
+    error_r = preload_first_period(player, player->decoder);
+  }
+  if (error_r == 0 && is_threaded) {
+    error_r = player_start_threads(player);
+  }
+  return error_r;
+}
+
+/**
+ * Frames written which have not been heard yet, processed frames
+ * leave DSP stages later than they enter them.
+ */
+static error_t
+player_get_delay(struct player *player, size_t *delay) {
+  error_t error_r = pcm_sink_delay(player->sink, delay);
+  if (error_r == 0 && player->dsp != NULL) {
+    *delay += pcm_dsp_chain_get_latency(player->dsp);
+  }
+  return error_r;
+}
+
+static size_t
+player_get_current_frame(struct player *player, size_t delay) {
+  size_t written = atomic_load(&player->written_frames);
+  return written > delay ? written - delay : 0;
+}
+
+/**
+ * Sink which cannot pause is dropped, frame heard last is found from
+ * its delay. Sink playing tail of previous track pauses at start
+ * of the current one.
+ */
+static error_t
+player_pause_dropping(struct player *player) {
+  player_stop_threads(player);
+
+  size_t delay;
+  error_t error_r = player_get_delay(player, &delay);
+  size_t current = player_get_current_frame(player, delay);
+  if (error_r == 0) {
+    error_r = player_drop_paused(player);
+  }
+  if (error_r == 0) {
+    pthread_mutex_lock(&player->tracks_lock);
+    struct player_track track = player->tracks[1];
+    pthread_mutex_unlock(&player->tracks_lock);
+    size_t frame = track.first_frame
+      + (current > track.start_frame ? current - track.start_frame : 0);
+    frame = min_size_t(frame, track.samples_count);
+
+    log_verbose("PLAYER: paused at frame %lu", frame);
+    player_set_paused_frame(player, frame);
+    atomic_store(&player->is_paused, true);
+  }
+  return error_r;
+}
+
+error_t
+player_pause(struct player *player) {
+  assert(player != NULL);
+  if (atomic_load(&player->is_paused)) {
+    return 0;
+  }
+  if (!pcm_sink_can_pause(player->sink)) {
+    return player_pause_dropping(player);
+  }
+  atomic_store(&player->is_paused, true);
+  return player->threads == NULL ? player_pause_sink(player, true) : 0;
+}
+
+error_t
+player_resume(struct player *player) {
+  assert(player != NULL);
+  if (!atomic_load(&player->is_paused)) {
+    return 0;
+  }
+  atomic_store(&player->is_paused, false);
+  if (!player->is_pause_dropped) {
+    return player->threads == NULL ? player_pause_sink(player, false) : 0;
+  }
+
+  error_t error_r = player_seek(player, player->paused_frame);
+  if (error_r == 0 && player->is_threaded) {
+    error_r = player_start_threads(player);
+  }
+  if (error_r == 0) {
+    player->is_pause_dropped = false;
+  } else {
+    atomic_store(&player->is_paused, true);
+  }
+  return error_r;
+}
+
+bool
+player_is_paused(const struct player *player) {
+  assert(player != NULL);
+  return atomic_load(&player->is_paused);
+}
+
+enum player_access
+player_get_access(const struct player *player) {
+  assert(player != NULL);
+  return pcm_sink_has_mmap(player->sink) ?
+    player_access_mmap : player_access_rw;
+}
+
+error_t
+player_get_playback_status(
+  struct player *player,
+  struct player_playback_status *result) {
+    assert(player != NULL);
+    assert(result != NULL);
+
+    if (player->threads != NULL) {
+      result->stream_buffer = atomic_load(&player->threads->source_buffer);
+    } else {
+      result->stream_buffer = pcm_decoder_get_source_buffer_unread_size(
+        player->decoder);
+    }
+
+    size_t delay;
+    error_t error_r = player_get_delay(player, &delay);
+    if (error_r != 0) {
+      return error_r;
+    }
+
+    // with gapless playback sink may still play previous track
+    size_t current = player_get_current_frame(player, delay);
+    pthread_mutex_lock(&player->tracks_lock);
+    struct player_track track = current >= player->tracks[1].start_frame ?
+      player->tracks[1] : player->tracks[0];
+    pthread_mutex_unlock(&player->tracks_lock);
+
+    result->track = track.index;
+    result->total = pcm_spec_get_samples_time(
+      &player->spec, track.samples_count);
+    size_t track_frame = track.first_frame
+      + (current > track.start_frame ? current - track.start_frame : 0);
+    result->actual = pcm_spec_get_samples_time(
+      &player->spec, min_size_t(track_frame, track.samples_count));
+    result->playback_buffer = pcm_spec_get_samples_time(
+      &player->spec, delay);
+    result->xruns_count = atomic_load(&player->sink->events.xruns_count);
+    return 0;
+  }
+
+void
+player_get_latency_statistics(
+  struct player *player,
+  struct player_latency_statistics *result) {
+    assert(player != NULL);
+    assert(result != NULL);
+    const struct pcm_sink_events *events = &player->sink->events;
+    // times up to the count are in place once the count is seen
+    result->xruns_count = atomic_load_explicit(
+      &events->xruns_count, memory_order_acquire);
+    result->suspends_count = atomic_load(&events->suspends_count);
+    result->xrun_times_count = min_size_t(
+      result->xruns_count,
+      min_size_t(PLAYER_XRUN_TIMES_COUNT, PCM_SINK_XRUN_TIMES_COUNT));
+
+    unsigned long started = timespec_microseconds(player->started);
+    for (size_t i = 0; i < result->xrun_times_count; ++i) {
+      size_t xrun = result->xruns_count - result->xrun_times_count + i;
+      unsigned long time = atomic_load_explicit(
+        &events->xrun_times[xrun % PCM_SINK_XRUN_TIMES_COUNT],
+        memory_order_relaxed);
+      result->xrun_times[i] = timespec_from_microseconds(
+        time > started ? time - started : 0);
+    }
+
+    histogram_get_summary(player->sink_avail, &result->sink_avail);
+    histogram_get_summary(player->decode_time, &result->decode_time);
+    histogram_get_summary(player->write_interval, &result->write_interval);
+  }
+
+void
+player_get_dsp_statistics(
+  struct player *player,
+  struct pcm_dsp_statistics *result) {
+    assert(player != NULL);
+    assert(result != NULL);
+    if (player->dsp != NULL) {
+      pcm_dsp_chain_get_statistics(player->dsp, result);
+    } else {
+      memset(result, 0, sizeof(struct pcm_dsp_statistics));
+    }
+  }
+
+error_t
+player_set_volume(struct player *player, double volume_db) {
+  assert(player != NULL);
+  if (player->gain == NULL) {
+    log_error("PLAYER: Volume control is not enabled");
+    return ENOTSUP;
+  }
+  log_verbose("PLAYER: Volume %.2fdB", volume_db);
+  pcm_gain_stage_set_volume(player->gain, volume_db);
+  return 0;
+}
+
+double
+player_get_volume(struct player *player) {
+  assert(player != NULL);
+  return player->gain != NULL ?
+    pcm_gain_stage_get_volume(player->gain) : 0;
+}
+
+error_t
+player_get_threads_statistics(
+  struct player *player,
+  struct player_threads_statistics *result) {
+    assert(player != NULL);
+    assert(result != NULL);
+    struct player_threads *threads = player->threads;
+    if (threads == NULL) {
+      return EINVAL;
+    }
+
+    result->producer_frames = atomic_load(&threads->producer_frames);
+    result->producer_source_empty_count = atomic_load(
+      &threads->producer_source_empty_count);
+    result->producer_handoff_full_count = atomic_load(
+      &threads->producer_handoff_full_count);
+    result->writer_frames = atomic_load(&threads->writer_frames);
+    result->writer_handoff_empty_count = atomic_load(
+      &threads->writer_handoff_empty_count);
+    result->writer_device_full_count = atomic_load(
+      &threads->writer_device_full_count);
+    result->handoff_buffer = io_spsc_buffer_get_unread_size(threads->handoff);
+    return 0;
+  }
+
+error_t
+player_tune_sink(
+  struct player *player,
+  unsigned int margin,
+  struct player_sink_tuning *result) {
+    assert(player != NULL);
+    assert(margin > 0);
+    assert(result != NULL);
+    struct player_latency_statistics stats;
+    player_get_latency_statistics(player, &stats);
+    if (stats.sink_avail.count == 0) {
+      return EINVAL;
+    }
+
+    // sink is refilled once per period, anything above it is a stall
+    const struct pcm_sink *sink = player->sink;
+    size_t rate = player->spec.samples_per_sec;
+    size_t dip = stats.sink_avail.max > sink->frames_per_period ?
+      stats.sink_avail.max - sink->frames_per_period : 0;
+    size_t stall_us = dip * 1000000ul / rate;
+    stall_us = max_size_t(stall_us, stats.decode_time.max / 1000);
+    // with producer thread source reads reach the sink via headroom only
+    const struct io_stream_statistics *io_stats = player->decoder->src->stats;
+    if (player->threads == NULL && io_stats != NULL) {
+      stall_us = max_size_t(
+        stall_us, timespec_microseconds(io_stats->read_latency_max));
+    }
+    stall_us = max_size_t(stall_us, PLAYER_TUNING_MIN_STALL_US);
+
+    size_t periods = min_size_t(margin + 1, USHRT_MAX);
+    size_t period_frames = (stall_us * rate + 999999) / 1000000;
+    if (stats.xruns_count > 0) {
+      size_t grown = (2 * sink->frames_per_buffer + periods - 1) / periods;
+      period_frames = max_size_t(period_frames, grown);
+    }
+
+    result->measured = timer_elapsed(player->started);
+    result->stall = timespec_from_microseconds(stall_us);
+    result->period_size = period_frames * pcm_frame_size(&player->spec);
+    result->periods_per_buffer = periods;
+    result->is_margin_violated = stats.xruns_count > 0
+      || sink->frames_per_buffer < period_frames * periods;
     return 0;
   }
@@ -1,7 +1,14 @@
 #ifndef PLAYER_H_
 #define PLAYER_H_
 
+#include "histogram.h"
 #include "pcm.h"
+#include "pcm_convolve.h"
+#include "pcm_dsp.h"
+#include "pcm_gain.h"
+#include "pcm_resample.h"
+
+#define PLAYER_XRUN_TIMES_COUNT 16
 
 struct sound_card_info;
 
@@ -29,16 +36,58 @@ soundc_release(struct sound_card_info **info);
 bool
 soundc_is_valid_hardware_id(const char *hardware_id);
 
+enum player_sink {
+  player_sink_alsa            = 1,
+  player_sink_null            = 2,
+  player_sink_null_realtime   = 3,
+  player_sink_wav             = 4,
+};
+
 /**
  * @brief Player parameters used for setting it up
  *
+ * In threaded mode source reading and decoding is done by producer thread,
+ * which hands PCM over to sink writer thread via lock-free buffer
+ * of handoff_buffer_size (4 periods by default).
+ *
+ * Mmap access is used if device supports it, unless disable_mmap_access.
+ * With resample_quality set, rates the device does not take are resampled
+ * by the player instead of ALSA.
+ * PCM goes to ALSA device hardware_id unless other sink is selected.
+ *
+ * Decoded PCM goes through dsp_stages in given order on its way to the sink.
+ * Player releases them, even if it fails to open.
+ * With convolution_path set, convolution stage with impulse responses
+ * of that WAV file follows them, see pcm_convolve.h.
+ * With volume control, ReplayGain mode or volume set, software gain stage
+ * follows them, see pcm_gain.h.
+ *
+ * Sink writer runs with SCHED_FIFO realtime_priority if it is set, and only
+ * on CPUs from writer_cpu_mask if it is set. Without threaded mode this
+ * applies to the thread calling player_open.
  */
 struct player_parameters {
+  enum player_sink sink;
+  const char *sink_file_path;
   const char *hardware_id;
   bool disable_resampling;
+  bool disable_mmap_access;
+  enum pcm_resample_quality resample_quality;
+  struct pcm_dsp_stage *const *dsp_stages;
+  size_t dsp_stages_count;
+  const char *convolution_path;
+  size_t convolution_partition;   // frames, latency of convolution
+  bool has_volume_control;
+  double volume_db;
+  enum pcm_replay_gain_mode replay_gain;  // tags are ignored if 0
+  enum pcm_dither dither;
   size_t period_size;
   unsigned short periods_per_buffer;
   unsigned short reads_per_period;
+  bool is_threaded;
+  size_t handoff_buffer_size;
+  int realtime_priority;
+  unsigned long writer_cpu_mask;
 };
 
 /**
@@ -47,27 +96,118 @@ struct player_parameters {
  */
 struct player;
 
+/**
+ * @brief Sink access type, with mmap access PCM is decoded
+ * straight into sink ring.
+ */
+enum player_access {
+  player_access_rw      = 1,
+  player_access_mmap    = 2,
+};
+
+static inline const char*
+player_access_name(enum player_access access) {
+  switch (access) {
+    case player_access_rw:
+      return "RW";
+    case player_access_mmap:
+      return "MMAP";
+  }
+  return "unknown";
+}
+
 error_t
 player_open(
   const struct player_parameters *params,
   struct pcm_decoder *pcm_stream,
   struct player **player);
 
+enum player_access
+player_get_access(const struct player *player);
+
 bool
 player_is_eof(struct player *player);
 
+/**
+ * @brief Read, decode and write to the device whatever can be done
+ * without blocking.
+ */
 error_t
 player_process_once(struct player *player);
 
 /**
- * @brief Player status like total and actual time playback time
+ * @brief Sleep until device needs more data, source read can progress,
+ * player_wakeup is called or timeout (in ms, -1 for infinite) expires.
+ */
+error_t
+player_wait(struct player *player, int timeout);
+
+/**
+ * @brief Interrupt player_wait, can be called from any thread.
+ */
+void
+player_wakeup(struct player *player);
+
+/**
+ * @brief Queue track to be played right after the current one.
  *
+ * Queued track continues on the same sink without draining it, its first
+ * period is decoded right away. Only one track can be queued and finished
+ * one has to be taken first, EBUSY otherwise. ENOTSUP if PCM format differs
+ * or current track is over already, then new player is needed for it.
+ * Player never releases decoders.
+ */
+error_t
+player_enqueue(struct player *player, struct pcm_decoder *next);
+
+/**
+ * @brief Take decoder replaced by the queued one, NULL if there is none.
+ * Player doesn't use it any more.
+ */
+struct pcm_decoder*
+player_take_finished(struct player *player);
+
+/**
+ * @brief Continue the track being decoded from given frame.
+ *
+ * Frames which have not been played yet are dropped, both decoded
+ * and queued in the sink. Queued track stays queued. ENOTSUP if decoder
+ * cannot seek, EINVAL if frame is past the end of the track.
+ */
+error_t
+player_seek(struct player *player, size_t frame);
+
+/**
+ * @brief Stop playback, sink which cannot pause drops frames
+ * which have not been played yet.
+ *
+ * While paused player does nothing, player_wait should not be used then
+ * and player_seek only moves the frame playback resumes from.
+ */
+error_t
+player_pause(struct player *player);
+
+/**
+ * @brief Continue playback from the frame heard last or sought to,
+ * ENOTSUP if decoder cannot seek.
+ */
+error_t
+player_resume(struct player *player);
+
+bool
+player_is_paused(const struct player *player);
+
+/**
+ * @brief Player status like total and actual time playback time
+ * of the track being heard, tracks are counted from 0.
  */
 struct player_playback_status {
+  size_t track;
   struct timespec total;
   struct timespec actual;
   struct timespec playback_buffer;
   size_t stream_buffer;
+  size_t xruns_count;
 };
 
 error_t
@@ -75,6 +215,105 @@ player_get_playback_status(
   struct player *player,
   struct player_playback_status *result);
 
+/**
+ * @brief Threaded mode counters, shows which side is starving
+ *
+ */
+struct player_threads_statistics {
+  size_t producer_frames;
+  size_t producer_source_empty_count;
+  size_t producer_handoff_full_count;
+  size_t writer_frames;
+  size_t writer_handoff_empty_count;
+  size_t writer_device_full_count;
+  size_t handoff_buffer;
+};
+
+/**
+ * @brief Get threaded mode counters, EINVAL if player is not threaded
+ */
+error_t
+player_get_threads_statistics(
+  struct player *player,
+  struct player_threads_statistics *result);
+
+/**
+ * @brief Sink interruptions and latency histograms
+ *
+ * Times of the last xruns are since player_open, the oldest goes first.
+ * Sink avail is sampled in frames once per wakeup, while there is something
+ * to write and once the sink has been filled after open or seek. Decode time is per decoded block in nanoseconds, write interval
+ * is time between writes to the sink in microseconds.
+ */
+struct player_latency_statistics {
+  size_t xruns_count;
+  size_t suspends_count;
+  struct timespec xrun_times[PLAYER_XRUN_TIMES_COUNT];
+  size_t xrun_times_count;
+  struct histogram_summary sink_avail;
+  struct histogram_summary decode_time;
+  struct histogram_summary write_interval;
+};
+
+/**
+ * @brief Get latency statistics, can be called from any thread.
+ */
+void
+player_get_latency_statistics(
+  struct player *player,
+  struct player_latency_statistics *result);
+
+/**
+ * @brief Get CPU time spent by DSP stages, none without them.
+ * Can be called from any thread.
+ */
+void
+player_get_dsp_statistics(
+  struct player *player,
+  struct pcm_dsp_statistics *result);
+
+/**
+ * @brief Set volume of software gain stage, it is ramped to within
+ * PCM_GAIN_RAMP_MS of the next block processed. ENOTSUP if player has
+ * no volume control. Can be called from any thread.
+ */
+error_t
+player_set_volume(struct player *player, double volume_db);
+
+/**
+ * @brief Volume set so far, 0 without volume control.
+ */
+double
+player_get_volume(struct player *player);
+
+/**
+ * @brief Sink size picked from playback measured so far
+ *
+ * Stall is the longest time the sink has not been fed: the deepest drop
+ * of sink headroom beyond a period, the longest source read and the longest
+ * block decoding, whichever is the greatest. Period covers a single stall
+ * and the rest of the buffer margin more of them. After xruns the current
+ * buffer is doubled at least. Margin is violated if the current buffer
+ * is smaller than the picked one or xruns have happened.
+ */
+struct player_sink_tuning {
+  struct timespec measured;
+  struct timespec stall;
+  size_t period_size;
+  unsigned short periods_per_buffer;
+  bool is_margin_violated;
+};
+
+/**
+ * @brief Pick sink size for given safety margin, EINVAL if nothing
+ * has been measured yet.
+ */
+error_t
+player_tune_sink(
+  struct player *player,
+  unsigned int margin,
+  struct player_sink_tuning *result);
+
 void
 player_release(struct player **player);
 
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "io.h"
+#include "log.h"
+#include "realtime.h"
+
+static void
+realtime_format_limit(rlim_t value, char *dest, size_t size) {
+  if (value == RLIM_INFINITY) {
+    snprintf(dest, size, "unlimited");
+  } else {
+    snprintf(dest, size, "%lu", (unsigned long)value);
+  }
+}
+
+static void
+realtime_log_limit(const char *name, int resource) {
+  struct rlimit limit;
+  if (getrlimit(resource, &limit) != 0) {
+    log_error("Cannot get %s: %s", name, strerror(errno));
+    return;
+  }
+  char soft[32];
+  char hard[32];
+  realtime_format_limit(limit.rlim_cur, soft, sizeof(soft));
+  realtime_format_limit(limit.rlim_max, hard, sizeof(hard));
+  log_info("%s: %s (hard limit %s)", name, soft, hard);
+}
+
+void
+realtime_log_limits() {
+  realtime_log_limit("RLIMIT_RTPRIO", RLIMIT_RTPRIO);
+  realtime_log_limit("RLIMIT_MEMLOCK", RLIMIT_MEMLOCK);
+  log_info(
+    "SCHED_FIFO priorities: %d-%d",
+    sched_get_priority_min(SCHED_FIFO),
+    sched_get_priority_max(SCHED_FIFO));
+}
+
+error_t
+realtime_lock_memory(bool lock_future) {
+  int flags = lock_future ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+  if (mlockall(flags) != 0) {
+    error_t error_r = errno;
+    log_error(
+      "Cannot lock process memory: %s, see RLIMIT_MEMLOCK",
+      strerror(error_r));
+    return error_r;
+  }
+  io_buffer_set_memory_locked(true);
+  log_verbose("Process memory is locked, future mappings: %d", lock_future);
+  return 0;
+}
+
+static error_t
+realtime_get_sched_param(int priority, struct sched_param *param) {
+  if (priority < sched_get_priority_min(SCHED_FIFO)
+    || priority > sched_get_priority_max(SCHED_FIFO)) {
+      log_error("Invalid SCHED_FIFO priority: %d", priority);
+      return EINVAL;
+    }
+  *param = (struct sched_param) { .sched_priority = priority };
+  return 0;
+}
+
+static void
+realtime_get_cpu_set(unsigned long cpu_mask, cpu_set_t *cpus) {
+  CPU_ZERO(cpus);
+  for (size_t cpu = 0; cpu < 8 * sizeof(cpu_mask); ++cpu) {
+    if (cpu_mask & (1ul << cpu)) {
+      CPU_SET(cpu, cpus);
+    }
+  }
+}
+
+error_t
+realtime_thread_attr_init(
+  pthread_attr_t *attr,
+  int priority,
+  unsigned long cpu_mask) {
+    assert(attr != NULL);
+    error_t error_r = pthread_attr_init(attr);
+    if (error_r != 0) {
+      return error_r;
+    }
+    if (priority > 0) {
+      struct sched_param param;
+      error_r = realtime_get_sched_param(priority, &param);
+      if (error_r == 0) {
+        error_r = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+      }
+      if (error_r == 0) {
+        error_r = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+      }
+      if (error_r == 0) {
+        error_r = pthread_attr_setschedparam(attr, &param);
+      }
+    }
+    if (error_r == 0 && cpu_mask != 0) {
+      cpu_set_t cpus;
+      realtime_get_cpu_set(cpu_mask, &cpus);
+      error_r = pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+    if (error_r != 0) {
+      log_error("Cannot set up thread attributes: %s", strerror(error_r));
+      pthread_attr_destroy(attr);
+    }
+    return error_r;
+  }
+
+error_t
+realtime_set_current_thread(int priority, unsigned long cpu_mask) {
+  error_t error_r = 0;
+  if (priority > 0) {
+    struct sched_param param;
+    error_r = realtime_get_sched_param(priority, &param);
+    if (error_r == 0) {
+      error_r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      if (error_r != 0) {
+        log_error(
+          "Cannot switch thread to SCHED_FIFO: %s, see RLIMIT_RTPRIO",
+          strerror(error_r));
+      }
+    }
+  }
+  if (error_r == 0 && cpu_mask != 0) {
+    cpu_set_t cpus;
+    realtime_get_cpu_set(cpu_mask, &cpus);
+    error_r = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error_r != 0) {
+      log_error("Cannot set thread CPU affinity: %s", strerror(error_r));
+    }
+  }
+  return error_r;
+}
@@ -0,0 +1,40 @@
+#ifndef PLAYER_REALTIME_H_
+#define PLAYER_REALTIME_H_
+
+#include <pthread.h>
+#include "shrdef.h"
+
+/**
+ * @brief Log limits of real-time priority and locked memory
+ * obtained by the process, i.e. RLIMIT_RTPRIO and RLIMIT_MEMLOCK.
+ */
+void
+realtime_log_limits();
+
+/**
+ * @brief Lock process memory in RAM, io_buffers allocated from now on
+ * are prefaulted and locked as well.
+ *
+ * Future mappings are locked only if lock_future, memory mapped files
+ * would be read into RAM as a whole otherwise.
+ */
+error_t
+realtime_lock_memory(bool lock_future);
+
+/**
+ * @brief Thread attributes for SCHED_FIFO of given priority (0 for normal
+ * scheduling) and affinity to CPUs of given mask (0 for any CPU).
+ */
+error_t
+realtime_thread_attr_init(
+  pthread_attr_t *attr,
+  int priority,
+  unsigned long cpu_mask);
+
+/**
+ * @brief The same as realtime_thread_attr_init, for the calling thread.
+ */
+error_t
+realtime_set_current_thread(int priority, unsigned long cpu_mask);
+
+#endif
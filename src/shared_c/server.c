@@ -0,0 +1,949 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "flac.h"
+#include "log.h"
+#include "server.h"
+#include "timer.h"
+
+#define SERVER_QUEUE_SIZE 64
+#define SERVER_EPOLL_EVENTS 16
+#define SERVER_CLIENT_OUTPUT_SIZE (4 * SERVER_MAX_MESSAGE_SIZE)
+#define SERVER_DEFAULT_READ_SIZE (64 * 1024)
+#define SERVER_DEFAULT_IO_BUFFER_SIZE (16 * 1024 * 1024)
+
+enum server_endpoint_kind {
+  server_endpoint_control   = 1,
+  server_endpoint_listener  = 2,
+  server_endpoint_client    = 3,
+};
+
+/**
+ * Registered in epoll, so that events can be told apart.
+ */
+struct server_endpoint {
+  enum server_endpoint_kind kind;
+  int fd;
+};
+
+struct server_client {
+  struct server_endpoint endpoint;
+  bool is_tcp;
+  bool is_subscribed;
+  // status has changed since it has been pushed to the client
+  bool is_status_stale;
+  bool is_writing;
+  // freed once events of the current batch are handled
+  bool is_closed;
+  size_t input_size;
+  uint8_t input[4 + SERVER_MAX_MESSAGE_SIZE];
+  size_t output_offset;
+  size_t output_size;
+  uint8_t output[SERVER_CLIENT_OUTPUT_SIZE];
+};
+
+struct server_track {
+  char *file_path;
+  struct io_rf_stream stream;
+  struct pcm_decoder *decoder;
+};
+
+struct server {
+  struct server_parameters params;
+  int epoll_fd;
+  atomic_bool is_stopping;
+  struct server_endpoint control;
+  struct server_endpoint unix_listener;
+  struct server_endpoint tcp_listener;
+  unsigned short tcp_port;
+  struct server_client **clients;
+  size_t clients_count;
+
+  // current track is played, next one is either queued in the player
+  // or waits for the player to be over if its format differs
+  struct player *player;
+  double volume_db;
+  struct server_track tracks[2];
+  struct server_track *current;
+  struct server_track *next;
+  size_t tracks_base;
+  char *queue[SERVER_QUEUE_SIZE];
+  size_t queue_head;
+  size_t queue_count;
+  uint8_t status[SERVER_STATUS_PAYLOAD_SIZE];
+};
+
+static inline uint8_t*
+server_put_u32(uint8_t *dest, uint32_t value) {
+  value = htole32(value);
+  memcpy(dest, &value, sizeof(value));
+  return dest + sizeof(value);
+}
+
+static inline uint8_t*
+server_put_u64(uint8_t *dest, uint64_t value) {
+  value = htole64(value);
+  memcpy(dest, &value, sizeof(value));
+  return dest + sizeof(value);
+}
+
+static inline uint32_t
+server_get_u32(const uint8_t *src) {
+  uint32_t value;
+  memcpy(&value, src, sizeof(value));
+  return le32toh(value);
+}
+
+static error_t
+server_track_open(
+  const struct server *server,
+  const char *file_path,
+  size_t file_path_size,
+  struct server_track *track) {
+    track->file_path = strndup(file_path, file_path_size);
+    if (track->file_path == NULL) {
+      log_error("SERVER: Insufficient memory for file path");
+      return ENOMEM;
+    }
+    log_verbose("SERVER: Opening [%s]", track->file_path);
+
+    size_t read_size = server->params.player.period_size > 0 ?
+      server->params.player.period_size : SERVER_DEFAULT_READ_SIZE;
+    size_t buffer_size = server->params.io_buffer_size > 0 ?
+      server->params.io_buffer_size : SERVER_DEFAULT_IO_BUFFER_SIZE;
+    enum pcm_format format;
+    error_t error_r = pcm_guess_format(track->file_path, &format);
+    if (error_r == 0) {
+      error_r = io_rf_stream_open_file(
+        track->file_path,
+        max_size_t(buffer_size, read_size),
+        read_size,
+        &track->stream);
+    }
+    if (error_r == 0) {
+      switch (format) {
+        case pcm_format_wav:
+          error_r = pcm_decoder_wav_open(&track->stream, &track->decoder);
+          break;
+        case pcm_format_flac:
+          error_r = pcm_decoder_flac_open(
+            &track->stream, 2 * read_size, &track->decoder);
+          break;
+        default:
+          log_error("SERVER: Unknown format: %d", format);
+          error_r = EINVAL;
+      }
+    }
+    return error_r;
+  }
+
+static void
+server_track_free(struct server_track *track) {
+  if (track->decoder != NULL) {
+    pcm_decoder_decode_release(&track->decoder);
+  }
+  io_rf_stream_free(&track->stream);
+  free(track->file_path);
+  *track = (struct server_track) { 0 };
+}
+
+static void
+server_swap_tracks(struct server *server) {
+  struct server_track *finished = server->current;
+  server->current = server->next;
+  server->next = finished;
+}
+
+static void
+server_clear_queue(struct server *server) {
+  while (server->queue_count > 0) {
+    free(server->queue[server->queue_head]);
+    server->queue_head = (server->queue_head + 1) % SERVER_QUEUE_SIZE;
+    server->queue_count--;
+  }
+}
+
+static void
+server_release_player(struct server *server) {
+  if (server->player != NULL) {
+    struct player_playback_status status;
+    size_t played = 1;
+    if (player_get_playback_status(server->player, &status) == 0) {
+      played = status.track + 1;
+    }
+    server->tracks_base += played;
+    player_release(&server->player);
+  }
+  server_track_free(server->current);
+}
+
+static error_t
+server_start_player(struct server *server) {
+  struct player_parameters params = server->params.player;
+  params.is_threaded = true;
+  params.has_volume_control = true;
+  params.volume_db = server->volume_db;
+  error_t error_r = player_open(
+    &params, server->current->decoder, &server->player);
+  if (error_r == 0) {
+    log_info("SERVER: Playing [%s]", server->current->file_path);
+  } else {
+    server_track_free(server->current);
+  }
+  return error_r;
+}
+
+/**
+ * Open queued files until one of them can be played next, it is queued
+ * in the player unless its format differs.
+ */
+static void
+server_open_next(struct server *server) {
+  while (server->next->decoder == NULL && server->queue_count > 0) {
+    char *file_path = server->queue[server->queue_head];
+    server->queue_head = (server->queue_head + 1) % SERVER_QUEUE_SIZE;
+    server->queue_count--;
+
+    error_t error_r = server_track_open(
+      server, file_path, strlen(file_path), server->next);
+    free(file_path);
+    if (error_r == 0 && server->player != NULL) {
+      error_r = player_enqueue(server->player, server->next->decoder);
+      if (error_r == ENOTSUP) {
+        log_verbose(
+          "SERVER: [%s] is going to be played on reopened sink",
+          server->next->file_path);
+        error_r = 0;
+      }
+    }
+    if (error_r != 0) {
+      log_error("SERVER: Skipping queued file: %s", strerror(error_r));
+      server_track_free(server->next);
+    }
+  }
+}
+
+/**
+ * Follow the player: take finished tracks, queue the next one and reopen
+ * player once it is over.
+ */
+static void
+server_service_player(struct server *server) {
+  if (server->player == NULL) {
+    return;
+  }
+
+  error_t error_r = player_process_once(server->player);
+  if (error_r != 0) {
+    // queued track may be decoded partially, start over with empty queue
+    log_error("SERVER: Playback failed: %s", strerror(error_r));
+    server_release_player(server);
+    server_track_free(server->next);
+    server_clear_queue(server);
+    return;
+  }
+  if (player_take_finished(server->player) != NULL) {
+    // next track is being decoded, its stream must stay in place
+    server_swap_tracks(server);
+    server_track_free(server->next);
+  }
+  server_open_next(server);
+
+  if (player_is_eof(server->player)) {
+    server_release_player(server);
+    server_open_next(server);
+    while (server->player == NULL && server->next->decoder != NULL) {
+      server_swap_tracks(server);
+      if (server_start_player(server) != 0) {
+        server_open_next(server);
+      }
+    }
+    if (server->player != NULL) {
+      server_open_next(server);
+    }
+  }
+}
+
+static error_t
+server_play(struct server *server, const char *file_path, size_t size) {
+  server_release_player(server);
+  server_track_free(server->next);
+  server_clear_queue(server);
+
+  error_t error_r = server_track_open(
+    server, file_path, size, server->current);
+  if (error_r == 0) {
+    error_r = server_start_player(server);
+  } else {
+    server_track_free(server->current);
+  }
+  return error_r;
+}
+
+static error_t
+server_queue(struct server *server, const char *file_path, size_t size) {
+  if (server->player == NULL) {
+    return server_play(server, file_path, size);
+  }
+  if (server->queue_count == SERVER_QUEUE_SIZE) {
+    return ENOSPC;
+  }
+  char *queued = strndup(file_path, size);
+  if (queued == NULL) {
+    log_error("SERVER: Insufficient memory for file path");
+    return ENOMEM;
+  }
+  size_t tail = (server->queue_head + server->queue_count) % SERVER_QUEUE_SIZE;
+  server->queue[tail] = queued;
+  server->queue_count++;
+  server_open_next(server);
+  return 0;
+}
+
+static error_t
+server_seek(struct server *server, uint32_t ms) {
+  if (server->player == NULL) {
+    return EINVAL;
+  }
+  size_t rate = server->current->decoder->spec.samples_per_sec;
+  return player_seek(server->player, (size_t)ms * rate / 1000);
+}
+
+static error_t
+server_set_volume(struct server *server, int32_t volume) {
+  // 1/100 dB
+  server->volume_db = volume / 100.0;
+  return server->player != NULL ?
+    player_set_volume(server->player, server->volume_db) : 0;
+}
+
+static void
+server_get_status(struct server *server, uint8_t *payload) {
+  struct player_playback_status status = { 0 };
+  enum server_state state = server_state_stopped;
+  if (server->player != NULL
+    && player_get_playback_status(server->player, &status) == 0) {
+      state = player_is_paused(server->player) ?
+        server_state_paused : server_state_playing;
+    }
+
+  memset(payload, 0, SERVER_STATUS_PAYLOAD_SIZE);
+  payload[0] = state;
+  uint8_t *dest = payload + 4;
+  dest = server_put_u32(dest, server->tracks_base + status.track);
+  dest = server_put_u32(dest, timespec_miliseconds(status.actual));
+  dest = server_put_u32(dest, timespec_miliseconds(status.total));
+  dest = server_put_u32(dest, timespec_miliseconds(status.playback_buffer));
+  dest = server_put_u32(dest, status.xruns_count);
+  server_put_u32(
+    dest,
+    server->queue_count + (server->next->decoder != NULL ? 1 : 0));
+}
+
+static uint8_t*
+server_put_histogram(uint8_t *dest, const struct histogram_summary *summary) {
+  dest = server_put_u64(dest, summary->count);
+  dest = server_put_u64(dest, summary->min);
+  dest = server_put_u64(dest, summary->avg);
+  dest = server_put_u64(dest, summary->max);
+  dest = server_put_u64(dest, summary->p50);
+  dest = server_put_u64(dest, summary->p90);
+  dest = server_put_u64(dest, summary->p99);
+  return server_put_u64(dest, summary->p999);
+}
+
+static error_t
+server_get_stats(struct server *server, uint8_t *payload) {
+  if (server->player == NULL) {
+    return EINVAL;
+  }
+  struct player_latency_statistics stats;
+  player_get_latency_statistics(server->player, &stats);
+  uint8_t *dest = server_put_u64(payload, stats.xruns_count);
+  dest = server_put_u64(dest, stats.suspends_count);
+  dest = server_put_histogram(dest, &stats.sink_avail);
+  dest = server_put_histogram(dest, &stats.decode_time);
+  server_put_histogram(dest, &stats.write_interval);
+  return 0;
+}
+
+static void
+server_client_close(struct server_client *client) {
+  if (!client->is_closed) {
+    close(client->endpoint.fd);
+    client->endpoint.fd = -1;
+    client->is_closed = true;
+  }
+}
+
+static void
+server_client_set_writing(
+  struct server *server,
+  struct server_client *client,
+  bool is_writing) {
+    if (client->is_writing != is_writing) {
+      struct epoll_event event = (struct epoll_event) {
+        .events = EPOLLIN | EPOLLRDHUP | (is_writing ? EPOLLOUT : 0),
+        .data.ptr = &client->endpoint
+      };
+      if (epoll_ctl(
+        server->epoll_fd, EPOLL_CTL_MOD, client->endpoint.fd, &event) == -1) {
+          log_error("SERVER: Cannot watch client: %s", strerror(errno));
+          server_client_close(client);
+          return;
+        }
+      client->is_writing = is_writing;
+    }
+  }
+
+static void
+server_client_flush(struct server *server, struct server_client *client) {
+  while (!client->is_closed && client->output_offset < client->output_size) {
+    ssize_t sent = send(
+      client->endpoint.fd,
+      client->output + client->output_offset,
+      client->output_size - client->output_offset,
+      MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent >= 0) {
+      client->output_offset += sent;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // the rest goes once socket is writable
+      server_client_set_writing(server, client, true);
+      return;
+    } else if (errno != EINTR) {
+      log_verbose("SERVER: Client is gone: %s", strerror(errno));
+      server_client_close(client);
+    }
+  }
+  client->output_offset = client->output_size = 0;
+  if (!client->is_closed) {
+    server_client_set_writing(server, client, false);
+  }
+}
+
+/**
+ * Client which does not read replies is disconnected once its output
+ * buffer is full, so that it cannot hold server memory.
+ */
+static void
+server_client_send(
+  struct server *server,
+  struct server_client *client,
+  uint8_t type,
+  const uint8_t *body,
+  size_t body_size) {
+    if (client->is_closed) {
+      return;
+    }
+    if (client->output_offset > 0) {
+      client->output_size -= client->output_offset;
+      memmove(
+        client->output,
+        client->output + client->output_offset,
+        client->output_size);
+      client->output_offset = 0;
+    }
+    size_t size = 5 + body_size;
+    if (client->output_size + size > SERVER_CLIENT_OUTPUT_SIZE) {
+      log_error("SERVER: Client does not read replies, disconnecting it");
+      server_client_close(client);
+      return;
+    }
+
+    uint8_t *dest = client->output + client->output_size;
+    dest = server_put_u32(dest, 1 + body_size);
+    *dest++ = type;
+    if (body_size > 0) {
+      memcpy(dest, body, body_size);
+    }
+    client->output_size += size;
+    server_client_flush(server, client);
+  }
+
+static void
+server_handle_message(
+  struct server *server,
+  struct server_client *client,
+  uint8_t type,
+  const uint8_t *body,
+  size_t size) {
+    uint8_t reply[4 + SERVER_STATS_PAYLOAD_SIZE];
+    size_t payload_size = 0;
+    error_t error_r = 0;
+    const char *file_path = (const char*)body;
+    bool is_path = size > 0 && memchr(body, 0, size) == NULL;
+
+    switch (type) {
+      case server_message_play:
+        error_r = is_path ? server_play(server, file_path, size) : EINVAL;
+        break;
+      case server_message_queue:
+        error_r = is_path ? server_queue(server, file_path, size) : EINVAL;
+        break;
+      case server_message_pause:
+        error_r = server->player != NULL ?
+          player_pause(server->player) : EINVAL;
+        break;
+      case server_message_resume:
+        error_r = server->player != NULL ?
+          player_resume(server->player) : EINVAL;
+        break;
+      case server_message_seek:
+        error_r = size == 4 ?
+          server_seek(server, server_get_u32(body)) : EINVAL;
+        break;
+      case server_message_volume:
+        error_r = size == 4 ?
+          server_set_volume(server, (int32_t)server_get_u32(body)) : EINVAL;
+        break;
+      case server_message_status:
+        server_get_status(server, reply + 4);
+        payload_size = SERVER_STATUS_PAYLOAD_SIZE;
+        break;
+      case server_message_stats:
+        error_r = server_get_stats(server, reply + 4);
+        payload_size = error_r == 0 ? SERVER_STATS_PAYLOAD_SIZE : 0;
+        break;
+      case server_message_subscribe:
+        if (size == 1) {
+          client->is_subscribed = body[0] != 0;
+          client->is_status_stale = true;
+        } else {
+          error_r = EINVAL;
+        }
+        break;
+      default:
+        log_verbose("SERVER: Unknown message type %d", type);
+        error_r = ENOTSUP;
+    }
+    if (error_r != 0) {
+      log_verbose("SERVER: Message %d failed: %s", type, strerror(error_r));
+    }
+
+    server_put_u32(reply, (uint32_t)error_r);
+    server_client_send(
+      server, client, type | server_message_reply, reply, 4 + payload_size);
+  }
+
+static void
+server_client_read(struct server *server, struct server_client *client) {
+  while (!client->is_closed) {
+    ssize_t count = recv(
+      client->endpoint.fd,
+      client->input + client->input_size,
+      sizeof(client->input) - client->input_size,
+      MSG_DONTWAIT);
+    if (count == 0) {
+      log_verbose("SERVER: Client disconnected");
+      server_client_close(client);
+      break;
+    } else if (count == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      } else if (errno != EINTR) {
+        log_verbose("SERVER: Client is gone: %s", strerror(errno));
+        server_client_close(client);
+      }
+      continue;
+    }
+    client->input_size += count;
+
+    // whole message of maximum size fits, so that input never stays full
+    size_t offset = 0;
+    while (!client->is_closed && client->input_size - offset >= 4) {
+      uint32_t length = server_get_u32(client->input + offset);
+      if (length == 0 || length > SERVER_MAX_MESSAGE_SIZE) {
+        log_error("SERVER: Invalid message length %u", length);
+        server_client_close(client);
+        break;
+      }
+      if (client->input_size - offset < 4 + length) {
+        break;
+      }
+      const uint8_t *message = client->input + offset + 4;
+      server_handle_message(
+        server, client, message[0], message + 1, length - 1);
+      offset += 4 + length;
+    }
+    if (!client->is_closed && offset > 0) {
+      client->input_size -= offset;
+      memmove(client->input, client->input + offset, client->input_size);
+    }
+  }
+}
+
+static void
+server_accept(struct server *server, const struct server_endpoint *listener) {
+  while (true) {
+    int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_error("SERVER: Cannot accept client: %s", strerror(errno));
+      }
+      return;
+    }
+    if (server->clients_count == server->params.max_clients) {
+      log_error("SERVER: Too many clients, rejecting connection");
+      close(fd);
+      continue;
+    }
+
+    struct server_client *client = calloc(1, sizeof(struct server_client));
+    if (client == NULL) {
+      log_error("SERVER: Insufficient memory for client");
+      close(fd);
+      continue;
+    }
+    client->endpoint.kind = server_endpoint_client;
+    client->endpoint.fd = fd;
+    client->is_tcp = listener == &server->tcp_listener;
+    if (client->is_tcp) {
+      // replies are small, they should not wait for more
+      int value = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+    }
+
+    struct epoll_event event = (struct epoll_event) {
+      .events = EPOLLIN | EPOLLRDHUP,
+      .data.ptr = &client->endpoint
+    };
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+      log_error("SERVER: Cannot watch client: %s", strerror(errno));
+      close(fd);
+      free(client);
+      continue;
+    }
+    server->clients[server->clients_count++] = client;
+    log_verbose(
+      "SERVER: %s client connected, %lu clients",
+      client->is_tcp ? "TCP" : "Unix",
+      server->clients_count);
+  }
+}
+
+static void
+server_free_closed_clients(struct server *server) {
+  size_t i = 0;
+  while (i < server->clients_count) {
+    if (server->clients[i]->is_closed) {
+      free(server->clients[i]);
+      server->clients[i] = server->clients[--server->clients_count];
+    } else {
+      ++i;
+    }
+  }
+}
+
+/**
+ * Status pushes are coalesced: subscribers get the latest status once
+ * per interval, and only after the previous push has been sent.
+ */
+static void
+server_push_status(struct server *server) {
+  uint8_t status[SERVER_STATUS_PAYLOAD_SIZE];
+  server_get_status(server, status);
+  bool is_changed = memcmp(status, server->status, sizeof(status)) != 0;
+  memcpy(server->status, status, sizeof(status));
+
+  for (size_t i = 0; i < server->clients_count; ++i) {
+    struct server_client *client = server->clients[i];
+    client->is_status_stale |= is_changed;
+    if (client->is_subscribed
+      && client->is_status_stale
+      && client->output_size == 0) {
+        client->is_status_stale = false;
+        server_client_send(
+          server,
+          client,
+          server_message_status_push,
+          status,
+          sizeof(status));
+      }
+  }
+}
+
+static error_t
+server_watch(struct server *server, struct server_endpoint *endpoint) {
+  struct epoll_event event = (struct epoll_event) {
+    .events = EPOLLIN,
+    .data.ptr = endpoint
+  };
+  if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, endpoint->fd, &event) == -1) {
+    error_t error_r = errno;
+    log_error("SERVER: Cannot watch descriptor: %s", strerror(error_r));
+    return error_r;
+  }
+  return 0;
+}
+
+static error_t
+server_listen_unix(struct server *server, const char *path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    log_error("SERVER: Unix socket path is too long: %s", path);
+    return ENAMETOOLONG;
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    error_t error_r = errno;
+    log_error("SERVER: Cannot create Unix socket: %s", strerror(error_r));
+    return error_r;
+  }
+  server->unix_listener.fd = fd;
+
+  // socket file left by previous server
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1
+    || listen(fd, SOMAXCONN) == -1) {
+      error_t error_r = errno;
+      log_error("SERVER: Cannot listen on [%s]: %s", path, strerror(error_r));
+      return error_r;
+    }
+  log_info("SERVER: Listening on [%s]", path);
+  return server_watch(server, &server->unix_listener);
+}
+
+static error_t
+server_listen_tcp(
+  struct server *server,
+  const char *host,
+  unsigned short port) {
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo hints = {
+      .ai_family = AF_UNSPEC,
+      .ai_socktype = SOCK_STREAM,
+      .ai_flags = AI_PASSIVE
+    };
+    struct addrinfo *addresses;
+    int gai_error = getaddrinfo(host, service, &hints, &addresses);
+    if (gai_error != 0) {
+      log_error(
+        "SERVER: Cannot resolve [%s]: %s", host, gai_strerror(gai_error));
+      return EINVAL;
+    }
+
+    error_t error_r = EADDRNOTAVAIL;
+    for (struct addrinfo *a = addresses; a != NULL; a = a->ai_next) {
+      int fd = socket(
+        a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd == -1) {
+        error_r = errno;
+        continue;
+      }
+      int value = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+      if (bind(fd, a->ai_addr, a->ai_addrlen) == 0
+        && listen(fd, SOMAXCONN) == 0) {
+          server->tcp_listener.fd = fd;
+          error_r = 0;
+          break;
+        }
+      error_r = errno;
+      close(fd);
+    }
+    freeaddrinfo(addresses);
+    if (error_r != 0) {
+      log_error(
+        "SERVER: Cannot listen on [%s]:%u: %s", host, port, strerror(error_r));
+      return error_r;
+    }
+
+    struct sockaddr_storage bound;
+    socklen_t bound_size = sizeof(bound);
+    if (getsockname(
+      server->tcp_listener.fd, (struct sockaddr*)&bound, &bound_size) == 0) {
+        server->tcp_port = ntohs(bound.ss_family == AF_INET6 ?
+          ((struct sockaddr_in6*)&bound)->sin6_port :
+          ((struct sockaddr_in*)&bound)->sin_port);
+      }
+    log_info("SERVER: Listening on [%s]:%u", host, server->tcp_port);
+    return server_watch(server, &server->tcp_listener);
+  }
+
+error_t
+server_open(const struct server_parameters *params, struct server **result) {
+  log_verbose("Setting up server");
+  assert(params != NULL);
+  assert(result != NULL);
+  struct server *server = calloc(1, sizeof(struct server));
+  if (server == NULL) {
+    log_error("SERVER: Insufficient memory for 'server'");
+    return ENOMEM;
+  }
+  server->params = *params;
+  server->volume_db = params->player.volume_db;
+  if (server->params.max_clients == 0) {
+    server->params.max_clients = 16;
+  }
+  if (server->params.status_interval_ms == 0) {
+    server->params.status_interval_ms = 250;
+  }
+  atomic_init(&server->is_stopping, false);
+  server->current = &server->tracks[0];
+  server->next = &server->tracks[1];
+  server->control = (struct server_endpoint) {
+    .kind = server_endpoint_control, .fd = -1 };
+  server->unix_listener = (struct server_endpoint) {
+    .kind = server_endpoint_listener, .fd = -1 };
+  server->tcp_listener = (struct server_endpoint) {
+    .kind = server_endpoint_listener, .fd = -1 };
+
+  error_t error_r = 0;
+  server->clients = calloc(
+    server->params.max_clients, sizeof(struct server_client*));
+  if (server->clients == NULL) {
+    log_error("SERVER: Insufficient memory for clients");
+    error_r = ENOMEM;
+  }
+  server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (error_r == 0 && server->epoll_fd == -1) {
+    error_r = errno;
+    log_error("SERVER: Cannot create epoll: %s", strerror(error_r));
+  }
+  if (error_r == 0) {
+    server->control.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->control.fd == -1) {
+      error_r = errno;
+      log_error("SERVER: Cannot create control eventfd: %s", strerror(error_r));
+    } else {
+      error_r = server_watch(server, &server->control);
+    }
+  }
+  if (error_r == 0 && params->unix_path != NULL) {
+    error_r = server_listen_unix(server, params->unix_path);
+  }
+  if (error_r == 0 && params->tcp_host != NULL) {
+    error_r = server_listen_tcp(server, params->tcp_host, params->tcp_port);
+  }
+
+  if (error_r == 0) {
+    *result = server;
+  } else {
+    server_release(&server);
+  }
+  return error_r;
+}
+
+unsigned short
+server_get_tcp_port(const struct server *server) {
+  assert(server != NULL);
+  return server->tcp_port;
+}
+
+error_t
+server_run(struct server *server) {
+  assert(server != NULL);
+  struct epoll_event events[SERVER_EPOLL_EVENTS];
+  unsigned int interval = server->params.status_interval_ms;
+  struct timespec last_tick;
+  timer_start(&last_tick);
+
+  error_t error_r = 0;
+  while (error_r == 0 && !atomic_load(&server->is_stopping)) {
+    unsigned int elapsed = timespec_miliseconds(timer_elapsed(last_tick));
+    int timeout = elapsed < interval ? (int)(interval - elapsed) : 0;
+    int count = epoll_wait(
+      server->epoll_fd, events, SERVER_EPOLL_EVENTS, timeout);
+    if (count == -1) {
+      if (errno != EINTR) {
+        error_r = errno;
+        log_error("SERVER: Wait failed: %s", strerror(error_r));
+      }
+      continue;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      struct server_endpoint *endpoint = events[i].data.ptr;
+      if (endpoint->kind == server_endpoint_control) {
+        uint64_t value;
+        if (read(endpoint->fd, &value, sizeof(value)) == -1
+          && errno != EAGAIN) {
+            log_error("SERVER: Cannot read control: %s", strerror(errno));
+          }
+      } else if (endpoint->kind == server_endpoint_listener) {
+        server_accept(server, endpoint);
+      } else {
+        struct server_client *client = (struct server_client*)endpoint;
+        if (events[i].events & EPOLLOUT) {
+          server_client_flush(server, client);
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+          server_client_read(server, client);
+        }
+      }
+    }
+    server_free_closed_clients(server);
+
+    if (timespec_miliseconds(timer_elapsed(last_tick)) >= interval) {
+      timer_start(&last_tick);
+      server_service_player(server);
+      server_push_status(server);
+      server_free_closed_clients(server);
+    }
+  }
+  return error_r;
+}
+
+void
+server_stop(struct server *server) {
+  assert(server != NULL);
+  atomic_store(&server->is_stopping, true);
+  uint64_t value = 1;
+  // ignore failure, server_run notices it at the next status interval
+  ssize_t written = write(server->control.fd, &value, sizeof(value));
+  (void)written;
+}
+
+void
+server_release(struct server **server) {
+  assert(server != NULL);
+  struct server *to_release = *server;
+  if (to_release != NULL) {
+    player_release(&to_release->player);
+    server_track_free(&to_release->tracks[0]);
+    server_track_free(&to_release->tracks[1]);
+    server_clear_queue(to_release);
+
+    if (to_release->clients != NULL) {
+      for (size_t i = 0; i < to_release->clients_count; ++i) {
+        server_client_close(to_release->clients[i]);
+        free(to_release->clients[i]);
+      }
+      free(to_release->clients);
+    }
+    if (to_release->unix_listener.fd != -1) {
+      close(to_release->unix_listener.fd);
+      unlink(to_release->params.unix_path);
+    }
+    if (to_release->tcp_listener.fd != -1) {
+      close(to_release->tcp_listener.fd);
+    }
+    if (to_release->control.fd != -1) {
+      close(to_release->control.fd);
+    }
+    if (to_release->epoll_fd != -1) {
+      close(to_release->epoll_fd);
+    }
+    free(to_release);
+  }
+  *server = NULL;
+}
@@ -0,0 +1,108 @@
+#ifndef PLAYER_SERVER_H_
+#define PLAYER_SERVER_H_
+
+#include <stdint.h>
+#include "player.h"
+
+/**
+ * Control protocol
+ *
+ * Every message is a little endian uint32 length of the rest of it,
+ * uint8 type and body of length - 1 bytes, SERVER_MAX_MESSAGE_SIZE at most.
+ * Each request is answered in order with message of type
+ * request | server_message_reply, body starts with int32 errno (0 on success)
+ * followed by a payload for status and stats. Subscribed clients get
+ * server_message_status_push with status payload every status interval,
+ * at most one is waiting for a client which does not keep up.
+ *
+ * Seek applies to the track being decoded, which is already the next one
+ * while the sink plays the end of the current track.
+ * Volume is int32 in 1/100 dB, it applies to the track being played
+ * and to the following ones.
+ *
+ * Status payload: uint8 enum server_state, 3 reserved bytes, uint32 track
+ * (played since the server start, counted from 0), uint32 actual ms,
+ * uint32 total ms, uint32 playback buffer ms, uint32 xruns count,
+ * uint32 queued tracks count.
+ *
+ * Stats payload: uint64 xruns count, uint64 suspends count, then uint64
+ * count, min, avg, max, p50, p90, p99, p99.9 of sink avail, decode time
+ * and write interval histograms, see struct player_latency_statistics.
+ */
+#define SERVER_MAX_MESSAGE_SIZE 4096
+#define SERVER_STATUS_PAYLOAD_SIZE 28
+#define SERVER_STATS_PAYLOAD_SIZE (2 * 8 + 3 * 8 * 8)
+
+enum server_message {
+  server_message_play         = 1,    // body: file path
+  server_message_queue        = 2,    // body: file path
+  server_message_pause        = 3,
+  server_message_resume       = 4,
+  server_message_seek         = 5,    // body: uint32 ms
+  server_message_status       = 6,
+  server_message_stats        = 7,
+  server_message_subscribe    = 8,    // body: uint8 0 or 1
+  server_message_volume       = 9,    // body: int32 1/100 dB
+  server_message_status_push  = 0x40,
+  server_message_reply        = 0x80,
+};
+
+enum server_state {
+  server_state_stopped  = 0,
+  server_state_playing  = 1,
+  server_state_paused   = 2,
+};
+
+/**
+ * @brief Server parameters
+ *
+ * Clients connect via Unix socket at unix_path and via TCP at tcp_host
+ * and tcp_port (0 for any free port), either can be NULL. Strings have
+ * to outlive the server.
+ *
+ * Files are played with player parameters, player is always threaded,
+ * so that commands never hold back writing to the sink, and has volume
+ * control.
+ */
+struct server_parameters {
+  const char *unix_path;
+  const char *tcp_host;
+  unsigned short tcp_port;
+  size_t max_clients;                   // 16 by default
+  unsigned int status_interval_ms;      // 250 by default
+  size_t io_buffer_size;
+  struct player_parameters player;
+};
+
+struct server;
+
+/**
+ * @brief Bind listening sockets, Unix socket file left by previous
+ * server is replaced.
+ */
+error_t
+server_open(const struct server_parameters *params, struct server **result);
+
+/**
+ * @brief TCP port clients can connect to, 0 without TCP.
+ */
+unsigned short
+server_get_tcp_port(const struct server *server);
+
+/**
+ * @brief Serve clients until server_stop is called.
+ */
+error_t
+server_run(struct server *server);
+
+/**
+ * @brief Make server_run return, can be called from any thread
+ * and from signal handler.
+ */
+void
+server_stop(struct server *server);
+
+void
+server_release(struct server **server);
+
+#endif
@@ -0,0 +1,48 @@
+#include <stdatomic.h>
+#include "simd.h"
+
+static atomic_int _simd_max_level = simd_level_avx2;
+
+enum simd_level
+simd_get_supported_level() {
+#ifdef PLAYER_SIMD_X86
+  if (__builtin_cpu_supports("avx2"))
+    return simd_level_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return simd_level_ssse3;
+  if (__builtin_cpu_supports("sse2"))
+    return simd_level_sse2;
+#endif
+  return simd_level_scalar;
+}
+
+enum simd_level
+simd_get_level() {
+  static atomic_int supported_level = -1;
+  int level = atomic_load_explicit(&supported_level, memory_order_relaxed);
+  if (level < 0) {
+    level = simd_get_supported_level();
+    atomic_store_explicit(&supported_level, level, memory_order_relaxed);
+  }
+  return min_int(level, atomic_load(&_simd_max_level));
+}
+
+void
+simd_set_max_level(enum simd_level level) {
+  atomic_store(&_simd_max_level, level);
+}
+
+const char*
+simd_level_name(enum simd_level level) {
+  switch (level) {
+    case simd_level_scalar:
+      return "scalar";
+    case simd_level_sse2:
+      return "SSE2";
+    case simd_level_ssse3:
+      return "SSSE3";
+    case simd_level_avx2:
+      return "AVX2";
+  }
+  return "unknown";
+}
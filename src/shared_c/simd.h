@@ -0,0 +1,43 @@
+#ifndef PLAYER_SIMD_H_
+#define PLAYER_SIMD_H_
+
+#include "shrdef.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLAYER_SIMD_X86 1
+#define SIMD_TARGET(t) __attribute__((target(t)))
+#endif
+
+/**
+ * @brief Instruction set level used by vectorized kernels
+ *
+ */
+enum simd_level {
+  simd_level_scalar   = 0,
+  simd_level_sse2     = 1,
+  simd_level_ssse3    = 2,
+  simd_level_avx2     = 3,
+};
+
+/**
+ * @brief Best level supported by CPU
+ */
+enum simd_level
+simd_get_supported_level();
+
+/**
+ * @brief Level kernels should use, supported one capped by simd_set_max_level
+ */
+enum simd_level
+simd_get_level();
+
+/**
+ * @brief Limit level used by kernels, i.e. to compare them in benchmarks
+ */
+void
+simd_set_max_level(enum simd_level level);
+
+const char*
+simd_level_name(enum simd_level level);
+
+#endif
@@ -0,0 +1,620 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "sink.h"
+#include "timer.h"
+
+void
+pcm_sink_add_xrun(struct pcm_sink *sink) {
+  assert(sink != NULL);
+  struct timespec now;
+  timer_start(&now);
+  unsigned long index = atomic_load_explicit(
+    &sink->events.xruns_count, memory_order_relaxed);
+  atomic_store_explicit(
+    &sink->events.xrun_times[index % PCM_SINK_XRUN_TIMES_COUNT],
+    now.tv_sec * 1000000ul + now.tv_nsec / 1000,
+    memory_order_relaxed);
+  // time is published together with the count
+  atomic_store_explicit(
+    &sink->events.xruns_count, index + 1, memory_order_release);
+}
+
+void
+pcm_sink_add_suspend(struct pcm_sink *sink) {
+  assert(sink != NULL);
+  atomic_fetch_add_explicit(
+    &sink->events.suspends_count, 1, memory_order_relaxed);
+}
+
+error_t
+pcm_sink_wait(struct pcm_sink *sink, int timeout) {
+  assert(sink != NULL);
+  struct pollfd fds[PCM_SINK_MAX_POLL_FDS];
+  int count = pcm_sink_poll_descriptors(sink, fds, PCM_SINK_MAX_POLL_FDS);
+  if (count < 0) {
+    return count;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  int ready = poll(fds, count, timeout);
+  if (ready == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    log_error("SINK: Poll failed: %s", strerror(errno));
+    return errno;
+  }
+  unsigned short revents = 0;
+  return ready > 0 ?
+    pcm_sink_poll_revents(sink, fds, count, &revents) : 0;
+}
+
+static void
+pcm_sink_init(
+  struct pcm_sink *sink,
+  const char *name,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec) {
+    sink->name = name;
+    sink->spec = *spec;
+    sink->frames_per_period = max_size_t(
+      1, params->period_size / pcm_frame_size(spec));
+    sink->frames_per_buffer = sink->frames_per_period
+      * max_uint(2, params->periods_per_buffer);
+    log_verbose(
+      "%s: Period %lu frames, buffer %lu frames",
+      name,
+      sink->frames_per_period,
+      sink->frames_per_buffer);
+  }
+
+/**
+ * Scratch area for sinks emulating mmap access
+ */
+static error_t
+pcm_sink_alloc_area(struct pcm_sink *sink, void **area) {
+  *area = malloc(sink->frames_per_buffer * pcm_sink_frame_size(sink));
+  if (*area == NULL) {
+    log_error("%s: Insufficient memory for mmap area", sink->name);
+    return ENOMEM;
+  }
+  return 0;
+}
+
+/**
+ * Null sink: behaves like device ring, which is consumed either
+ * at sample rate once start threshold (one period) is reached,
+ * or immediately.
+ */
+struct pcm_sink_null {
+  struct pcm_sink base;
+  bool is_realtime;
+  void *area;
+  int timer_fd;
+
+  size_t written;
+  size_t played;
+  bool is_running;
+  size_t started_played;
+  struct timespec started;
+  // running out of frames is not an underrun then
+  bool is_draining;
+  bool is_paused;
+};
+
+static size_t
+pcm_sink_null_get_queued(struct pcm_sink_null *sink) {
+  if (!sink->is_realtime) {
+    sink->played = sink->written;
+  } else if (sink->is_running) {
+    struct timespec elapsed = timer_elapsed(sink->started);
+    unsigned int rate = sink->base.spec.samples_per_sec;
+    size_t played = sink->started_played
+      + elapsed.tv_sec * rate
+      + elapsed.tv_nsec * rate / 1000000000l;
+    if (played >= sink->written) {
+      sink->played = sink->written;
+      sink->is_running = false;
+      if (!sink->is_draining) {
+        pcm_sink_add_xrun(&sink->base);
+      }
+    } else {
+      sink->played = played;
+    }
+  }
+  return sink->written - sink->played;
+}
+
+static void
+pcm_sink_null_start(struct pcm_sink_null *sink) {
+  if (!sink->is_running && !sink->is_paused && sink->written > sink->played) {
+    sink->is_running = true;
+    sink->started_played = sink->played;
+    timer_start(&sink->started);
+  }
+}
+
+static void
+pcm_sink_null_add_written(struct pcm_sink_null *sink, size_t count) {
+  sink->written += count;
+  sink->is_draining = false;
+  if (pcm_sink_null_get_queued(sink) >= sink->base.frames_per_period) {
+    pcm_sink_null_start(sink);
+  }
+}
+
+static error_t
+pcm_sink_null_avail(struct pcm_sink *sink, size_t *count) {
+  struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+  *count = sink->frames_per_buffer - pcm_sink_null_get_queued(null_sink);
+  return 0;
+}
+
+static error_t
+pcm_sink_null_write(
+  struct pcm_sink *sink,
+  const void *pcm,
+  size_t count,
+  size_t *written) {
+    UNUSED(pcm);
+    size_t avail;
+    pcm_sink_null_avail(sink, &avail);
+    *written = min_size_t(count, avail);
+    pcm_sink_null_add_written((struct pcm_sink_null*)sink, *written);
+    return 0;
+  }
+
+static error_t
+pcm_sink_null_mmap_begin(struct pcm_sink *sink, void **area, size_t *count) {
+  struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+  size_t avail;
+  pcm_sink_null_avail(sink, &avail);
+  size_t offset = null_sink->written % sink->frames_per_buffer;
+  *count = min_size_t(
+    min_size_t(*count, avail),
+    sink->frames_per_buffer - offset);
+  *area = (char*)null_sink->area + offset * pcm_sink_frame_size(sink);  // NOLINT
+  return 0;
+}
+
+static error_t
+pcm_sink_null_mmap_commit(struct pcm_sink *sink, size_t count) {
+  pcm_sink_null_add_written((struct pcm_sink_null*)sink, count);
+  return 0;
+}
+
+static error_t
+pcm_sink_null_delay(struct pcm_sink *sink, size_t *count) {
+  *count = pcm_sink_null_get_queued((struct pcm_sink_null*)sink);
+  return 0;
+}
+
+/**
+ * Timer fires when the whole period can be written.
+ */
+static int
+pcm_sink_null_poll_descriptors(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int space) {
+    struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+    assert(space >= 1);
+    UNUSED(space);
+
+    size_t queued = pcm_sink_null_get_queued(null_sink);
+    size_t max_queued = sink->frames_per_buffer - sink->frames_per_period;
+    struct itimerspec timer = { 0 };
+    if (queued > max_queued && null_sink->is_running) {
+      timer.it_value = pcm_spec_get_samples_time(
+        &sink->spec, queued - max_queued);
+    }
+    if (timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0) {
+      // zero would disarm the timer
+      timer.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(null_sink->timer_fd, 0, &timer, NULL) == -1) {
+      log_error("NULL: Cannot set timer: %s", strerror(errno));
+      return -errno;
+    }
+
+    fds[0] = (struct pollfd) {
+      .fd = null_sink->timer_fd,
+      .events = POLLIN
+    };
+    return 1;
+  }
+
+static error_t
+pcm_sink_null_poll_revents(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int count,
+  unsigned short *revents) {
+    struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+    assert(count == 1);
+    UNUSED(count);
+    *revents = 0;
+    if (fds[0].revents & POLLIN) {
+      uint64_t expirations;
+      if (read(null_sink->timer_fd, &expirations, sizeof(expirations)) == -1
+        && errno != EAGAIN) {
+          log_error("NULL: Cannot read timer: %s", strerror(errno));
+          return errno;
+        }
+      *revents = POLLOUT;
+    }
+    return 0;
+  }
+
+static error_t
+pcm_sink_null_drain(struct pcm_sink *sink) {
+  struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+  null_sink->is_draining = true;
+  pcm_sink_null_start(null_sink);
+  return 0;
+}
+
+static bool
+pcm_sink_null_is_drained(struct pcm_sink *sink) {
+  return pcm_sink_null_get_queued((struct pcm_sink_null*)sink) == 0;
+}
+
+static error_t
+pcm_sink_null_drop(struct pcm_sink *sink) {
+  struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+  pcm_sink_null_get_queued(null_sink);
+  null_sink->written = null_sink->played;
+  null_sink->is_running = false;
+  null_sink->is_paused = false;
+  return 0;
+}
+
+/**
+ * Clock stops at the frame played last, running sink restarts on resume.
+ */
+static error_t
+pcm_sink_null_pause(struct pcm_sink *sink, bool is_paused) {
+  struct pcm_sink_null *null_sink = (struct pcm_sink_null*)sink;
+  pcm_sink_null_get_queued(null_sink);
+  if (is_paused && null_sink->is_running) {
+    null_sink->is_running = false;
+    null_sink->is_paused = true;
+  } else if (!is_paused && null_sink->is_paused) {
+    null_sink->is_paused = false;
+    pcm_sink_null_start(null_sink);
+  }
+  return 0;
+}
+
+static void
+pcm_sink_null_release(struct pcm_sink **sink) {
+  assert(sink != NULL);
+  struct pcm_sink_null *to_release = (struct pcm_sink_null*) *sink;
+  if (to_release != NULL) {
+    if (to_release->written > 0) {
+      log_verbose(
+        "NULL: %lu frames written, %lu underruns",
+        to_release->written,
+        atomic_load(&to_release->base.events.xruns_count));
+    }
+    if (to_release->timer_fd != -1) {
+      close(to_release->timer_fd);
+    }
+    free(to_release->area);
+    free(to_release);
+    *sink = NULL;
+  }
+}
+
+error_t
+pcm_sink_null_open(
+  bool is_realtime,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec,
+  struct pcm_sink **sink) {
+    log_verbose("Setting up null sink");
+    assert(params != NULL);
+    assert(spec != NULL);
+    assert(sink != NULL);
+    struct pcm_sink_null *result = calloc(1, sizeof(struct pcm_sink_null));
+    if (result == NULL) {
+      log_error("NULL: Insufficient memory for 'pcm_sink_null'");
+      return ENOMEM;
+    }
+    result->timer_fd = -1;
+    result->is_realtime = is_realtime;
+    pcm_sink_init(&result->base, "NULL", params, spec);
+
+    error_t error_r = 0;
+    if (!params->disable_mmap_access) {
+      error_r = pcm_sink_alloc_area(&result->base, &result->area);
+    }
+    if (error_r == 0 && is_realtime) {
+      result->timer_fd = timerfd_create(
+        CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (result->timer_fd == -1) {
+        error_r = errno;
+        log_error("NULL: Cannot create timer: %s", strerror(error_r));
+      } else {
+        result->base.poll_fds_count = 1;
+      }
+    }
+
+    if (error_r == 0) {
+      result->base.avail = &pcm_sink_null_avail;
+      result->base.write = &pcm_sink_null_write;
+      if (result->area != NULL) {
+        result->base.mmap_begin = &pcm_sink_null_mmap_begin;
+        result->base.mmap_commit = &pcm_sink_null_mmap_commit;
+      }
+      result->base.delay = &pcm_sink_null_delay;
+      result->base.poll_descriptors = &pcm_sink_null_poll_descriptors;
+      result->base.poll_revents = &pcm_sink_null_poll_revents;
+      result->base.drain = &pcm_sink_null_drain;
+      result->base.is_drained = &pcm_sink_null_is_drained;
+      result->base.drop = &pcm_sink_null_drop;
+      result->base.pause = &pcm_sink_null_pause;
+      result->base.release = &pcm_sink_null_release;
+      *sink = (struct pcm_sink*)result;
+    } else {
+      pcm_sink_null_release((struct pcm_sink**)&result);
+    }
+    return error_r;
+  }
+
+/**
+ * WAV file sink, data size in header is updated on release.
+ */
+#define WAV_HEADER_SIZE 44
+#define WAV_RIFF_SIZE_OFFSET 4
+#define WAV_DATA_SIZE_OFFSET 40
+
+struct pcm_sink_wav {
+  struct pcm_sink base;
+  int fd;
+  void *area;
+  size_t data_size;
+};
+
+static void
+wav_put_uint(
+  unsigned char *dest,
+  uint32_t value,
+  size_t size,
+  bool is_big_endian) {
+    for (size_t i = 0; i < size; ++i) {
+      size_t shift = 8 * (is_big_endian ? size - 1 - i : i);
+      dest[i] = (value >> shift) & 0xff;
+    }
+  }
+
+static void
+wav_fill_header(
+  const struct pcm_spec *spec,
+  size_t data_size,
+  unsigned char *header) {
+    bool be = spec->is_big_endian;
+    size_t frame_size = pcm_frame_size(spec);
+    memcpy(header, be ? "RIFX" : "RIFF", 4);
+    wav_put_uint(header + 4, WAV_HEADER_SIZE - 8 + data_size, 4, be);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    wav_put_uint(header + 16, 16, 4, be);
+    wav_put_uint(header + 20, 1, 2, be);  // PCM
+    wav_put_uint(header + 22, spec->channels_count, 2, be);
+    wav_put_uint(header + 24, spec->samples_per_sec, 4, be);
+    wav_put_uint(header + 28, spec->samples_per_sec * frame_size, 4, be);
+    wav_put_uint(header + 32, frame_size, 2, be);
+    wav_put_uint(header + 34, spec->bits_per_sample, 2, be);
+    memcpy(header + 36, "data", 4);
+    wav_put_uint(header + 40, data_size, 4, be);
+  }
+
+static error_t
+wav_write_all(int fd, const void *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log_error("WAV: Cannot write to the file: %s", strerror(errno));
+      return errno;
+    }
+    data = (const char*)data + written;  // NOLINT
+    size -= written;
+  }
+  return 0;
+}
+
+static error_t
+pcm_sink_wav_avail(struct pcm_sink *sink, size_t *count) {
+  *count = sink->frames_per_buffer;
+  return 0;
+}
+
+static error_t
+pcm_sink_wav_write(
+  struct pcm_sink *sink,
+  const void *pcm,
+  size_t count,
+  size_t *written) {
+    struct pcm_sink_wav *wav = (struct pcm_sink_wav*)sink;
+    size_t size = count * pcm_sink_frame_size(sink);
+    if (wav->data_size + size > PCM_SINK_WAV_MAX_DATA_SIZE) {
+      log_error("WAV: file cannot be bigger than 4GB");
+      *written = 0;
+      return EFBIG;
+    }
+    error_t error_r = wav_write_all(wav->fd, pcm, size);
+    if (error_r == 0) {
+      wav->data_size += size;
+      *written = count;
+    } else {
+      *written = 0;
+    }
+    return error_r;
+  }
+
+static error_t
+pcm_sink_wav_mmap_begin(struct pcm_sink *sink, void **area, size_t *count) {
+  struct pcm_sink_wav *wav = (struct pcm_sink_wav*)sink;
+  *area = wav->area;
+  *count = min_size_t(*count, sink->frames_per_buffer);
+  return 0;
+}
+
+static error_t
+pcm_sink_wav_mmap_commit(struct pcm_sink *sink, size_t count) {
+  struct pcm_sink_wav *wav = (struct pcm_sink_wav*)sink;
+  size_t written;
+  return count > 0 ?
+    pcm_sink_wav_write(sink, wav->area, count, &written) : 0;
+}
+
+static error_t
+pcm_sink_wav_delay(struct pcm_sink *sink, size_t *count) {
+  UNUSED(sink);
+  *count = 0;
+  return 0;
+}
+
+static int
+pcm_sink_wav_poll_descriptors(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int space) {
+    UNUSED(sink);
+    UNUSED(fds);
+    UNUSED(space);
+    return 0;
+  }
+
+static error_t
+pcm_sink_wav_poll_revents(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int count,
+  unsigned short *revents) {
+    UNUSED(sink);
+    UNUSED(fds);
+    UNUSED(count);
+    *revents = POLLOUT;
+    return 0;
+  }
+
+static error_t
+pcm_sink_wav_drain(struct pcm_sink *sink) {
+  UNUSED(sink);
+  return 0;
+}
+
+static bool
+pcm_sink_wav_is_drained(struct pcm_sink *sink) {
+  UNUSED(sink);
+  return true;
+}
+
+static error_t
+pcm_sink_wav_drop(struct pcm_sink *sink) {
+  UNUSED(sink);
+  return 0;
+}
+
+static error_t
+pcm_sink_wav_pause(struct pcm_sink *sink, bool is_paused) {
+  UNUSED(sink);
+  UNUSED(is_paused);
+  return 0;
+}
+
+static void
+pcm_sink_wav_release(struct pcm_sink **sink) {
+  assert(sink != NULL);
+  struct pcm_sink_wav *to_release = (struct pcm_sink_wav*) *sink;
+  if (to_release != NULL) {
+    if (to_release->fd != -1) {
+      unsigned char header[WAV_HEADER_SIZE];
+      wav_fill_header(&to_release->base.spec, to_release->data_size, header);
+      if (pwrite(to_release->fd, header, WAV_HEADER_SIZE, 0) == -1) {
+        log_error("WAV: Cannot update the header: %s", strerror(errno));
+      }
+      close(to_release->fd);
+      log_verbose("WAV: %lu bytes of PCM written", to_release->data_size);
+    }
+    free(to_release->area);
+    free(to_release);
+    *sink = NULL;
+  }
+}
+
+error_t
+pcm_sink_wav_open(
+  const char *file_path,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec,
+  struct pcm_sink **sink) {
+    log_verbose("Setting up WAV sink for [%s]", file_path);
+    assert(file_path != NULL);
+    assert(params != NULL);
+    assert(spec != NULL);
+    assert(sink != NULL);
+    if (spec->is_signed != (spec->bits_per_sample > 8)) {
+      log_error(
+        "WAV: %s %d bit PCM is not supported",
+        spec->is_signed ? "signed" : "unsigned",
+        spec->bits_per_sample);
+      return EINVAL;
+    }
+
+    struct pcm_sink_wav *result = calloc(1, sizeof(struct pcm_sink_wav));
+    if (result == NULL) {
+      log_error("WAV: Insufficient memory for 'pcm_sink_wav'");
+      return ENOMEM;
+    }
+    pcm_sink_init(&result->base, "WAV", params, spec);
+
+    error_t error_r = 0;
+    result->fd = open(
+      file_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (result->fd == -1) {
+      error_r = errno;
+      log_error("WAV: Cannot open [%s]: %s", file_path, strerror(error_r));
+    }
+    if (error_r == 0) {
+      unsigned char header[WAV_HEADER_SIZE];
+      wav_fill_header(spec, 0, header);
+      error_r = wav_write_all(result->fd, header, WAV_HEADER_SIZE);
+    }
+    if (error_r == 0 && !params->disable_mmap_access) {
+      error_r = pcm_sink_alloc_area(&result->base, &result->area);
+    }
+
+    if (error_r == 0) {
+      result->base.avail = &pcm_sink_wav_avail;
+      result->base.write = &pcm_sink_wav_write;
+      if (result->area != NULL) {
+        result->base.mmap_begin = &pcm_sink_wav_mmap_begin;
+        result->base.mmap_commit = &pcm_sink_wav_mmap_commit;
+      }
+      result->base.delay = &pcm_sink_wav_delay;
+      result->base.poll_descriptors = &pcm_sink_wav_poll_descriptors;
+      result->base.poll_revents = &pcm_sink_wav_poll_revents;
+      result->base.drain = &pcm_sink_wav_drain;
+      result->base.is_drained = &pcm_sink_wav_is_drained;
+      result->base.drop = &pcm_sink_wav_drop;
+      result->base.pause = &pcm_sink_wav_pause;
+      result->base.release = &pcm_sink_wav_release;
+      *sink = (struct pcm_sink*)result;
+    } else {
+      pcm_sink_wav_release((struct pcm_sink**)&result);
+    }
+    return error_r;
+  }
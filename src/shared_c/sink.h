@@ -0,0 +1,305 @@
+#ifndef PLAYER_SINK_H_
+#define PLAYER_SINK_H_
+
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "pcm.h"
+#include "pcm_resample.h"
+
+#define PCM_SINK_MAX_POLL_FDS 16
+#define PCM_SINK_XRUN_TIMES_COUNT 16
+
+// RIFF size field counts 36 header bytes on top of data
+#define PCM_SINK_WAV_MAX_DATA_SIZE (UINT32_MAX - 36)
+
+/**
+ * @brief Parameters shared by all sinks
+ *
+ * Sinks behave like a device ring of periods_per_buffer periods,
+ * period_size is in bytes. Resample_quality, if set, replaces resampling
+ * of the device, 0 leaves it to the device.
+ */
+struct pcm_sink_parameters {
+  size_t period_size;
+  unsigned short periods_per_buffer;
+  bool disable_resampling;
+  bool disable_mmap_access;
+  enum pcm_resample_quality resample_quality;
+};
+
+/**
+ * @brief PCM output sink
+ *
+ */
+struct pcm_sink;
+
+/**
+ * @brief Frames which can be written right now
+ */
+typedef error_t (*pcm_sink_avail_f) (
+  struct pcm_sink *sink,
+  size_t *count);
+
+/**
+ * @brief Write up to count frames without blocking
+ */
+typedef error_t (*pcm_sink_write_f) (
+  struct pcm_sink *sink,
+  const void *pcm,
+  size_t count,
+  size_t *written);
+
+/**
+ * @brief Get contiguous area of sink ring for count frames at most
+ */
+typedef error_t (*pcm_sink_mmap_begin_f) (
+  struct pcm_sink *sink,
+  void **area,
+  size_t *count);
+
+typedef error_t (*pcm_sink_mmap_commit_f) (
+  struct pcm_sink *sink,
+  size_t count);
+
+/**
+ * @brief Frames written, but not played yet
+ */
+typedef error_t (*pcm_sink_delay_f) (
+  struct pcm_sink *sink,
+  size_t *count);
+
+/**
+ * @brief Fill descriptors signalling that at least one period can be written
+ */
+typedef int (*pcm_sink_poll_descriptors_f) (
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int space);
+
+typedef error_t (*pcm_sink_poll_revents_f) (
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int count,
+  unsigned short *revents);
+
+/**
+ * @brief Nothing more is going to be written, play the rest
+ *
+ * Sink may take its last frames over several calls, it is called
+ * until the sink is drained.
+ */
+typedef error_t (*pcm_sink_drain_f) (struct pcm_sink *sink);
+
+typedef bool (*pcm_sink_is_drained_f) (struct pcm_sink *sink);
+
+/**
+ * @brief Discard frames which have not been played yet,
+ * sink stays ready for writing
+ */
+typedef error_t (*pcm_sink_drop_f) (struct pcm_sink *sink);
+
+/**
+ * @brief Stop or continue consuming frames without discarding them,
+ * sink which is not running stays stopped, drop ends pause as well
+ */
+typedef error_t (*pcm_sink_pause_f) (struct pcm_sink *sink, bool is_paused);
+
+typedef void (*pcm_sink_release_f) (struct pcm_sink **sink);
+
+/**
+ * @brief Stream interruptions recovered by the sink
+ *
+ * Updated by the thread writing to the sink, can be read from any thread.
+ * Times of the last PCM_SINK_XRUN_TIMES_COUNT xruns are kept in a ring
+ * indexed by xruns_count, in microseconds of the timer_start clock.
+ */
+struct pcm_sink_events {
+  atomic_ulong xruns_count;
+  atomic_ulong suspends_count;
+  atomic_ulong xrun_times[PCM_SINK_XRUN_TIMES_COUNT];
+};
+
+struct pcm_sink {
+  const char *name;
+  struct pcm_spec spec;
+  size_t frames_per_period;
+  size_t frames_per_buffer;
+  unsigned int poll_fds_count;
+  struct pcm_sink_events events;
+
+  pcm_sink_avail_f avail;
+  pcm_sink_write_f write;
+  pcm_sink_mmap_begin_f mmap_begin;   // NULL without direct access
+  pcm_sink_mmap_commit_f mmap_commit;
+  pcm_sink_delay_f delay;
+  pcm_sink_poll_descriptors_f poll_descriptors;
+  pcm_sink_poll_revents_f poll_revents;
+  pcm_sink_drain_f drain;
+  pcm_sink_is_drained_f is_drained;
+  pcm_sink_drop_f drop;
+  pcm_sink_pause_f pause;             // NULL if device cannot pause
+  pcm_sink_release_f release;
+};
+
+static inline size_t
+pcm_sink_frame_size(const struct pcm_sink *sink) {
+  assert(sink != NULL);
+  return pcm_frame_size(&sink->spec);
+}
+
+static inline bool
+pcm_sink_has_mmap(const struct pcm_sink *sink) {
+  assert(sink != NULL);
+  return sink->mmap_begin != NULL;
+}
+
+static inline error_t
+pcm_sink_avail(struct pcm_sink *sink, size_t *count) {
+  assert(sink != NULL);
+  return sink->avail(sink, count);
+}
+
+static inline error_t
+pcm_sink_write(
+  struct pcm_sink *sink,
+  const void *pcm,
+  size_t count,
+  size_t *written) {
+    assert(sink != NULL);
+    return sink->write(sink, pcm, count, written);
+  }
+
+static inline error_t
+pcm_sink_mmap_begin(struct pcm_sink *sink, void **area, size_t *count) {
+  assert(pcm_sink_has_mmap(sink));
+  return sink->mmap_begin(sink, area, count);
+}
+
+static inline error_t
+pcm_sink_mmap_commit(struct pcm_sink *sink, size_t count) {
+  assert(pcm_sink_has_mmap(sink));
+  return sink->mmap_commit(sink, count);
+}
+
+static inline error_t
+pcm_sink_delay(struct pcm_sink *sink, size_t *count) {
+  assert(sink != NULL);
+  return sink->delay(sink, count);
+}
+
+static inline int
+pcm_sink_poll_descriptors(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int space) {
+    assert(sink != NULL);
+    return sink->poll_fds_count == 0 ?
+      0 : sink->poll_descriptors(sink, fds, space);
+  }
+
+static inline error_t
+pcm_sink_poll_revents(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int count,
+  unsigned short *revents) {
+    assert(sink != NULL);
+    return sink->poll_revents(sink, fds, count, revents);
+  }
+
+static inline error_t
+pcm_sink_drain(struct pcm_sink *sink) {
+  assert(sink != NULL);
+  return sink->drain(sink);
+}
+
+static inline bool
+pcm_sink_is_drained(struct pcm_sink *sink) {
+  assert(sink != NULL);
+  return sink->is_drained(sink);
+}
+
+static inline error_t
+pcm_sink_drop(struct pcm_sink *sink) {
+  assert(sink != NULL);
+  return sink->drop(sink);
+}
+
+static inline bool
+pcm_sink_can_pause(const struct pcm_sink *sink) {
+  assert(sink != NULL);
+  return sink->pause != NULL;
+}
+
+static inline error_t
+pcm_sink_pause(struct pcm_sink *sink, bool is_paused) {
+  assert(pcm_sink_can_pause(sink));
+  return sink->pause(sink, is_paused);
+}
+
+static inline void
+pcm_sink_release(struct pcm_sink **sink) {
+  assert(sink != NULL);
+  if (*sink != NULL) {
+    (*sink)->release(sink);
+  }
+}
+
+/**
+ * @brief Record underrun, for sinks only
+ */
+void
+pcm_sink_add_xrun(struct pcm_sink *sink);
+
+/**
+ * @brief Record suspend of the device, for sinks only
+ */
+void
+pcm_sink_add_suspend(struct pcm_sink *sink);
+
+/**
+ * @brief Wait up to timeout ms until at least one period can be written,
+ * returns immediately for sinks which never block.
+ */
+error_t
+pcm_sink_wait(struct pcm_sink *sink, int timeout);
+
+/**
+ * @brief ALSA playback sink, "default" device if hardware_id is NULL.
+ *
+ * Frames are written in spec format. If the device does not take it,
+ * they are converted to the cheapest format it takes, without mmap
+ * access for the player then. The same goes for the rate, which is
+ * resampled if resample_quality is set, frame counts of the sink are
+ * in stream frames.
+ */
+error_t
+pcm_sink_alsa_open(
+  const char *hardware_id,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec,
+  struct pcm_sink **sink);
+
+/**
+ * @brief Sink dropping PCM, either consumed at real-time rate
+ * like a device would do it, or as fast as it is written.
+ */
+error_t
+pcm_sink_null_open(
+  bool is_realtime,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec,
+  struct pcm_sink **sink);
+
+/**
+ * @brief Sink writing PCM into WAV file, RIFX for big endian PCM.
+ */
+error_t
+pcm_sink_wav_open(
+  const char *file_path,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec,
+  struct pcm_sink **sink);
+
+#endif
@@ -0,0 +1,908 @@
+#include <alsa/asoundlib.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "log.h"
+#include "pcm_convert.h"
+#include "pcm_resample.h"
+#include "sink.h"
+
+#define RETURN_ON_SNDERROR(f, e)  error_r = f;\
+  if (error_r < 0) {\
+    log_error(e, snd_strerror(error_r));\
+    return error_r;\
+  }
+
+struct pcm_sink_alsa {
+  struct pcm_sink base;
+  snd_pcm_t *handle;
+  snd_pcm_uframes_t mmap_offset;
+  bool is_mmap;
+  bool is_paused;
+
+  // device does not take stream format, frames are converted on write
+  struct pcm_converter converter;
+  void *converted;
+  size_t converted_frames;
+
+  // device does not take stream rate, converted frames are resampled,
+  // those device has not taken yet are pending from resampled_offset
+  struct pcm_resampler *resampler;
+  void *resampled;
+  size_t resampled_frames;
+  size_t resampled_offset;
+  size_t resampled_pending;
+  bool is_flushed;
+};
+
+static error_t
+get_pcm_format(const struct pcm_spec *spec, snd_pcm_format_t *format) {
+  switch (spec->bits_per_sample) {
+  case 8:
+    *format = spec->is_signed ? SND_PCM_FORMAT_S8 : SND_PCM_FORMAT_U8;
+    return 0;
+  case 16:
+    if (spec->is_big_endian)
+      *format = spec->is_signed ? SND_PCM_FORMAT_S16_BE : SND_PCM_FORMAT_U16_BE;
+    else
+      *format = spec->is_signed ? SND_PCM_FORMAT_S16_LE : SND_PCM_FORMAT_U16_LE;
+    return 0;
+  case 24:
+    if (spec->is_big_endian)
+      *format = spec->is_signed ?
+        SND_PCM_FORMAT_S24_3BE : SND_PCM_FORMAT_U24_3BE;
+    else
+      *format = spec->is_signed ?
+        SND_PCM_FORMAT_S24_3LE : SND_PCM_FORMAT_U24_3LE;
+    return 0;
+  case 32:
+    if (spec->is_big_endian)
+      *format = spec->is_signed ? SND_PCM_FORMAT_S32_BE : SND_PCM_FORMAT_U32_BE;
+    else
+      *format = spec->is_signed ? SND_PCM_FORMAT_S32_LE : SND_PCM_FORMAT_U32_LE;
+    return 0;
+  }
+
+  log_error("ALSA: Unsupported player bitrate: %d", spec->bits_per_sample);
+  return EINVAL;
+}
+
+static snd_pcm_format_t
+get_convert_pcm_format(enum pcm_convert_format format) {
+  switch (format) {
+  case pcm_convert_format_s8:
+    return SND_PCM_FORMAT_S8;
+  case pcm_convert_format_s16_le:
+    return SND_PCM_FORMAT_S16_LE;
+  case pcm_convert_format_s24_3le:
+    return SND_PCM_FORMAT_S24_3LE;
+  case pcm_convert_format_s24_le:
+    return SND_PCM_FORMAT_S24_LE;
+  case pcm_convert_format_s32_le:
+    return SND_PCM_FORMAT_S32_LE;
+  }
+  return SND_PCM_FORMAT_UNKNOWN;
+}
+
+/**
+ * Stream format is used if device takes it, otherwise the cheapest
+ * conversion to one it takes, raw hw: devices take just a few.
+ * Resampler takes only conversion formats, so it is always converted.
+ */
+static error_t
+alsa_set_params_format(
+  snd_pcm_t *handle,
+  snd_pcm_hw_params_t *hw_params,
+  const struct pcm_spec *stream_spec,
+  snd_pcm_format_t stream_format,
+  bool is_resampled,
+  enum pcm_convert_format *convert_format) {
+    error_t error_r;
+    snd_pcm_format_t pcm_format = stream_format;
+    *convert_format = 0;
+    if (is_resampled
+      || snd_pcm_hw_params_test_format(handle, hw_params, pcm_format) != 0) {
+        enum pcm_convert_format formats[PCM_CONVERT_MAX_FORMATS];
+        size_t count = pcm_convert_list_formats(stream_spec, formats);
+        for (size_t i = 0; i < count && *convert_format == 0; i++) {
+          snd_pcm_format_t converted = get_convert_pcm_format(formats[i]);
+          if (snd_pcm_hw_params_test_format(
+            handle, hw_params, converted) == 0) {
+              pcm_format = converted;
+              *convert_format = formats[i];
+            }
+        }
+      }
+    if (is_resampled && *convert_format == 0) {
+      log_error(
+        "ALSA: Device takes no format to resample %s in",
+        snd_pcm_format_name(stream_format));
+      return EINVAL;
+    }
+    if (pcm_format != stream_format) {
+      log_info(
+        "ALSA: Device does not take %s, converting to %s",
+        snd_pcm_format_name(stream_format),
+        snd_pcm_format_name(pcm_format));
+    }
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_set_format(handle, hw_params, pcm_format),
+      "ALSA: Sample format not available for playback: %s");
+    return 0;
+  }
+
+static error_t
+alsa_set_params_access(
+  snd_pcm_t *handle,
+  snd_pcm_hw_params_t *hw_params,
+  const struct pcm_sink_parameters *params,
+  bool *is_mmap) {
+    error_t error_r;
+    *is_mmap = false;
+    if (!params->disable_mmap_access
+      && snd_pcm_hw_params_test_access(
+        handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0) {
+        *is_mmap = true;
+        RETURN_ON_SNDERROR(
+          snd_pcm_hw_params_set_access(
+            handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED),
+          "ALSA: Mmap access type not available for playback: %s");
+      } else {
+        RETURN_ON_SNDERROR(
+          snd_pcm_hw_params_set_access(
+            handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED),
+          "ALSA: Access type not available for playback: %s");
+      }
+
+    log_verbose("ALSA: Access type is %s", *is_mmap ? "MMAP" : "RW");
+    return 0;
+  }
+
+static error_t
+alsa_set_params_stream(
+  snd_pcm_t *handle,
+  snd_pcm_hw_params_t *hw_params,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *stream_spec,
+  bool *is_mmap,
+  enum pcm_convert_format *convert_format,
+  unsigned int *samples_per_sec) {
+    snd_pcm_format_t pcm_format;
+    error_t error_r = get_pcm_format(stream_spec, &pcm_format);
+    if (error_r != 0) {
+      return error_r;
+    }
+
+    // own resampler replaces the one of ALSA
+    bool is_device_resampling =
+      !params->disable_resampling && params->resample_quality == 0;
+    log_verbose(
+      "ALSA: Resampling is %s",
+      params->resample_quality != 0 ?
+        pcm_resample_quality_name(params->resample_quality) :
+        is_device_resampling ? "ON" : "OFF");
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_set_rate_resample(
+        handle, hw_params, is_device_resampling ? 1 : 0),
+      "ALSA: Resampling setup failed for playback: %s");
+    bool is_resampled = params->resample_quality != 0
+      && snd_pcm_hw_params_test_rate(
+        handle, hw_params, stream_spec->samples_per_sec, 0) != 0;
+
+    log_verbose(
+      "ALSA: Stream parameters are %uHz, %s, %u channels",
+      stream_spec->samples_per_sec,
+      snd_pcm_format_name(pcm_format),
+      stream_spec->channels_count);
+    error_r = alsa_set_params_access(
+      handle, hw_params, params, is_mmap);
+    if (error_r != 0) {
+      return error_r;
+    }
+    error_r = alsa_set_params_format(
+      handle, hw_params, stream_spec, pcm_format,
+      is_resampled, convert_format);
+    if (error_r != 0) {
+      return error_r;
+    }
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_set_channels(
+        handle, hw_params, stream_spec->channels_count),
+      "ALSA: Channels count not available for playbacks: %s");
+
+    int dir = 0;
+    *samples_per_sec = stream_spec->samples_per_sec;
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_set_rate_near(
+        handle, hw_params, samples_per_sec, &dir),
+      "ALSA: Rate not available for playback: %s");
+    if (*samples_per_sec != stream_spec->samples_per_sec && !is_resampled) {
+      log_error(
+        "ALSA: Rate doesn't match (requested %uHz, get %uHz)",
+        stream_spec->samples_per_sec, *samples_per_sec);
+      return EINVAL;
+    }
+    if (is_resampled) {
+      log_info(
+        "ALSA: Device does not take %uHz, resampling to %uHz",
+        stream_spec->samples_per_sec, *samples_per_sec);
+    }
+
+    return error_r;
+  }
+
+static error_t
+alsa_set_params_period(
+  snd_pcm_t *handle,
+  snd_pcm_hw_params_t *hw_params,
+  const struct pcm_spec *stream_spec,
+  size_t *period_buffer_size,
+  snd_pcm_uframes_t *frames_per_period) {
+    int dir;
+    error_t error_r;
+
+    if (log_is_verbose()) {
+      snd_pcm_uframes_t period_size_max, period_size_min;
+      dir = 0;
+      RETURN_ON_SNDERROR(
+        snd_pcm_hw_params_get_period_size_max(
+          hw_params, &period_size_max, &dir),
+        "ALSA: Unable to get max period size for playback: %s");
+      dir = 0;
+      RETURN_ON_SNDERROR(
+        snd_pcm_hw_params_get_period_size_min(
+          hw_params, &period_size_min, &dir),
+        "ALSA: Unable to get min period size for playback: %s");
+
+      size_t requested = *period_buffer_size / pcm_frame_size(stream_spec);
+      log_verbose(
+        "ALSA: Frames per period (min, max, requested): %d, %d, %d (%d%)",
+        period_size_min, period_size_max,
+        requested, requested * 100 / period_size_max);
+    }
+
+    unsigned int period_time = pcm_buffer_time_us(
+      stream_spec, *period_buffer_size);
+    dir = 0;
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_set_period_time_near(
+        handle, hw_params, &period_time, &dir),
+      "ALSA: Unable to set period time for playback: %s");
+    if (period_time < 100000) {
+      // expected with tuned sink, otherwise a hint for xruns
+      log_verbose(
+        "ALSA: Period time is smaller than 100ms: %dus",
+        period_time);
+    }
+
+    dir = 0;
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_get_period_size(hw_params, frames_per_period, &dir),
+      "ALSA: Unable to get period size for playback: %s");
+    size_t period_size = *frames_per_period * pcm_frame_size(stream_spec);
+    if (period_size > *period_buffer_size) {
+      log_error(
+        "ALSA: Period size %d is greater than period buffer size %d",
+        period_size, *period_buffer_size);
+    }
+    *period_buffer_size = period_size;
+
+    log_verbose(
+      "ALSA: Period time %dms (%d frames, %dkb)",
+      period_time / 1000,
+      *frames_per_period,
+      period_size / 1024);
+
+    return 0;
+  }
+
+static error_t
+alsa_set_params_buffer(
+  snd_pcm_t *handle,
+  snd_pcm_hw_params_t *hw_params,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *stream_spec,
+  size_t frames_per_period,
+  snd_pcm_uframes_t *frames_per_buffer) {
+    int dir;
+    error_t error_r;
+    size_t period_size = frames_per_period * pcm_frame_size(stream_spec);
+
+    if (log_is_verbose()) {
+      snd_pcm_uframes_t buffer_size_max, buffer_size_min;
+      RETURN_ON_SNDERROR(
+        snd_pcm_hw_params_get_buffer_size_max(
+          hw_params, &buffer_size_max),
+        "ALSA: Unable to get max buffer size for playback: %s");
+      RETURN_ON_SNDERROR(
+        snd_pcm_hw_params_get_buffer_size_min(
+          hw_params, &buffer_size_min),
+        "ALSA: Unable to get min buffer size for playback: %s");
+
+      size_t requested = frames_per_period * params->periods_per_buffer;
+      log_verbose(
+        "ALSA: Frames per buffer (min, max, requested): %d, %d, %d (%d%)",
+        buffer_size_min, buffer_size_max,
+        requested, requested * 100 / buffer_size_max);
+    }
+
+    unsigned int buffer_time = pcm_buffer_time_us(
+      stream_spec, period_size * max_int(params->periods_per_buffer, 2));
+    dir = 0;
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_set_buffer_time_near(
+        handle, hw_params, &buffer_time, &dir),
+      "ALSA: Unable to set buffer time for playback: %s");
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_get_buffer_size(hw_params, frames_per_buffer),
+      "ALSA: Unable to get buffer size for playback: %s");
+    log_verbose(
+      "ALSA: Buffer time %dms (%d periods, %d frames, %dkB)",
+      buffer_time / 1000,
+      *frames_per_buffer / frames_per_period,
+      *frames_per_buffer,
+      *frames_per_buffer * pcm_frame_size(stream_spec) / 1024);
+    return 0;
+  }
+
+static error_t
+alsa_set_params_sw(
+  snd_pcm_t *handle,
+  snd_pcm_uframes_t frames_per_period) {
+    error_t error_r = 0;
+    snd_pcm_sw_params_t *sw_params = NULL;
+
+    snd_pcm_sw_params_alloca(&sw_params);
+    if (sw_params == NULL) {
+      log_error("ALSA: cannot allocate sw_params");
+      return ENOMEM;
+    }
+
+    RETURN_ON_SNDERROR(
+      snd_pcm_sw_params_current(
+        handle, sw_params),
+      "ALSA: Unable to get software parameters: %s");
+
+    RETURN_ON_SNDERROR(
+      snd_pcm_sw_params_set_start_threshold(
+        handle, sw_params, frames_per_period),
+      "ALSA: Unable to set start threshold: %s");
+
+    // poll descriptors report ready when whole period can be written
+    RETURN_ON_SNDERROR(
+      snd_pcm_sw_params_set_avail_min(
+        handle, sw_params, frames_per_period),
+      "ALSA: Unable to set avail min: %s");
+
+    RETURN_ON_SNDERROR(
+      snd_pcm_sw_params(handle, sw_params),
+      "ALSA: Unable to set sw params for playback: %s");
+
+    return error_r;
+  }
+
+static error_t
+alsa_set_params(
+  snd_pcm_t *handle,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *stream_spec,
+  bool *is_mmap,
+  bool *can_pause,
+  enum pcm_convert_format *convert_format,
+  unsigned int *samples_per_sec,
+  snd_pcm_uframes_t *frames_per_period,
+  snd_pcm_uframes_t *frames_per_buffer) {
+    error_t error_r = 0;
+    snd_pcm_hw_params_t *hw_params = NULL;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    if (hw_params == NULL) {
+      log_error("ALSA: cannot allocate hw_params");
+      return ENOMEM;
+    }
+    RETURN_ON_SNDERROR(
+      snd_pcm_hw_params_any(handle, hw_params),
+      "ALSA: no configurations available: %s");
+
+    error_r = alsa_set_params_stream(
+      handle, hw_params, params, stream_spec,
+      is_mmap, convert_format, samples_per_sec);
+    // period and buffer take the same time at device rate
+    struct pcm_spec device_spec = *stream_spec;
+    device_spec.samples_per_sec = *samples_per_sec;
+    if (error_r == 0) {
+      size_t frame_size = pcm_frame_size(stream_spec);
+      size_t period_buffer_size = params->period_size / frame_size
+        * device_spec.samples_per_sec / stream_spec->samples_per_sec
+        * frame_size;
+      error_r = alsa_set_params_period(
+        handle, hw_params, &device_spec,
+        &period_buffer_size, frames_per_period);
+    }
+    if (error_r == 0) {
+      error_r = alsa_set_params_buffer(
+        handle, hw_params, params, &device_spec,
+        *frames_per_period, frames_per_buffer);
+    }
+    if (error_r == 0) {
+      RETURN_ON_SNDERROR(
+        snd_pcm_hw_params(handle, hw_params),
+        "ALSA: Unable to set hw params for playback: %s");
+      *can_pause = snd_pcm_hw_params_can_pause(hw_params) == 1;
+
+      error_r = alsa_set_params_sw(
+        handle,
+        *frames_per_period);
+    }
+
+    return error_r;
+  }
+
+static error_t
+alsa_xrun_recovery(struct pcm_sink_alsa *alsa, error_t error_r) {
+    snd_pcm_t *handle = alsa->handle;
+    if (error_r == -EPIPE) {
+      log_verbose("ALSA: recovery due to broken pipe");
+      pcm_sink_add_xrun(&alsa->base);
+      RETURN_ON_SNDERROR(
+        snd_pcm_prepare(handle),
+        "ALSA: Can't recovery from underrun, prepare failed: %s");
+      return 0;
+    } else if (error_r == -ESTRPIPE) {
+      log_verbose("ALSA: recovery due to stream pipe error");
+      pcm_sink_add_suspend(&alsa->base);
+      error_t resume_error_r = snd_pcm_resume(handle);
+      while (resume_error_r == -EAGAIN) {
+        log_verbose("ALSA: recovery sleep");
+        sleep(1);
+        resume_error_r = snd_pcm_resume(handle);
+      }
+      if (resume_error_r < 0) {
+        RETURN_ON_SNDERROR(
+          snd_pcm_prepare(handle),
+          "ALSA: Can't recovery from suspend, prepare failed: %s");
+      }
+      return 0;
+    } else {
+      log_verbose("ALSA: can't recovery from %d", error_r);
+      return error_r;
+    }
+}
+
+/**
+ * Underrun is reported to the caller as no progress, stream is recovered.
+ */
+static error_t
+alsa_check_result(struct pcm_sink_alsa *alsa, snd_pcm_sframes_t result) {
+  if (result >= 0 || result == -EAGAIN) {
+    return 0;
+  }
+  error_t error_r = alsa_xrun_recovery(alsa, result);
+  if (error_r < 0) {
+    log_error("ALSA: Write error: %s", snd_strerror(error_r));
+  }
+  return error_r;
+}
+
+static error_t
+pcm_sink_alsa_avail(struct pcm_sink *sink, size_t *count) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa->handle);
+  *count = avail > 0 ? avail : 0;
+  if (alsa->resampler != NULL) {
+    // pending frames take the space first
+    *count = *count > alsa->resampled_pending ?
+      *count - alsa->resampled_pending : 0;
+    *count = pcm_resampler_get_input_frames(alsa->resampler, *count);
+  }
+  return alsa_check_result(alsa, avail);
+}
+
+/**
+ * Write resampled frames device has not taken yet, short write
+ * or recovery from underrun leaves the rest of them pending.
+ */
+static error_t
+alsa_write_resampled_pending(struct pcm_sink_alsa *alsa) {
+  size_t frame_size = alsa->base.spec.channels_count
+    * alsa->converter.dest_bytes;
+  const char *pending = (const char*)alsa->resampled  // NOLINT
+    + alsa->resampled_offset * frame_size;
+  snd_pcm_sframes_t write_result;
+  if (alsa->is_mmap) {
+    write_result = snd_pcm_mmap_writei(
+      alsa->handle, pending, alsa->resampled_pending);
+  } else {
+    write_result = snd_pcm_writei(
+      alsa->handle, pending, alsa->resampled_pending);
+  }
+  if (write_result > 0) {
+    alsa->resampled_offset += write_result;
+    alsa->resampled_pending -= write_result;
+  }
+  return alsa_check_result(alsa, write_result);
+}
+
+/**
+ * Resample as many frames as device has space for, frames consumed
+ * by resampler are written, even if they are still in filter history
+ * or pending. Pending frames go first, new ones wait until they are all
+ * written. NULL pcm pushes out the history.
+ */
+static error_t
+alsa_write_resampled(
+  struct pcm_sink_alsa *alsa,
+  const void *pcm,
+  size_t count,
+  size_t *written) {
+    *written = 0;
+    if (alsa->resampled_pending > 0) {
+      error_t error_r = alsa_write_resampled_pending(alsa);
+      if (error_r != 0 || alsa->resampled_pending > 0) {
+        return error_r;
+      }
+    }
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa->handle);
+    if (avail <= 0) {
+      return alsa_check_result(alsa, avail);
+    }
+    size_t capacity = min_size_t(avail, alsa->resampled_frames);
+    // input for more output than device takes is not converted
+    count = min_size_t(
+      count,
+      pcm_resampler_get_input_frames(alsa->resampler, capacity) + 1);
+    count = min_size_t(count, alsa->converted_frames);
+    if (pcm != NULL) {
+      pcm_convert(
+        &alsa->converter,
+        pcm,
+        count * alsa->base.spec.channels_count,
+        alsa->converted);
+      pcm = alsa->converted;
+    }
+    alsa->resampled_offset = 0;
+    alsa->resampled_pending = pcm_resample(
+      alsa->resampler, pcm, count, written, alsa->resampled, capacity);
+    return alsa->resampled_pending > 0 ?
+      alsa_write_resampled_pending(alsa) : 0;
+  }
+
+static error_t
+pcm_sink_alsa_write(
+  struct pcm_sink *sink,
+  const void *pcm,
+  size_t count,
+  size_t *written) {
+    struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+    if (alsa->resampler != NULL) {
+      alsa->is_flushed = false;
+      return alsa_write_resampled(alsa, pcm, count, written);
+    }
+    if (alsa->converted != NULL) {
+      // frames which are not written are converted again next time
+      count = min_size_t(count, alsa->converted_frames);
+      pcm_convert(
+        &alsa->converter,
+        pcm,
+        count * sink->spec.channels_count,
+        alsa->converted);
+      pcm = alsa->converted;
+    }
+
+    snd_pcm_sframes_t write_result;
+    if (alsa->is_mmap) {
+      write_result = snd_pcm_mmap_writei(alsa->handle, pcm, count);
+    } else {
+      write_result = snd_pcm_writei(alsa->handle, pcm, count);
+    }
+    *written = write_result > 0 ? write_result : 0;
+    return alsa_check_result(alsa, write_result);
+  }
+
+static error_t
+pcm_sink_alsa_mmap_begin(struct pcm_sink *sink, void **area, size_t *count) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t frames_count = *count;
+  error_t error_r;
+  RETURN_ON_SNDERROR(
+    snd_pcm_mmap_begin(
+      alsa->handle, &areas, &alsa->mmap_offset, &frames_count),
+    "ALSA: Unable to begin mmap transfer: %s");
+
+  *area = (char*)areas[0].addr  // NOLINT
+    + (areas[0].first + alsa->mmap_offset * areas[0].step) / 8;
+  *count = frames_count;
+  return 0;
+}
+
+static error_t
+pcm_sink_alsa_mmap_commit(struct pcm_sink *sink, size_t count) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  snd_pcm_sframes_t commit_result = snd_pcm_mmap_commit(
+    alsa->handle, alsa->mmap_offset, count);
+  if (commit_result >= 0 && (size_t)commit_result != count) {
+    commit_result = -EPIPE;
+  }
+  return alsa_check_result(alsa, commit_result);
+}
+
+static error_t
+pcm_sink_alsa_delay(struct pcm_sink *sink, size_t *count) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  snd_pcm_sframes_t delay = 0;
+  error_t error_r = snd_pcm_delay(alsa->handle, &delay);
+  *count = delay > 0 ? delay : 0;
+  if (alsa->resampler != NULL) {
+    *count = pcm_resampler_get_input_frames(
+      alsa->resampler, *count + alsa->resampled_pending)
+      + pcm_resampler_get_latency(alsa->resampler);
+  }
+  if (error_r == -EPIPE) {
+    // underrun, nothing is being played
+    return 0;
+  }
+  if (error_r < 0) {
+    log_error("ALSA: getting delay: %s", snd_strerror(error_r));
+  }
+  return error_r;
+}
+
+static int
+pcm_sink_alsa_poll_descriptors(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int space) {
+    struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+    int count = snd_pcm_poll_descriptors(alsa->handle, fds, space);
+    if (count < 0) {
+      log_error("ALSA: Unable to get poll descriptors: %s", snd_strerror(count));
+    }
+    return count;
+  }
+
+static error_t
+pcm_sink_alsa_poll_revents(
+  struct pcm_sink *sink,
+  struct pollfd *fds,
+  unsigned int count,
+  unsigned short *revents) {
+    struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+    error_t error_r;
+    RETURN_ON_SNDERROR(
+      snd_pcm_poll_descriptors_revents(alsa->handle, fds, count, revents),
+      "ALSA: Unable to get poll events: %s");
+    return 0;
+  }
+
+static error_t
+pcm_sink_alsa_drain(struct pcm_sink *sink) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  error_t error_r = 0;
+  if (alsa->resampler != NULL && !alsa->is_flushed) {
+    // last frames are in filter history, silence pushes them out
+    // once pending ones are written, next drain retries until then
+    size_t flushed = 0;
+    size_t latency = pcm_resampler_get_latency(alsa->resampler);
+    error_r = alsa_write_resampled(alsa, NULL, latency, &flushed);
+    if (error_r != 0) {
+      return error_r;
+    }
+    if (flushed > 0 && flushed < latency) {
+      log_verbose(
+        "ALSA: %zu resampled frames dropped on drain",
+        latency - flushed);
+    }
+    alsa->is_flushed = flushed > 0 || latency == 0;
+  } else if (alsa->resampled_pending > 0) {
+    error_r = alsa_write_resampled_pending(alsa);
+    if (error_r != 0) {
+      return error_r;
+    }
+  }
+  if (alsa->resampled_pending == 0
+    && snd_pcm_state(alsa->handle) == SND_PCM_STATE_PREPARED) {
+      // less than start threshold has been written
+      RETURN_ON_SNDERROR(
+        snd_pcm_start(alsa->handle),
+        "ALSA: Unable to start playback: %s");
+    }
+  return error_r;
+}
+
+static bool
+pcm_sink_alsa_is_drained(struct pcm_sink *sink) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  return alsa->resampled_pending == 0
+    && snd_pcm_state(alsa->handle) == SND_PCM_STATE_XRUN;
+}
+
+static error_t
+pcm_sink_alsa_drop(struct pcm_sink *sink) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  error_t error_r;
+  RETURN_ON_SNDERROR(
+    snd_pcm_drop(alsa->handle),
+    "ALSA: Unable to drop playback: %s");
+  RETURN_ON_SNDERROR(
+    snd_pcm_prepare(alsa->handle),
+    "ALSA: Unable to prepare playback: %s");
+  alsa->is_paused = false;
+  if (alsa->resampler != NULL) {
+    pcm_resampler_reset(alsa->resampler);
+    alsa->resampled_pending = 0;
+    alsa->is_flushed = false;
+  }
+  return 0;
+}
+
+/**
+ * Only running playback is paused, prepared one starts once
+ * the start threshold is written after resume.
+ */
+static error_t
+pcm_sink_alsa_pause(struct pcm_sink *sink, bool is_paused) {
+  struct pcm_sink_alsa *alsa = (struct pcm_sink_alsa*)sink;
+  error_t error_r = 0;
+  snd_pcm_state_t state = snd_pcm_state(alsa->handle);
+  if (is_paused && state == SND_PCM_STATE_RUNNING) {
+    RETURN_ON_SNDERROR(
+      snd_pcm_pause(alsa->handle, 1),
+      "ALSA: Unable to pause playback: %s");
+    alsa->is_paused = true;
+  } else if (!is_paused && alsa->is_paused) {
+    alsa->is_paused = false;
+    // suspended playback is recovered by the next write
+    if (state == SND_PCM_STATE_PAUSED) {
+      RETURN_ON_SNDERROR(
+        snd_pcm_pause(alsa->handle, 0),
+        "ALSA: Unable to resume playback: %s");
+    }
+  }
+  return error_r;
+}
+
+static void
+pcm_sink_alsa_release(struct pcm_sink **sink) {
+  assert(sink != NULL);
+  struct pcm_sink_alsa *to_release = (struct pcm_sink_alsa*) *sink;
+  if (to_release != NULL) {
+    if (to_release->handle != NULL) {
+      snd_pcm_drain(to_release->handle);
+      snd_pcm_close(to_release->handle);
+    }
+    free(to_release->converted);
+    pcm_resampler_release(&to_release->resampler);
+    free(to_release->resampled);
+    free(to_release);
+    *sink = NULL;
+  }
+}
+
+error_t
+pcm_sink_alsa_open(
+  const char *hardware_id,
+  const struct pcm_sink_parameters *params,
+  const struct pcm_spec *spec,
+  struct pcm_sink **sink) {
+    log_verbose("Setting up ALSA sink");
+    assert(params != NULL);
+    assert(spec != NULL);
+    assert(sink != NULL);
+    error_t error_r = 0;
+    snd_output_t *output = NULL;
+
+    const char *device_name = hardware_id != NULL ? hardware_id : "default";
+    log_verbose("ALSA: library version:  %s", SND_LIB_VERSION_STR);
+    log_verbose("ALSA: Playback device: [%s]", device_name);
+
+    struct pcm_sink_alsa *result = calloc(1, sizeof(struct pcm_sink_alsa));
+    if (result == NULL) {
+      log_error("ALSA: Insufficient memory for 'pcm_sink_alsa'");
+      return ENOMEM;
+    }
+
+    error_r = snd_pcm_open(
+      &result->handle,
+      device_name,
+      SND_PCM_STREAM_PLAYBACK,
+      SND_PCM_NONBLOCK);
+    if (error_r < 0) {
+      log_error("ALSA: Playback open error: %s", snd_strerror(error_r));
+      result->handle = NULL;
+    }
+
+    bool is_mmap = false;
+    bool can_pause = false;
+    enum pcm_convert_format convert_format = 0;
+    unsigned int samples_per_sec = 0;
+    snd_pcm_uframes_t frames_per_period = 0;
+    snd_pcm_uframes_t frames_per_buffer = 0;
+    if (error_r == 0) {
+      error_r = alsa_set_params(
+        result->handle, params, spec,
+        &is_mmap, &can_pause, &convert_format, &samples_per_sec,
+        &frames_per_period, &frames_per_buffer);
+    }
+    if (error_r == 0 && convert_format != 0) {
+      error_r = pcm_converter_init(spec, convert_format, &result->converter);
+    }
+    if (error_r == 0 && samples_per_sec != spec->samples_per_sec) {
+      error_r = pcm_resampler_open(
+        params->resample_quality,
+        spec->channels_count,
+        convert_format,
+        spec->samples_per_sec,
+        samples_per_sec,
+        &result->resampler);
+    }
+    if (error_r == 0 && result->resampler != NULL) {
+      result->resampled_frames = frames_per_buffer;
+      result->resampled = malloc(
+        frames_per_buffer * spec->channels_count
+        * pcm_convert_format_bytes(convert_format));
+      if (result->resampled == NULL) {
+        log_error("ALSA: Insufficient memory for resampled frames");
+        error_r = ENOMEM;
+      }
+      // sink counts stream frames from now on
+      frames_per_period = pcm_resampler_get_input_frames(
+        result->resampler, frames_per_period);
+      frames_per_buffer = pcm_resampler_get_input_frames(
+        result->resampler, frames_per_buffer);
+    }
+    if (error_r == 0 && convert_format != 0) {
+      // resampler may take one frame more than device takes
+      result->converted_frames = frames_per_buffer + 1;
+      result->converted = malloc(
+        result->converted_frames * spec->channels_count
+        * pcm_convert_format_bytes(convert_format));
+      if (result->converted == NULL) {
+        log_error("ALSA: Insufficient memory for converted frames");
+        error_r = ENOMEM;
+      }
+    }
+    if (error_r == 0) {
+      int poll_fds_count = snd_pcm_poll_descriptors_count(result->handle);
+      if (poll_fds_count < 0 || poll_fds_count > PCM_SINK_MAX_POLL_FDS) {
+        log_error("ALSA: Unsupported poll descriptors count %d", poll_fds_count);
+        error_r = EINVAL;
+      } else {
+        result->base.poll_fds_count = poll_fds_count;
+      }
+    }
+    if (error_r == 0 && log_is_verbose()
+      && snd_output_stdio_attach(&output, stdout, 0) == 0) {
+        snd_pcm_dump(result->handle, output);
+        snd_output_close(output);
+      }
+
+    if (error_r == 0) {
+      result->base.name = "ALSA";
+      result->base.spec = *spec;
+      result->base.frames_per_period = frames_per_period;
+      result->base.frames_per_buffer = frames_per_buffer;
+      result->base.avail = &pcm_sink_alsa_avail;
+      result->base.write = &pcm_sink_alsa_write;
+      result->is_mmap = is_mmap;
+      // player decodes into mmap area, which is in device format
+      if (is_mmap && result->converted == NULL) {
+        result->base.mmap_begin = &pcm_sink_alsa_mmap_begin;
+        result->base.mmap_commit = &pcm_sink_alsa_mmap_commit;
+      }
+      result->base.delay = &pcm_sink_alsa_delay;
+      result->base.poll_descriptors = &pcm_sink_alsa_poll_descriptors;
+      result->base.poll_revents = &pcm_sink_alsa_poll_revents;
+      result->base.drain = &pcm_sink_alsa_drain;
+      result->base.is_drained = &pcm_sink_alsa_is_drained;
+      result->base.drop = &pcm_sink_alsa_drop;
+      if (can_pause) {
+        result->base.pause = &pcm_sink_alsa_pause;
+      }
+      result->base.release = &pcm_sink_alsa_release;
+      *sink = (struct pcm_sink*)result;
+    } else {
+      pcm_sink_alsa_release((struct pcm_sink**)&result);
+    }
+    return error_r;
+  }
@@ -2,6 +2,9 @@
 
 #define _MILISECONDS_IN_SECOND 1000u
 
+#define _MICROSECONDS_IN_SECOND 1000000ul
+
+#define _NANOSECONDS_IN_MICROSECOND 1000u
 #define _NANOSECONDS_IN_MILISECOND 1000000u
 #define _NANOSECONDS_IN_SECOND (_NANOSECONDS_IN_MILISECOND * 1000u)
 
@@ -11,6 +14,35 @@ timespec_miliseconds(const struct timespec span) {
     + span.tv_nsec / _NANOSECONDS_IN_MILISECOND;
 }
 
+unsigned long
+timespec_microseconds(const struct timespec span) {
+  return _MICROSECONDS_IN_SECOND * span.tv_sec
+    + span.tv_nsec / _NANOSECONDS_IN_MICROSECOND;
+}
+
+struct timespec
+timespec_from_microseconds(unsigned long microseconds) {
+  struct timespec result;
+  result.tv_sec = microseconds / _MICROSECONDS_IN_SECOND;
+  result.tv_nsec = microseconds % _MICROSECONDS_IN_SECOND
+    * _NANOSECONDS_IN_MICROSECOND;
+  return result;
+}
+
+struct timespec
+timespec_add(
+  const struct timespec a,
+  const struct timespec b) {
+    struct timespec result;
+    result.tv_sec = a.tv_sec + b.tv_sec;
+    result.tv_nsec = a.tv_nsec + b.tv_nsec;
+    if (result.tv_nsec >= _NANOSECONDS_IN_SECOND) {
+      result.tv_nsec -= _NANOSECONDS_IN_SECOND;
+      result.tv_sec += 1;
+    }
+    return result;
+  }
+
 struct timespec
 timespec_elapsed_between(
   const struct timespec start,
@@ -29,7 +61,9 @@ timespec_elapsed_between(
 struct timespec
 timer_elapsed(const struct timespec start) {
   struct timespec end;
-  assert(clock_gettime(CLOCK_MONOTONIC_RAW, &end) == 0);
+  int result = clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  assert(result == 0);
+  UNUSED(result);
   return timespec_elapsed_between(start, end);
 }
 
@@ -37,11 +71,5 @@ void
 timer_add_elapsed(
     struct timespec *current_value,
     const struct timespec start) {
-  struct timespec elapsed = timer_elapsed(start);
-  current_value->tv_nsec += elapsed.tv_nsec;
-  current_value->tv_sec += elapsed.tv_sec;
-  if (current_value->tv_nsec >= _NANOSECONDS_IN_SECOND) {
-    current_value->tv_nsec -= _NANOSECONDS_IN_SECOND;
-    current_value->tv_sec += 1;
-  }
+  *current_value = timespec_add(*current_value, timer_elapsed(start));
 }
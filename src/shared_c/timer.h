@@ -8,6 +8,23 @@
 unsigned
 timespec_miliseconds(const struct timespec span);
 
+unsigned long
+timespec_microseconds(const struct timespec span);
+
+struct timespec
+timespec_from_microseconds(unsigned long microseconds);
+
+struct timespec
+timespec_add(
+  const struct timespec a,
+  const struct timespec b);
+
+inline static bool
+timespec_is_greater(const struct timespec a, const struct timespec b) {
+  return a.tv_sec > b.tv_sec
+    || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
 struct timespec
 timespec_elapsed_between(
   const struct timespec start,
@@ -26,7 +43,9 @@ timespec_get_remaining_seconds(struct timespec span) {
 static inline void
 timer_start(struct timespec *start) {
   assert(start != NULL);
-  assert(clock_gettime(CLOCK_MONOTONIC_RAW, start) == 0);
+  int result = clock_gettime(CLOCK_MONOTONIC_RAW, start);
+  assert(result == 0);
+  UNUSED(result);
 }
 
 struct timespec
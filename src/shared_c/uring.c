@@ -0,0 +1,394 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "timer.h"
+#include "uring.h"
+
+#ifdef PLAYER_HAVE_URING
+
+#include <liburing.h>
+
+struct io_rf_uring_read {
+  off_t file_offset;
+  size_t size;
+  struct timespec submitted;
+  bool is_completed;
+  int result;
+};
+
+struct io_rf_uring {
+  struct io_uring ring;
+  int fd;
+  int event_fd;
+  unsigned int queue_depth;
+
+  // reads in flight, in the order of submission
+  struct io_rf_uring_read *reads;
+  unsigned int head;
+  unsigned int in_flight;
+  size_t pending_size;
+
+  off_t file_offset;
+  bool is_discarding;
+  bool is_eof;
+};
+
+error_t
+io_rf_uring_open(
+  int fd,
+  unsigned int queue_depth,
+  struct io_rf_uring **result) {
+    assert(fd != -1);
+    assert(queue_depth > 0);
+    assert(result != NULL);
+
+    off_t file_offset = lseek(fd, 0, SEEK_CUR);
+    if (file_offset == -1) {
+      return errno;
+    }
+
+    struct io_rf_uring *reader = calloc(1, sizeof(struct io_rf_uring));
+    if (reader == NULL) {
+      log_error("URING: Insufficient memory for 'io_rf_uring'");
+      return ENOMEM;
+    }
+    reader->reads = calloc(queue_depth, sizeof(struct io_rf_uring_read));
+    if (reader->reads == NULL) {
+      log_error("URING: Insufficient memory for reads queue");
+      free(reader);
+      return ENOMEM;
+    }
+
+    int init_r = io_uring_queue_init(queue_depth, &reader->ring, 0);
+    if (init_r < 0) {
+      log_verbose("URING: cannot set up io_uring: %s", strerror(-init_r));
+      free(reader->reads);
+      free(reader);
+      switch (-init_r) {
+        case ENOSYS:
+        // disabled by sysctl or seccomp, or RLIMIT_MEMLOCK is too low
+        case EPERM:
+        case EACCES:
+        case ENOMEM:
+          return ENOTSUP;
+        default:
+          return -init_r;
+      }
+    }
+
+    // completions are signalled via eventfd, so they can be polled
+    reader->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reader->event_fd == -1) {
+      error_t error_r = errno;
+      log_error("URING: cannot create eventfd: %s", strerror(error_r));
+      io_uring_queue_exit(&reader->ring);
+      free(reader->reads);
+      free(reader);
+      return error_r;
+    }
+    int register_r = io_uring_register_eventfd(&reader->ring, reader->event_fd);
+    if (register_r < 0) {
+      log_error("URING: cannot register eventfd: %s", strerror(-register_r));
+      close(reader->event_fd);
+      io_uring_queue_exit(&reader->ring);
+      free(reader->reads);
+      free(reader);
+      return -register_r;
+    }
+
+    reader->fd = fd;
+    reader->queue_depth = queue_depth;
+    reader->file_offset = file_offset;
+    *result = reader;
+    return 0;
+  }
+
+static error_t
+io_rf_uring_submit(
+  struct io_rf_uring *src,
+  struct io_buffer *dest,
+  size_t max_read_size) {
+    unsigned int submitted = 0;
+    while (!src->is_eof
+      && !src->is_discarding
+      && src->in_flight < src->queue_depth) {
+        // linear buffer can be compacted only if nothing is in flight
+        void *free_start;
+        size_t free_size = io_buffer_write_begin(
+          dest,
+          src->in_flight == 0 ? max_read_size : 0,
+          &free_start);
+        if (free_size <= src->pending_size) {
+          break;
+        }
+
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&src->ring);
+        if (sqe == NULL) {
+          break;
+        }
+
+        unsigned int slot = (src->head + src->in_flight) % src->queue_depth;
+        struct io_rf_uring_read *read = &src->reads[slot];
+        read->file_offset = src->file_offset;
+        read->size = min_size_t(max_read_size, free_size - src->pending_size);
+        read->is_completed = false;
+        timer_start(&read->submitted);
+
+        io_uring_prep_read(
+          sqe,
+          src->fd,
+          (char*)free_start + src->pending_size, // NOLINT
+          read->size,
+          read->file_offset);
+        io_uring_sqe_set_data(sqe, read);
+
+        src->file_offset += read->size;
+        src->pending_size += read->size;
+        src->in_flight++;
+        submitted++;
+      }
+
+    if (submitted > 0) {
+      int submit_r = io_uring_submit(&src->ring);
+      if (submit_r < 0) {
+        log_error("URING: submit failed: %s", strerror(-submit_r));
+        return -submit_r;
+      }
+    }
+    return 0;
+  }
+
+/**
+ * Move completed reads from the head of the queue into the buffer.
+ * Reads after short one are discarded and repeated from its end.
+ */
+static error_t
+io_rf_uring_commit(
+  struct io_rf_uring *src,
+  struct io_buffer *dest,
+  bool *has_progress) {
+    error_t error_r = 0;
+    while (src->in_flight > 0 && src->reads[src->head].is_completed) {
+      struct io_rf_uring_read *read = &src->reads[src->head];
+      src->head = (src->head + 1) % src->queue_depth;
+      src->in_flight--;
+      src->pending_size -= read->size;
+
+      if (src->is_discarding) {
+        // memory after short read is not part of the buffer
+      } else if (read->result < 0) {
+        // reads after the failed one are not contiguous, retry from it
+        src->file_offset = read->file_offset;
+        src->is_discarding = true;
+        if (read->result != -EINTR && read->result != -EAGAIN) {
+          log_error("URING: read failed: %s", strerror(-read->result));
+          error_r = -read->result;
+        }
+      } else {
+        io_buffer_write_commit(dest, read->result);
+        *has_progress = true;
+        if (read->result == 0) {
+          src->is_eof = true;
+          src->is_discarding = true;
+        } else if ((size_t)read->result < read->size) {
+          src->file_offset = read->file_offset + read->result;
+          src->is_discarding = true;
+        }
+      }
+    }
+
+    if (src->in_flight == 0) {
+      src->is_discarding = false;
+    }
+    return error_r;
+  }
+
+static void
+io_rf_uring_complete(
+  struct io_rf_uring *src,
+  struct io_uring_cqe *cqe,
+  struct io_stream_statistics *stats) {
+    struct io_rf_uring_read *read = io_uring_cqe_get_data(cqe);
+    assert(read != NULL);
+    read->result = cqe->res;
+    read->is_completed = true;
+    io_uring_cqe_seen(&src->ring, cqe);
+
+    if (stats != NULL) {
+      io_stream_statistics_add_read(stats, timer_elapsed(read->submitted));
+    }
+  }
+
+static error_t
+io_rf_uring_reap(
+  struct io_rf_uring *src,
+  struct io_buffer *dest,
+  bool *has_progress,
+  struct io_stream_statistics *stats) {
+    // rearm eventfd before looking at completion queue, nothing gets lost
+    uint64_t events_count;
+    if (read(src->event_fd, &events_count, sizeof(events_count)) == -1
+      && errno != EAGAIN) {
+        log_error("URING: cannot read eventfd: %s", strerror(errno));
+        return errno;
+      }
+
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&src->ring, &cqe) == 0) {
+      io_rf_uring_complete(src, cqe, stats);
+    }
+    return io_rf_uring_commit(src, dest, has_progress);
+  }
+
+static error_t
+io_rf_uring_wait(
+  struct io_rf_uring *src,
+  int wait_timeout,
+  struct io_stream_statistics *stats) {
+    struct timespec wait_start;
+    if (stats != NULL) {
+      timer_start(&wait_start);
+    }
+
+    struct io_uring_cqe *cqe;
+    int wait_r;
+    if (wait_timeout < 0) {
+      wait_r = io_uring_wait_cqe(&src->ring, &cqe);
+    } else {
+      struct __kernel_timespec timeout = {
+        .tv_sec = wait_timeout / 1000,
+        .tv_nsec = (wait_timeout % 1000) * 1000000l
+      };
+      wait_r = io_uring_wait_cqe_timeout(&src->ring, &cqe, &timeout);
+    }
+
+    if (stats != NULL) {
+      timer_add_elapsed(&stats->waiting_time, wait_start);
+    }
+
+    if (wait_r == 0) {
+      io_rf_uring_complete(src, cqe, stats);
+      return 0;
+    } else if (wait_r == -ETIME || wait_r == -EINTR) {
+      return 0;
+    } else {
+      log_error("URING: waiting for completion failed: %s", strerror(-wait_r));
+      return -wait_r;
+    }
+  }
+
+error_t
+io_rf_uring_read(
+  struct io_rf_uring *src,
+  struct io_buffer *dest,
+  size_t max_read_size,
+  int wait_timeout,
+  bool *is_eof,
+  struct io_stream_statistics *stats) {
+    assert(src != NULL);
+    assert(dest != NULL);
+    assert(max_read_size > 0);
+    assert(is_eof != NULL);
+
+    bool has_progress = false;
+    error_t error_r = io_rf_uring_reap(src, dest, &has_progress, stats);
+    if (error_r == 0) {
+      error_r = io_rf_uring_submit(src, dest, max_read_size);
+    }
+    while (error_r == 0
+      && !has_progress
+      && wait_timeout != 0
+      && src->in_flight > 0) {
+        error_r = io_rf_uring_wait(src, wait_timeout, stats);
+        if (error_r == 0) {
+          error_r = io_rf_uring_reap(src, dest, &has_progress, stats);
+        }
+        if (error_r == 0) {
+          error_r = io_rf_uring_submit(src, dest, max_read_size);
+        }
+        if (wait_timeout > 0) {
+          // timeout is not cumulative, give up after first wait
+          break;
+        }
+      }
+
+    *is_eof = src->is_eof && src->in_flight == 0;
+    return error_r;
+  }
+
+int
+io_rf_uring_get_poll_fd(const struct io_rf_uring *src) {
+  assert(src != NULL);
+  return src->event_fd;
+}
+
+void
+io_rf_uring_release(struct io_rf_uring **src) {
+  assert(src != NULL);
+  struct io_rf_uring *to_release = *src;
+  if (to_release != NULL) {
+    struct io_uring_cqe *cqe;
+    while (to_release->in_flight > 0
+      && io_uring_wait_cqe(&to_release->ring, &cqe) == 0) {
+        // buffer memory must not be released with reads in flight
+        io_uring_cqe_seen(&to_release->ring, cqe);
+        to_release->in_flight--;
+      }
+    io_uring_queue_exit(&to_release->ring);
+    close(to_release->event_fd);
+    free(to_release->reads);
+    free(to_release);
+    *src = NULL;
+  }
+}
+
+#else
+
+error_t
+io_rf_uring_open(
+  int fd,
+  unsigned int queue_depth,
+  struct io_rf_uring **result) {
+    UNUSED(fd);
+    UNUSED(queue_depth);
+    UNUSED(result);
+    return ENOTSUP;
+  }
+
+error_t
+io_rf_uring_read(
+  struct io_rf_uring *src,
+  struct io_buffer *dest,
+  size_t max_read_size,
+  int wait_timeout,
+  bool *is_eof,
+  struct io_stream_statistics *stats) {
+    UNUSED(src);
+    UNUSED(dest);
+    UNUSED(max_read_size);
+    UNUSED(wait_timeout);
+    UNUSED(is_eof);
+    UNUSED(stats);
+    assert(false);
+    return ENOTSUP;
+  }
+
+int
+io_rf_uring_get_poll_fd(const struct io_rf_uring *src) {
+  UNUSED(src);
+  assert(false);
+  return -1;
+}
+
+void
+io_rf_uring_release(struct io_rf_uring **src) {
+  assert(src != NULL);
+  assert(*src == NULL);
+  UNUSED(src);
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PLAYER_URING_H_
+#define PLAYER_URING_H_
+
+#include "io.h"
+
+/**
+ * @brief io_uring reader keeping several reads in flight
+ * into the free part of io_buffer.
+ *
+ */
+struct io_rf_uring;
+
+/**
+ * @brief Set up io_uring for reading given file from its current offset.
+ * Returns ENOTSUP when io_uring is not available or the kernel refuses
+ * to set it up, i.e. it is disabled or memlock limit is too low.
+ */
+error_t
+io_rf_uring_open(
+  int fd,
+  unsigned int queue_depth,
+  struct io_rf_uring **result);
+
+/**
+ * @brief Reap completed reads into the buffer and submit new ones.
+ * If nothing has been completed, wait up to wait_timeout ms for completion.
+ */
+error_t
+io_rf_uring_read(
+  struct io_rf_uring *src,
+  struct io_buffer *dest,
+  size_t max_read_size,
+  int wait_timeout,
+  bool *is_eof,
+  struct io_stream_statistics *stats);
+
+/**
+ * @brief Eventfd signalled when any read has been completed.
+ */
+int
+io_rf_uring_get_poll_fd(const struct io_rf_uring *src);
+
+void
+io_rf_uring_release(struct io_rf_uring **src);
+
+#endif
@@ -0,0 +1,163 @@
+#include "SharedTestFixture.h"
+#include <cstdint>
+
+extern "C" {
+  #include "corpus.h"
+  #include "flac.h"
+}
+
+static void
+decodeFirstFrames(
+  const char *filePath,
+  enum pcm_format format,
+  struct pcm_spec *spec,
+  unsigned char *pcm,
+  size_t size) {
+    EMPTY_STRUCT(io_rf_stream, stream);
+    struct pcm_decoder *decoder = NULL;
+
+    ASSERT_EQ(0, io_rf_stream_open_file(filePath, 64 * 1024, 4096, &stream));
+    if (format == pcm_format_flac) {
+      ASSERT_EQ(0, pcm_decoder_flac_open(&stream, 4096, &decoder));
+    } else {
+      ASSERT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+    }
+    *spec = decoder->spec;
+    struct io_buffer *output = pcm_decoder_get_output_buffer(decoder);
+    while (io_buffer_get_unread_size(output) < size) {
+      if (!pcm_decoder_is_source_buffer_ready_to_read(decoder)) {
+        EXPECT_EQ(0, pcm_decoder_read_source(decoder, -1));
+      } else {
+        EXPECT_EQ(0, pcm_decoder_decode_once(decoder));
+      }
+    }
+    void *decoded;
+    io_buffer_read_array(output, 1, &decoded, size);
+    memcpy(pcm, decoded, size);
+
+    decoder->release(&decoder);
+    io_rf_stream_free(&stream);
+  }
+
+TEST_F(SharedTestFixture, pcm_corpus_write_TEST_rifx) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.channels_count = 3;
+  spec.samples_per_sec = 8000;
+  spec.bits_per_sample = 24;
+  spec.samples_count = 8000;
+
+  EXPECT_EQ(0, pcm_corpus_write(
+    "pcm_corpus_write_TEST_riff.wav",
+    pcm_format_wav,
+    pcm_corpus_signal_noise,
+    1,
+    &spec));
+  spec.is_big_endian = true;
+  EXPECT_EQ(0, pcm_corpus_write(
+    "pcm_corpus_write_TEST_rifx.wav",
+    pcm_format_wav,
+    pcm_corpus_signal_noise,
+    1,
+    &spec));
+
+  EMPTY_STRUCT(pcm_spec, riff_spec);
+  EMPTY_STRUCT(pcm_spec, rifx_spec);
+  unsigned char riff[9 * 4];
+  unsigned char rifx[9 * 4];
+  decodeFirstFrames(
+    "pcm_corpus_write_TEST_riff.wav", pcm_format_wav, &riff_spec,
+    riff, sizeof(riff));
+  decodeFirstFrames(
+    "pcm_corpus_write_TEST_rifx.wav", pcm_format_wav, &rifx_spec,
+    rifx, sizeof(rifx));
+
+  EXPECT_FALSE(riff_spec.is_big_endian);
+  EXPECT_TRUE(rifx_spec.is_big_endian);
+  EXPECT_EQ(3, rifx_spec.channels_count);
+  EXPECT_EQ(8000, rifx_spec.samples_per_sec);
+  EXPECT_EQ(24, rifx_spec.bits_per_sample);
+  EXPECT_TRUE(rifx_spec.is_signed);
+  EXPECT_EQ(8000, rifx_spec.samples_count);
+
+  // the same noise, bytes of each sample in reversed order
+  for (size_t i = 0; i < sizeof(riff); i += 3) {
+    EXPECT_EQ(riff[i], rifx[i + 2]);
+    EXPECT_EQ(riff[i + 1], rifx[i + 1]);
+    EXPECT_EQ(riff[i + 2], rifx[i]);
+  }
+}
+
+TEST_F(SharedTestFixture, pcm_corpus_write_TEST_8bit) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.channels_count = 1;
+  spec.samples_per_sec = 8000;
+  spec.bits_per_sample = 8;
+  spec.samples_count = 100;
+
+  EXPECT_EQ(0, pcm_corpus_write(
+    "pcm_corpus_write_TEST_8bit.wav",
+    pcm_format_wav,
+    pcm_corpus_signal_sine,
+    1,
+    &spec));
+
+  EMPTY_STRUCT(pcm_spec, result);
+  unsigned char pcm[20];
+  decodeFirstFrames(
+    "pcm_corpus_write_TEST_8bit.wav", pcm_format_wav, &result,
+    pcm, sizeof(pcm));
+  EXPECT_FALSE(result.is_signed);
+  EXPECT_EQ(100, result.samples_count);
+  // unsigned sine starts in the middle and goes up
+  EXPECT_EQ(128, pcm[0]);
+  EXPECT_GT(pcm[1], 128);
+}
+
+TEST_F(SharedTestFixture, pcm_corpus_write_TEST_flac) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.channels_count = 2;
+  spec.samples_per_sec = 44100;
+  spec.bits_per_sample = 16;
+  spec.samples_count = 44100;
+
+  EXPECT_EQ(0, pcm_corpus_write(
+    "pcm_corpus_write_TEST_flac.wav",
+    pcm_format_wav,
+    pcm_corpus_signal_sine,
+    1,
+    &spec));
+  EXPECT_EQ(0, pcm_corpus_write(
+    "pcm_corpus_write_TEST_flac.flac",
+    pcm_format_flac,
+    pcm_corpus_signal_sine,
+    1,
+    &spec));
+
+  EMPTY_STRUCT(pcm_spec, wav_spec);
+  EMPTY_STRUCT(pcm_spec, flac_spec);
+  unsigned char wav[1024];
+  unsigned char flac[1024];
+  decodeFirstFrames(
+    "pcm_corpus_write_TEST_flac.wav", pcm_format_wav, &wav_spec,
+    wav, sizeof(wav));
+  decodeFirstFrames(
+    "pcm_corpus_write_TEST_flac.flac", pcm_format_flac, &flac_spec,
+    flac, sizeof(flac));
+  EXPECT_EQ(wav_spec.samples_count, flac_spec.samples_count);
+  EXPECT_EQ(0, memcmp(wav, flac, sizeof(wav)));
+}
+
+TEST_F(SharedTestFixture, pcm_corpus_write_TEST_wav_limit) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.channels_count = 2;
+  spec.samples_per_sec = 44100;
+  spec.bits_per_sample = 16;
+  spec.samples_count = (size_t)UINT32_MAX / 4;
+
+  EXPECT_EQ(ENOTSUP, pcm_corpus_write(
+    "pcm_corpus_write_TEST_wav_limit.wav",
+    pcm_format_wav,
+    pcm_corpus_signal_sine,
+    1,
+    &spec));
+}
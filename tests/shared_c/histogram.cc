@@ -0,0 +1,88 @@
+#include "SharedTestFixture.h"
+
+extern "C" {
+  #include "histogram.h"
+}
+
+TEST_F(SharedTestFixture, histogram_record_TEST_empty) {
+  EMPTY_STRUCT(histogram_summary, summary);
+  struct histogram *histogram = NULL;
+
+  EXPECT_EQ(0, histogram_alloc(&histogram));
+  histogram_get_summary(histogram, &summary);
+  EXPECT_EQ(0, summary.count);
+  EXPECT_EQ(0, summary.min);
+  EXPECT_EQ(0, summary.max);
+  EXPECT_EQ(0, histogram_get_percentile(histogram, 500));
+
+  histogram_free(&histogram);
+  EXPECT_EQ(NULL, histogram);
+}
+
+TEST_F(SharedTestFixture, histogram_record_TEST_exact_small_values) {
+  EMPTY_STRUCT(histogram_summary, summary);
+  struct histogram *histogram = NULL;
+
+  EXPECT_EQ(0, histogram_alloc(&histogram));
+  for (unsigned long i = 0; i < 8; ++i) {
+    histogram_record(histogram, i);
+  }
+  histogram_get_summary(histogram, &summary);
+  EXPECT_EQ(8, summary.count);
+  EXPECT_EQ(0, summary.min);
+  EXPECT_EQ(3, summary.avg);
+  EXPECT_EQ(7, summary.max);
+  EXPECT_EQ(3, summary.p50);
+  EXPECT_EQ(7, summary.p999);
+  EXPECT_EQ(0, histogram_get_percentile(histogram, 0));
+  EXPECT_EQ(7, histogram_get_percentile(histogram, 1000));
+
+  histogram_free(&histogram);
+}
+
+TEST_F(SharedTestFixture, histogram_record_TEST_relative_precision) {
+  EMPTY_STRUCT(histogram_summary, summary);
+  struct histogram *histogram = NULL;
+
+  EXPECT_EQ(0, histogram_alloc(&histogram));
+  for (unsigned long i = 1; i <= 1000; ++i) {
+    histogram_record(histogram, i * 1000);
+  }
+  histogram_get_summary(histogram, &summary);
+  EXPECT_EQ(1000, summary.count);
+  EXPECT_EQ(1000, summary.min);
+  EXPECT_EQ(500500, summary.avg);
+  EXPECT_EQ(1000000, summary.max);
+
+  // reported values are bucket lower bounds, within 1/8 below exact ones
+  EXPECT_LE(summary.p50, 500000);
+  EXPECT_GT(summary.p50, 500000 - 500000 / 8);
+  EXPECT_LE(summary.p99, 990000);
+  EXPECT_GT(summary.p99, 990000 - 990000 / 8);
+  EXPECT_LE(summary.p90, summary.p99);
+  EXPECT_LE(summary.p99, summary.p999);
+
+  histogram_record(histogram, ~0ul);
+  histogram_get_summary(histogram, &summary);
+  EXPECT_EQ(~0ul, summary.max);
+  EXPECT_EQ(0xFul << 60, histogram_get_percentile(histogram, 1000));
+
+  histogram_free(&histogram);
+}
+
+TEST_F(SharedTestFixture, histogram_get_percentile_TEST_clamped) {
+  EMPTY_STRUCT(histogram_summary, summary);
+  struct histogram *histogram = NULL;
+
+  // bucket of 1000 starts at 960
+  EXPECT_EQ(0, histogram_alloc(&histogram));
+  for (int i = 0; i < 10; ++i) {
+    histogram_record(histogram, 1000);
+  }
+  histogram_get_summary(histogram, &summary);
+  EXPECT_EQ(1000, summary.min);
+  EXPECT_EQ(1000, summary.p50);
+  EXPECT_EQ(1000, summary.p999);
+
+  histogram_free(&histogram);
+}
@@ -1,6 +1,10 @@
 #include "SharedTestFixture.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 extern "C" {
   #include "log.h"
@@ -73,6 +77,66 @@ TEST_F(SharedTestFixture, io_buffer_TEST_basic) {
   io_buffer_free(&buffer);
 }
 
+TEST_F(SharedTestFixture, io_buffer_TEST_ring) {
+  EMPTY_STRUCT(io_buffer, buffer);
+  const size_t page_size = getpagesize();
+  char *val_c;
+
+  EXPECT_EQ(0, io_buffer_alloc_ring(page_size - 1, &buffer));
+  EXPECT_TRUE(buffer.is_ring);
+  EXPECT_EQ(page_size, io_buffer_get_allocated_size(&buffer));
+
+  std::vector<char> src(2 * page_size);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = getCharacterAt(i);
+  }
+  EXPECT_TRUE(io_buffer_try_write(&buffer, page_size - 3, src.data()));
+  EXPECT_EQ(page_size - 5, io_buffer_read_array(&buffer, 1, (void**)&val_c, page_size - 5));
+  EXPECT_EQ(2, io_buffer_get_unread_size(&buffer));
+
+  // write wraps around the end of the mapping
+  EXPECT_TRUE(io_buffer_try_write(&buffer, 10, src.data() + page_size - 3));
+  EXPECT_FALSE(io_buffer_try_write(&buffer, page_size, src.data()));
+  EXPECT_EQ(12, io_buffer_get_unread_size(&buffer));
+
+  // and is read back as one contiguous block
+  size_t available_count;
+  io_buffer_array_items(&buffer, 1, (void**)&val_c, &available_count);
+  EXPECT_EQ(12, available_count);
+  for (size_t i = 0; i < available_count; ++i) {
+    EXPECT_EQ(getCharacterAt(page_size - 5 + i), val_c[i]);
+  }
+  io_buffer_array_seek(&buffer, 1, available_count);
+  EXPECT_TRUE(io_buffer_is_empty(&buffer));
+  EXPECT_LT(buffer.start_offset, page_size);
+
+  EXPECT_TRUE(io_buffer_try_write(&buffer, page_size, src.data()));
+  EXPECT_TRUE(io_buffer_is_full(&buffer));
+  EXPECT_TRUE(io_buffer_try_read(&buffer, page_size, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(0), val_c[0]);
+  EXPECT_EQ(getCharacterAt(page_size - 1), val_c[page_size - 1]);
+
+  io_buffer_free(&buffer);
+  EXPECT_EQ(NULL, buffer.data);
+}
+
+TEST_F(SharedTestFixture, io_buffer_TEST_view) {
+  char data[8];
+  void *region;
+
+  EMPTY_STRUCT(io_buffer, buffer);
+  io_buffer_init_view(data, sizeof(data), &buffer);
+  EXPECT_EQ(sizeof(data), io_buffer_get_allocated_size(&buffer));
+  EXPECT_TRUE(io_buffer_is_empty(&buffer));
+
+  EXPECT_EQ(sizeof(data), io_buffer_write_begin(&buffer, 0, &region));
+  EXPECT_EQ((void*)data, region);
+  EXPECT_TRUE(io_buffer_try_write(&buffer, 5, "abcde"));
+  EXPECT_EQ(0, memcmp(data, "abcde", 5));
+  EXPECT_FALSE(io_buffer_try_write(&buffer, 4, "fghi"));
+  EXPECT_EQ(3, io_buffer_get_available_size(&buffer));
+}
+
 TEST_F(SharedTestFixture, io_rf_stream_TEST_basic) {
   const char *filePath = "io_rf_stream_TEST_basic.txt";
   prepareTestFile(filePath, 14);
@@ -84,6 +148,7 @@ TEST_F(SharedTestFixture, io_rf_stream_TEST_basic) {
   EXPECT_FALSE(io_rf_stream_is_empty(&buffer));
   EXPECT_EQ(11, io_rf_stream_get_allocated_buffer_size(&buffer));
   EXPECT_EQ(0, io_rf_stream_get_unread_buffer_size(&buffer));
+  EXPECT_EQ(buffer.fd, io_rf_stream_get_poll_fd(&buffer));
 
   EXPECT_EQ(0, io_rf_stream_read_with_poll(&buffer, 0));
   EXPECT_FALSE(io_rf_stream_is_eof(&buffer));
@@ -107,6 +172,169 @@ TEST_F(SharedTestFixture, io_rf_stream_TEST_basic) {
   EXPECT_EQ(0, io_rf_stream_read_with_poll(&buffer, 0));
   EXPECT_TRUE(io_rf_stream_is_eof(&buffer));
   EXPECT_TRUE(io_rf_stream_is_empty(&buffer));
+  EXPECT_EQ(-1, io_rf_stream_get_poll_fd(&buffer));
+
+  io_rf_stream_free(&buffer);
+}
+
+TEST_F(SharedTestFixture, io_rf_stream_TEST_mapped) {
+  const char *filePath = "io_rf_stream_TEST_mapped.txt";
+  prepareTestFile(filePath, 14);
+  char *val_c;
+
+  EMPTY_STRUCT(io_rf_stream, buffer);
+  EXPECT_EQ(0, io_rf_stream_open_file_mapped(filePath, 11, 5, &buffer));
+  EXPECT_TRUE(buffer.is_mapped);
+  EXPECT_TRUE(io_rf_stream_is_eof(&buffer));
+  EXPECT_EQ(-1, io_rf_stream_get_poll_fd(&buffer));
+  EXPECT_FALSE(io_rf_stream_is_empty(&buffer));
+  EXPECT_EQ(14, io_rf_stream_get_unread_buffer_size(&buffer));
+
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 9, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(0), *val_c);
+  EXPECT_EQ(getCharacterAt(8), *(val_c + 8));
+  EXPECT_EQ(5, io_rf_stream_read_array(&buffer, 1, (void**)&val_c, 10));
+  EXPECT_EQ(getCharacterAt(9), *val_c);
+  EXPECT_EQ(getCharacterAt(13), *(val_c + 4));
+  EXPECT_TRUE(io_rf_stream_is_empty(&buffer));
 
   io_rf_stream_free(&buffer);
+  EXPECT_FALSE(buffer.is_mapped);
+}
+
+TEST_F(SharedTestFixture, io_rf_stream_TEST_seek) {
+  const char *filePath = "io_rf_stream_TEST_seek.txt";
+  prepareTestFile(filePath, 14);
+  char *val_c;
+  off_t size;
+
+  EMPTY_STRUCT(io_rf_stream, buffer);
+  EXPECT_EQ(0, io_rf_stream_open_file(filePath, 11, 5, &buffer));
+  EXPECT_EQ(0, io_rf_stream_get_size(&buffer, &size));
+  EXPECT_EQ(14, size);
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 4, (void**)&val_c));
+  EXPECT_EQ(4, io_rf_stream_get_position(&buffer));
+
+  // within the buffer
+  EXPECT_EQ(0, io_rf_stream_seek(&buffer, 2));
+  EXPECT_EQ(2, io_rf_stream_get_position(&buffer));
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 1, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(2), *val_c);
+
+  // beyond the buffer
+  EXPECT_EQ(0, io_rf_stream_seek(&buffer, 12));
+  EXPECT_EQ(12, io_rf_stream_get_position(&buffer));
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 2, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(12), *val_c);
+  EXPECT_EQ(0, io_rf_stream_read_with_poll(&buffer, 0));
+  EXPECT_TRUE(io_rf_stream_is_empty(&buffer));
+
+  // file is reopened after EOF
+  EXPECT_EQ(0, io_rf_stream_seek(&buffer, 7));
+  EXPECT_FALSE(io_rf_stream_is_eof(&buffer));
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 3, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(7), *val_c);
+  EXPECT_EQ(getCharacterAt(9), *(val_c + 2));
+  EXPECT_EQ(10, io_rf_stream_get_position(&buffer));
+  io_rf_stream_free(&buffer);
+
+  EXPECT_EQ(0, io_rf_stream_open_file_mapped(filePath, 11, 5, &buffer));
+  EXPECT_EQ(0, io_rf_stream_get_size(&buffer, &size));
+  EXPECT_EQ(14, size);
+  EXPECT_EQ(0, io_rf_stream_seek(&buffer, 10));
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 4, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(10), *val_c);
+  EXPECT_TRUE(io_rf_stream_is_empty(&buffer));
+  EXPECT_EQ(0, io_rf_stream_seek(&buffer, 1));
+  EXPECT_EQ(0, io_rf_stream_read(&buffer, 1, (void**)&val_c));
+  EXPECT_EQ(getCharacterAt(1), *val_c);
+  EXPECT_EQ(EINVAL, io_rf_stream_seek(&buffer, 15));
+  io_rf_stream_free(&buffer);
+}
+
+TEST_F(SharedTestFixture, io_rf_stream_TEST_uring) {
+  const char *filePath = "io_rf_stream_TEST_uring.txt";
+  const size_t fileSize = 10000;
+  prepareTestFile(filePath, fileSize);
+  char *val_c;
+
+  EMPTY_STRUCT(io_rf_stream, buffer);
+  EXPECT_EQ(0, io_rf_stream_open_file(filePath, getpagesize(), 1000, &buffer));
+  error_t error_r = io_rf_stream_enable_uring(&buffer, 4);
+  // also when io_uring is disabled or memlock limit is too low
+  if (error_r == ENOTSUP) {
+    io_rf_stream_free(&buffer);
+    GTEST_SKIP();
+  }
+  EXPECT_EQ(0, error_r);
+  EXPECT_NE(-1, io_rf_stream_get_poll_fd(&buffer));
+  EXPECT_NE(buffer.fd, io_rf_stream_get_poll_fd(&buffer));
+
+  size_t position = 0;
+  while (position < fileSize) {
+    size_t item_size = std::min((size_t)300, fileSize - position);
+    EXPECT_EQ(0, io_rf_stream_read(&buffer, item_size, (void**)&val_c));
+    for (size_t i = 0; i < item_size; ++i) {
+      EXPECT_EQ(getCharacterAt(position + i), val_c[i]);
+    }
+    position += item_size;
+  }
+
+  while (!io_rf_stream_is_eof(&buffer)) {
+    EXPECT_EQ(0, io_rf_stream_read_with_poll(&buffer, -1));
+  }
+  EXPECT_TRUE(io_rf_stream_is_empty(&buffer));
+  EXPECT_EQ(NULL, buffer.uring);
+  io_rf_stream_free(&buffer);
+}
+
+TEST_F(SharedTestFixture, io_spsc_buffer_TEST_threads) {
+  struct io_spsc_buffer *buffer = NULL;
+  const size_t totalSize = 1024 * 1024;
+  EXPECT_EQ(0, io_spsc_buffer_alloc(getpagesize(), 1, &buffer));
+  EXPECT_EQ((size_t)getpagesize(), io_spsc_buffer_get_allocated_size(buffer));
+
+  std::thread producer([buffer, totalSize]() {
+    size_t position = 0;
+    while (position < totalSize) {
+      char *dest;
+      size_t size = io_spsc_buffer_write_begin(buffer, (void**)&dest);
+      size = std::min(std::min(size, (size_t)1000), totalSize - position);
+      for (size_t i = 0; i < size; ++i) {
+        dest[i] = getCharacterAt(position + i);
+      }
+      io_spsc_buffer_write_commit(buffer, size);
+      position += size;
+    }
+  });
+
+  size_t position = 0;
+  size_t mismatches = 0;
+  while (position < totalSize) {
+    char *src;
+    size_t size = io_spsc_buffer_read_begin(buffer, (void**)&src);
+    size = std::min(size, (size_t)777);
+    for (size_t i = 0; i < size; ++i) {
+      mismatches += src[i] != getCharacterAt(position + i);
+    }
+    io_spsc_buffer_read_commit(buffer, size);
+    position += size;
+  }
+  producer.join();
+
+  EXPECT_EQ(0, mismatches);
+  EXPECT_EQ(0, io_spsc_buffer_get_unread_size(buffer));
+  io_spsc_buffer_free(&buffer);
+  EXPECT_EQ(NULL, buffer);
+}
+
+TEST_F(SharedTestFixture, io_spsc_buffer_alloc_TEST_item_size) {
+  // 24-bit stereo frames do not fit a page evenly
+  struct io_spsc_buffer *buffer = NULL;
+  EXPECT_EQ(0, io_spsc_buffer_alloc(getpagesize(), 6, &buffer));
+  size_t size = io_spsc_buffer_get_allocated_size(buffer);
+  EXPECT_EQ(0, size % 6);
+  EXPECT_EQ(0, size % getpagesize());
+  EXPECT_LE((size_t)getpagesize(), size);
+  io_spsc_buffer_free(&buffer);
 }
@@ -0,0 +1,117 @@
+#include "SharedTestFixture.h"
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+  #include "corpus.h"
+  #include "library.h"
+}
+
+static void
+writeTrack(
+  const std::string &filePath,
+  enum pcm_format format,
+  size_t samplesCount) {
+    EMPTY_STRUCT(pcm_spec, spec);
+    spec.channels_count = 2;
+    spec.samples_per_sec = 8000;
+    spec.bits_per_sample = 16;
+    spec.samples_count = samplesCount;
+    ASSERT_EQ(0, pcm_corpus_write(
+      filePath.c_str(), format, pcm_corpus_signal_sine, 1, &spec));
+  }
+
+static void
+scan(
+  const char *dirPath,
+  const char *indexPath,
+  struct library_scan_statistics *stats) {
+    EMPTY_STRUCT(library_scan_parameters, params);
+    params.dir_path = dirPath;
+    params.index_path = indexPath;
+    params.threads_count = 3;
+    ASSERT_EQ(0, library_scan(&params, stats));
+  }
+
+TEST_F(SharedTestFixture, library_scan_TEST_incremental) {
+  const char *dirPath = "library_scan_TEST";
+  const char *indexPath = "library_scan_TEST.index";
+  mkdir(dirPath, 0755);
+  mkdir("library_scan_TEST/album", 0755);
+  unlink(indexPath);
+
+  char *rootPath = realpath(dirPath, NULL);
+  ASSERT_TRUE(rootPath != NULL);
+  const std::string root(rootPath);
+  free(rootPath);
+  writeTrack(root + "/first.wav", pcm_format_wav, 8000);
+  writeTrack(root + "/album/second.flac", pcm_format_flac, 4000);
+  FILE *invalid = fopen((root + "/album/invalid.wav").c_str(), "w");
+  ASSERT_TRUE(invalid != NULL);
+  fputs("not a wav file", invalid);
+  fclose(invalid);
+  FILE *other = fopen((root + "/album/cover.txt").c_str(), "w");
+  ASSERT_TRUE(other != NULL);
+  fclose(other);
+
+  EMPTY_STRUCT(library_scan_statistics, stats);
+  scan(dirPath, indexPath, &stats);
+  EXPECT_EQ(2, stats.dirs_count);
+  EXPECT_EQ(3, stats.files_count);
+  EXPECT_EQ(3, stats.probed_count);
+  EXPECT_EQ(0, stats.unchanged_count);
+  EXPECT_EQ(1, stats.invalid_count);
+
+  EMPTY_STRUCT(library_index, index);
+  EMPTY_STRUCT(pcm_spec, spec);
+  ASSERT_EQ(0, library_index_open(indexPath, &index));
+  EXPECT_EQ(3, library_index_get_count(&index));
+  const struct library_record *record = library_index_find(
+    &index, (root + "/album/second.flac").c_str());
+  ASSERT_TRUE(record != NULL);
+  EXPECT_TRUE(library_record_is_valid(record));
+  EXPECT_EQ(pcm_format_flac, record->format);
+  library_record_get_spec(record, &spec);
+  EXPECT_EQ(2, spec.channels_count);
+  EXPECT_EQ(8000, spec.samples_per_sec);
+  EXPECT_EQ(16, spec.bits_per_sample);
+  EXPECT_TRUE(spec.is_signed);
+  EXPECT_EQ(4000, spec.samples_count);
+  record = library_index_find(&index, (root + "/album/invalid.wav").c_str());
+  ASSERT_TRUE(record != NULL);
+  EXPECT_FALSE(library_record_is_valid(record));
+  EXPECT_EQ(NULL, library_index_find(&index, "first.wav"));
+  library_index_free(&index);
+
+  // only the changed file is read again
+  writeTrack(root + "/first.wav", pcm_format_wav, 16000);
+  scan(dirPath, indexPath, &stats);
+  EXPECT_EQ(3, stats.files_count);
+  EXPECT_EQ(1, stats.probed_count);
+  EXPECT_EQ(2, stats.unchanged_count);
+  EXPECT_EQ(1, stats.invalid_count);
+
+  ASSERT_EQ(0, library_index_open(indexPath, &index));
+  record = library_index_find(&index, (root + "/first.wav").c_str());
+  ASSERT_TRUE(record != NULL);
+  EXPECT_EQ(pcm_format_wav, record->format);
+  EXPECT_EQ(16000, record->samples_count);
+  library_index_free(&index);
+}
+
+TEST_F(SharedTestFixture, library_index_open_TEST_invalid) {
+  const char *indexPath = "library_index_open_TEST_invalid.index";
+  FILE *file = fopen(indexPath, "w");
+  ASSERT_TRUE(file != NULL);
+  fputs("ALTL but not an index of any version", file);
+  fclose(file);
+
+  EMPTY_STRUCT(library_index, index);
+  EXPECT_EQ(EINVAL, library_index_open(indexPath, &index));
+  EXPECT_EQ(NULL, index.data);
+  EXPECT_EQ(ENOENT, library_index_open("library_missing.index", &index));
+}
@@ -0,0 +1,41 @@
+#include "SharedTestFixture.h"
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+  #include "log.h"
+}
+
+TEST_F(SharedTestFixture, log_start_async_TEST_output) {
+  const char *path = "log_start_async_TEST_output.txt";
+  remove(path);
+
+  EXPECT_EQ(0, log_open_output_st(path));
+  EXPECT_EQ(0, log_start_async());
+  for (int i = 0; i < 100; i++) {
+    log_verbose("line %d", i);
+  }
+  EXPECT_EQ(0, log_get_dropped_count());
+  log_free();
+
+  FILE *st = fopen(path, "r");
+  ASSERT_TRUE(st != NULL);
+  char line[LOG_ASYNC_LINE_SIZE + 64];
+  char expected[32];
+  int count = 0;
+  while (fgets(line, sizeof(line), st) != NULL) {
+    snprintf(expected, sizeof(expected), "] line %d\n", count);
+    EXPECT_TRUE(strstr(line, expected) != NULL) << line;
+    count++;
+  }
+  fclose(st);
+  EXPECT_EQ(100, count);
+}
+
+TEST_F(SharedTestFixture, log_start_async_TEST_not_verbose) {
+  EXPECT_EQ(0, log_start_async());
+  log_set_verbose(false);
+  log_verbose("not logged");
+  EXPECT_EQ(0, log_get_dropped_count());
+  log_set_verbose(true);
+}
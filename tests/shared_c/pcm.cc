@@ -1,4 +1,7 @@
 #include "SharedTestFixture.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 extern "C" {
   #include "pcm.h"
@@ -21,13 +24,15 @@ TEST_F(SharedTestFixture, pcm_decoder_wav_open_TEST_basic) {
   struct pcm_decoder *decoder = NULL;
 
   EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
-  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, 1, &decoder));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
   EXPECT_EQ(1, decoder->spec.channels_count);
   EXPECT_EQ(false, decoder->spec.is_big_endian);
   EXPECT_EQ(true, decoder->spec.is_signed);
   EXPECT_EQ(22050, decoder->spec.samples_per_sec);
   EXPECT_EQ(16, decoder->spec.bits_per_sample);
   EXPECT_EQ(2, decoder->block_size);
+  EXPECT_TRUE(decoder->is_passthrough);
+  EXPECT_EQ(0, io_buffer_get_allocated_size(&decoder->dest));
   EXPECT_EQ(3000000, pcm_buffer_time_us(
     &decoder->spec,
     decoder->spec.samples_count * pcm_frame_size(&decoder->spec)));
@@ -54,6 +59,8 @@ TEST_F(SharedTestFixture, pcm_decoder_flac_open_TEST_basic) {
   EXPECT_EQ(16, decoder->spec.bits_per_sample);
   EXPECT_GT(decoder->block_size, 2);
   EXPECT_EQ(0, decoder->block_size % 2);
+  EXPECT_FALSE(decoder->is_passthrough);
+  EXPECT_LT(0, decoder->min_decode_size);
   EXPECT_EQ(3000000, pcm_buffer_time_us(
     &decoder->spec,
     decoder->spec.samples_count * pcm_frame_size(&decoder->spec)));
@@ -62,3 +69,107 @@ TEST_F(SharedTestFixture, pcm_decoder_flac_open_TEST_basic) {
   EXPECT_EQ(NULL, decoder);
   io_rf_stream_free(&stream);
 }
+
+static void
+decodeFrames(struct pcm_decoder *decoder, size_t count, int16_t *result) {
+  size_t decoded = 0;
+  while (decoded < count) {
+    if (pcm_decoder_is_output_buffer_empty(decoder)) {
+      ASSERT_FALSE(pcm_decoder_is_source_empty(decoder));
+      ASSERT_EQ(0, pcm_decoder_read_source(decoder, -1));
+      if (!decoder->is_passthrough) {
+        error_t error_r = pcm_decoder_decode_once(decoder);
+        ASSERT_TRUE(error_r == 0 || error_r == EAGAIN);
+      }
+    }
+
+    void *pcm;
+    size_t available;
+    struct io_buffer *output = pcm_decoder_get_output_buffer(decoder);
+    io_buffer_array_items(output, sizeof(int16_t), &pcm, &available);
+    size_t moved = std::min(available, count - decoded);
+    memcpy(result + decoded, pcm, moved * sizeof(int16_t));
+    io_buffer_array_seek(output, sizeof(int16_t), moved);
+    decoded += moved;
+  }
+}
+
+static void
+expectSeek(
+  struct pcm_decoder *decoder,
+  size_t frame,
+  const std::vector<int16_t> &expected) {
+    int16_t samples[4];
+    EXPECT_EQ(0, pcm_decoder_seek(decoder, frame));
+    decodeFrames(decoder, 4, samples);
+    for (size_t i = 0; i < 4; ++i) {
+      EXPECT_EQ(expected[frame + i], samples[i]);
+    }
+  }
+
+TEST_F(SharedTestFixture, pcm_decoder_wav_seek_TEST_basic) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  struct pcm_decoder *decoder = NULL;
+
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  const size_t samples_count = decoder->spec.samples_count;
+  std::vector<int16_t> expected(samples_count);
+  decodeFrames(decoder, samples_count, expected.data());
+  EXPECT_EQ(0, pcm_decoder_read_source(decoder, -1));
+  EXPECT_TRUE(pcm_decoder_is_source_empty(decoder));
+
+  // file is reopened after EOF, then seek goes back and forth
+  expectSeek(decoder, 22050 + 7, expected);
+  expectSeek(decoder, 5, expected);
+  expectSeek(decoder, samples_count - 4, expected);
+  EXPECT_EQ(EINVAL, pcm_decoder_seek(decoder, samples_count));
+  EXPECT_EQ(3, stream.stats->seeks_count);
+
+  decoder->release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, pcm_decoder_flac_seek_TEST_basic) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  struct pcm_decoder *decoder = NULL;
+
+  EXPECT_EQ(0, io_rf_stream_open_file("test.flac", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_flac_open(&stream, 4096, &decoder));
+  const size_t samples_count = decoder->spec.samples_count;
+  std::vector<int16_t> expected(samples_count);
+  decodeFrames(decoder, samples_count, expected.data());
+
+  // decoder is initialized again once it has finished
+  expectSeek(decoder, 22050 + 7, expected);
+  expectSeek(decoder, 5, expected);
+  expectSeek(decoder, samples_count - 4, expected);
+  EXPECT_EQ(3, stream.stats->seeks_count);
+
+  decoder->release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, pcm_decoder_flac_decode_once_TEST_partial_frame) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  struct pcm_decoder *decoder = NULL;
+
+  // single byte reads leave only part of the first frame buffered
+  EXPECT_EQ(0, io_rf_stream_open_file("test.flac", 64 * 1024, 1, &stream));
+  EXPECT_EQ(0, pcm_decoder_flac_open(&stream, 4096, &decoder));
+  EXPECT_FALSE(pcm_decoder_is_source_buffer_ready_to_read(decoder));
+  EXPECT_EQ(EAGAIN, pcm_decoder_decode_once(decoder));
+  EXPECT_TRUE(pcm_decoder_is_output_buffer_empty(decoder));
+
+  while (!pcm_decoder_is_source_buffer_ready_to_read(decoder)) {
+    ASSERT_EQ(0, pcm_decoder_read_source(decoder, -1));
+  }
+  EXPECT_LE(
+    decoder->min_decode_size,
+    pcm_decoder_get_source_buffer_unread_size(decoder));
+  EXPECT_EQ(0, pcm_decoder_decode_once(decoder));
+  EXPECT_FALSE(pcm_decoder_is_output_buffer_empty(decoder));
+
+  decoder->release(&decoder);
+  io_rf_stream_free(&stream);
+}
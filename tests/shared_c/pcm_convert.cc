@@ -0,0 +1,105 @@
+#include "SharedTestFixture.h"
+#include <vector>
+
+extern "C" {
+  #include "pcm_convert.h"
+  #include "simd.h"
+}
+
+static std::vector<uint8_t>
+prepareSamples(size_t size) {
+  std::vector<uint8_t> result(size);
+  for (size_t i = 0; i < size; ++i) {
+    result[i] = (uint8_t)(((i + 1) * 2654435761u) >> 13);
+  }
+  return result;
+}
+
+/**
+ * Reference: sample value shifted to the top of the format.
+ */
+static int64_t
+expectedSample(
+  const struct pcm_spec *spec,
+  enum pcm_convert_format format,
+  const uint8_t *src) {
+    unsigned int bytes = spec->bits_per_sample / 8;
+    uint64_t value = 0;
+    for (unsigned int b = 0; b < bytes; ++b) {
+      unsigned int from = spec->is_big_endian ? bytes - 1 - b : b;
+      value |= (uint64_t)src[from] << (8 * b);
+    }
+    int64_t sample = spec->is_signed ?
+      (int64_t)(value << (64 - 8 * bytes)) >> (64 - 8 * bytes) :
+      (int64_t)value - ((int64_t)1 << (8 * bytes - 1));
+    unsigned int dest_bits = format == pcm_convert_format_s24_le ?
+      24 : 8 * pcm_convert_format_bytes(format);
+    return sample * ((int64_t)1 << (dest_bits - 8 * bytes));
+  }
+
+TEST_F(SharedTestFixture, pcm_convert_TEST_levels) {
+  for (unsigned int bits = 8; bits <= 32; bits += 8) {
+    for (int variant = 0; variant < 4; ++variant) {
+      EMPTY_STRUCT(pcm_spec, spec);
+      spec.bits_per_sample = bits;
+      spec.channels_count = 2;
+      spec.is_big_endian = bits > 8 && (variant & 1);
+      spec.is_signed = variant & 2;
+
+      enum pcm_convert_format formats[PCM_CONVERT_MAX_FORMATS];
+      size_t formats_count = pcm_convert_list_formats(&spec, formats);
+      EXPECT_LT(0, formats_count);
+      for (size_t f = 0; f < formats_count; ++f) {
+        struct pcm_converter converter;
+        ASSERT_EQ(0, pcm_converter_init(&spec, formats[f], &converter));
+        const size_t samples = 131;
+        unsigned int dest_bytes = pcm_convert_format_bytes(formats[f]);
+        auto src = prepareSamples(samples * bits / 8);
+
+        for (int level = simd_level_scalar; level <= simd_level_avx2; ++level) {
+          simd_set_max_level((enum simd_level)level);
+          std::vector<uint8_t> dest(samples * dest_bytes);
+          pcm_convert(&converter, src.data(), samples, dest.data());
+
+          size_t mismatches = 0;
+          for (size_t i = 0; i < samples; ++i) {
+            int64_t expected = expectedSample(
+              &spec, formats[f], src.data() + i * bits / 8);
+            for (unsigned int b = 0; b < dest_bytes; ++b) {
+              mismatches += dest[i * dest_bytes + b]
+                != (uint8_t)((uint64_t)expected >> (8 * b));
+            }
+          }
+          EXPECT_EQ(0, mismatches)
+            << bits << "bit, big endian " << spec.is_big_endian
+            << ", signed " << spec.is_signed
+            << ", format " << formats[f] << ", level " << level;
+        }
+      }
+    }
+  }
+  simd_set_max_level(simd_level_avx2);
+}
+
+TEST_F(SharedTestFixture, pcm_converter_init_TEST_narrowing) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  struct pcm_converter converter;
+  spec.bits_per_sample = 32;
+  EXPECT_EQ(EINVAL, pcm_converter_init(
+    &spec, pcm_convert_format_s24_le, &converter));
+  spec.bits_per_sample = 24;
+  EXPECT_EQ(0, pcm_converter_init(
+    &spec, pcm_convert_format_s24_le, &converter));
+  EXPECT_EQ(4, converter.dest_bytes);
+}
+
+TEST_F(SharedTestFixture, pcm_convert_list_formats_TEST_8bit) {
+  // plenty of devices take no 8 bit format at all
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 8;
+  enum pcm_convert_format formats[PCM_CONVERT_MAX_FORMATS];
+  ASSERT_EQ(3, pcm_convert_list_formats(&spec, formats));
+  EXPECT_EQ(pcm_convert_format_s8, formats[0]);
+  EXPECT_EQ(pcm_convert_format_s16_le, formats[1]);
+  EXPECT_EQ(pcm_convert_format_s32_le, formats[2]);
+}
@@ -0,0 +1,192 @@
+#include "SharedTestFixture.h"
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+extern "C" {
+  #include "pcm_convolve.h"
+  #include "simd.h"
+}
+
+static std::vector<float>
+randomSignal(size_t count, uint32_t seed) {
+  std::vector<float> result(count);
+  for (float &sample : result) {
+    seed = seed * 1664525 + 1013904223;
+    sample = (float)(int32_t)seed / 2147483648.0f;
+  }
+  return result;
+}
+
+static void
+prepareStage(
+  struct pcm_dsp_stage *stage,
+  unsigned int channels,
+  size_t block_frames) {
+    EMPTY_STRUCT(pcm_spec, spec);
+    spec.bits_per_sample = 32;
+    spec.channels_count = channels;
+    spec.samples_per_sec = 48000;
+    EXPECT_EQ(0, stage->prepare(stage, &spec, block_frames));
+  }
+
+/**
+ * Stage run on float planes in blocks of given size.
+ */
+static std::vector<std::vector<float>>
+convolve(
+  struct pcm_dsp_stage *stage,
+  const std::vector<std::vector<float>> &in,
+  size_t block_frames) {
+    std::vector<std::vector<float>> out = in;
+    size_t frames = in[0].size();
+    for (size_t done = 0; done < frames; done += block_frames) {
+      void *planes[PCM_DSP_MAX_CHANNELS];
+      for (size_t c = 0; c < out.size(); ++c) {
+        planes[c] = out[c].data() + done;
+      }
+      stage->process(
+        stage,
+        (const void *const *)planes,
+        planes,
+        std::min(block_frames, frames - done));
+    }
+    return out;
+  }
+
+static void
+writeWav(
+  const char *path,
+  unsigned int channels,
+  unsigned int rate,
+  const std::vector<int16_t> &samples) {
+    uint32_t data_size = samples.size() * 2;
+    uint32_t riff_size = 36 + data_size;
+    uint16_t format = 1, bits = 16, block = channels * 2;
+    uint16_t channels_count = channels;
+    uint32_t fmt_size = 16, byte_rate = rate * block;
+    std::ofstream file(path, std::ios::binary);
+    file.write("RIFF", 4);
+    file.write((const char*)&riff_size, 4);
+    file.write("WAVEfmt ", 8);
+    file.write((const char*)&fmt_size, 4);
+    file.write((const char*)&format, 2);
+    file.write((const char*)&channels_count, 2);
+    file.write((const char*)&rate, 4);
+    file.write((const char*)&byte_rate, 4);
+    file.write((const char*)&block, 2);
+    file.write((const char*)&bits, 2);
+    file.write("data", 4);
+    file.write((const char*)&data_size, 4);
+    file.write((const char*)samples.data(), data_size);
+  }
+
+TEST_F(SharedTestFixture, pcm_convolve_TEST_direct) {
+  const size_t taps = 1000, frames = 3000, partition = 64;
+  std::vector<std::vector<float>> ir = {
+    randomSignal(taps, 1), randomSignal(taps, 2) };
+  const float *channels[] = { ir[0].data(), ir[1].data() };
+  std::vector<std::vector<float>> in = {
+    randomSignal(frames, 3), randomSignal(frames, 4) };
+
+  // one IR per channel, or the same one for both
+  for (unsigned int ir_channels = 1; ir_channels <= 2; ++ir_channels) {
+    EMPTY_STRUCT(pcm_convolve_ir, params);
+    params.channels = channels;
+    params.channels_count = ir_channels;
+    params.taps_count = taps;
+    struct pcm_dsp_stage *stage = NULL;
+    ASSERT_EQ(0, pcm_convolve_stage_open_ir(&params, partition, &stage));
+    EXPECT_EQ(partition, pcm_convolve_stage_get_latency(stage));
+    EXPECT_EQ(partition + taps - 1, stage->get_tail(stage));
+    prepareStage(stage, 2, 1000);
+    auto out = convolve(stage, in, 100);
+
+    for (size_t c = 0; c < 2; ++c) {
+      const std::vector<float> &h = ir[ir_channels == 1 ? 0 : c];
+      double max_error = 0;
+      for (size_t n = 0; n < frames; ++n) {
+        double expected = 0;
+        for (size_t j = 0; j < taps && j + partition <= n; ++j) {
+          expected += (double)h[j] * in[c][n - partition - j];
+        }
+        max_error = std::max(max_error, std::fabs(expected - out[c][n]));
+      }
+      EXPECT_GT(1e-3, max_error) << ir_channels << " IR channels";
+    }
+
+    // history is forgotten
+    stage->reset(stage);
+    auto again = convolve(stage, in, 1000);
+    EXPECT_EQ(out, again);
+    pcm_dsp_stage_release(&stage);
+  }
+}
+
+TEST_F(SharedTestFixture, pcm_convolve_TEST_levels) {
+  const size_t taps = 5000, frames = 4096;
+  std::vector<float> ir = randomSignal(taps, 5);
+  const float *channels[] = { ir.data() };
+  EMPTY_STRUCT(pcm_convolve_ir, params);
+  params.channels = channels;
+  params.channels_count = 1;
+  params.taps_count = taps;
+  std::vector<std::vector<float>> in = { randomSignal(frames, 6) };
+
+  std::vector<std::vector<float>> expected;
+  for (int level = simd_level_scalar; level <= simd_level_avx2; ++level) {
+    simd_set_max_level((enum simd_level)level);
+    struct pcm_dsp_stage *stage = NULL;
+    ASSERT_EQ(0, pcm_convolve_stage_open_ir(&params, 256, &stage));
+    prepareStage(stage, 1, 333);
+    auto out = convolve(stage, in, 333);
+    if (level == simd_level_scalar) {
+      expected = out;
+    }
+    EXPECT_EQ(expected, out) << simd_level_name(simd_get_level());
+    pcm_dsp_stage_release(&stage);
+  }
+  simd_set_max_level(simd_level_avx2);
+}
+
+TEST_F(SharedTestFixture, pcm_convolve_stage_open_TEST_wav) {
+  // left channel is halved, right one delayed by 70 frames and inverted
+  std::vector<int16_t> ir(2 * 100);
+  ir[2 * 0] = 16384;
+  ir[2 * 70 + 1] = -32768;
+  writeWav("pcm_convolve_TEST_ir.wav", 2, 48000, ir);
+
+  EMPTY_STRUCT(pcm_convolve_parameters, params);
+  params.ir_path = "pcm_convolve_TEST_ir.wav";
+  params.partition_frames = 32;
+  struct pcm_dsp_stage *stage = NULL;
+  ASSERT_EQ(0, pcm_convolve_stage_open(&params, &stage));
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 16;
+  spec.channels_count = 2;
+  spec.samples_per_sec = 48000;
+  spec.is_signed = true;
+  struct pcm_dsp_chain *chain = NULL;
+  ASSERT_EQ(0, pcm_dsp_chain_open(&spec, 50, &stage, 1, &chain));
+
+  std::vector<int16_t> in(2 * 200);
+  in[2 * 1] = 1000;
+  in[2 * 1 + 1] = 1000;
+  std::vector<int16_t> out(in.size());
+  pcm_dsp_chain_process(chain, in.data(), in.size() / 2, out.data());
+  std::vector<int16_t> expected(in.size());
+  expected[2 * 33] = 500;
+  expected[2 * 103 + 1] = -1000;
+  EXPECT_EQ(expected, out);
+  pcm_dsp_chain_release(&chain);
+
+  // IR is for other rate
+  ASSERT_EQ(0, pcm_convolve_stage_open(&params, &stage));
+  spec.samples_per_sec = 44100;
+  EXPECT_EQ(EINVAL, pcm_dsp_chain_open(&spec, 50, &stage, 1, &chain));
+
+  params.partition_frames = 100;
+  EXPECT_EQ(EINVAL, pcm_convolve_stage_open(&params, &stage));
+  params.ir_path = "pcm_convolve_TEST_missing.wav";
+  EXPECT_NE(0, pcm_convolve_stage_open(&params, &stage));
+}
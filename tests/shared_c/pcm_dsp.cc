@@ -0,0 +1,260 @@
+#include "SharedTestFixture.h"
+#include <vector>
+
+extern "C" {
+  #include "pcm_dsp.h"
+}
+
+/**
+ * Stage copying or scaling samples, optionally delayed by one frame.
+ */
+struct TestStage {
+  struct pcm_dsp_stage base;
+  float gain;
+  bool is_delayed;
+  unsigned int channels;
+  int32_t delayed[PCM_DSP_MAX_CHANNELS];
+  float delayed_float[PCM_DSP_MAX_CHANNELS];
+  size_t max_frames;
+  bool *is_released;
+};
+
+static error_t
+test_stage_prepare(
+  struct pcm_dsp_stage *stage,
+  const struct pcm_spec *spec,
+  size_t max_frames) {
+    struct TestStage *test = (struct TestStage*)stage;
+    test->channels = spec->channels_count;
+    test->max_frames = max_frames;
+    return 0;
+  }
+
+static void
+test_stage_process(
+  struct pcm_dsp_stage *stage,
+  const void *const *in,
+  void *const *out,
+  size_t frames) {
+    struct TestStage *test = (struct TestStage*)stage;
+    EXPECT_GE(test->max_frames, frames);
+    for (unsigned int c = 0; c < test->channels; ++c) {
+      EXPECT_EQ(0, (uintptr_t)in[c] % 32);
+      EXPECT_EQ(0, (uintptr_t)out[c] % 32);
+      if (stage->format == pcm_dsp_format_int32) {
+        const int32_t *from = (const int32_t*)in[c];
+        int32_t *to = (int32_t*)out[c];
+        for (size_t i = 0; i < frames; ++i) {
+          int32_t value = from[i];
+          if (test->is_delayed) {
+            std::swap(value, test->delayed[c]);
+          }
+          to[i] = test->gain == 1 ? value : (int32_t)(value * test->gain);
+        }
+      } else {
+        const float *from = (const float*)in[c];
+        float *to = (float*)out[c];
+        for (size_t i = 0; i < frames; ++i) {
+          float value = from[i];
+          if (test->is_delayed) {
+            std::swap(value, test->delayed_float[c]);
+          }
+          to[i] = value * test->gain;
+        }
+      }
+    }
+  }
+
+static void
+test_stage_reset(struct pcm_dsp_stage *stage) {
+  struct TestStage *test = (struct TestStage*)stage;
+  memset(test->delayed, 0, sizeof(test->delayed));
+  memset(test->delayed_float, 0, sizeof(test->delayed_float));
+}
+
+static size_t
+test_stage_get_delay(const struct pcm_dsp_stage *stage) {
+  return ((const struct TestStage*)stage)->is_delayed ? 1 : 0;
+}
+
+static void
+test_stage_release(struct pcm_dsp_stage **stage) {
+  struct TestStage *test = (struct TestStage*)*stage;
+  if (test->is_released != NULL) {
+    *test->is_released = true;
+  }
+  delete test;
+  *stage = NULL;
+}
+
+static struct pcm_dsp_stage*
+testStage(
+  enum pcm_dsp_format format,
+  bool is_in_place,
+  float gain,
+  bool is_delayed = false,
+  bool *is_released = NULL) {
+    struct TestStage *test = new TestStage();
+    test->base.name = format == pcm_dsp_format_float ? "float" : "int32";
+    test->base.format = format;
+    test->base.is_in_place = is_in_place;
+    test->base.prepare = &test_stage_prepare;
+    test->base.process = &test_stage_process;
+    test->base.reset = &test_stage_reset;
+    test->base.get_latency = &test_stage_get_delay;
+    test->base.get_tail = &test_stage_get_delay;
+    test->base.release = &test_stage_release;
+    test->gain = gain;
+    test->is_delayed = is_delayed;
+    test->is_released = is_released;
+    return &test->base;
+  }
+
+static std::vector<uint8_t>
+prepareFrames(size_t size) {
+  std::vector<uint8_t> result(size);
+  for (size_t i = 0; i < size; ++i) {
+    result[i] = (uint8_t)(((i + 1) * 2654435761u) >> 13);
+  }
+  return result;
+}
+
+TEST_F(SharedTestFixture, pcm_dsp_chain_process_TEST_formats) {
+  for (unsigned int bits = 8; bits <= 32; bits += 8) {
+    for (int variant = 0; variant < 4; ++variant) {
+      EMPTY_STRUCT(pcm_spec, spec);
+      spec.bits_per_sample = bits;
+      spec.channels_count = 3;
+      spec.is_big_endian = variant & 1;
+      spec.is_signed = variant & 2;
+
+      // floats keep 24 bits exactly
+      enum pcm_dsp_format format = bits == 32 ?
+        pcm_dsp_format_int32 : pcm_dsp_format_float;
+      struct pcm_dsp_stage *stages[] = {
+        testStage(pcm_dsp_format_int32, false, 1),
+        testStage(format, true, 1),
+      };
+      struct pcm_dsp_chain *chain = NULL;
+      ASSERT_EQ(0, pcm_dsp_chain_open(&spec, 100, stages, 2, &chain));
+
+      const size_t frames = 257;
+      size_t size = frames * pcm_frame_size(&spec);
+      auto in = prepareFrames(size);
+      std::vector<uint8_t> out(size);
+      pcm_dsp_chain_process(chain, in.data(), frames, out.data());
+      EXPECT_EQ(in, out)
+        << bits << "bit, big endian " << spec.is_big_endian
+        << ", signed " << spec.is_signed;
+
+      // in place
+      pcm_dsp_chain_process(chain, out.data(), frames, out.data());
+      EXPECT_EQ(in, out);
+      pcm_dsp_chain_release(&chain);
+      EXPECT_TRUE(chain == NULL);
+    }
+  }
+}
+
+TEST_F(SharedTestFixture, pcm_dsp_chain_process_TEST_stages) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  EMPTY_STRUCT(pcm_dsp_statistics, stats);
+  spec.bits_per_sample = 16;
+  spec.channels_count = 2;
+  spec.is_signed = true;
+
+  struct pcm_dsp_stage *stages[] = {
+    testStage(pcm_dsp_format_int32, false, -1),
+    testStage(pcm_dsp_format_float, true, 0.5f),
+    testStage(pcm_dsp_format_float, false, 4.0f),
+  };
+  struct pcm_dsp_chain *chain = NULL;
+  ASSERT_EQ(0, pcm_dsp_chain_open(&spec, 64, stages, 3, &chain));
+  EXPECT_EQ(64, pcm_dsp_chain_get_max_frames(chain));
+
+  std::vector<int16_t> in = { 0, 1, -1, 1000, -1000, 16384, -16384, 32767 };
+  std::vector<int16_t> out(in.size());
+  pcm_dsp_chain_process(chain, in.data(), in.size() / 2, out.data());
+  // gain of 2 saturates
+  std::vector<int16_t> expected = {
+    0, -2, 2, -2000, 2000, -32768, 32767, -32768 };
+  EXPECT_EQ(expected, out);
+
+  pcm_dsp_chain_get_statistics(chain, &stats);
+  EXPECT_EQ(3, stats.stages_count);
+  EXPECT_STREQ("int32", stats.stages[0].name);
+  EXPECT_STREQ("float", stats.stages[1].name);
+  for (size_t i = 0; i < stats.stages_count; ++i) {
+    EXPECT_EQ(in.size() / 2, stats.stages[i].frames);
+  }
+  EXPECT_STREQ("format", stats.format.name);
+  EXPECT_EQ(in.size() / 2, stats.format.frames);
+  pcm_dsp_chain_release(&chain);
+}
+
+TEST_F(SharedTestFixture, pcm_dsp_chain_reset_TEST_delay) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 16;
+  spec.channels_count = 1;
+  spec.is_signed = true;
+
+  struct pcm_dsp_stage *stages[] = {
+    testStage(pcm_dsp_format_int32, true, 1, true),
+  };
+  struct pcm_dsp_chain *chain = NULL;
+  ASSERT_EQ(0, pcm_dsp_chain_open(&spec, 2, stages, 1, &chain));
+
+  // blocks are smaller than frames, history goes across them
+  std::vector<int16_t> in = { 1, 2, 3, 4, 5 };
+  std::vector<int16_t> out(in.size());
+  pcm_dsp_chain_process(chain, in.data(), in.size(), out.data());
+  EXPECT_EQ(std::vector<int16_t>({ 0, 1, 2, 3, 4 }), out);
+  pcm_dsp_chain_process(chain, in.data(), in.size(), out.data());
+  EXPECT_EQ(std::vector<int16_t>({ 5, 1, 2, 3, 4 }), out);
+
+  pcm_dsp_chain_reset(chain);
+  pcm_dsp_chain_process(chain, in.data(), in.size(), out.data());
+  EXPECT_EQ(std::vector<int16_t>({ 0, 1, 2, 3, 4 }), out);
+  pcm_dsp_chain_release(&chain);
+}
+
+TEST_F(SharedTestFixture, pcm_dsp_chain_process_TEST_tail) {
+  // silence of unsigned samples is not zero
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 8;
+  spec.channels_count = 1;
+
+  struct pcm_dsp_stage *stages[] = {
+    testStage(pcm_dsp_format_int32, true, 1, true),
+    testStage(pcm_dsp_format_float, false, 1, true),
+    testStage(pcm_dsp_format_int32, true, 1),
+  };
+  struct pcm_dsp_chain *chain = NULL;
+  ASSERT_EQ(0, pcm_dsp_chain_open(&spec, 2, stages, 3, &chain));
+  EXPECT_EQ(2, pcm_dsp_chain_get_latency(chain));
+  EXPECT_EQ(2, pcm_dsp_chain_get_tail(chain));
+
+  std::vector<uint8_t> in = { 0x90, 0xa0, 0xb0 };
+  std::vector<uint8_t> out(in.size());
+  pcm_dsp_chain_process(chain, in.data(), in.size(), out.data());
+  EXPECT_EQ(std::vector<uint8_t>({ 0x80, 0x80, 0x90 }), out);
+  pcm_dsp_chain_process(chain, NULL, 3, out.data());
+  EXPECT_EQ(std::vector<uint8_t>({ 0xa0, 0xb0, 0x80 }), out);
+  pcm_dsp_chain_release(&chain);
+}
+
+TEST_F(SharedTestFixture, pcm_dsp_chain_open_TEST_invalid) {
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.bits_per_sample = 16;
+  spec.channels_count = PCM_DSP_MAX_CHANNELS + 1;
+
+  bool is_released = false;
+  struct pcm_dsp_stage *stages[] = {
+    testStage(pcm_dsp_format_int32, true, 1, false, &is_released),
+  };
+  struct pcm_dsp_chain *chain = NULL;
+  EXPECT_EQ(EINVAL, pcm_dsp_chain_open(&spec, 64, stages, 1, &chain));
+  EXPECT_TRUE(chain == NULL);
+  // chain owns stages even if it fails to open
+  EXPECT_TRUE(is_released);
+}
@@ -0,0 +1,230 @@
+#include "SharedTestFixture.h"
+#include <cmath>
+#include <vector>
+
+extern "C" {
+  #include "pcm_gain.h"
+  #include "simd.h"
+}
+
+static struct pcm_dsp_chain*
+openGainChain(
+  unsigned int bits,
+  unsigned int channels,
+  double volume_db,
+  enum pcm_dither dither,
+  struct pcm_dsp_stage **stage) {
+    EMPTY_STRUCT(pcm_spec, spec);
+    EMPTY_STRUCT(pcm_gain_parameters, params);
+    spec.bits_per_sample = bits;
+    spec.channels_count = channels;
+    spec.samples_per_sec = 48000;
+    spec.is_signed = true;
+    params.volume_db = volume_db;
+    params.dither = dither;
+    struct pcm_dsp_chain *chain = NULL;
+    EXPECT_EQ(0, pcm_gain_stage_open(&params, stage));
+    EXPECT_EQ(0, pcm_dsp_chain_open(&spec, 1000, stage, 1, &chain));
+    return chain;
+  }
+
+static std::vector<int16_t>
+amplify(const std::vector<int16_t> &samples, double gain_db) {
+  std::vector<int16_t> result;
+  for (int16_t sample : samples) {
+    long value = lround(sample * pow(10, gain_db / 20));
+    result.push_back((int16_t)std::max(-32768l, std::min(32767l, value)));
+  }
+  return result;
+}
+
+TEST_F(SharedTestFixture, pcm_replay_gain_parse_comment_TEST_tags) {
+  EMPTY_STRUCT(pcm_replay_gain, tags);
+  const char *comments[] = {
+    "ARTIST=REPLAYGAIN_TRACK_GAIN=1",
+    "replaygain_track_gain=-7.25 dB",
+    "REPLAYGAIN_TRACK_PEAK=0.988",
+    "REPLAYGAIN_ALBUM_GAIN=dB",
+    "REPLAYGAIN_ALBUM_PEAK=1.2",
+  };
+  for (const char *comment : comments) {
+    pcm_replay_gain_parse_comment(&tags, comment, strlen(comment));
+  }
+  EXPECT_TRUE(tags.has_track);
+  EXPECT_FLOAT_EQ(-7.25f, tags.track_gain);
+  EXPECT_FLOAT_EQ(0.988f, tags.track_peak);
+  EXPECT_FALSE(tags.has_album);
+  EXPECT_FLOAT_EQ(1.2f, tags.album_peak);
+
+  // comment is not terminated
+  const char *album = "REPLAYGAIN_ALBUM_GAIN=3.5 dBREPLAYGAIN";
+  pcm_replay_gain_parse_comment(&tags, album, 28);
+  EXPECT_TRUE(tags.has_album);
+  EXPECT_FLOAT_EQ(3.5f, tags.album_gain);
+}
+
+TEST_F(SharedTestFixture, pcm_replay_gain_get_db_TEST_modes) {
+  EMPTY_STRUCT(pcm_replay_gain, tags);
+  EXPECT_EQ(0, pcm_replay_gain_get_db(&tags, pcm_replay_gain_album));
+
+  tags.has_track = true;
+  tags.track_gain = -3;
+  EXPECT_DOUBLE_EQ(-3, pcm_replay_gain_get_db(&tags, pcm_replay_gain_album));
+  tags.has_album = true;
+  tags.album_gain = 4;
+  EXPECT_DOUBLE_EQ(4, pcm_replay_gain_get_db(&tags, pcm_replay_gain_album));
+  EXPECT_DOUBLE_EQ(-3, pcm_replay_gain_get_db(&tags, pcm_replay_gain_track));
+
+  // peak of 0.5 allows 6dB at most
+  tags.album_peak = 0.5;
+  EXPECT_DOUBLE_EQ(4, pcm_replay_gain_get_db(&tags, pcm_replay_gain_album));
+  tags.album_gain = 7;
+  EXPECT_NEAR(6.02, pcm_replay_gain_get_db(&tags, pcm_replay_gain_album), 0.01);
+}
+
+TEST_F(SharedTestFixture, pcm_gain_TEST_volume) {
+  struct pcm_dsp_stage *stage = NULL;
+  struct pcm_dsp_chain *chain = openGainChain(
+    16, 2, 0, pcm_dither_none, &stage);
+  std::vector<int16_t> in = { 0, 1, -1, 3, -3, 1001, 32767, -32768 };
+  std::vector<int16_t> out(in.size());
+
+  // 0dB keeps samples as they are
+  pcm_dsp_chain_process(chain, in.data(), in.size() / 2, out.data());
+  EXPECT_EQ(in, out);
+
+  // ramp is over after 20ms
+  pcm_gain_stage_set_volume(stage, -6);
+  EXPECT_DOUBLE_EQ(-6, pcm_gain_stage_get_volume(stage));
+  std::vector<int16_t> silence(2 * 960);
+  pcm_dsp_chain_process(
+    chain, silence.data(), silence.size() / 2, silence.data());
+  pcm_dsp_chain_process(chain, in.data(), in.size() / 2, out.data());
+  EXPECT_EQ(amplify(in, -6), out);
+
+  // ReplayGain adds to volume, which is limited
+  pcm_gain_stage_set_replay_gain(stage, 12);
+  pcm_gain_stage_set_volume(stage, 100);
+  EXPECT_DOUBLE_EQ(PCM_GAIN_MAX_DB, pcm_gain_stage_get_volume(stage));
+  pcm_gain_stage_set_volume(stage, -6);
+  pcm_dsp_chain_process(
+    chain, silence.data(), silence.size() / 2, silence.data());
+  pcm_dsp_chain_process(chain, in.data(), in.size() / 2, out.data());
+  EXPECT_EQ(amplify(in, 6), out);
+  pcm_dsp_chain_release(&chain);
+}
+
+TEST_F(SharedTestFixture, pcm_gain_TEST_ramp) {
+  struct pcm_dsp_stage *stage = NULL;
+  struct pcm_dsp_chain *chain = openGainChain(
+    24, 1, 0, pcm_dither_tpdf, &stage);
+  const size_t ramp_frames = 48000 * PCM_GAIN_RAMP_MS / 1000;
+  const int32_t value = 0x400000;
+  std::vector<uint8_t> block(3 * 300);
+  std::vector<int32_t> out;
+
+  // volume changes between blocks, mute is ramped to
+  for (size_t frames = 0; frames < 2 * ramp_frames; frames += 300) {
+    if (frames == 300) {
+      pcm_gain_stage_set_volume(stage, -200);
+    }
+    for (size_t i = 0; i < 300; ++i) {
+      memcpy(&block[3 * i], &value, 3);
+    }
+    pcm_dsp_chain_process(chain, block.data(), 300, block.data());
+    for (size_t i = 0; i < 300; ++i) {
+      int32_t sample = 0;
+      memcpy(&sample, &block[3 * i], 3);
+      out.push_back((int32_t)((uint32_t)sample << 8) >> 8);
+    }
+  }
+
+  // no step is larger than a ramp one and dither
+  int32_t max_step = 0;
+  for (size_t i = 1; i < out.size(); ++i) {
+    max_step = std::max(max_step, std::abs(out[i] - out[i - 1]));
+  }
+  EXPECT_GE((int32_t)(value / ramp_frames + 2), max_step);
+  for (size_t i = 0; i < 300; ++i) {
+    EXPECT_EQ(value, out[i]) << i;
+  }
+  for (size_t i = 300 + ramp_frames; i < out.size(); ++i) {
+    EXPECT_GE(1, std::abs(out[i])) << i;
+  }
+  pcm_dsp_chain_release(&chain);
+}
+
+/**
+ * Constant between two 16 bit values, dithered output averages to it,
+ * shaped dither error averages to 0 even faster.
+ */
+TEST_F(SharedTestFixture, pcm_gain_TEST_dither) {
+  const size_t frames = 20000;
+  std::vector<int16_t> in(frames, 1001);
+  const enum pcm_dither dithers[] = {
+    pcm_dither_none, pcm_dither_tpdf, pcm_dither_shaped };
+  for (enum pcm_dither dither : dithers) {
+    struct pcm_dsp_stage *stage = NULL;
+    struct pcm_dsp_chain *chain = openGainChain(
+      16, 1, -6, dither, &stage);
+    std::vector<int16_t> out(frames);
+    for (size_t i = 0; i < frames; i += 1000) {
+      pcm_dsp_chain_process(chain, in.data() + i, 1000, out.data() + i);
+    }
+    double sum = 0;
+    int16_t min = out[0], max = out[0];
+    for (int16_t sample : out) {
+      sum += sample;
+      min = std::min(min, sample);
+      max = std::max(max, sample);
+    }
+    double error = sum / frames - 1001 * pow(10, -6 / 20.0);
+    switch (dither) {
+      case pcm_dither_none:
+        EXPECT_EQ(min, max);
+        EXPECT_LT(0.2, std::fabs(error));
+        break;
+      case pcm_dither_tpdf:
+        EXPECT_LE(500, min);
+        EXPECT_GE(503, max);
+        EXPECT_GT(0.03, std::fabs(error));
+        break;
+      case pcm_dither_shaped:
+        EXPECT_GT(0.002, std::fabs(error));
+        break;
+    }
+    pcm_dsp_chain_release(&chain);
+  }
+}
+
+TEST_F(SharedTestFixture, pcm_gain_TEST_levels) {
+  const size_t frames = 1003;
+  std::vector<int32_t> in(frames);
+  uint32_t random = 1;
+  for (int32_t &sample : in) {
+    random = random * 1664525 + 1013904223;
+    sample = (int32_t)random;
+  }
+  const unsigned int bits[] = { 8, 16, 24, 32 };
+  const double gains[] = { -10.5, 6 };
+  for (unsigned int depth : bits) {
+    for (double gain : gains) {
+      std::vector<int32_t> expected;
+      for (int level = simd_level_scalar; level <= simd_level_avx2; ++level) {
+        simd_set_max_level((enum simd_level)level);
+        struct pcm_dsp_stage *stage = NULL;
+        struct pcm_dsp_chain *chain = openGainChain(
+          depth, 1, gain, pcm_dither_tpdf, &stage);
+        // 32 bit samples are processed as they are, others are rounded
+        std::vector<int32_t> out(frames);
+        pcm_dsp_chain_process(chain, in.data(), frames, out.data());
+        if (level == simd_level_scalar) {
+          expected = out;
+        }
+        EXPECT_EQ(expected, out) << depth << " bits, " << gain << "dB";
+        pcm_dsp_chain_release(&chain);
+      }
+    }
+  }
+  simd_set_max_level(simd_level_avx2);
+}
@@ -0,0 +1,58 @@
+#include "SharedTestFixture.h"
+#include <vector>
+
+extern "C" {
+  #include "pcm_pack.h"
+  #include "simd.h"
+}
+
+static std::vector<std::vector<int32_t>>
+preparePlanar(unsigned int channels, size_t frames, unsigned int bytes) {
+  std::vector<std::vector<int32_t>> result(channels);
+  for (unsigned int c = 0; c < channels; ++c) {
+    result[c].resize(frames);
+    for (size_t i = 0; i < frames; ++i) {
+      uint32_t value = (uint32_t)((i + 1) * 2654435761u + c * 40503u);
+      result[c][i] = (int32_t)value >> (32 - 8 * bytes);
+    }
+  }
+  return result;
+}
+
+static std::vector<const int32_t*>
+planarPointers(const std::vector<std::vector<int32_t>> &planar) {
+  std::vector<const int32_t*> result;
+  for (const auto &channel : planar) {
+    result.push_back(channel.data());
+  }
+  return result;
+}
+
+TEST_F(SharedTestFixture, pcm_pack_interleave_TEST_levels) {
+  for (unsigned int channels = 1; channels <= 8; ++channels) {
+    for (unsigned int bytes = 1; bytes <= 4; ++bytes) {
+      const size_t frames = 67;
+      auto planar = preparePlanar(channels, frames, bytes);
+      auto pointers = planarPointers(planar);
+      for (int level = simd_level_scalar; level <= simd_level_avx2; ++level) {
+        simd_set_max_level((enum simd_level)level);
+        std::vector<uint8_t> dest(frames * channels * bytes);
+        pcm_pack_interleave(
+          pointers.data(), channels, frames, bytes, dest.data());
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < frames; ++i) {
+          for (unsigned int c = 0; c < channels; ++c) {
+            for (unsigned int b = 0; b < bytes; ++b) {
+              uint8_t expected = (uint32_t)planar[c][i] >> (8 * b);
+              mismatches += dest[(i * channels + c) * bytes + b] != expected;
+            }
+          }
+        }
+        EXPECT_EQ(0, mismatches)
+          << channels << "ch, " << bytes * 8 << "bit, level " << level;
+      }
+    }
+  }
+  simd_set_max_level(simd_level_avx2);
+}
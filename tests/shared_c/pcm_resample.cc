@@ -0,0 +1,140 @@
+#include "SharedTestFixture.h"
+#include <cmath>
+#include <vector>
+
+extern "C" {
+  #include "pcm_resample.h"
+  #include "simd.h"
+}
+
+static std::vector<int32_t>
+prepareSine(unsigned int channels, size_t frames, unsigned int rate) {
+  std::vector<int32_t> result(frames * channels);
+  for (size_t i = 0; i < frames; ++i) {
+    for (unsigned int c = 0; c < channels; ++c) {
+      double t = (double)i / rate;
+      result[i * channels + c] = (int32_t)lrint(
+        0.5 * 2147483647.0 * sin(2 * M_PI * 1000 * (c + 1) * t));
+    }
+  }
+  return result;
+}
+
+/**
+ * Resample whole input, output buffer is smaller than needed,
+ * so that resampling continues where it has stopped.
+ */
+static std::vector<int32_t>
+resampleAll(
+  struct pcm_resampler *resampler,
+  unsigned int channels,
+  const std::vector<int32_t> &input) {
+    std::vector<int32_t> result;
+    std::vector<int32_t> out(100 * channels);
+    size_t frames = input.size() / channels;
+    size_t consumed = 0;
+    size_t produced = 1;
+    while (consumed < frames || produced > 0) {
+      size_t used;
+      produced = pcm_resample(
+        resampler,
+        input.data() + consumed * channels,
+        frames - consumed,
+        &used,
+        out.data(),
+        100);
+      consumed += used;
+      result.insert(result.end(), out.begin(), out.begin() + produced * channels);
+    }
+    return result;
+  }
+
+TEST_F(SharedTestFixture, pcm_resample_TEST_sine) {
+  const unsigned int channels = 2;
+  const unsigned int rates[][2] = {
+    { 44100, 48000 }, { 192000, 48000 }, { 48000, 44100 }, { 48000, 48000 }
+  };
+  for (const auto &rate : rates) {
+    for (int quality = pcm_resample_quality_fast;
+      quality <= pcm_resample_quality_best;
+      ++quality) {
+        struct pcm_resampler *resampler = NULL;
+        ASSERT_EQ(0, pcm_resampler_open(
+          (enum pcm_resample_quality)quality,
+          channels, pcm_convert_format_s32_le,
+          rate[0], rate[1], &resampler));
+        size_t latency = pcm_resampler_get_latency(resampler);
+        auto input = prepareSine(channels, rate[0] / 10, rate[0]);
+        auto output = resampleAll(resampler, channels, input);
+        EXPECT_NEAR(
+          (double)rate[1] / 10, output.size() / channels, latency + 1)
+          << rate[0] << " to " << rate[1] << ", quality " << quality;
+
+        // output is delayed by latency of input frames
+        double max_error = 0;
+        size_t frames = output.size() / channels;
+        for (size_t i = 2 * latency * rate[1] / rate[0]; i < frames; ++i) {
+          double t = (double)i / rate[1] - (double)latency / rate[0];
+          if (t * rate[0] + 2 * latency >= input.size() / channels) {
+            break;
+          }
+          for (unsigned int c = 0; c < channels; ++c) {
+            double expected = 0.5 * sin(2 * M_PI * 1000 * (c + 1) * t);
+            double actual = output[i * channels + c] / 2147483648.0;
+            max_error = std::max(max_error, std::fabs(expected - actual));
+          }
+        }
+        EXPECT_GT(quality == pcm_resample_quality_fast ? 3e-3 : 1e-3, max_error)
+          << rate[0] << " to " << rate[1] << ", quality " << quality;
+        pcm_resampler_release(&resampler);
+        EXPECT_TRUE(resampler == NULL);
+      }
+  }
+}
+
+TEST_F(SharedTestFixture, pcm_resample_TEST_levels) {
+  const unsigned int channels = 3;
+  auto input = prepareSine(channels, 4410, 44100);
+  std::vector<int16_t> input16(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    input16[i] = input[i] >> 16;
+  }
+
+  std::vector<int16_t> expected;
+  for (int level = simd_level_scalar; level <= simd_level_avx2; ++level) {
+    simd_set_max_level((enum simd_level)level);
+    struct pcm_resampler *resampler = NULL;
+    ASSERT_EQ(0, pcm_resampler_open(
+      pcm_resample_quality_medium, channels, pcm_convert_format_s16_le,
+      44100, 48000, &resampler));
+    std::vector<int16_t> output(5000 * channels);
+    size_t used;
+    size_t produced = pcm_resample(
+      resampler, input16.data(), 4410, &used, output.data(), 5000);
+    EXPECT_EQ(4410, used);
+    output.resize(produced * channels);
+    if (level == simd_level_scalar) {
+      expected = output;
+    }
+    ASSERT_EQ(expected.size(), output.size());
+    size_t mismatches = 0;
+    for (size_t i = 0; i < output.size(); ++i) {
+      // sums are in different order, rounding may differ
+      mismatches += std::abs(output[i] - expected[i]) > 1;
+    }
+    EXPECT_EQ(0, mismatches) << "level " << level;
+    pcm_resampler_release(&resampler);
+  }
+  simd_set_max_level(simd_level_avx2);
+}
+
+TEST_F(SharedTestFixture, pcm_resampler_open_TEST_invalid) {
+  struct pcm_resampler *resampler = NULL;
+  EXPECT_EQ(EINVAL, pcm_resampler_open(
+    pcm_resample_quality_best, 2, pcm_convert_format_s16_le,
+    44100, 44099, &resampler));
+  EXPECT_EQ(EINVAL, pcm_resampler_open(
+    pcm_resample_quality_best, 9, pcm_convert_format_s16_le,
+    44100, 48000, &resampler));
+  EXPECT_TRUE(resampler == NULL);
+}
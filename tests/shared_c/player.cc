@@ -1,7 +1,12 @@
 #include "SharedTestFixture.h"
+#include <cmath>
+#include <fstream>
+#include <vector>
 
 extern "C" {
+  #include "corpus.h"
   #include "player.h"
+  #include "timer.h"
 }
 
 TEST_F(SharedTestFixture, player_open_TEST_open) {
@@ -11,10 +16,481 @@ TEST_F(SharedTestFixture, player_open_TEST_open) {
   struct player *player = NULL;
 
   EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
-  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, 4096, &decoder));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
   EXPECT_EQ(0, player_open(&params, decoder, &player));
 
   pcm_decoder_decode_release(&decoder);
   io_rf_stream_free(&stream);
   player_release(&player);
 }
+
+static error_t
+play_to_end(struct player *player) {
+  error_t error_r = 0;
+  while (error_r == 0 && !player_is_eof(player)) {
+    error_r = player_wait(player, 1000);
+    if (error_r == 0) {
+      error_r = player_process_once(player);
+    }
+  }
+  return error_r;
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_null_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(player_playback_status, status);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  params.sink = player_sink_null;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(&params, decoder, &player));
+  EXPECT_EQ(player_access_mmap, player_get_access(player));
+  EXPECT_EQ(ENOTSUP, player_set_volume(player, -6));
+  EXPECT_EQ(0, play_to_end(player));
+
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(3, status.actual.tv_sec);
+  EXPECT_EQ(0, status.actual.tv_nsec);
+
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, player_get_latency_statistics_TEST_null_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(player_latency_statistics, stats);
+  EMPTY_STRUCT(player_playback_status, status);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  params.sink = player_sink_null;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(&params, decoder, &player));
+  EXPECT_EQ(0, play_to_end(player));
+
+  // sink consuming everything at once never runs out while writing
+  player_get_latency_statistics(player, &stats);
+  EXPECT_EQ(0, stats.xruns_count);
+  EXPECT_EQ(0, stats.suspends_count);
+  EXPECT_EQ(0, stats.xrun_times_count);
+  EXPECT_LT(0, stats.sink_avail.count);
+  // WAV decoder is passthrough, there is nothing to decode
+  EXPECT_EQ(0, stats.decode_time.count);
+  EXPECT_LT(0, stats.write_interval.count);
+  EXPECT_LE(stats.decode_time.min, stats.decode_time.p50);
+  EXPECT_LE(stats.decode_time.p50, stats.decode_time.max);
+
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(0, status.xruns_count);
+
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, player_tune_sink_TEST_null_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(player_sink_tuning, tuning);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  params.sink = player_sink_null;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(&params, decoder, &player));
+  EXPECT_EQ(EINVAL, player_tune_sink(player, 3, &tuning));
+  EXPECT_EQ(0, play_to_end(player));
+
+  // sink consuming everything at once looks like a stall of the whole ring
+  EXPECT_EQ(0, player_tune_sink(player, 3, &tuning));
+  EXPECT_EQ(4, tuning.periods_per_buffer);
+  EXPECT_EQ(0, tuning.period_size % pcm_frame_size(&decoder->spec));
+  EXPECT_LE(5000, timespec_microseconds(tuning.stall));
+  EXPECT_TRUE(tuning.is_margin_violated);
+
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_wav_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  EMPTY_STRUCT(io_rf_stream, stream);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  params.sink = player_sink_wav;
+  params.sink_file_path = "player_open_TEST_wav_sink.wav";
+  params.disable_mmap_access = true;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(&params, decoder, &player));
+  EXPECT_EQ(player_access_rw, player_get_access(player));
+  EXPECT_EQ(0, play_to_end(player));
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+
+  EXPECT_EQ(
+    0,
+    io_rf_stream_open_file(params.sink_file_path, 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(1, decoder->spec.channels_count);
+  EXPECT_EQ(22050, decoder->spec.samples_per_sec);
+  EXPECT_EQ(16, decoder->spec.bits_per_sample);
+  EXPECT_EQ(3 * 22050, decoder->spec.samples_count);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+static void
+seek_to_end(struct player_parameters *params) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(player_playback_status, status);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(params, decoder, &player));
+  EXPECT_EQ(0, player_seek(player, 2 * 22050));
+  if (!params->is_threaded) {
+    // null sink is not synchronized with writer thread
+    EXPECT_EQ(0, player_get_playback_status(player, &status));
+    EXPECT_EQ(2, status.actual.tv_sec);
+  }
+  EXPECT_EQ(0, play_to_end(player));
+
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(3, status.actual.tv_sec);
+  EXPECT_EQ(0, status.actual.tv_nsec);
+
+  // playback is over, it can be started again
+  EXPECT_EQ(0, player_seek(player, 22050));
+  EXPECT_FALSE(player_is_eof(player));
+  EXPECT_EQ(0, play_to_end(player));
+  EXPECT_EQ(EINVAL, player_seek(player, 3 * 22050));
+
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, player_seek_TEST_null_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.sink = player_sink_null;
+  seek_to_end(&params);
+}
+
+TEST_F(SharedTestFixture, player_seek_TEST_threaded) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.sink = player_sink_null;
+  params.is_threaded = true;
+  seek_to_end(&params);
+}
+
+static void
+pause_and_seek(struct player_parameters *params) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(player_playback_status, status);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  params->sink = player_sink_null;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(params, decoder, &player));
+  EXPECT_EQ(0, player_pause(player));
+  EXPECT_TRUE(player_is_paused(player));
+  EXPECT_EQ(0, player_process_once(player));
+  EXPECT_FALSE(player_is_eof(player));
+
+  // paused player only moves the frame playback resumes from
+  EXPECT_EQ(EINVAL, player_seek(player, 3 * 22050));
+  EXPECT_EQ(0, player_seek(player, 2 * 22050));
+  EXPECT_TRUE(player_is_paused(player));
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(2, status.actual.tv_sec);
+
+  EXPECT_EQ(0, player_resume(player));
+  EXPECT_FALSE(player_is_paused(player));
+  EXPECT_EQ(0, play_to_end(player));
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(3, status.actual.tv_sec);
+  EXPECT_EQ(0, status.actual.tv_nsec);
+
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, player_pause_TEST_null_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  pause_and_seek(&params);
+}
+
+TEST_F(SharedTestFixture, player_pause_TEST_threaded) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.is_threaded = true;
+  pause_and_seek(&params);
+}
+
+static void
+enqueue_to_end(struct player_parameters *params) {
+  EMPTY_STRUCT(io_rf_stream, first_stream);
+  EMPTY_STRUCT(io_rf_stream, second_stream);
+  EMPTY_STRUCT(player_playback_status, status);
+  struct pcm_decoder *first = NULL;
+  struct pcm_decoder *second = NULL;
+  struct player *player = NULL;
+
+  params->sink = player_sink_null;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &first_stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&first_stream, &first));
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &second_stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&second_stream, &second));
+
+  EXPECT_EQ(0, player_open(params, first, &player));
+  EXPECT_EQ(0, player_enqueue(player, second));
+  EXPECT_EQ(EBUSY, player_enqueue(player, second));
+  EXPECT_EQ(0, play_to_end(player));
+  EXPECT_EQ(first, player_take_finished(player));
+  EXPECT_EQ(NULL, player_take_finished(player));
+
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(1, status.track);
+  EXPECT_EQ(3, status.total.tv_sec);
+  EXPECT_EQ(3, status.actual.tv_sec);
+  EXPECT_EQ(0, status.actual.tv_nsec);
+
+  player_release(&player);
+  pcm_decoder_decode_release(&first);
+  pcm_decoder_decode_release(&second);
+  io_rf_stream_free(&first_stream);
+  io_rf_stream_free(&second_stream);
+}
+
+TEST_F(SharedTestFixture, player_enqueue_TEST_gapless) {
+  EMPTY_STRUCT(player_parameters, params);
+  enqueue_to_end(&params);
+}
+
+TEST_F(SharedTestFixture, player_enqueue_TEST_gapless_threaded) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.is_threaded = true;
+  enqueue_to_end(&params);
+}
+
+TEST_F(SharedTestFixture, player_enqueue_TEST_format_differs) {
+  EMPTY_STRUCT(player_parameters, params);
+  EMPTY_STRUCT(io_rf_stream, first_stream);
+  EMPTY_STRUCT(io_rf_stream, second_stream);
+  struct pcm_decoder *first = NULL;
+  struct pcm_decoder *second = NULL;
+  struct player *player = NULL;
+
+  const char *file_path = "player_enqueue_TEST_format_differs.wav";
+  EMPTY_STRUCT(pcm_spec, spec);
+  spec.channels_count = 2;
+  spec.samples_per_sec = 44100;
+  spec.bits_per_sample = 16;
+  spec.samples_count = 4410;
+  EXPECT_EQ(0, pcm_corpus_write(
+    file_path, pcm_format_wav, pcm_corpus_signal_sine, 1, &spec));
+
+  params.sink = player_sink_null;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &first_stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&first_stream, &first));
+  EXPECT_EQ(0, io_rf_stream_open_file(file_path, 1024, 4096, &second_stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&second_stream, &second));
+
+  EXPECT_EQ(0, player_open(&params, first, &player));
+  EXPECT_EQ(ENOTSUP, player_enqueue(player, second));
+  EXPECT_EQ(0, play_to_end(player));
+  EXPECT_EQ(NULL, player_take_finished(player));
+
+  player_release(&player);
+  pcm_decoder_decode_release(&first);
+  pcm_decoder_decode_release(&second);
+  io_rf_stream_free(&first_stream);
+  io_rf_stream_free(&second_stream);
+}
+
+static void
+negate_stage_process(
+  struct pcm_dsp_stage *stage,
+  const void *const *in,
+  void *const *out,
+  size_t frames) {
+    UNUSED(stage);
+    const int32_t *from = (const int32_t*)in[0];
+    int32_t *to = (int32_t*)out[0];
+    for (size_t i = 0; i < frames; ++i) {
+      to[i] = from[i] == INT32_MIN ? INT32_MAX : -from[i];
+    }
+  }
+
+static void
+negate_stage_release(struct pcm_dsp_stage **stage) {
+  delete *stage;
+  *stage = NULL;
+}
+
+static std::vector<int16_t>
+read_wav_samples(const char *path) {
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> content(
+    (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  // test.wav is mono 16 bit, data chunk is last
+  const size_t samples = 3 * 22050;
+  std::vector<int16_t> result(samples);
+  if (content.size() >= samples * 2) {
+    memcpy(
+      result.data(), content.data() + content.size() - samples * 2,
+      samples * 2);
+  }
+  return result;
+}
+
+static void
+play_negated(struct player_parameters *params) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(pcm_dsp_statistics, stats);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  struct pcm_dsp_stage *stage = new pcm_dsp_stage();
+  stage->name = "negate";
+  stage->format = pcm_dsp_format_int32;
+  stage->process = &negate_stage_process;
+  stage->release = &negate_stage_release;
+  params->sink = player_sink_wav;
+  params->sink_file_path = "player_open_TEST_dsp.wav";
+  params->dsp_stages = &stage;
+  params->dsp_stages_count = 1;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(params, decoder, &player));
+  EXPECT_EQ(0, play_to_end(player));
+  player_get_dsp_statistics(player, &stats);
+  EXPECT_EQ(1, stats.stages_count);
+  EXPECT_STREQ("negate", stats.stages[0].name);
+  EXPECT_EQ(3 * 22050, stats.stages[0].frames);
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+
+  auto expected = read_wav_samples("test.wav");
+  auto actual = read_wav_samples(params->sink_file_path);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    int16_t negated = expected[i] == INT16_MIN ? INT16_MAX : -expected[i];
+    mismatches += actual[i] != negated;
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_dsp_rw) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.disable_mmap_access = true;
+  play_negated(&params);
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_dsp_mmap) {
+  EMPTY_STRUCT(player_parameters, params);
+  play_negated(&params);
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_dsp_threaded) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.is_threaded = true;
+  play_negated(&params);
+}
+
+TEST_F(SharedTestFixture, player_set_volume_TEST_wav_sink) {
+  EMPTY_STRUCT(player_parameters, params);
+  EMPTY_STRUCT(io_rf_stream, stream);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  params.sink = player_sink_wav;
+  params.sink_file_path = "player_set_volume_TEST_wav_sink.wav";
+  params.has_volume_control = true;
+  params.volume_db = -6;
+  params.dither = pcm_dither_none;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(0, player_open(&params, decoder, &player));
+  EXPECT_DOUBLE_EQ(-6, player_get_volume(player));
+  EXPECT_EQ(0, player_set_volume(player, -6));
+  EXPECT_EQ(0, play_to_end(player));
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+
+  auto original = read_wav_samples("test.wav");
+  auto actual = read_wav_samples(params.sink_file_path);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < original.size(); ++i) {
+    // gain and conversion to 16 bit are rounded separately
+    mismatches += std::abs(
+      lround(original[i] * pow(10, -6 / 20.0)) - actual[i]) > 1;
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
+static void
+play_convolved(struct player_parameters *params) {
+  EMPTY_STRUCT(io_rf_stream, stream);
+  EMPTY_STRUCT(pcm_dsp_statistics, stats);
+  EMPTY_STRUCT(player_playback_status, status);
+  struct pcm_decoder *decoder = NULL;
+  struct player *player = NULL;
+
+  // any mono file of the same rate is an impulse response
+  params->sink = player_sink_null;
+  params->convolution_path = "test.wav";
+  params->convolution_partition = 100;
+  EXPECT_EQ(0, io_rf_stream_open_file("test.wav", 1024, 4096, &stream));
+  EXPECT_EQ(0, pcm_decoder_wav_open(&stream, &decoder));
+  EXPECT_EQ(EINVAL, player_open(params, decoder, &player));
+
+  params->convolution_partition = 4096;
+  EXPECT_EQ(0, player_open(params, decoder, &player));
+  // partition delays the output
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_LE(
+    timespec_microseconds(pcm_spec_get_samples_time(&decoder->spec, 4096)),
+    timespec_microseconds(status.playback_buffer));
+  EXPECT_EQ(0, play_to_end(player));
+
+  // tail of the last frame is played out
+  player_get_dsp_statistics(player, &stats);
+  EXPECT_EQ(1, stats.stages_count);
+  EXPECT_STREQ("convolve", stats.stages[0].name);
+  EXPECT_EQ(3 * 22050 + 4096 + 3 * 22050 - 1, stats.stages[0].frames);
+  EXPECT_EQ(0, player_get_playback_status(player, &status));
+  EXPECT_EQ(3, status.actual.tv_sec);
+  EXPECT_EQ(0, status.actual.tv_nsec);
+  player_release(&player);
+  pcm_decoder_decode_release(&decoder);
+  io_rf_stream_free(&stream);
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_convolution) {
+  EMPTY_STRUCT(player_parameters, params);
+  play_convolved(&params);
+}
+
+TEST_F(SharedTestFixture, player_open_TEST_convolution_threaded) {
+  EMPTY_STRUCT(player_parameters, params);
+  params.is_threaded = true;
+  play_convolved(&params);
+}
@@ -0,0 +1,62 @@
+#include "SharedTestFixture.h"
+#include <sched.h>
+
+extern "C" {
+  #include "io.h"
+  #include "realtime.h"
+}
+
+static void*
+getCpu(void *arg) {
+  *static_cast<int*>(arg) = sched_getcpu();
+  return NULL;
+}
+
+TEST_F(SharedTestFixture, realtime_thread_attr_init_TEST_affinity) {
+  pthread_attr_t attr;
+  pthread_t thread;
+  int cpu = -1;
+
+  // the first CPU allowed, CPU 0 may be excluded by cgroup or taskset
+  cpu_set_t allowed;
+  int allowedCpu = -1;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int i = 0; i < (int)(8 * sizeof(unsigned long)); ++i) {
+      if (CPU_ISSET(i, &allowed)) {
+        allowedCpu = i;
+        break;
+      }
+    }
+  }
+  if (allowedCpu == -1) {
+    GTEST_SKIP();
+  }
+
+  ASSERT_EQ(0, realtime_thread_attr_init(&attr, 0, 1UL << allowedCpu));
+  ASSERT_EQ(0, pthread_create(&thread, &attr, getCpu, &cpu));
+  pthread_join(thread, NULL);
+  pthread_attr_destroy(&attr);
+  EXPECT_EQ(allowedCpu, cpu);
+}
+
+TEST_F(SharedTestFixture, realtime_thread_attr_init_TEST_invalid_priority) {
+  pthread_attr_t attr;
+  EXPECT_EQ(EINVAL, realtime_thread_attr_init(&attr, 1000, 0));
+  EXPECT_EQ(EINVAL, realtime_set_current_thread(1000, 0));
+}
+
+TEST_F(SharedTestFixture, io_buffer_set_memory_locked_TEST_alloc) {
+  EMPTY_STRUCT(io_buffer, linear);
+  EMPTY_STRUCT(io_buffer, ring);
+
+  // locking may fail within RLIMIT_MEMLOCK, buffers are usable anyway
+  io_buffer_set_memory_locked(true);
+  EXPECT_EQ(0, io_buffer_alloc(1000, &linear));
+  EXPECT_EQ(0, io_buffer_alloc_ring(4096, &ring));
+  io_buffer_set_memory_locked(false);
+
+  EXPECT_TRUE(io_buffer_try_write(&linear, 3, "abc"));
+  EXPECT_TRUE(io_buffer_try_write(&ring, 3, "abc"));
+  io_buffer_free(&linear);
+  io_buffer_free(&ring);
+}
@@ -0,0 +1,171 @@
+#include "SharedTestFixture.h"
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern "C" {
+  #include "server.h"
+}
+
+#define SERVER_TEST_SOCKET "server_test.sock"
+
+static void
+send_message(int fd, uint8_t type, const void *body, uint32_t size) {
+  uint8_t message[5 + 64];
+  uint32_t length = 1 + size;
+  memcpy(message, &length, 4);
+  message[4] = type;
+  if (size > 0) {
+    memcpy(message + 5, body, size);
+  }
+  ASSERT_EQ(5 + size, send(fd, message, 5 + size, 0));
+}
+
+/**
+ * Reply or push, returns errno from reply body.
+ */
+static int32_t
+receive_message(int fd, uint8_t *type, uint8_t *payload, uint32_t *size) {
+  uint32_t length = 0;
+  EXPECT_EQ(4, recv(fd, &length, 4, MSG_WAITALL));
+  EXPECT_LT(0, length);
+  EXPECT_GE(SERVER_MAX_MESSAGE_SIZE, length);
+  uint8_t body[SERVER_MAX_MESSAGE_SIZE];
+  EXPECT_EQ(length, recv(fd, body, length, MSG_WAITALL));
+  *type = body[0];
+
+  int32_t error_r = 0;
+  uint8_t *data = body + 1;
+  if (*type & server_message_reply) {
+    memcpy(&error_r, data, 4);
+    data += 4;
+  }
+  *size = length - (data - body);
+  memcpy(payload, data, *size);
+  return error_r;
+}
+
+static int32_t
+request(int fd, uint8_t type, const void *body, uint32_t size) {
+  uint8_t payload[SERVER_MAX_MESSAGE_SIZE];
+  uint8_t reply_type;
+  uint32_t payload_size;
+  send_message(fd, type, body, size);
+  int32_t error_r = receive_message(fd, &reply_type, payload, &payload_size);
+  EXPECT_EQ(type | server_message_reply, reply_type);
+  return error_r;
+}
+
+static enum server_state
+request_state(int fd) {
+  uint8_t payload[SERVER_MAX_MESSAGE_SIZE];
+  uint8_t type;
+  uint32_t size;
+  send_message(fd, server_message_status, NULL, 0);
+  EXPECT_EQ(0, receive_message(fd, &type, payload, &size));
+  EXPECT_EQ(server_message_status | server_message_reply, type);
+  EXPECT_EQ(SERVER_STATUS_PAYLOAD_SIZE, size);
+  return (enum server_state)payload[0];
+}
+
+static int
+connect_unix() {
+  struct sockaddr_un address = { 0 };
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, SERVER_TEST_SOCKET);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  EXPECT_EQ(0, connect(fd, (struct sockaddr*)&address, sizeof(address)));
+  return fd;
+}
+
+static int
+connect_tcp(unsigned short port) {
+  struct sockaddr_in address = { 0 };
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  EXPECT_EQ(0, connect(fd, (struct sockaddr*)&address, sizeof(address)));
+  return fd;
+}
+
+TEST_F(SharedTestFixture, server_open_TEST_no_listeners) {
+  EMPTY_STRUCT(server_parameters, params);
+  struct server *server = NULL;
+
+  EXPECT_EQ(0, server_open(&params, &server));
+  EXPECT_EQ(0, server_get_tcp_port(server));
+  server_release(&server);
+  EXPECT_TRUE(server == NULL);
+}
+
+TEST_F(SharedTestFixture, server_run_TEST_loopback_clients) {
+  EMPTY_STRUCT(server_parameters, params);
+  struct server *server = NULL;
+  struct stat socket_stat;
+
+  params.unix_path = SERVER_TEST_SOCKET;
+  params.tcp_host = "127.0.0.1";
+  params.status_interval_ms = 10;
+  params.io_buffer_size = 64 * 1024;
+  params.player.sink = player_sink_null_realtime;
+  ASSERT_EQ(0, server_open(&params, &server));
+  EXPECT_LT(0, server_get_tcp_port(server));
+  std::thread serving([server]() {
+    EXPECT_EQ(0, server_run(server));
+  });
+
+  int unix_fd = connect_unix();
+  int tcp_fd = connect_tcp(server_get_tcp_port(server));
+  EXPECT_EQ(server_state_stopped, request_state(unix_fd));
+  EXPECT_EQ(EINVAL, request(tcp_fd, server_message_pause, NULL, 0));
+  EXPECT_EQ(ENOTSUP, request(tcp_fd, 0x3f, NULL, 0));
+
+  const char *file_path = "test.wav";
+  EXPECT_EQ(0, request(
+    tcp_fd, server_message_play, file_path, strlen(file_path)));
+  EXPECT_EQ(0, request(
+    tcp_fd, server_message_queue, file_path, strlen(file_path)));
+  EXPECT_EQ(server_state_playing, request_state(unix_fd));
+
+  // commands of one client are answered while the other one waits
+  EXPECT_EQ(0, request(unix_fd, server_message_pause, NULL, 0));
+  EXPECT_EQ(server_state_paused, request_state(tcp_fd));
+  uint32_t ms = 1000;
+  EXPECT_EQ(0, request(tcp_fd, server_message_seek, &ms, sizeof(ms)));
+  EXPECT_EQ(server_state_paused, request_state(unix_fd));
+  EXPECT_EQ(0, request(unix_fd, server_message_resume, NULL, 0));
+  EXPECT_EQ(server_state_playing, request_state(tcp_fd));
+  EXPECT_EQ(0, request(tcp_fd, server_message_stats, NULL, 0));
+  int32_t volume = -600;
+  EXPECT_EQ(0, request(
+    unix_fd, server_message_volume, &volume, sizeof(volume)));
+  EXPECT_EQ(EINVAL, request(unix_fd, server_message_volume, &volume, 2));
+
+  uint8_t is_subscribed = 1;
+  EXPECT_EQ(0, request(
+    unix_fd, server_message_subscribe, &is_subscribed, 1));
+  uint8_t payload[SERVER_MAX_MESSAGE_SIZE];
+  uint8_t type;
+  uint32_t size;
+  EXPECT_EQ(0, receive_message(unix_fd, &type, payload, &size));
+  EXPECT_EQ(server_message_status_push, type);
+  EXPECT_EQ(SERVER_STATUS_PAYLOAD_SIZE, size);
+
+  // invalid length disconnects the client
+  uint32_t length = SERVER_MAX_MESSAGE_SIZE + 1;
+  EXPECT_EQ(4, send(tcp_fd, &length, 4, 0));
+  EXPECT_EQ(0, recv(tcp_fd, payload, 1, 0));
+
+  close(tcp_fd);
+  close(unix_fd);
+  server_stop(server);
+  serving.join();
+  server_release(&server);
+  EXPECT_EQ(-1, stat(SERVER_TEST_SOCKET, &socket_stat));
+}
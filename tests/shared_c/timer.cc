@@ -16,6 +16,21 @@ TEST_F(SharedTestFixture, timespec_miliseconds_TEST_basic) {
   EXPECT_EQ(1001, timespec_miliseconds(span));
 }
 
+TEST_F(SharedTestFixture, timespec_microseconds_TEST_basic) {
+  struct timespec span;
+
+  span.tv_sec = 1;
+  span.tv_nsec = 1000; // us
+  EXPECT_EQ(1000001, timespec_microseconds(span));
+}
+
+TEST_F(SharedTestFixture, timespec_from_microseconds_TEST_basic) {
+  struct timespec span = timespec_from_microseconds(2000003);
+  EXPECT_EQ(2, span.tv_sec);
+  EXPECT_EQ(3000, span.tv_nsec);
+  EXPECT_EQ(2000003, timespec_microseconds(span));
+}
+
 TEST_F(SharedTestFixture, timespec_get_minutes_TEST_basic) {
   struct timespec span;
 
@@ -59,3 +74,18 @@ TEST_F(SharedTestFixture, timespec_elapsed_between_TEST_basic) {
   EXPECT_EQ(0, result.tv_sec);
   EXPECT_EQ(999999999l, result.tv_nsec);
 }
+
+TEST_F(SharedTestFixture, timespec_add_TEST_basic) {
+  struct timespec a, b, result;
+
+  a.tv_sec = 1;
+  a.tv_nsec = 999999999l;
+  b.tv_sec = 2;
+  b.tv_nsec = 2;
+  result = timespec_add(a, b);
+  EXPECT_EQ(4, result.tv_sec);
+  EXPECT_EQ(1, result.tv_nsec);
+  EXPECT_TRUE(timespec_is_greater(result, a));
+  EXPECT_FALSE(timespec_is_greater(a, result));
+  EXPECT_FALSE(timespec_is_greater(a, a));
+}